@@ -0,0 +1,159 @@
+#!/usr/bin/perl -w
+
+# Copyright (C) Nginx, Inc.
+
+# converts access logs written with "log_format name binary ..." to text,
+# one line per record, with tab separated fields in the order of the format
+#
+#   binlog2text.pl [-n name1,name2,...] [file ...]
+#
+# with "-n" records are printed as JSON objects with the given field names,
+# varint fields as numbers and the others as strings
+#
+# record layout: 32-bit little-endian length of the record, then fields,
+# each starting with a type byte:
+#
+#   0  not found
+#   1  unsigned LEB128 varint
+#   2  varint length, string
+#   3  address length byte (4 or 16), address in network order
+
+use warnings;
+use strict;
+
+use Socket qw/ AF_INET AF_INET6 inet_ntop /;
+
+my @names;
+
+if (@ARGV >= 2 && $ARGV[0] eq '-n') {
+	shift @ARGV;
+	@names = split /,/, shift @ARGV;
+}
+
+binmode STDOUT;
+
+push @ARGV, '-' unless @ARGV;
+
+for my $file (@ARGV) {
+	my $fh;
+
+	if ($file eq '-') {
+		$fh = \*STDIN;
+	} else {
+		open $fh, '<', $file or die "$file: $!\n";
+	}
+
+	binmode $fh;
+
+	while (1) {
+		my $header = read_bytes($fh, 4, $file);
+		last unless defined $header;
+
+		my $len = unpack 'V', $header;
+		my $record = read_bytes($fh, $len, $file);
+
+		die "$file: truncated record\n" unless defined $record;
+
+		print_record(parse_record($record, $file));
+	}
+
+	close $fh unless $file eq '-';
+}
+
+sub read_bytes {
+	my ($fh, $len, $file) = @_;
+	my $buf = '';
+
+	while (length($buf) < $len) {
+		my $n = read $fh, $buf, $len - length($buf), length($buf);
+		die "$file: $!\n" unless defined $n;
+		last if $n == 0;
+	}
+
+	return undef if length($buf) == 0 && $len > 0;
+	die "$file: truncated record\n" if length($buf) < $len;
+
+	return $buf;
+}
+
+sub varint {
+	my ($data, $pos) = @_;
+	my ($n, $shift) = (0, 0);
+
+	while (1) {
+		my $b = ord substr($$data, $$pos++, 1);
+		$n += ($b & 0x7f) * 2 ** $shift;
+		last unless $b & 0x80;
+		$shift += 7;
+	}
+
+	return $n;
+}
+
+# fields are returned as [ type, value ] pairs
+
+sub parse_record {
+	my ($data, $file) = @_;
+	my ($pos, @fields) = (0);
+
+	while ($pos < length $data) {
+		my $type = ord substr($data, $pos++, 1);
+		my $value;
+
+		if ($type == 0) {
+			$value = undef;
+
+		} elsif ($type == 1) {
+			$value = varint(\$data, \$pos);
+
+		} elsif ($type == 2) {
+			my $len = varint(\$data, \$pos);
+			$value = substr($data, $pos, $len);
+			$pos += $len;
+
+		} elsif ($type == 3) {
+			my $len = ord substr($data, $pos++, 1);
+			my $addr = substr($data, $pos, $len);
+			$pos += $len;
+
+			$value = inet_ntop($len == 4 ? AF_INET : AF_INET6, $addr);
+
+		} else {
+			die "$file: unknown field type $type\n";
+		}
+
+		push @fields, [ $type, $value ];
+	}
+
+	return @fields;
+}
+
+sub print_record {
+	my @fields = @_;
+
+	if (!@names) {
+		print join("\t", map { defined $_->[1] ? $_->[1] : '-' } @fields),
+			"\n";
+		return;
+	}
+
+	my @pairs;
+
+	for my $i (0 .. $#fields) {
+		my $name = defined $names[$i] ? $names[$i] : "field$i";
+		my ($type, $value) = @{$fields[$i]};
+
+		if ($type == 0) {
+			$value = 'null';
+
+		} elsif ($type != 1) {
+			$value =~ s/(["\\])/\\$1/g;
+			$value =~ s/([\x00-\x1f])/sprintf '\\u%04x', ord $1/ge;
+			$value = "\"$value\"";
+		}
+
+		push @pairs, "\"$name\":$value";
+	}
+
+	print '{', join(',', @pairs), "}\n";
+}
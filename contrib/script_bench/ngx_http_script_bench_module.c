@@ -0,0 +1,341 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * The module compares the two engines evaluating complex values:
+ * the lengths and values codes, and the segments.  Each value of
+ * the "script_bench" directive is evaluated the given number of times
+ * by each engine in the context of the request, and the average time
+ * per evaluation is returned.
+ *
+ *     location = /bench {
+ *         script_bench  "https://$host$request_uri"
+ *                       "$scheme://$host$uri?from=$remote_addr&$args";
+ *         script_bench_iterations  2000000;
+ *     }
+ *
+ * Build with --add-module=contrib/script_bench, without --with-debug.
+ */
+
+
+#define NGX_HTTP_SCRIPT_BENCH_BATCH  1024
+
+
+typedef struct {
+    ngx_array_t                *values;     /* ngx_http_complex_value_t */
+    ngx_uint_t                  iterations;
+} ngx_http_script_bench_loc_conf_t;
+
+
+static ngx_int_t ngx_http_script_bench_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_script_bench_run(ngx_http_request_t *r,
+    ngx_http_complex_value_t *cv, ngx_uint_t iterations, ngx_uint_t *usec);
+static void *ngx_http_script_bench_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_script_bench_merge_loc_conf(ngx_conf_t *cf,
+    void *parent, void *child);
+static char *ngx_http_script_bench(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_script_bench_commands[] = {
+
+    { ngx_string("script_bench"),
+      NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_script_bench,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("script_bench_iterations"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_script_bench_loc_conf_t, iterations),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_script_bench_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    ngx_http_script_bench_create_loc_conf, /* create location configuration */
+    ngx_http_script_bench_merge_loc_conf   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_script_bench_module = {
+    NGX_MODULE_V1,
+    &ngx_http_script_bench_module_ctx,     /* module context */
+    ngx_http_script_bench_commands,        /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_script_bench_handler(ngx_http_request_t *r)
+{
+    size_t                             size;
+    ngx_int_t                          rc;
+    ngx_buf_t                         *b;
+    ngx_uint_t                         i, n, codes, segments;
+    ngx_chain_t                        out;
+    ngx_http_complex_value_t          *cv, old;
+    ngx_http_script_bench_loc_conf_t  *sbcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    sbcf = ngx_http_get_module_loc_conf(r, ngx_http_script_bench_module);
+
+    cv = sbcf->values->elts;
+    n = sbcf->values->nelts;
+
+    size = sizeof("iterations: \n") + NGX_INT_T_LEN;
+
+    for (i = 0; i < n; i++) {
+        size += sizeof("\"\" codes:  ns, segments:  ns\n") + cv[i].value.len
+                + 2 * NGX_INT_T_LEN;
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_sprintf(b->last, "iterations: %ui\n", sbcf->iterations);
+
+    for (i = 0; i < n; i++) {
+
+        old = cv[i];
+        old.segments = NULL;
+
+        if (ngx_http_script_bench_run(r, &old, sbcf->iterations, &codes)
+            != NGX_OK)
+        {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        b->last = ngx_sprintf(b->last, "\"%V\" codes: %ui ns, ",
+                              &cv[i].value,
+                              codes * 1000 / sbcf->iterations);
+
+        if (cv[i].segments == NULL) {
+            b->last = ngx_cpymem(b->last, "no segments\n",
+                                 sizeof("no segments\n") - 1);
+            continue;
+        }
+
+        if (ngx_http_script_bench_run(r, &cv[i], sbcf->iterations, &segments)
+            != NGX_OK)
+        {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        b->last = ngx_sprintf(b->last, "segments: %ui ns\n",
+                              segments * 1000 / sbcf->iterations);
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_script_bench_run(ngx_http_request_t *r, ngx_http_complex_value_t *cv,
+    ngx_uint_t iterations, ngx_uint_t *usec)
+{
+    ngx_str_t        value;
+    ngx_uint_t       i, n;
+    ngx_pool_t      *pool, *temp;
+    struct timeval   start, end;
+
+    /*
+     * the cacheable variables are evaluated once with the request pool,
+     * their values are kept in r->variables and must outlive the
+     * temporary pools used for the measured evaluations
+     */
+
+    if (ngx_http_complex_value(r, cv, &value) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    pool = r->pool;
+
+    ngx_gettimeofday(&start);
+
+    for (i = 0; i < iterations; i += n) {
+
+        temp = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, r->connection->log);
+        if (temp == NULL) {
+            r->pool = pool;
+            return NGX_ERROR;
+        }
+
+        r->pool = temp;
+
+        for (n = 0; n < NGX_HTTP_SCRIPT_BENCH_BATCH && i + n < iterations; n++)
+        {
+            if (ngx_http_complex_value(r, cv, &value) != NGX_OK) {
+                r->pool = pool;
+                ngx_destroy_pool(temp);
+                return NGX_ERROR;
+            }
+        }
+
+        r->pool = pool;
+        ngx_destroy_pool(temp);
+    }
+
+    ngx_gettimeofday(&end);
+
+    *usec = (ngx_uint_t) ((end.tv_sec - start.tv_sec) * 1000000
+                          + (end.tv_usec - start.tv_usec));
+
+    /* the non-cacheable variables may still point to a temporary pool */
+
+    if (ngx_http_complex_value(r, cv, &value) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_script_bench_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_script_bench_loc_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_script_bench_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->values = NULL;
+     */
+
+    conf->iterations = NGX_CONF_UNSET_UINT;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_script_bench_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child)
+{
+    ngx_http_script_bench_loc_conf_t *prev = parent;
+    ngx_http_script_bench_loc_conf_t *conf = child;
+
+    ngx_conf_merge_uint_value(conf->iterations, prev->iterations, 1000000);
+
+    if (conf->iterations == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"script_bench_iterations\" must be positive");
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_script_bench(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_script_bench_loc_conf_t *sbcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_uint_t                         i;
+    ngx_http_core_loc_conf_t          *clcf;
+    ngx_http_complex_value_t          *cv;
+    ngx_http_compile_complex_value_t   ccv;
+
+    if (sbcf->values) {
+        return "is duplicate";
+    }
+
+    sbcf->values = ngx_array_create(cf->pool, cf->args->nelts - 1,
+                                    sizeof(ngx_http_complex_value_t));
+    if (sbcf->values == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        cv = ngx_array_push(sbcf->values);
+        if (cv == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_memzero(&ccv, sizeof(ngx_http_compile_complex_value_t));
+
+        ccv.cf = cf;
+        ccv.value = &value[i];
+        ccv.complex_value = cv;
+
+        if (ngx_http_compile_complex_value(&ccv) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_script_bench_handler;
+
+    return NGX_CONF_OK;
+}
@@ -302,6 +302,7 @@ syn keyword ngxDirective contained hls_mp4_buffer_size
 syn keyword ngxDirective contained hls_mp4_max_buffer_size
 syn keyword ngxDirective contained http2_body_preread_size
 syn keyword ngxDirective contained http2_chunk_size
+syn keyword ngxDirective contained http2_hpack_encoder_table_size
 syn keyword ngxDirective contained http2_idle_timeout
 syn keyword ngxDirective contained http2_max_concurrent_pushes
 syn keyword ngxDirective contained http2_max_concurrent_streams
@@ -405,6 +406,7 @@ syn keyword ngxDirective contained open_log_file_cache
 syn keyword ngxDirective contained output_buffers
 syn keyword ngxDirective contained override_charset
 syn keyword ngxDirective contained pcre_jit
+syn keyword ngxDirective contained pcre_stats
 syn keyword ngxDirective contained perl
 syn keyword ngxDirective contained perl_modules
 syn keyword ngxDirective contained perl_require
@@ -595,6 +597,7 @@ syn keyword ngxDirective contained ssl_early_data
 syn keyword ngxDirective contained ssl_ecdh_curve
 syn keyword ngxDirective contained ssl_engine
 syn keyword ngxDirective contained ssl_handshake_timeout
+syn keyword ngxDirective contained ssl_ktls
 syn keyword ngxDirective contained ssl_password_file
 syn keyword ngxDirective contained ssl_prefer_server_ciphers
 syn keyword ngxDirective contained ssl_preread
@@ -627,6 +630,7 @@ syn keyword ngxDirective contained tcp_nodelay
 syn keyword ngxDirective contained tcp_nopush
 syn keyword ngxDirective contained thread_pool
 syn keyword ngxDirective contained timeout
+syn keyword ngxDirective contained timer_engine
 syn keyword ngxDirective contained timer_resolution
 syn keyword ngxDirective contained types_hash_bucket_size
 syn keyword ngxDirective contained types_hash_max_size
@@ -707,6 +711,7 @@ syn keyword ngxDirective contained variables_hash_max_size
 syn keyword ngxDirective contained worker_aio_requests
 syn keyword ngxDirective contained worker_connections
 syn keyword ngxDirective contained worker_cpu_affinity
+syn keyword ngxDirective contained worker_pool_cache
 syn keyword ngxDirective contained worker_priority
 syn keyword ngxDirective contained worker_processes
 syn keyword ngxDirective contained worker_rlimit_core
@@ -9,6 +9,9 @@
 #include <ngx_core.h>
 
 
+ngx_uint_t  ngx_cpu_features;
+
+
 #if (( __i386__ || __amd64__ ) && ( __GNUC__ || __INTEL_COMPILER ))
 
 
@@ -55,7 +58,7 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 
         "cpuid"
 
-    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i) );
+    : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx) : "a" (i), "c" (0) );
 
     buf[0] = eax;
     buf[1] = ebx;
@@ -64,6 +67,21 @@ ngx_cpuid(uint32_t i, uint32_t *buf)
 }
 
 
+static ngx_inline uint32_t
+ngx_xgetbv(void)
+{
+    uint32_t  eax, edx;
+
+    __asm__ (
+
+        "xgetbv"
+
+    : "=a" (eax), "=d" (edx) : "c" (0) );
+
+    return eax;
+}
+
+
 #endif
 
 
@@ -74,6 +92,9 @@ ngx_cpuinfo(void)
 {
     u_char    *vendor;
     uint32_t   vbuf[5], cpu[4], model;
+#if ( __amd64__ )
+    uint32_t   ext[4];
+#endif
 
     vbuf[0] = 0;
     vbuf[1] = 0;
@@ -91,6 +112,32 @@ ngx_cpuinfo(void)
 
     ngx_cpuid(1, cpu);
 
+    /* SSE4.2 */
+
+    if (cpu[3] & 0x00100000) {
+        ngx_cpu_features |= NGX_CPU_SSE42;
+    }
+
+#if ( __amd64__ )
+
+    /*
+     * AVX2 also requires OSXSAVE and AVX bits set, and the YMM state
+     * enabled by the OS; the cpuid leaf 7 is queried with subleaf 0
+     */
+
+    if (vbuf[0] >= 7
+        && (cpu[3] & 0x18000000) == 0x18000000
+        && (ngx_xgetbv() & 0x06) == 0x06)
+    {
+        ngx_cpuid(7, ext);
+
+        if (ext[1] & 0x00000020) {
+            ngx_cpu_features |= NGX_CPU_AVX2;
+        }
+    }
+
+#endif
+
     if (ngx_strcmp(vendor, "GenuineIntel") == 0) {
 
         switch ((cpu[0] & 0xf00) >> 8) {
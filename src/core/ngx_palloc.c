@@ -7,12 +7,43 @@
 
 #include <ngx_config.h>
 #include <ngx_core.h>
+#if (NGX_STAT_STUB)
+#include <ngx_event.h>
+#endif
 
 
 static ngx_inline void *ngx_palloc_small(ngx_pool_t *pool, size_t size,
     ngx_uint_t align);
 static void *ngx_palloc_block(ngx_pool_t *pool, size_t size);
 static void *ngx_palloc_large(ngx_pool_t *pool, size_t size);
+static ngx_inline ngx_int_t ngx_pool_cache_slot(size_t size);
+static void *ngx_pool_cache_alloc(size_t *size, ngx_log_t *log);
+static void ngx_pool_cache_free(void *p, size_t size);
+
+
+/*
+ * blocks of pools and large allocations of up to 64k are kept by a worker
+ * process in free lists of power of two size classes starting from 256
+ */
+
+#define NGX_POOL_CACHE_MIN_SHIFT  8
+#define NGX_POOL_CACHE_SLOTS      9
+
+
+typedef struct ngx_pool_cached_block_s  ngx_pool_cached_block_t;
+
+struct ngx_pool_cached_block_s {
+    ngx_pool_cached_block_t  *next;
+};
+
+
+static ngx_pool_cached_block_t  *ngx_pool_cache[NGX_POOL_CACHE_SLOTS];
+static size_t                    ngx_pool_cache_max;
+#if (NGX_THREADS)
+static pthread_t                 ngx_pool_cache_thread;
+#endif
+
+ngx_pool_cache_stats_t           ngx_pool_cache_stats;
 
 
 ngx_pool_t *
@@ -20,7 +51,7 @@ ngx_create_pool(size_t size, ngx_log_t *log)
 {
     ngx_pool_t  *p;
 
-    p = ngx_memalign(NGX_POOL_ALIGNMENT, size, log);
+    p = ngx_pool_cache_alloc(&size, log);
     if (p == NULL) {
         return NULL;
     }
@@ -82,12 +113,12 @@ ngx_destroy_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
 
     for (p = pool, n = pool->d.next; /* void */; p = n, n = n->d.next) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, p->d.end - (u_char *) p);
 
         if (n == NULL) {
             break;
@@ -104,7 +135,7 @@ ngx_reset_pool(ngx_pool_t *pool)
 
     for (l = pool->large; l; l = l->next) {
         if (l->alloc) {
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
         }
     }
 
@@ -183,7 +214,7 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 
     psize = (size_t) (pool->d.end - (u_char *) pool);
 
-    m = ngx_memalign(NGX_POOL_ALIGNMENT, psize, pool->log);
+    m = ngx_pool_cache_alloc(&psize, pool->log);
     if (m == NULL) {
         return NULL;
     }
@@ -217,7 +248,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     ngx_uint_t         n;
     ngx_pool_large_t  *large;
 
-    p = ngx_alloc(size, pool->log);
+    p = ngx_pool_cache_alloc(&size, pool->log);
     if (p == NULL) {
         return NULL;
     }
@@ -227,6 +258,7 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
+            large->size = size;
             return p;
         }
 
@@ -237,11 +269,12 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
+        ngx_pool_cache_free(p, size);
         return NULL;
     }
 
     large->alloc = p;
+    large->size = size;
     large->next = pool->large;
     pool->large = large;
 
@@ -266,7 +299,10 @@ ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment)
         return NULL;
     }
 
+    /* blocks of arbitrary alignment are not cached */
+
     large->alloc = p;
+    large->size = 0;
     large->next = pool->large;
     pool->large = large;
 
@@ -283,7 +319,7 @@ ngx_pfree(ngx_pool_t *pool, void *p)
         if (p == l->alloc) {
             ngx_log_debug1(NGX_LOG_DEBUG_ALLOC, pool->log, 0,
                            "free: %p", l->alloc);
-            ngx_free(l->alloc);
+            ngx_pool_cache_free(l->alloc, l->size);
             l->alloc = NULL;
 
             return NGX_OK;
@@ -401,30 +437,121 @@ ngx_pool_delete_file(void *data)
 }
 
 
-#if 0
+void
+ngx_pool_cache_init(size_t max)
+{
+    ngx_pool_cache_max = max;
+
+#if (NGX_THREADS)
+    ngx_pool_cache_thread = pthread_self();
+#endif
+}
+
+
+static ngx_inline ngx_int_t
+ngx_pool_cache_slot(size_t size)
+{
+    ngx_int_t  n;
+
+    if (ngx_pool_cache_max == 0
+        || size > (size_t) 1 << (NGX_POOL_CACHE_MIN_SHIFT
+                                 + NGX_POOL_CACHE_SLOTS - 1))
+    {
+        return NGX_DECLINED;
+    }
+
+#if (NGX_THREADS)
+
+    /* the free lists are not shared with threads */
+
+    if (!pthread_equal(pthread_self(), ngx_pool_cache_thread)) {
+        return NGX_DECLINED;
+    }
+
+#endif
+
+    for (n = 0; (size_t) 1 << (NGX_POOL_CACHE_MIN_SHIFT + n) < size; n++) {
+        /* void */
+    }
+
+    return n;
+}
+
 
 static void *
-ngx_get_cached_block(size_t size)
+ngx_pool_cache_alloc(size_t *size, ngx_log_t *log)
 {
-    void                     *p;
-    ngx_cached_block_slot_t  *slot;
+    ngx_int_t                 n;
+    ngx_pool_cached_block_t  *b;
 
-    if (ngx_cycle->cache == NULL) {
-        return NULL;
+    n = ngx_pool_cache_slot(*size);
+
+    if (n == NGX_DECLINED) {
+        return ngx_memalign(NGX_POOL_ALIGNMENT, *size, log);
     }
 
-    slot = &ngx_cycle->cache[(size + ngx_pagesize - 1) / ngx_pagesize];
+    *size = (size_t) 1 << (NGX_POOL_CACHE_MIN_SHIFT + n);
 
-    slot->tries++;
+    b = ngx_pool_cache[n];
 
-    if (slot->number) {
-        p = slot->block;
-        slot->block = slot->block->next;
-        slot->number--;
-        return p;
+    if (b) {
+        ngx_pool_cache[n] = b->next;
+        ngx_pool_cache_stats.retained -= *size;
+        ngx_pool_cache_stats.hits++;
+
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_pool_cache_retained,
+                                    -(ngx_atomic_int_t) *size);
+        (void) ngx_atomic_fetch_add(ngx_stat_pool_cache_hits, 1);
+#endif
+
+        return b;
     }
 
-    return NULL;
+    ngx_pool_cache_stats.misses++;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_pool_cache_misses, 1);
+#endif
+
+    return ngx_memalign(NGX_POOL_ALIGNMENT, *size, log);
 }
 
+
+static void
+ngx_pool_cache_free(void *p, size_t size)
+{
+    ngx_int_t                 n;
+    ngx_pool_cached_block_t  *b;
+
+    n = ngx_pool_cache_slot(size);
+
+    if (n == NGX_DECLINED
+        || size != (size_t) 1 << (NGX_POOL_CACHE_MIN_SHIFT + n))
+    {
+        ngx_free(p);
+        return;
+    }
+
+    if (ngx_pool_cache_stats.retained + size > ngx_pool_cache_max) {
+        ngx_pool_cache_stats.released++;
+
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_pool_cache_released, 1);
 #endif
+
+        ngx_free(p);
+        return;
+    }
+
+    b = p;
+
+    b->next = ngx_pool_cache[n];
+    ngx_pool_cache[n] = b;
+
+    ngx_pool_cache_stats.retained += size;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_pool_cache_retained, size);
+#endif
+}
@@ -43,6 +43,7 @@ typedef struct ngx_pool_large_s  ngx_pool_large_t;
 struct ngx_pool_large_s {
     ngx_pool_large_t     *next;         /* 指向下一个存储地址 通过这个地址可以知道当前块长度 */
     void                 *alloc;        /* 数据块指针地址 */
+    size_t                size;
 };
 
 
@@ -72,6 +73,14 @@ typedef struct {
 } ngx_pool_cleanup_file_t;
 
 
+typedef struct {
+    ngx_uint_t            hits;
+    ngx_uint_t            misses;
+    ngx_uint_t            released;
+    size_t                retained;
+} ngx_pool_cache_stats_t;
+
+
 ngx_pool_t *ngx_create_pool(size_t size, ngx_log_t *log);
 void ngx_destroy_pool(ngx_pool_t *pool);
 void ngx_reset_pool(ngx_pool_t *pool);
@@ -88,5 +97,10 @@ void ngx_pool_run_cleanup_file(ngx_pool_t *p, ngx_fd_t fd);
 void ngx_pool_cleanup_file(void *data);
 void ngx_pool_delete_file(void *data);
 
+void ngx_pool_cache_init(size_t max);
+
+
+extern ngx_pool_cache_stats_t  ngx_pool_cache_stats;
+
 
 #endif /* _NGX_PALLOC_H_INCLUDED_ */
@@ -9,25 +9,53 @@
 #include <ngx_core.h>
 
 
+#define NGX_REGEX_JIT_STACK_MIN  (32 * 1024)
+#define NGX_REGEX_JIT_STACK_MAX  (1024 * 1024)
+
+
 typedef struct {
-    ngx_flag_t  pcre_jit;
+    ngx_flag_t        pcre_jit;
+    ngx_flag_t        pcre_stats;
+    ngx_list_t       *studies;
+
+    ngx_shm_zone_t   *shm_zone;
+    ngx_regex_elt_t  *regexes;
+    ngx_uint_t        nregexes;
+    u_char           *stats;
+    ngx_uint_t        nslots;
+    size_t            stride;
 } ngx_regex_conf_t;
 
 
+static ngx_inline void ngx_regex_malloc_init(ngx_pool_t *pool);
+static ngx_inline void ngx_regex_malloc_done(void);
+
+#if (NGX_PCRE2)
+static void * ngx_libc_cdecl ngx_regex_malloc(size_t size, void *data);
+static void ngx_libc_cdecl ngx_regex_free(void *p, void *data);
+#else
 static void * ngx_libc_cdecl ngx_regex_malloc(size_t size);
 static void ngx_libc_cdecl ngx_regex_free(void *p);
-#if (NGX_HAVE_PCRE_JIT)
-static void ngx_pcre_free_studies(void *data);
 #endif
+#if (NGX_PCRE2 || NGX_HAVE_PCRE_JIT)
+static void ngx_regex_cleanup(void *data);
+#endif
+static uint64_t ngx_regex_time(void);
 
 static ngx_int_t ngx_regex_module_init(ngx_cycle_t *cycle);
+static ngx_int_t ngx_regex_init_process(ngx_cycle_t *cycle);
+static void ngx_regex_exit_process(ngx_cycle_t *cycle);
 
 static void *ngx_regex_create_conf(ngx_cycle_t *cycle);
 static char *ngx_regex_init_conf(ngx_cycle_t *cycle, void *conf);
+static ngx_int_t ngx_regex_init_zone(ngx_shm_zone_t *shm_zone, void *data);
 
 static char *ngx_regex_pcre_jit(ngx_conf_t *cf, void *post, void *data);
 static ngx_conf_post_t  ngx_regex_pcre_jit_post = { ngx_regex_pcre_jit };
 
+static char *ngx_regex_pcre_stats(ngx_conf_t *cf, void *post, void *data);
+static ngx_conf_post_t  ngx_regex_pcre_stats_post = { ngx_regex_pcre_stats };
+
 
 static ngx_command_t  ngx_regex_commands[] = {
 
@@ -38,6 +66,13 @@ static ngx_command_t  ngx_regex_commands[] = {
       offsetof(ngx_regex_conf_t, pcre_jit),
       &ngx_regex_pcre_jit_post },
 
+    { ngx_string("pcre_stats"),
+      NGX_MAIN_CONF|NGX_DIRECT_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      0,
+      offsetof(ngx_regex_conf_t, pcre_stats),
+      &ngx_regex_pcre_stats_post },
+
       ngx_null_command
 };
 
@@ -56,40 +91,289 @@ ngx_module_t  ngx_regex_module = {
     NGX_CORE_MODULE,                       /* module type */
     NULL,                                  /* init master */
     ngx_regex_module_init,                 /* init module */
-    NULL,                                  /* init process */
+    ngx_regex_init_process,                /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
-    NULL,                                  /* exit process */
+    ngx_regex_exit_process,                /* exit process */
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
 
 
-static ngx_pool_t  *ngx_pcre_pool;
-static ngx_list_t  *ngx_pcre_studies;
+static ngx_pool_t             *ngx_regex_pool;
+static ngx_list_t             *ngx_regex_studies;
+
+#if (NGX_PCRE2)
+static ngx_uint_t              ngx_regex_direct_alloc;
+static pcre2_compile_context  *ngx_regex_compile_context;
+static pcre2_match_context    *ngx_regex_match_context;
+static pcre2_jit_stack        *ngx_regex_jit_stack;
+static pcre2_match_data       *ngx_regex_match_data;
+static ngx_uint_t              ngx_regex_match_data_size;
+#endif
 
 
 void
 ngx_regex_init(void)
 {
+#if !(NGX_PCRE2)
     pcre_malloc = ngx_regex_malloc;
     pcre_free = ngx_regex_free;
+#endif
 }
 
 
 static ngx_inline void
 ngx_regex_malloc_init(ngx_pool_t *pool)
 {
-    ngx_pcre_pool = pool;
+    ngx_regex_pool = pool;
+
+#if (NGX_PCRE2)
+    ngx_regex_direct_alloc = (pool == NULL) ? 1 : 0;
+#endif
 }
 
 
 static ngx_inline void
 ngx_regex_malloc_done(void)
 {
-    ngx_pcre_pool = NULL;
+    ngx_regex_pool = NULL;
+
+#if (NGX_PCRE2)
+    ngx_regex_direct_alloc = 0;
+#endif
+}
+
+
+#if (NGX_PCRE2)
+
+ngx_int_t
+ngx_regex_compile(ngx_regex_compile_t *rc)
+{
+    int                     n, errcode;
+    char                   *p;
+    u_char                  errstr[128];
+    size_t                  erroff;
+    uint32_t                options;
+    pcre2_code             *re;
+    ngx_regex_elt_t        *elt;
+    pcre2_general_context  *gctx;
+
+    if (ngx_regex_compile_context == NULL) {
+
+        /*
+         * regexes are also compiled at runtime, so the compile context
+         * is allocated from heap and kept for the process lifetime
+         */
+
+        ngx_regex_malloc_init(NULL);
+
+        gctx = pcre2_general_context_create(ngx_regex_malloc, ngx_regex_free,
+                                            NULL);
+        if (gctx == NULL) {
+            ngx_regex_malloc_done();
+            goto nomem;
+        }
+
+        ngx_regex_compile_context = pcre2_compile_context_create(gctx);
+
+        pcre2_general_context_free(gctx);
+
+        ngx_regex_malloc_done();
+
+        if (ngx_regex_compile_context == NULL) {
+            goto nomem;
+        }
+    }
+
+    options = 0;
+
+    if (rc->options & NGX_REGEX_CASELESS) {
+        options |= PCRE2_CASELESS;
+    }
+
+    if (rc->options & ~NGX_REGEX_CASELESS) {
+        rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                            "regex \"%V\" compilation failed: invalid options",
+                            &rc->pattern)
+                      - rc->err.data;
+        return NGX_ERROR;
+    }
+
+    ngx_regex_malloc_init(rc->pool);
+
+    re = pcre2_compile(rc->pattern.data, rc->pattern.len, options,
+                       &errcode, &erroff, ngx_regex_compile_context);
+
+    /* ensure that there is no current pool */
+    ngx_regex_malloc_done();
+
+    if (re == NULL) {
+        pcre2_get_error_message(errcode, errstr, 128);
+
+        if ((size_t) erroff == rc->pattern.len) {
+           rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                              "pcre2_compile() failed: %s in \"%V\"",
+                               errstr, &rc->pattern)
+                      - rc->err.data;
+
+        } else {
+           rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                              "pcre2_compile() failed: %s in \"%V\" at \"%s\"",
+                               errstr, &rc->pattern, rc->pattern.data + erroff)
+                      - rc->err.data;
+        }
+
+        return NGX_ERROR;
+    }
+
+    rc->regex = ngx_pcalloc(rc->pool, sizeof(ngx_regex_t));
+    if (rc->regex == NULL) {
+        goto nomem;
+    }
+
+    rc->regex->code = re;
+
+    /* do not JIT compile at runtime */
+
+    if (ngx_regex_studies != NULL) {
+        elt = ngx_list_push(ngx_regex_studies);
+        if (elt == NULL) {
+            goto nomem;
+        }
+
+        elt->regex = rc->regex;
+        elt->name = rc->pattern.data;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_CAPTURECOUNT, &rc->captures);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_CAPTURECOUNT) failed: %d";
+        goto failed;
+    }
+
+    if (rc->captures == 0) {
+        return NGX_OK;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_NAMECOUNT, &rc->named_captures);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_NAMECOUNT) failed: %d";
+        goto failed;
+    }
+
+    if (rc->named_captures == 0) {
+        return NGX_OK;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_NAMEENTRYSIZE, &rc->name_size);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_NAMEENTRYSIZE) failed: %d";
+        goto failed;
+    }
+
+    n = pcre2_pattern_info(re, PCRE2_INFO_NAMETABLE, &rc->names);
+    if (n < 0) {
+        p = "pcre2_pattern_info(\"%V\", PCRE2_INFO_NAMETABLE) failed: %d";
+        goto failed;
+    }
+
+    return NGX_OK;
+
+failed:
+
+    rc->err.len = ngx_snprintf(rc->err.data, rc->err.len, p, &rc->pattern, n)
+                  - rc->err.data;
+    return NGX_ERROR;
+
+nomem:
+
+    rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                               "regex \"%V\" compilation failed: no memory",
+                               &rc->pattern)
+                  - rc->err.data;
+    return NGX_ERROR;
+}
+
+
+ngx_int_t
+ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures, ngx_uint_t size)
+{
+    size_t      *ov;
+    u_char      *data;
+    uint64_t     start;
+    ngx_int_t    rc;
+    ngx_uint_t   n, i;
+
+    /*
+     * the match data is kept per process and only grows, so
+     * backtracking frames allocated by pcre2_match() are reused
+     */
+
+    if (ngx_regex_match_data == NULL || size > ngx_regex_match_data_size) {
+
+        if (ngx_regex_match_data) {
+            pcre2_match_data_free(ngx_regex_match_data);
+        }
+
+        ngx_regex_match_data_size = size;
+        ngx_regex_match_data = pcre2_match_data_create(size / 3, NULL);
+
+        if (ngx_regex_match_data == NULL) {
+            ngx_regex_match_data_size = 0;
+            return PCRE2_ERROR_NOMEMORY;
+        }
+    }
+
+    /* older PCRE2 versions do not accept NULL subjects */
+    data = s->len ? s->data : (u_char *) "";
+
+    if (re->stats) {
+        start = ngx_regex_time();
+
+        rc = pcre2_match(re->code, data, s->len, 0, 0, ngx_regex_match_data,
+                         ngx_regex_match_context);
+
+        re->stats->time += ngx_regex_time() - start;
+        re->stats->calls++;
+
+        if (rc >= 0) {
+            re->stats->matches++;
+        }
+
+    } else {
+        rc = pcre2_match(re->code, data, s->len, 0, 0, ngx_regex_match_data,
+                         ngx_regex_match_context);
+    }
+
+    if (rc < 0) {
+        return rc;
+    }
+
+    n = size / 3;
+
+    if ((ngx_uint_t) rc > n) {
+
+        /* as with pcre_exec(), the vector is too small */
+
+        rc = 0;
+    }
+
+    ov = pcre2_get_ovector_pointer(ngx_regex_match_data);
+
+    if (n > pcre2_get_ovector_count(ngx_regex_match_data)) {
+        n = pcre2_get_ovector_count(ngx_regex_match_data);
+    }
+
+    for (i = 0; i < n; i++) {
+        captures[i * 2] = ov[i * 2];
+        captures[i * 2 + 1] = ov[i * 2 + 1];
+    }
+
+    return rc;
 }
 
+#else
 
 ngx_int_t
 ngx_regex_compile(ngx_regex_compile_t *rc)
@@ -98,11 +382,26 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
     char             *p;
     pcre             *re;
     const char       *errstr;
+    ngx_uint_t        options;
     ngx_regex_elt_t  *elt;
 
+    options = 0;
+
+    if (rc->options & NGX_REGEX_CASELESS) {
+        options |= PCRE_CASELESS;
+    }
+
+    if (rc->options & ~NGX_REGEX_CASELESS) {
+        rc->err.len = ngx_snprintf(rc->err.data, rc->err.len,
+                            "regex \"%V\" compilation failed: invalid options",
+                            &rc->pattern)
+                      - rc->err.data;
+        return NGX_ERROR;
+    }
+
     ngx_regex_malloc_init(rc->pool);
 
-    re = pcre_compile((const char *) rc->pattern.data, (int) rc->options,
+    re = pcre_compile((const char *) rc->pattern.data, (int) options,
                       &errstr, &erroff, NULL);
 
     /* ensure that there is no current pool */
@@ -134,8 +433,8 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
 
     /* do not study at runtime */
 
-    if (ngx_pcre_studies != NULL) {
-        elt = ngx_list_push(ngx_pcre_studies);
+    if (ngx_regex_studies != NULL) {
+        elt = ngx_list_push(ngx_regex_studies);
         if (elt == NULL) {
             goto nomem;
         }
@@ -194,6 +493,35 @@ nomem:
 }
 
 
+ngx_int_t
+ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures, ngx_uint_t size)
+{
+    uint64_t   start;
+    ngx_int_t  rc;
+
+    if (re->stats == NULL) {
+        return pcre_exec(re->code, re->extra, (const char *) s->data, s->len,
+                         0, 0, captures, size);
+    }
+
+    start = ngx_regex_time();
+
+    rc = pcre_exec(re->code, re->extra, (const char *) s->data, s->len, 0, 0,
+                   captures, size);
+
+    re->stats->time += ngx_regex_time() - start;
+    re->stats->calls++;
+
+    if (rc >= 0) {
+        re->stats->matches++;
+    }
+
+    return rc;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 {
@@ -227,11 +555,40 @@ ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 }
 
 
+#if (NGX_PCRE2)
+
+static void * ngx_libc_cdecl
+ngx_regex_malloc(size_t size, void *data)
+{
+    if (ngx_regex_pool) {
+        return ngx_palloc(ngx_regex_pool, size);
+    }
+
+    if (ngx_regex_direct_alloc) {
+        return ngx_alloc(size, ngx_cycle->log);
+    }
+
+    return NULL;
+}
+
+
+static void ngx_libc_cdecl
+ngx_regex_free(void *p, void *data)
+{
+    if (ngx_regex_direct_alloc) {
+        ngx_free(p);
+    }
+
+    return;
+}
+
+#else
+
 static void * ngx_libc_cdecl
 ngx_regex_malloc(size_t size)
 {
     ngx_pool_t      *pool;
-    pool = ngx_pcre_pool;
+    pool = ngx_regex_pool;
 
     if (pool) {
         return ngx_palloc(pool, size);
@@ -247,11 +604,13 @@ ngx_regex_free(void *p)
     return;
 }
 
+#endif
 
-#if (NGX_HAVE_PCRE_JIT)
+
+#if (NGX_PCRE2 || NGX_HAVE_PCRE_JIT)
 
 static void
-ngx_pcre_free_studies(void *data)
+ngx_regex_cleanup(void *data)
 {
     ngx_list_t *studies = data;
 
@@ -274,33 +633,133 @@ ngx_pcre_free_studies(void *data)
             i = 0;
         }
 
+#if (NGX_PCRE2)
+
+        /*
+         * the code itself is allocated from the cycle pool,
+         * so this only frees JIT compiled code
+         */
+
+        pcre2_code_free(elts[i].regex->code);
+
+#else
+
         if (elts[i].regex->extra != NULL) {
             pcre_free_study(elts[i].regex->extra);
         }
+
+#endif
     }
 }
 
 #endif
 
 
+static uint64_t
+ngx_regex_time(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+
+#if (NGX_PCRE2)
+
 static ngx_int_t
 ngx_regex_module_init(ngx_cycle_t *cycle)
 {
-    int               opt;
-    const char       *errstr;
-    ngx_uint_t        i;
-    ngx_list_part_t  *part;
-    ngx_regex_elt_t  *elts;
+    int                  n;
+    ngx_uint_t           i;
+    ngx_list_part_t     *part;
+    ngx_regex_elt_t     *elts;
+    ngx_regex_conf_t    *rcf;
+    ngx_pool_cleanup_t  *cln;
+
+    rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
+
+    ngx_regex_studies = NULL;
+
+    if (!rcf->pcre_jit) {
+        return NGX_OK;
+    }
+
+    /*
+     * The PCRE2 JIT compiler uses mmap for its executable codes, so we
+     * have to explicitly call the pcre2_code_free() function to free
+     * this memory.
+     */
+
+    cln = ngx_pool_cleanup_add(cycle->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_regex_cleanup;
+    cln->data = rcf->studies;
+
+    ngx_regex_malloc_init(cycle->pool);
+
+    part = &rcf->studies->part;
+    elts = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            elts = part->elts;
+            i = 0;
+        }
+
+        n = pcre2_jit_compile(elts[i].regex->code, PCRE2_JIT_COMPLETE);
+
+        if (n != 0) {
+            ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                          "pcre2_jit_compile() failed: %d in \"%s\", "
+                          "ignored", n, elts[i].name);
+        }
+    }
+
+    ngx_regex_malloc_done();
+
+    return NGX_OK;
+}
+
+#else
+
+static ngx_int_t
+ngx_regex_module_init(ngx_cycle_t *cycle)
+{
+    int                opt;
+    const char        *errstr;
+    ngx_uint_t         i;
+    ngx_list_part_t   *part;
+    ngx_regex_elt_t   *elts;
+    ngx_regex_conf_t  *rcf;
 
     opt = 0;
 
+    rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
+
 #if (NGX_HAVE_PCRE_JIT)
     {
-    ngx_regex_conf_t    *rcf;
     ngx_pool_cleanup_t  *cln;
 
-    rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
-
     if (rcf->pcre_jit) {
         opt = PCRE_STUDY_JIT_COMPILE;
 
@@ -315,15 +774,15 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
             return NGX_ERROR;
         }
 
-        cln->handler = ngx_pcre_free_studies;
-        cln->data = ngx_pcre_studies;
+        cln->handler = ngx_regex_cleanup;
+        cln->data = rcf->studies;
     }
     }
 #endif
 
     ngx_regex_malloc_init(cycle->pool);
 
-    part = &ngx_pcre_studies->part;
+    part = &rcf->studies->part;
     elts = part->elts;
 
     for (i = 0; /* void */ ; i++) {
@@ -365,12 +824,138 @@ ngx_regex_module_init(ngx_cycle_t *cycle)
 
     ngx_regex_malloc_done();
 
-    ngx_pcre_studies = NULL;
+    ngx_regex_studies = NULL;
+
+    return NGX_OK;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_regex_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t          i;
+    ngx_regex_conf_t   *rcf;
+    ngx_regex_stats_t  *stats;
+
+    rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
+
+    if (rcf->stats
+        && (ngx_process == NGX_PROCESS_WORKER
+            || ngx_process == NGX_PROCESS_SINGLE))
+    {
+        stats = (ngx_regex_stats_t *)
+                    (rcf->stats + (ngx_worker % rcf->nslots) * rcf->stride);
+
+        for (i = 0; i < rcf->nregexes; i++) {
+            rcf->regexes[i].regex->stats = &stats[i];
+        }
+    }
+
+#if (NGX_PCRE2)
+
+    if (!rcf->pcre_jit || ngx_regex_match_context) {
+        return NGX_OK;
+    }
+
+    /*
+     * JIT compiled code uses a small area on the machine stack by default,
+     * a larger per process JIT stack is used instead so that complex
+     * patterns do not fail with PCRE2_ERROR_JIT_STACKLIMIT
+     */
+
+    ngx_regex_match_context = pcre2_match_context_create(NULL);
+    if (ngx_regex_match_context == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_regex_jit_stack = pcre2_jit_stack_create(NGX_REGEX_JIT_STACK_MIN,
+                                                 NGX_REGEX_JIT_STACK_MAX,
+                                                 NULL);
+    if (ngx_regex_jit_stack == NULL) {
+        return NGX_ERROR;
+    }
+
+    pcre2_jit_stack_assign(ngx_regex_match_context, NULL,
+                           ngx_regex_jit_stack);
+#endif
 
     return NGX_OK;
 }
 
 
+/*
+ * The counters of the slot are logged, they include the calls made
+ * by the previous processes with the same worker number, if any.
+ */
+
+static void
+ngx_regex_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t          i;
+    ngx_regex_elt_t    *elts;
+    ngx_regex_conf_t   *rcf;
+    ngx_regex_stats_t  *stats;
+
+    rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
+
+    elts = rcf->regexes;
+
+    for (i = 0; i < rcf->nregexes; i++) {
+
+        stats = elts[i].regex->stats;
+
+        if (stats == NULL || stats->calls == 0) {
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                      "regex \"%s\": %ui calls, %ui matches, %uL us",
+                      elts[i].name, stats->calls, stats->matches,
+                      stats->time / 1000);
+    }
+}
+
+
+/*
+ * The statistics of the n-th regex compiled from the configuration,
+ * summed over the slots of all worker processes, and its pattern;
+ * NULL is returned when there is no such regex or the statistics
+ * are not collected.
+ *
+ * Regex locations and map regexes which are matched with a combined
+ * pattern are counted against the combined regex, and are counted
+ * themselves only when they match and are executed to get captures.
+ */
+
+u_char *
+ngx_regex_stats(ngx_cycle_t *cycle, ngx_uint_t n, ngx_regex_stats_t *stats)
+{
+    ngx_uint_t          i;
+    ngx_regex_conf_t   *rcf;
+    ngx_regex_stats_t  *slot;
+
+    rcf = (ngx_regex_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_regex_module);
+
+    if (rcf->stats == NULL || n >= rcf->nregexes) {
+        return NULL;
+    }
+
+    ngx_memzero(stats, sizeof(ngx_regex_stats_t));
+
+    for (i = 0; i < rcf->nslots; i++) {
+        slot = (ngx_regex_stats_t *) (rcf->stats + i * rcf->stride) + n;
+
+        stats->calls += slot->calls;
+        stats->matches += slot->matches;
+        stats->time += slot->time;
+    }
+
+    return rcf->regexes[n].name;
+}
+
+
 static void *
 ngx_regex_create_conf(ngx_cycle_t *cycle)
 {
@@ -382,12 +967,15 @@ ngx_regex_create_conf(ngx_cycle_t *cycle)
     }
 
     rcf->pcre_jit = NGX_CONF_UNSET;
+    rcf->pcre_stats = NGX_CONF_UNSET;
 
-    ngx_pcre_studies = ngx_list_create(cycle->pool, 8, sizeof(ngx_regex_elt_t));
-    if (ngx_pcre_studies == NULL) {
+    rcf->studies = ngx_list_create(cycle->pool, 8, sizeof(ngx_regex_elt_t));
+    if (rcf->studies == NULL) {
         return NULL;
     }
 
+    ngx_regex_studies = rcf->studies;
+
     return rcf;
 }
 
@@ -397,12 +985,77 @@ ngx_regex_init_conf(ngx_cycle_t *cycle, void *conf)
 {
     ngx_regex_conf_t *rcf = conf;
 
+    ngx_uint_t        i, n;
+    ngx_core_conf_t  *ccf;
+    ngx_list_part_t  *part;
+    ngx_regex_elt_t  *elts;
+
     ngx_conf_init_value(rcf->pcre_jit, 0);
+    ngx_conf_init_value(rcf->pcre_stats, 0);
+
+    if (rcf->shm_zone == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    /*
+     * the regexes compiled from the configuration are known by now;
+     * each worker process updates the statistics of all of them
+     * in a slot of its own, the slots are cache line aligned
+     */
+
+    n = 0;
+
+    for (part = &rcf->studies->part; part; part = part->next) {
+        n += part->nelts;
+    }
+
+    rcf->regexes = ngx_palloc(cycle->pool, n * sizeof(ngx_regex_elt_t));
+    if (rcf->regexes == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    for (part = &rcf->studies->part; part; part = part->next) {
+        elts = part->elts;
+
+        for (i = 0; i < part->nelts; i++) {
+            rcf->regexes[rcf->nregexes++] = elts[i];
+        }
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    rcf->nslots = ccf->worker_processes;
+    rcf->stride = ngx_align(n * sizeof(ngx_regex_stats_t),
+                            NGX_CPU_CACHE_LINE);
+
+    rcf->shm_zone->shm.size = 8 * ngx_pagesize + rcf->nslots * rcf->stride;
 
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_regex_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_regex_conf_t *rcf = shm_zone->data;
+
+    ngx_slab_pool_t  *shpool;
+
+    if (rcf->nregexes == 0) {
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    rcf->stats = ngx_slab_calloc(shpool, rcf->nslots * rcf->stride);
+    if (rcf->stats == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
 static char *
 ngx_regex_pcre_jit(ngx_conf_t *cf, void *post, void *data)
 {
@@ -412,7 +1065,21 @@ ngx_regex_pcre_jit(ngx_conf_t *cf, void *post, void *data)
         return NGX_CONF_OK;
     }
 
-#if (NGX_HAVE_PCRE_JIT)
+#if (NGX_PCRE2)
+    {
+    int       r;
+    uint32_t  jit;
+
+    jit = 0;
+    r = pcre2_config(PCRE2_CONFIG_JIT, &jit);
+
+    if (r < 0 || jit != 1) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "PCRE2 library does not support JIT");
+        *fp = 0;
+    }
+    }
+#elif (NGX_HAVE_PCRE_JIT)
     {
     int  jit, r;
 
@@ -433,3 +1100,35 @@ ngx_regex_pcre_jit(ngx_conf_t *cf, void *post, void *data)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_regex_pcre_stats(ngx_conf_t *cf, void *post, void *data)
+{
+    ngx_flag_t  *fp = data;
+
+    ngx_str_t          name;
+    ngx_regex_conf_t  *rcf;
+
+    if (*fp == 0) {
+        return NGX_CONF_OK;
+    }
+
+    rcf = (ngx_regex_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                            ngx_regex_module);
+
+    ngx_str_set(&name, "nginx_regex_stats");
+
+    /* the size is known in ngx_regex_init_conf() */
+
+    rcf->shm_zone = ngx_shared_memory_add(cf, &name, 0, &ngx_regex_module);
+    if (rcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    rcf->shm_zone->init = ngx_regex_init_zone;
+    rcf->shm_zone->data = rcf;
+    rcf->shm_zone->noreuse = 1;
+
+    return NGX_CONF_OK;
+}
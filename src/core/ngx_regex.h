@@ -12,17 +12,45 @@
 #include <ngx_config.h>
 #include <ngx_core.h>
 
+#if (NGX_PCRE2)
+
+#define PCRE2_CODE_UNIT_WIDTH  8
+#include <pcre2.h>
+
+#define NGX_REGEX_NO_MATCHED  PCRE2_ERROR_NOMATCH   /* -1 */
+
+#else
+
 #include <pcre.h>
 
+#define NGX_REGEX_NO_MATCHED  PCRE_ERROR_NOMATCH    /* -1 */
+
+#endif
 
-#define NGX_REGEX_NO_MATCHED  PCRE_ERROR_NOMATCH   /* -1 */
 
-#define NGX_REGEX_CASELESS    PCRE_CASELESS
+#define NGX_REGEX_CASELESS    0x00000001
 
 
 typedef struct {
-    pcre        *code;
-    pcre_extra  *extra;
+    ngx_uint_t          calls;
+    ngx_uint_t          matches;
+    uint64_t            time;        /* nanoseconds */
+} ngx_regex_stats_t;
+
+
+typedef struct {
+#if (NGX_PCRE2)
+    pcre2_code         *code;
+#else
+    pcre               *code;
+    pcre_extra         *extra;
+#endif
+
+    /*
+     * statistics in the slot of the worker process, see the "pcre_stats"
+     * directive; NULL for regexes compiled at runtime
+     */
+    ngx_regex_stats_t  *stats;
 } ngx_regex_t;
 
 
@@ -49,12 +77,19 @@ typedef struct {
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
-#define ngx_regex_exec(re, s, captures, size)                                \
-    pcre_exec(re->code, re->extra, (const char *) (s)->data, (s)->len, 0, 0, \
-              captures, size)
+ngx_int_t ngx_regex_exec(ngx_regex_t *re, ngx_str_t *s, int *captures,
+    ngx_uint_t size);
+
+#if (NGX_PCRE2)
+#define ngx_regex_exec_n      "pcre2_match()"
+#else
 #define ngx_regex_exec_n      "pcre_exec()"
+#endif
 
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
+u_char *ngx_regex_stats(ngx_cycle_t *cycle, ngx_uint_t n,
+    ngx_regex_stats_t *stats);
+
 
 #endif /* _NGX_REGEX_H_INCLUDED_ */
@@ -13,28 +13,49 @@
 
 typedef struct {
     ngx_array_t               pools;
+
+    ngx_shm_zone_t           *shm_zone;
+    u_char                   *stats;
+    ngx_uint_t                nslots;
+    size_t                    stride;
 } ngx_thread_pool_conf_t;
 
 
-typedef struct {
-    ngx_thread_task_t        *first;
-    ngx_thread_task_t       **last;
-} ngx_thread_pool_queue_t;
+/*
+ * Tasks are posted by the worker process event loop only, and are taken
+ * by the pool threads.  The submission queue is a bounded ring, where
+ * each cell carries a sequence number: a cell at position "pos" is free
+ * when its sequence equals "pos", and holds a task when it is "pos + 1".
+ * The threads claim cells with a compare-and-swap on the dequeue position,
+ * so neither posting nor taking a task requires a lock.
+ *
+ * The mutex and the condition variable are only used to put idle threads
+ * to sleep, a post signals the condition only if there are idle threads.
+ */
 
-#define ngx_thread_pool_queue_init(q)                                         \
-    (q)->first = NULL;                                                        \
-    (q)->last = &(q)->first
+typedef struct {
+    ngx_atomic_t              sequence;
+    ngx_thread_task_t        *task;
+    uint64_t                  posted;
+} ngx_thread_pool_cell_t;
 
 
 struct ngx_thread_pool_s {
+    ngx_thread_pool_cell_t   *cells;
+    ngx_atomic_uint_t         mask;
+    ngx_atomic_uint_t         enqueue_pos;
+    ngx_atomic_t              dequeue_pos;
+
+    ngx_atomic_t              idle;
     ngx_thread_mutex_t        mtx;
-    ngx_thread_pool_queue_t   queue;
-    ngx_int_t                 waiting;
     ngx_thread_cond_t         cond;
 
+    ngx_thread_pool_stats_t  *stats;
+
     ngx_log_t                *log;
 
     ngx_str_t                 name;
+    ngx_uint_t                index;
     ngx_uint_t                threads;
     ngx_int_t                 max_queue;
 
@@ -48,6 +69,11 @@ static ngx_int_t ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log,
 static void ngx_thread_pool_destroy(ngx_thread_pool_t *tp);
 static void ngx_thread_pool_exit_handler(void *data, ngx_log_t *log);
 
+static ngx_int_t ngx_thread_pool_enqueue(ngx_thread_pool_t *tp,
+    ngx_thread_task_t *task);
+static ngx_thread_task_t *ngx_thread_pool_dequeue(ngx_thread_pool_t *tp,
+    uint64_t *posted);
+static uint64_t ngx_thread_pool_time(void);
 static void *ngx_thread_pool_cycle(void *data);
 static void ngx_thread_pool_handler(ngx_event_t *ev);
 
@@ -55,6 +81,8 @@ static char *ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 static void *ngx_thread_pool_create_conf(ngx_cycle_t *cycle);
 static char *ngx_thread_pool_init_conf(ngx_cycle_t *cycle, void *conf);
+static ngx_int_t ngx_thread_pool_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
 
 static ngx_int_t ngx_thread_pool_init_worker(ngx_cycle_t *cycle);
 static void ngx_thread_pool_exit_worker(ngx_cycle_t *cycle);
@@ -98,9 +126,10 @@ ngx_module_t  ngx_thread_pool_module = {
 
 static ngx_str_t  ngx_thread_pool_default = ngx_string("default");
 
-static ngx_uint_t               ngx_thread_pool_task_id;
-static ngx_atomic_t             ngx_thread_pool_done_lock;
-static ngx_thread_pool_queue_t  ngx_thread_pool_done;
+static ngx_uint_t    ngx_thread_pool_task_id;
+
+/* a lock-free stack of completed tasks, in reverse order */
+static ngx_atomic_t  ngx_thread_pool_done;
 
 
 static ngx_int_t
@@ -108,7 +137,7 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
 {
     int             err;
     pthread_t       tid;
-    ngx_uint_t      n;
+    ngx_uint_t      n, size;
     pthread_attr_t  attr;
 
     if (ngx_notify == NULL) {
@@ -117,7 +146,31 @@ ngx_thread_pool_init(ngx_thread_pool_t *tp, ngx_log_t *log, ngx_pool_t *pool)
         return NGX_ERROR;
     }
 
-    ngx_thread_pool_queue_init(&tp->queue);
+    for (size = 1; size < (ngx_uint_t) tp->max_queue; size <<= 1) {
+        /* void */
+    }
+
+    tp->cells = ngx_palloc(pool, size * sizeof(ngx_thread_pool_cell_t));
+    if (tp->cells == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (n = 0; n < size; n++) {
+        tp->cells[n].sequence = n;
+        tp->cells[n].task = NULL;
+    }
+
+    tp->mask = size - 1;
+    tp->enqueue_pos = 0;
+    tp->dequeue_pos = 0;
+    tp->idle = 0;
+
+    if (tp->stats == NULL) {
+        tp->stats = ngx_pcalloc(pool, sizeof(ngx_thread_pool_stats_t));
+        if (tp->stats == NULL) {
+            return NGX_ERROR;
+        }
+    }
 
     if (ngx_thread_mutex_create(&tp->mtx, log) != NGX_OK) {
         return NGX_ERROR;
@@ -194,6 +247,13 @@ ngx_thread_pool_destroy(ngx_thread_pool_t *tp)
         task.event.active = 0;
     }
 
+    ngx_log_error(NGX_LOG_INFO, tp->log, 0,
+                  "thread pool \"%V\": %uA tasks, %uA overflows, "
+                  "max queue %uA, wait time %uAus, run time %uAus",
+                  &tp->name, tp->stats->tasks, tp->stats->overflows,
+                  tp->stats->max_queue, tp->stats->wait_time,
+                  tp->stats->run_time);
+
     (void) ngx_thread_cond_destroy(&tp->cond, tp->log);
 
     (void) ngx_thread_mutex_destroy(&tp->mtx, tp->log);
@@ -230,41 +290,50 @@ ngx_thread_task_alloc(ngx_pool_t *pool, size_t size)
 ngx_int_t
 ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 {
+    ngx_atomic_uint_t  waiting;
+
     if (task->event.active) {
         ngx_log_error(NGX_LOG_ALERT, tp->log, 0,
                       "task #%ui already active", task->id);
         return NGX_ERROR;
     }
 
-    if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-        return NGX_ERROR;
-    }
+    waiting = tp->stats->waiting;
 
-    if (tp->waiting >= tp->max_queue) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    if ((ngx_atomic_int_t) waiting >= tp->max_queue
+        || ngx_thread_pool_enqueue(tp, task) != NGX_OK)
+    {
+        tp->stats->overflows++;
 
         ngx_log_error(NGX_LOG_ERR, tp->log, 0,
-                      "thread pool \"%V\" queue overflow: %i tasks waiting",
-                      &tp->name, tp->waiting);
+                      "thread pool \"%V\" queue overflow: %uA tasks waiting",
+                      &tp->name, waiting);
         return NGX_ERROR;
     }
 
-    task->event.active = 1;
+    /*
+     * the atomic increment also orders the enqueued task
+     * before the check of idle threads below
+     */
 
-    task->id = ngx_thread_pool_task_id++;
-    task->next = NULL;
+    waiting = ngx_atomic_fetch_add(&tp->stats->waiting, 1) + 1;
 
-    if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
-        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
-        return NGX_ERROR;
+    if (waiting > tp->stats->max_queue) {
+        tp->stats->max_queue = waiting;
     }
 
-    *tp->queue.last = task;
-    tp->queue.last = &task->next;
+    if (tp->idle) {
+        if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
+            return NGX_ERROR;
+        }
 
-    tp->waiting++;
+        if (ngx_thread_cond_signal(&tp->cond, tp->log) != NGX_OK) {
+            (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+            return NGX_ERROR;
+        }
 
-    (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+        (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
+    }
 
     ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
                    "task #%ui added to thread pool \"%V\"",
@@ -274,6 +343,146 @@ ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
 }
 
 
+/*
+ * The statistics of the n-th pool, summed over the slots of all worker
+ * processes; NULL is returned when there is no such pool.
+ */
+
+ngx_str_t *
+ngx_thread_pool_stats(ngx_cycle_t *cycle, ngx_uint_t n,
+    ngx_thread_pool_stats_t *stats)
+{
+    ngx_uint_t                i;
+    ngx_thread_pool_t       **tpp;
+    ngx_thread_pool_conf_t   *tcf;
+    ngx_thread_pool_stats_t  *slot;
+
+    tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
+                                                  ngx_thread_pool_module);
+
+    if (tcf == NULL || n >= tcf->pools.nelts) {
+        return NULL;
+    }
+
+    ngx_memzero(stats, sizeof(ngx_thread_pool_stats_t));
+
+    tpp = tcf->pools.elts;
+
+    for (i = 0; tcf->stats && i < tcf->nslots; i++) {
+        slot = (ngx_thread_pool_stats_t *) (tcf->stats + i * tcf->stride) + n;
+
+        stats->waiting += slot->waiting;
+        stats->overflows += slot->overflows;
+        stats->tasks += slot->tasks;
+        stats->wait_time += slot->wait_time;
+        stats->run_time += slot->run_time;
+
+        if (slot->max_queue > stats->max_queue) {
+            stats->max_queue = slot->max_queue;
+        }
+    }
+
+    return &tpp[n]->name;
+}
+
+
+static ngx_int_t
+ngx_thread_pool_enqueue(ngx_thread_pool_t *tp, ngx_thread_task_t *task)
+{
+    ngx_atomic_uint_t        pos;
+    ngx_thread_pool_cell_t  *cell;
+
+    /* there is only one producer, so no atomic update is needed */
+
+    pos = tp->enqueue_pos;
+    cell = &tp->cells[pos & tp->mask];
+
+    if (cell->sequence != pos) {
+        /* the cell is not yet released by a thread */
+        return NGX_DECLINED;
+    }
+
+    task->event.active = 1;
+
+    task->id = ngx_thread_pool_task_id++;
+    task->next = NULL;
+
+    cell->task = task;
+    cell->posted = ngx_thread_pool_time();
+
+    ngx_memory_barrier();
+
+    cell->sequence = pos + 1;
+
+    tp->enqueue_pos = pos + 1;
+
+    return NGX_OK;
+}
+
+
+static ngx_thread_task_t *
+ngx_thread_pool_dequeue(ngx_thread_pool_t *tp, uint64_t *posted)
+{
+    ngx_atomic_int_t         diff;
+    ngx_atomic_uint_t        pos;
+    ngx_thread_task_t       *task;
+    ngx_thread_pool_cell_t  *cell;
+
+    pos = tp->dequeue_pos;
+
+    for ( ;; ) {
+        cell = &tp->cells[pos & tp->mask];
+
+        diff = (ngx_atomic_int_t) (cell->sequence - (pos + 1));
+
+        if (diff == 0) {
+            if (ngx_atomic_cmp_set(&tp->dequeue_pos, pos, pos + 1)) {
+                break;
+            }
+
+        } else if (diff < 0) {
+            /* the queue is empty */
+            return NULL;
+        }
+
+        pos = tp->dequeue_pos;
+    }
+
+    ngx_memory_barrier();
+
+    task = cell->task;
+    *posted = cell->posted;
+
+    ngx_memory_barrier();
+
+    cell->sequence = pos + tp->mask + 1;
+
+    (void) ngx_atomic_fetch_add(&tp->stats->waiting, -1);
+
+    return task;
+}
+
+
+static uint64_t
+ngx_thread_pool_time(void)
+{
+#if (NGX_HAVE_CLOCK_MONOTONIC)
+    struct timespec  ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+
+#else
+    struct timeval   tv;
+
+    ngx_gettimeofday(&tv);
+
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+
 static void *
 ngx_thread_pool_cycle(void *data)
 {
@@ -281,6 +490,8 @@ ngx_thread_pool_cycle(void *data)
 
     int                 err;
     sigset_t            set;
+    uint64_t            posted, start, now;
+    ngx_atomic_uint_t   done;
     ngx_thread_task_t  *task;
 
 #if 0
@@ -304,31 +515,36 @@ ngx_thread_pool_cycle(void *data)
     }
 
     for ( ;; ) {
-        if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
-        }
+        task = ngx_thread_pool_dequeue(tp, &posted);
+
+        while (task == NULL) {
+            if (ngx_thread_mutex_lock(&tp->mtx, tp->log) != NGX_OK) {
+                return NULL;
+            }
+
+            /*
+             * the atomic increment orders the idle counter
+             * before the queue check, see ngx_thread_task_post()
+             */
 
-        /* the number may become negative */
-        tp->waiting--;
+            (void) ngx_atomic_fetch_add(&tp->idle, 1);
 
-        while (tp->queue.first == NULL) {
-            if (ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
-                != NGX_OK)
+            task = ngx_thread_pool_dequeue(tp, &posted);
+
+            if (task == NULL
+                && ngx_thread_cond_wait(&tp->cond, &tp->mtx, tp->log)
+                   != NGX_OK)
             {
+                (void) ngx_atomic_fetch_add(&tp->idle, -1);
                 (void) ngx_thread_mutex_unlock(&tp->mtx, tp->log);
                 return NULL;
             }
-        }
 
-        task = tp->queue.first;
-        tp->queue.first = task->next;
+            (void) ngx_atomic_fetch_add(&tp->idle, -1);
 
-        if (tp->queue.first == NULL) {
-            tp->queue.last = &tp->queue.first;
-        }
-
-        if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
-            return NULL;
+            if (ngx_thread_mutex_unlock(&tp->mtx, tp->log) != NGX_OK) {
+                return NULL;
+            }
         }
 
 #if 0
@@ -339,24 +555,37 @@ ngx_thread_pool_cycle(void *data)
                        "run task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
 
+        start = ngx_thread_pool_time();
+
         task->handler(task->ctx, tp->log);
 
+        now = ngx_thread_pool_time();
+
+        (void) ngx_atomic_fetch_add(&tp->stats->tasks, 1);
+        (void) ngx_atomic_fetch_add(&tp->stats->wait_time,
+                                    (ngx_atomic_int_t) (start - posted));
+        (void) ngx_atomic_fetch_add(&tp->stats->run_time,
+                                    (ngx_atomic_int_t) (now - start));
+
         ngx_log_debug2(NGX_LOG_DEBUG_CORE, tp->log, 0,
                        "complete task #%ui in thread pool \"%V\"",
                        task->id, &tp->name);
 
-        task->next = NULL;
-
-        ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
-
-        *ngx_thread_pool_done.last = task;
-        ngx_thread_pool_done.last = &task->next;
+        do {
+            done = ngx_thread_pool_done;
+            task->next = (ngx_thread_task_t *) done;
 
-        ngx_memory_barrier();
+        } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, done,
+                                     (ngx_atomic_uint_t) task));
 
-        ngx_unlock(&ngx_thread_pool_done_lock);
+        /*
+         * the event loop is notified only on the first completion,
+         * the next ones are collected by the same handler call
+         */
 
-        (void) ngx_notify(ngx_thread_pool_handler);
+        if (done == 0) {
+            (void) ngx_notify(ngx_thread_pool_handler);
+        }
     }
 }
 
@@ -365,19 +594,27 @@ static void
 ngx_thread_pool_handler(ngx_event_t *ev)
 {
     ngx_event_t        *event;
-    ngx_thread_task_t  *task;
+    ngx_atomic_uint_t   done;
+    ngx_thread_task_t  *task, *next, *prev;
 
     ngx_log_debug0(NGX_LOG_DEBUG_CORE, ev->log, 0, "thread pool handler");
 
-    ngx_spinlock(&ngx_thread_pool_done_lock, 1, 2048);
+    do {
+        done = ngx_thread_pool_done;
 
-    task = ngx_thread_pool_done.first;
-    ngx_thread_pool_done.first = NULL;
-    ngx_thread_pool_done.last = &ngx_thread_pool_done.first;
+    } while (!ngx_atomic_cmp_set(&ngx_thread_pool_done, done, 0));
 
-    ngx_memory_barrier();
+    /* restore the completion order */
+
+    prev = NULL;
+
+    for (task = (ngx_thread_task_t *) done; task; task = next) {
+        next = task->next;
+        task->next = prev;
+        prev = task;
+    }
 
-    ngx_unlock(&ngx_thread_pool_done_lock);
+    task = prev;
 
     while (task) {
         ngx_log_debug1(NGX_LOG_DEBUG_CORE, ev->log, 0,
@@ -421,6 +658,7 @@ ngx_thread_pool_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_thread_pool_conf_t *tcf = conf;
 
     ngx_uint_t           i;
+    ngx_core_conf_t     *ccf;
     ngx_thread_pool_t  **tpp;
 
     tpp = tcf->pools.elts;
@@ -448,10 +686,45 @@ ngx_thread_pool_init_conf(ngx_cycle_t *cycle, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    if (tcf->shm_zone == NULL) {
+        return NGX_CONF_OK;
+    }
+
+    /*
+     * each worker process updates the statistics of all pools
+     * in a slot of its own, the slots are cache line aligned
+     */
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    tcf->nslots = ccf->worker_processes;
+    tcf->stride = ngx_align(tcf->pools.nelts * sizeof(ngx_thread_pool_stats_t),
+                            NGX_CPU_CACHE_LINE);
+
+    tcf->shm_zone->shm.size = 8 * ngx_pagesize + tcf->nslots * tcf->stride;
+
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_thread_pool_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_thread_pool_conf_t *tcf = shm_zone->data;
+
+    ngx_slab_pool_t  *shpool;
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    tcf->stats = ngx_slab_calloc(shpool, tcf->nslots * tcf->stride);
+    if (tcf->stats == NULL) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
 static char *
 ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
@@ -518,6 +791,7 @@ ngx_thread_pool(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 ngx_thread_pool_t *
 ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name)
 {
+    ngx_str_t                zone;
     ngx_thread_pool_t       *tp, **tpp;
     ngx_thread_pool_conf_t  *tcf;
 
@@ -543,6 +817,24 @@ ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name)
     tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
                                                   ngx_thread_pool_module);
 
+    if (tcf->shm_zone == NULL) {
+        ngx_str_set(&zone, "nginx_thread_pools");
+
+        /* the size is known in ngx_thread_pool_init_conf() */
+
+        tcf->shm_zone = ngx_shared_memory_add(cf, &zone, 0,
+                                              &ngx_thread_pool_module);
+        if (tcf->shm_zone == NULL) {
+            return NULL;
+        }
+
+        tcf->shm_zone->init = ngx_thread_pool_init_zone;
+        tcf->shm_zone->data = tcf;
+        tcf->shm_zone->noreuse = 1;
+    }
+
+    tp->index = tcf->pools.nelts;
+
     tpp = ngx_array_push(&tcf->pools);
     if (tpp == NULL) {
         return NULL;
@@ -579,12 +871,29 @@ ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name)
 }
 
 
+/*
+ * Thread pools are only started in worker processes; helper processes,
+ * such as the cache loader, start the pools they need on demand.
+ */
+
+ngx_int_t
+ngx_thread_pool_start(ngx_thread_pool_t *tp, ngx_cycle_t *cycle)
+{
+    if (tp->cells) {
+        return NGX_OK;
+    }
+
+    return ngx_thread_pool_init(tp, cycle->log, cycle->pool);
+}
+
+
 static ngx_int_t
 ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
 {
     ngx_uint_t                i;
     ngx_thread_pool_t       **tpp;
     ngx_thread_pool_conf_t   *tcf;
+    ngx_thread_pool_stats_t  *stats;
 
     if (ngx_process != NGX_PROCESS_WORKER
         && ngx_process != NGX_PROCESS_SINGLE)
@@ -595,15 +904,27 @@ ngx_thread_pool_init_worker(ngx_cycle_t *cycle)
     tcf = (ngx_thread_pool_conf_t *) ngx_get_conf(cycle->conf_ctx,
                                                   ngx_thread_pool_module);
 
-    if (tcf == NULL) {
+    if (tcf == NULL || tcf->pools.nelts == 0) {
         return NGX_OK;
     }
 
-    ngx_thread_pool_queue_init(&ngx_thread_pool_done);
+    ngx_thread_pool_done = 0;
 
     tpp = tcf->pools.elts;
 
+    stats = (ngx_thread_pool_stats_t *)
+                (tcf->stats + (ngx_worker % tcf->nslots) * tcf->stride);
+
     for (i = 0; i < tcf->pools.nelts; i++) {
+
+        /*
+         * the counters left by a previous process in the slot
+         * are kept, except for the tasks it had queued
+         */
+
+        tpp[i]->stats = &stats[tpp[i]->index];
+        tpp[i]->stats->waiting = 0;
+
         if (ngx_thread_pool_init(tpp[i], cycle->log, cycle->pool) != NGX_OK) {
             return NGX_ERROR;
         }
@@ -23,14 +23,27 @@ struct ngx_thread_task_s {
 };
 
 
+typedef struct {
+    ngx_atomic_t         waiting;
+    ngx_atomic_t         max_queue;
+    ngx_atomic_t         overflows;
+    ngx_atomic_t         tasks;
+    ngx_atomic_t         wait_time;      /* microseconds */
+    ngx_atomic_t         run_time;       /* microseconds */
+} ngx_thread_pool_stats_t;
+
+
 typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 
 
 ngx_thread_pool_t *ngx_thread_pool_add(ngx_conf_t *cf, ngx_str_t *name);
 ngx_thread_pool_t *ngx_thread_pool_get(ngx_cycle_t *cycle, ngx_str_t *name);
+ngx_int_t ngx_thread_pool_start(ngx_thread_pool_t *tp, ngx_cycle_t *cycle);
 
 ngx_thread_task_t *ngx_thread_task_alloc(ngx_pool_t *pool, size_t size);
 ngx_int_t ngx_thread_task_post(ngx_thread_pool_t *tp, ngx_thread_task_t *task);
+ngx_str_t *ngx_thread_pool_stats(ngx_cycle_t *cycle, ngx_uint_t n,
+    ngx_thread_pool_stats_t *stats);
 
 
 #endif /* _NGX_THREAD_POOL_H_INCLUDED_ */
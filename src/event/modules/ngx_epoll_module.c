@@ -143,7 +143,11 @@ static ngx_connection_t     notify_conn;
 #if (NGX_HAVE_FILE_AIO)
 
 int                         ngx_eventfd = -1;
+#if (NGX_HAVE_IO_URING_AIO)
+static ngx_io_uring_t       ngx_aio_ring;
+#else
 aio_context_t               ngx_aio_ctx = 0;
+#endif
 
 static ngx_event_t          ngx_eventfd_event;
 static ngx_connection_t     ngx_eventfd_conn;
@@ -216,7 +220,7 @@ ngx_module_t  ngx_epoll_module = {
 };
 
 
-#if (NGX_HAVE_FILE_AIO)
+#if (NGX_HAVE_FILE_AIO) && !(NGX_HAVE_IO_URING_AIO)
 
 /*
  * We call io_setup(), io_destroy() io_submit(), and io_getevents() directly
@@ -245,6 +249,10 @@ io_getevents(aio_context_t ctx, long min_nr, long nr, struct io_event *events,
     return syscall(SYS_io_getevents, ctx, min_nr, nr, events, tmo);
 }
 
+#endif
+
+
+#if (NGX_HAVE_FILE_AIO)
 
 static void
 ngx_epoll_aio_init(ngx_cycle_t *cycle, ngx_epoll_conf_t *epcf)
@@ -276,12 +284,40 @@ ngx_epoll_aio_init(ngx_cycle_t *cycle, ngx_epoll_conf_t *epcf)
         goto failed;
     }
 
+#if (NGX_HAVE_IO_URING_AIO)
+
+    /*
+     * file reads are submitted to a separate io_uring instance,
+     * its completions are signalled via the eventfd
+     */
+
+    if (ngx_io_uring_create(&ngx_aio_ring, epcf->aio_requests,
+                            IORING_FEAT_NODROP|IORING_FEAT_RW_CUR_POS,
+                            cycle->log)
+        != NGX_OK)
+    {
+        ngx_log_error(NGX_LOG_EMERG, cycle->log, 0,
+                      "io_uring file aio is not supported");
+        goto failed;
+    }
+
+    if (ngx_io_uring_register_eventfd(&ngx_aio_ring, ngx_eventfd, cycle->log)
+        != NGX_OK)
+    {
+        ngx_io_uring_destroy(&ngx_aio_ring, cycle->log);
+        goto failed;
+    }
+
+#else
+
     if (io_setup(epcf->aio_requests, &ngx_aio_ctx) == -1) {
         ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
                       "io_setup() failed");
         goto failed;
     }
 
+#endif
+
     ngx_eventfd_event.data = &ngx_eventfd_conn;
     ngx_eventfd_event.handler = ngx_epoll_eventfd_handler;
     ngx_eventfd_event.log = cycle->log;
@@ -294,16 +330,23 @@ ngx_epoll_aio_init(ngx_cycle_t *cycle, ngx_epoll_conf_t *epcf)
     ee.data.ptr = &ngx_eventfd_conn;
 
     if (epoll_ctl(ep, EPOLL_CTL_ADD, ngx_eventfd, &ee) != -1) {
+#if (NGX_HAVE_IO_URING_AIO)
+        ngx_io_uring_aio = &ngx_aio_ring;
+#endif
         return;
     }
 
     ngx_log_error(NGX_LOG_EMERG, cycle->log, ngx_errno,
                   "epoll_ctl(EPOLL_CTL_ADD, eventfd) failed");
 
+#if (NGX_HAVE_IO_URING_AIO)
+    ngx_io_uring_destroy(&ngx_aio_ring, cycle->log);
+#else
     if (io_destroy(ngx_aio_ctx) == -1) {
         ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
                       "io_destroy() failed");
     }
+#endif
 
 failed:
 
@@ -313,7 +356,9 @@ failed:
     }
 
     ngx_eventfd = -1;
+#if !(NGX_HAVE_IO_URING_AIO)
     ngx_aio_ctx = 0;
+#endif
     ngx_file_aio = 0;
 }
 
@@ -552,10 +597,15 @@ ngx_epoll_done(ngx_cycle_t *cycle)
 
     if (ngx_eventfd != -1) {
 
+#if (NGX_HAVE_IO_URING_AIO)
+        ngx_io_uring_destroy(&ngx_aio_ring, cycle->log);
+        ngx_io_uring_aio = NULL;
+#else
         if (io_destroy(ngx_aio_ctx) == -1) {
             ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
                           "io_destroy() failed");
         }
+#endif
 
         if (close(ngx_eventfd) == -1) {
             ngx_log_error(NGX_LOG_ALERT, cycle->log, ngx_errno,
@@ -565,7 +615,9 @@ ngx_epoll_done(ngx_cycle_t *cycle)
         ngx_eventfd = -1;
     }
 
+#if !(NGX_HAVE_IO_URING_AIO)
     ngx_aio_ctx = 0;
+#endif
 
 #endif
 
@@ -797,6 +849,21 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
 
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, cycle->log, 0,
                    "epoll timer: %M", timer);
+
+#if (NGX_HAVE_IO_URING_AIO)
+
+    /* pass file reads queued in this iteration */
+
+    if (ngx_eventfd != -1 && ngx_io_uring_enter(&ngx_aio_ring, 0, 0) == -1) {
+        err = ngx_errno;
+
+        if (err != EBUSY && err != NGX_EAGAIN) {
+            ngx_log_error(NGX_LOG_ALERT, cycle->log, err,
+                          "io_uring_enter() failed");
+        }
+    }
+
+#endif
     /* epoll_wait 可操作的fd事件 */
     events = epoll_wait(ep, event_list, (int) nevents, timer);
 
@@ -946,14 +1013,20 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
 static void
 ngx_epoll_eventfd_handler(ngx_event_t *ev)
 {
-    int               n, events;
-    long              i;
-    uint64_t          ready;
-    ngx_err_t         err;
-    ngx_event_t      *e;
-    ngx_event_aio_t  *aio;
-    struct io_event   event[64];
-    struct timespec   ts;
+    int                   n;
+    uint64_t              ready;
+    ngx_err_t             err;
+#if (NGX_HAVE_IO_URING_AIO)
+    uint32_t              head, tail;
+    struct io_uring_cqe  *cqe;
+#else
+    int                   events;
+    long                  i;
+    ngx_event_t          *e;
+    ngx_event_aio_t      *aio;
+    struct io_event       event[64];
+    struct timespec       ts;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0, "eventfd handler");
 
@@ -978,6 +1051,30 @@ ngx_epoll_eventfd_handler(ngx_event_t *ev)
         return;
     }
 
+#if (NGX_HAVE_IO_URING_AIO)
+
+    head = *ngx_aio_ring.cq_head;
+    tail = *ngx_aio_ring.cq_tail;
+
+    ngx_memory_barrier();
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring aio events: %uD", tail - head);
+
+    while (head != tail) {
+        cqe = &ngx_aio_ring.cqes[head & ngx_aio_ring.cq_mask];
+
+        ngx_io_uring_aio_event(cqe->user_data, cqe->res);
+
+        head++;
+    }
+
+    ngx_memory_barrier();
+
+    *ngx_aio_ring.cq_head = head;
+
+#else
+
     ts.tv_sec = 0;
     ts.tv_nsec = 0;
 
@@ -1022,6 +1119,8 @@ ngx_epoll_eventfd_handler(ngx_event_t *ev)
                       "io_getevents() failed");
         return;
     }
+
+#endif
 }
 
 #endif
@@ -23,6 +23,9 @@ extern ngx_module_t ngx_select_module;
 static char *ngx_event_init_conf(ngx_cycle_t *cycle, void *conf);
 static ngx_int_t ngx_event_module_init(ngx_cycle_t *cycle);
 static ngx_int_t ngx_event_process_init(ngx_cycle_t *cycle);
+#if (NGX_STAT_STUB)
+static void ngx_stat_set_slot(ngx_uint_t n);
+#endif
 static char *ngx_events_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 
 static char *ngx_event_connections(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -59,20 +62,26 @@ ngx_int_t             ngx_accept_disabled;
 
 #if (NGX_STAT_STUB)
 
-static ngx_atomic_t   ngx_stat_accepted0;
-ngx_atomic_t         *ngx_stat_accepted = &ngx_stat_accepted0;
-static ngx_atomic_t   ngx_stat_handled0;
-ngx_atomic_t         *ngx_stat_handled = &ngx_stat_handled0;
-static ngx_atomic_t   ngx_stat_requests0;
-ngx_atomic_t         *ngx_stat_requests = &ngx_stat_requests0;
-static ngx_atomic_t   ngx_stat_active0;
-ngx_atomic_t         *ngx_stat_active = &ngx_stat_active0;
-static ngx_atomic_t   ngx_stat_reading0;
-ngx_atomic_t         *ngx_stat_reading = &ngx_stat_reading0;
-static ngx_atomic_t   ngx_stat_writing0;
-ngx_atomic_t         *ngx_stat_writing = &ngx_stat_writing0;
-static ngx_atomic_t   ngx_stat_waiting0;
-ngx_atomic_t         *ngx_stat_waiting = &ngx_stat_waiting0;
+static ngx_stat_slot_t   ngx_stat_slot0;
+static ngx_stat_slot_t  *ngx_stat_slots = &ngx_stat_slot0;
+static ngx_uint_t        ngx_stat_nslots = 1;
+
+ngx_atomic_t         *ngx_stat_accepted = &ngx_stat_slot0.accepted;
+ngx_atomic_t         *ngx_stat_handled = &ngx_stat_slot0.handled;
+ngx_atomic_t         *ngx_stat_requests = &ngx_stat_slot0.requests;
+ngx_atomic_t         *ngx_stat_active = &ngx_stat_slot0.active;
+ngx_atomic_t         *ngx_stat_reading = &ngx_stat_slot0.reading;
+ngx_atomic_t         *ngx_stat_writing = &ngx_stat_slot0.writing;
+ngx_atomic_t         *ngx_stat_waiting = &ngx_stat_slot0.waiting;
+ngx_atomic_t         *ngx_stat_log_dropped = &ngx_stat_slot0.log_dropped;
+ngx_atomic_t         *ngx_stat_pool_cache_hits =
+                                               &ngx_stat_slot0.pool_cache_hits;
+ngx_atomic_t         *ngx_stat_pool_cache_misses =
+                                             &ngx_stat_slot0.pool_cache_misses;
+ngx_atomic_t         *ngx_stat_pool_cache_released =
+                                           &ngx_stat_slot0.pool_cache_released;
+ngx_atomic_t         *ngx_stat_pool_cache_retained =
+                                           &ngx_stat_slot0.pool_cache_retained;
 
 #endif
 
@@ -121,6 +130,13 @@ ngx_module_t  ngx_events_module = {
 /* event核心模块名称 */
 static ngx_str_t  event_core_name = ngx_string("event_core");
 
+
+static ngx_conf_enum_t  ngx_event_timer_engines[] = {
+    { ngx_string("rbtree"), NGX_EVENT_TIMER_RBTREE },
+    { ngx_string("wheel"), NGX_EVENT_TIMER_WHEEL },
+    { ngx_null_string, 0 }
+};
+
 /**
  * 定义Event核心模块的命令参数
  * 主要：
@@ -167,6 +183,13 @@ static ngx_command_t  ngx_event_core_commands[] = {
       offsetof(ngx_event_conf_t, accept_mutex_delay),
       NULL },
 
+    { ngx_string("timer_engine"),
+      NGX_EVENT_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
+      0,
+      offsetof(ngx_event_conf_t, timer_engine),
+      &ngx_event_timer_engines },
+
     { ngx_string("debug_connection"),
       NGX_EVENT_CONF|NGX_CONF_TAKE1,
       ngx_event_debug_connection,
@@ -579,13 +602,14 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
 #if (NGX_STAT_STUB)
 
-    size += cl           /* ngx_stat_accepted */
-           + cl          /* ngx_stat_handled */
-           + cl          /* ngx_stat_requests */
-           + cl          /* ngx_stat_active */
-           + cl          /* ngx_stat_reading */
-           + cl          /* ngx_stat_writing */
-           + cl;         /* ngx_stat_waiting */
+    /*
+     * the number of slots is fixed by the first configuration,
+     * if more worker processes are started later they share slots
+     */
+
+    ngx_stat_nslots = ngx_max(ccf->worker_processes, 1);
+
+    size += ngx_stat_nslots * sizeof(ngx_stat_slot_t);
 
 #endif
 
@@ -625,13 +649,9 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 
 #if (NGX_STAT_STUB)
 
-    ngx_stat_accepted = (ngx_atomic_t *) (shared + 3 * cl);
-    ngx_stat_handled = (ngx_atomic_t *) (shared + 4 * cl);
-    ngx_stat_requests = (ngx_atomic_t *) (shared + 5 * cl);
-    ngx_stat_active = (ngx_atomic_t *) (shared + 6 * cl);
-    ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
-    ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
-    ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
+    ngx_stat_slots = (ngx_stat_slot_t *) (shared + 3 * cl);
+
+    ngx_stat_set_slot(0);
 
 #endif
 
@@ -639,6 +659,59 @@ ngx_event_module_init(ngx_cycle_t *cycle)
 }
 
 
+#if (NGX_STAT_STUB)
+
+static void
+ngx_stat_set_slot(ngx_uint_t n)
+{
+    ngx_stat_slot_t  *slot;
+
+    slot = &ngx_stat_slots[n % ngx_stat_nslots];
+
+    ngx_stat_accepted = &slot->accepted;
+    ngx_stat_handled = &slot->handled;
+    ngx_stat_requests = &slot->requests;
+    ngx_stat_active = &slot->active;
+    ngx_stat_reading = &slot->reading;
+    ngx_stat_writing = &slot->writing;
+    ngx_stat_waiting = &slot->waiting;
+    ngx_stat_log_dropped = &slot->log_dropped;
+    ngx_stat_pool_cache_hits = &slot->pool_cache_hits;
+    ngx_stat_pool_cache_misses = &slot->pool_cache_misses;
+    ngx_stat_pool_cache_released = &slot->pool_cache_released;
+    ngx_stat_pool_cache_retained = &slot->pool_cache_retained;
+}
+
+
+void
+ngx_stat_collect(ngx_stat_slot_t *stat)
+{
+    ngx_uint_t        i;
+    ngx_stat_slot_t  *slot;
+
+    ngx_memzero(stat, sizeof(ngx_stat_slot_t));
+
+    for (i = 0; i < ngx_stat_nslots; i++) {
+        slot = &ngx_stat_slots[i];
+
+        stat->accepted += slot->accepted;
+        stat->handled += slot->handled;
+        stat->requests += slot->requests;
+        stat->active += slot->active;
+        stat->reading += slot->reading;
+        stat->writing += slot->writing;
+        stat->waiting += slot->waiting;
+        stat->log_dropped += slot->log_dropped;
+        stat->pool_cache_hits += slot->pool_cache_hits;
+        stat->pool_cache_misses += slot->pool_cache_misses;
+        stat->pool_cache_released += slot->pool_cache_released;
+        stat->pool_cache_retained += slot->pool_cache_retained;
+    }
+}
+
+#endif
+
+
 #if !(NGX_WIN32)
 
 static void
@@ -686,13 +759,17 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
     ngx_use_accept_mutex = 0;
 
+#endif
+
+#if (NGX_STAT_STUB)
+    ngx_stat_set_slot(ngx_worker);
 #endif
     /* 初始化全局队列：ngx_posted_accept_events和ngx_posted_events */
     ngx_queue_init(&ngx_posted_accept_events);
     ngx_queue_init(&ngx_posted_next_events);
     ngx_queue_init(&ngx_posted_events);
     /* 初始化event模块的时间 */
-    if (ngx_event_timer_init(cycle->log) == NGX_ERROR) {
+    if (ngx_event_timer_init(cycle->log, ecf->timer_engine) == NGX_ERROR) {
         return NGX_ERROR;
     }
     /* 找到事件模型的模块，例如epoll/kqueue */
@@ -1283,6 +1360,7 @@ ngx_event_core_create_conf(ngx_cycle_t *cycle)
     ecf->multi_accept = NGX_CONF_UNSET;
     ecf->accept_mutex = NGX_CONF_UNSET;
     ecf->accept_mutex_delay = NGX_CONF_UNSET_MSEC;
+    ecf->timer_engine = NGX_CONF_UNSET_UINT;
     ecf->name = (void *) NGX_CONF_UNSET;
 
 #if (NGX_DEBUG)
@@ -1390,6 +1468,7 @@ ngx_event_core_init_conf(ngx_cycle_t *cycle, void *conf)
     ngx_conf_init_value(ecf->multi_accept, 0);
     ngx_conf_init_value(ecf->accept_mutex, 0);
     ngx_conf_init_msec_value(ecf->accept_mutex_delay, 500);
+    ngx_conf_init_uint_value(ecf->timer_engine, NGX_EVENT_TIMER_RBTREE);
 
     return NGX_CONF_OK;
 }
@@ -443,6 +443,8 @@ typedef struct {
 
     ngx_msec_t    accept_mutex_delay;
 
+    ngx_uint_t    timer_engine;
+
     u_char       *name;
 
 #if (NGX_DEBUG)
@@ -475,6 +477,30 @@ extern ngx_int_t              ngx_accept_disabled;
 
 #if (NGX_STAT_STUB)
 
+#define NGX_STAT_SLOT_SIZE  128
+
+/*
+ * each worker process updates its own slot of counters, the slots are
+ * padded to a cache line size and are summed up only when read
+ */
+
+typedef struct {
+    ngx_atomic_t   accepted;
+    ngx_atomic_t   handled;
+    ngx_atomic_t   requests;
+    ngx_atomic_t   active;
+    ngx_atomic_t   reading;
+    ngx_atomic_t   writing;
+    ngx_atomic_t   waiting;
+    ngx_atomic_t   log_dropped;
+    ngx_atomic_t   pool_cache_hits;
+    ngx_atomic_t   pool_cache_misses;
+    ngx_atomic_t   pool_cache_released;
+    ngx_atomic_t   pool_cache_retained;
+    u_char         padding[NGX_STAT_SLOT_SIZE - 12 * sizeof(ngx_atomic_t)];
+} ngx_stat_slot_t;
+
+
 extern ngx_atomic_t  *ngx_stat_accepted;
 extern ngx_atomic_t  *ngx_stat_handled;
 extern ngx_atomic_t  *ngx_stat_requests;
@@ -482,6 +508,14 @@ extern ngx_atomic_t  *ngx_stat_active;
 extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 extern ngx_atomic_t  *ngx_stat_waiting;
+extern ngx_atomic_t  *ngx_stat_log_dropped;
+extern ngx_atomic_t  *ngx_stat_pool_cache_hits;
+extern ngx_atomic_t  *ngx_stat_pool_cache_misses;
+extern ngx_atomic_t  *ngx_stat_pool_cache_released;
+extern ngx_atomic_t  *ngx_stat_pool_cache_retained;
+
+
+void ngx_stat_collect(ngx_stat_slot_t *stat);
 
 #endif
 
@@ -99,6 +99,7 @@ struct ngx_ssl_connection_s {
     unsigned                    in_early:1;
     unsigned                    early_preread:1;
     unsigned                    write_blocked:1;
+    unsigned                    sendfile:1;
 };
 
 
@@ -130,9 +131,35 @@ typedef struct {
     ngx_rbtree_t                session_rbtree;
     ngx_rbtree_node_t           sentinel;
     ngx_queue_t                 expire_queue;
+    ngx_slab_pool_t            *shpool;
+    ngx_uint_t                  sessions;
+    ngx_atomic_t                hits;
+    ngx_atomic_t                misses;
+    ngx_atomic_t                evictions;
+} ngx_ssl_session_shard_t;
+
+
+typedef struct {
+    ngx_uint_t                  nshards;
+    ngx_ssl_session_shard_t   **shards;
+} ngx_ssl_session_cache_sh_t;
+
+
+typedef struct {
+    ngx_ssl_session_cache_sh_t *sh;
+    ngx_uint_t                  shards;
 } ngx_ssl_session_cache_t;
 
 
+typedef struct {
+    ngx_uint_t                  shards;
+    ngx_uint_t                  sessions;
+    ngx_atomic_uint_t           hits;
+    ngx_atomic_uint_t           misses;
+    ngx_atomic_uint_t           evictions;
+} ngx_ssl_session_cache_stats_t;
+
+
 #ifdef SSL_CTRL_SET_TLSEXT_TICKET_KEY_CB
 
 typedef struct {
@@ -189,6 +216,7 @@ ngx_int_t ngx_ssl_dhparam(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *file);
 ngx_int_t ngx_ssl_ecdh_curve(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_str_t *name);
 ngx_int_t ngx_ssl_early_data(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_uint_t enable);
+ngx_int_t ngx_ssl_ktls(ngx_conf_t *cf, ngx_ssl_t *ssl, ngx_uint_t enable);
 ngx_int_t ngx_ssl_client_session_cache(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_uint_t enable);
 ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
@@ -196,7 +224,11 @@ ngx_int_t ngx_ssl_session_cache(ngx_ssl_t *ssl, ngx_str_t *sess_ctx,
     ngx_shm_zone_t *shm_zone, time_t timeout);
 ngx_int_t ngx_ssl_session_ticket_keys(ngx_conf_t *cf, ngx_ssl_t *ssl,
     ngx_array_t *paths);
+ngx_int_t ngx_ssl_session_cache_zone(ngx_conf_t *cf, ngx_shm_zone_t *shm_zone,
+    ngx_uint_t shards);
 ngx_int_t ngx_ssl_session_cache_init(ngx_shm_zone_t *shm_zone, void *data);
+void ngx_ssl_session_cache_stats(ngx_shm_zone_t *shm_zone,
+    ngx_ssl_session_cache_stats_t *stats);
 ngx_int_t ngx_ssl_create_connection(ngx_ssl_t *ssl, ngx_connection_t *c,
     ngx_uint_t flags);
 
@@ -10,9 +10,50 @@
 #include <ngx_event.h>
 
 
+/*
+ * The timing wheel consists of NGX_TIMER_WHEEL_LEVELS levels of 256 slots
+ * each, a slot of the level n covers 256^n milliseconds.  A timer is placed
+ * to the lowest level able to hold its distance from the wheel time,
+ * and is moved down a level once the wheel time reaches the start of its
+ * slot.  The slots are circular lists linked through the left and right
+ * pointers of the timer node, the parent pointer refers to the slot head.
+ * Timers which are already due are kept in a separate list.
+ */
+
+#define NGX_TIMER_WHEEL_LEVELS  4
+#define NGX_TIMER_WHEEL_BITS    8
+#define NGX_TIMER_WHEEL_SLOTS   (1 << NGX_TIMER_WHEEL_BITS)
+#define NGX_TIMER_WHEEL_MASK    (NGX_TIMER_WHEEL_SLOTS - 1)
+
+
+struct ngx_event_timer_wheel_s {
+    ngx_msec_t                now;
+    ngx_uint_t                count;
+    ngx_rbtree_node_t         expired;
+    uint64_t                  map[NGX_TIMER_WHEEL_LEVELS]
+                                 [NGX_TIMER_WHEEL_SLOTS / 64];
+    ngx_rbtree_node_t         slots[NGX_TIMER_WHEEL_LEVELS]
+                                   [NGX_TIMER_WHEEL_SLOTS];
+};
+
+
+static ngx_msec_t ngx_event_timer_wheel_find(ngx_event_timer_wheel_t *wheel);
+static ngx_int_t ngx_event_timer_wheel_nearest(ngx_event_timer_wheel_t *wheel,
+    ngx_msec_t now, ngx_msec_t *next);
+static void ngx_event_timer_wheel_expire(ngx_event_timer_wheel_t *wheel);
+static void ngx_event_timer_wheel_cascade(ngx_event_timer_wheel_t *wheel,
+    ngx_uint_t level, ngx_uint_t n);
+static void ngx_event_timer_wheel_run(ngx_event_timer_wheel_t *wheel,
+    ngx_rbtree_node_t *head);
+static ngx_int_t ngx_event_timer_wheel_next(uint64_t *map, ngx_uint_t n);
+static ngx_int_t ngx_event_timer_wheel_left(ngx_rbtree_node_t *head);
+
+
 ngx_rbtree_t              ngx_event_timer_rbtree;
 static ngx_rbtree_node_t  ngx_event_timer_sentinel;
 
+ngx_event_timer_wheel_t  *ngx_event_timer_wheel;
+
 /*
  * the event timer rbtree may contain the duplicate keys, however,
  * it should not be a problem, because we use the rbtree to find
@@ -20,21 +61,129 @@ static ngx_rbtree_node_t  ngx_event_timer_sentinel;
  */
 
 ngx_int_t
-ngx_event_timer_init(ngx_log_t *log)
+ngx_event_timer_init(ngx_log_t *log, ngx_uint_t engine)
 {
+    ngx_uint_t                level, n;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *wheel;
+
     ngx_rbtree_init(&ngx_event_timer_rbtree, &ngx_event_timer_sentinel,
                     ngx_rbtree_insert_timer_value);
 
+    if (engine != NGX_EVENT_TIMER_WHEEL) {
+        return NGX_OK;
+    }
+
+    wheel = ngx_alloc(sizeof(ngx_event_timer_wheel_t), log);
+    if (wheel == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(wheel->map, sizeof(wheel->map));
+
+    wheel->now = ngx_current_msec;
+    wheel->count = 0;
+
+    wheel->expired.left = &wheel->expired;
+    wheel->expired.right = &wheel->expired;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        for (n = 0; n < NGX_TIMER_WHEEL_SLOTS; n++) {
+            head = &wheel->slots[level][n];
+            head->left = head;
+            head->right = head;
+        }
+    }
+
+    ngx_event_timer_wheel = wheel;
+
     return NGX_OK;
 }
 
 
+void
+ngx_event_timer_wheel_insert(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t                level, n;
+    ngx_msec_t                delta;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = ngx_event_timer_wheel;
+
+    if ((ngx_msec_int_t) (node->key - wheel->now) < 0) {
+        head = &wheel->expired;
+        goto insert;
+    }
+
+    delta = node->key - wheel->now;
+
+    for (level = 0; level < NGX_TIMER_WHEEL_LEVELS - 1; level++) {
+        if (delta >> ((level + 1) * NGX_TIMER_WHEEL_BITS) == 0) {
+            break;
+        }
+    }
+
+    n = (node->key >> (level * NGX_TIMER_WHEEL_BITS)) & NGX_TIMER_WHEEL_MASK;
+
+    head = &wheel->slots[level][n];
+
+    wheel->map[level][n / 64] |= (uint64_t) 1 << (n % 64);
+
+    wheel->count++;
+
+insert:
+
+    node->left = head;
+    node->right = head->right;
+    head->right->left = node;
+    head->right = node;
+
+    node->parent = head;
+}
+
+
+void
+ngx_event_timer_wheel_delete(ngx_rbtree_node_t *node)
+{
+    ngx_uint_t                n;
+    ngx_rbtree_node_t        *head;
+    ngx_event_timer_wheel_t  *wheel;
+
+    wheel = ngx_event_timer_wheel;
+
+    node->right->left = node->left;
+    node->left->right = node->right;
+
+    head = node->parent;
+
+    if (head == &wheel->expired) {
+        return;
+    }
+
+    wheel->count--;
+
+    if (head->left != head) {
+        return;
+    }
+
+    n = head - &wheel->slots[0][0];
+
+    wheel->map[n / NGX_TIMER_WHEEL_SLOTS][(n % NGX_TIMER_WHEEL_SLOTS) / 64]
+        &= ~((uint64_t) 1 << (n % 64));
+}
+
+
 ngx_msec_t
 ngx_event_find_timer(void)
 {
     ngx_msec_int_t      timer;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        return ngx_event_timer_wheel_find(ngx_event_timer_wheel);
+    }
+
     if (ngx_event_timer_rbtree.root == &ngx_event_timer_sentinel) {
         return NGX_TIMER_INFINITE;
     }
@@ -56,6 +205,11 @@ ngx_event_expire_timers(void)
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+        ngx_event_timer_wheel_expire(ngx_event_timer_wheel);
+        return;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
 
     for ( ;; ) {
@@ -99,9 +253,32 @@ ngx_event_expire_timers(void)
 ngx_int_t
 ngx_event_no_timers_left(void)
 {
+    ngx_uint_t          level, n;
     ngx_event_t        *ev;
     ngx_rbtree_node_t  *node, *root, *sentinel;
 
+    if (ngx_event_timer_wheel) {
+
+        if (ngx_event_timer_wheel_left(&ngx_event_timer_wheel->expired)
+            != NGX_OK)
+        {
+            return NGX_AGAIN;
+        }
+
+        for (level = 0; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+            for (n = 0; n < NGX_TIMER_WHEEL_SLOTS; n++) {
+                if (ngx_event_timer_wheel_left(
+                                      &ngx_event_timer_wheel->slots[level][n])
+                    != NGX_OK)
+                {
+                    return NGX_AGAIN;
+                }
+            }
+        }
+
+        return NGX_OK;
+    }
+
     sentinel = ngx_event_timer_rbtree.sentinel;
     root = ngx_event_timer_rbtree.root;
 
@@ -124,3 +301,278 @@ ngx_event_no_timers_left(void)
 
     return NGX_OK;
 }
+
+
+static ngx_msec_t
+ngx_event_timer_wheel_find(ngx_event_timer_wheel_t *wheel)
+{
+    ngx_msec_t      next;
+    ngx_msec_int_t  timer;
+
+    if (wheel->expired.left != &wheel->expired) {
+        return 0;
+    }
+
+    if (ngx_event_timer_wheel_nearest(wheel, wheel->now, &next) != NGX_OK) {
+        return NGX_TIMER_INFINITE;
+    }
+
+    timer = (ngx_msec_int_t) (next - ngx_current_msec);
+
+    return (ngx_msec_t) (timer > 0 ? timer : 0);
+}
+
+
+/*
+ * finds the start of the first occupied slot not before the given time:
+ * a slot of level 0 holds timers due at its start, and the start of a slot
+ * of a higher level is the time to move its timers down; the slot of
+ * a higher level containing the time is already moved down unless the time
+ * is at its start
+ */
+
+static ngx_int_t
+ngx_event_timer_wheel_nearest(ngx_event_timer_wheel_t *wheel, ngx_msec_t now,
+    ngx_msec_t *next)
+{
+    ngx_int_t   n;
+    ngx_uint_t  level, shift, slot, found;
+    ngx_msec_t  key, round;
+
+    if (wheel->count == 0) {
+        return NGX_DECLINED;
+    }
+
+    found = 0;
+
+    slot = now & NGX_TIMER_WHEEL_MASK;
+
+    n = ngx_event_timer_wheel_next(wheel->map[0], slot);
+
+    if (n != NGX_ERROR) {
+        *next = now + (n - slot);
+
+        if (slot) {
+            return NGX_OK;
+        }
+
+        found = 1;
+
+    } else {
+        n = ngx_event_timer_wheel_next(wheel->map[0], 0);
+
+        if (n != NGX_ERROR) {
+            *next = (now | NGX_TIMER_WHEEL_MASK) + 1 + n;
+            found = 1;
+        }
+    }
+
+    for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+        shift = level * NGX_TIMER_WHEEL_BITS;
+        round = now >> shift;
+        slot = round & NGX_TIMER_WHEEL_MASK;
+
+        if (now & (((ngx_msec_t) 1 << shift) - 1)) {
+            n = ngx_event_timer_wheel_next(wheel->map[level], slot + 1);
+
+        } else {
+            n = ngx_event_timer_wheel_next(wheel->map[level], slot);
+        }
+
+        if (n != NGX_ERROR) {
+            n -= slot;
+
+        } else {
+            n = ngx_event_timer_wheel_next(wheel->map[level], 0);
+
+            if (n == NGX_ERROR) {
+                continue;
+            }
+
+            n += NGX_TIMER_WHEEL_SLOTS - slot;
+        }
+
+        key = (round + n) << shift;
+
+        if (!found || (ngx_msec_int_t) (key - *next) < 0) {
+            *next = key;
+            found = 1;
+        }
+    }
+
+    return found ? NGX_OK : NGX_DECLINED;
+}
+
+
+static void
+ngx_event_timer_wheel_expire(ngx_event_timer_wheel_t *wheel)
+{
+    ngx_int_t   n;
+    ngx_uint_t  level, slot;
+    ngx_msec_t  next;
+
+    while ((ngx_msec_int_t) (ngx_current_msec - wheel->now) >= 0) {
+
+        if (wheel->count == 0) {
+            break;
+        }
+
+        slot = wheel->now & NGX_TIMER_WHEEL_MASK;
+
+        if (slot == 0) {
+            for (level = 1; level < NGX_TIMER_WHEEL_LEVELS; level++) {
+                n = (wheel->now >> (level * NGX_TIMER_WHEEL_BITS))
+                    & NGX_TIMER_WHEEL_MASK;
+
+                ngx_event_timer_wheel_cascade(wheel, level, n);
+
+                if (n != 0) {
+                    break;
+                }
+            }
+        }
+
+        ngx_event_timer_wheel_run(wheel, &wheel->slots[0][slot]);
+
+        /*
+         * the wheel time jumps to the nearest occupied slot, as all slots
+         * in between are empty; it is not moved past the current time,
+         * so new timers are placed relative to it
+         */
+
+        if (ngx_event_timer_wheel_nearest(wheel, wheel->now + 1, &next)
+            != NGX_OK
+            || (ngx_msec_int_t) (next - ngx_current_msec) > 0)
+        {
+            next = ngx_current_msec + 1;
+        }
+
+        wheel->now = next;
+    }
+
+    if ((ngx_msec_int_t) (ngx_current_msec - wheel->now) >= 0) {
+        wheel->now = ngx_current_msec + 1;
+    }
+
+    ngx_event_timer_wheel_run(wheel, &wheel->expired);
+}
+
+
+static void
+ngx_event_timer_wheel_cascade(ngx_event_timer_wheel_t *wheel,
+    ngx_uint_t level, ngx_uint_t n)
+{
+    ngx_rbtree_node_t   list, *head, *node;
+
+    head = &wheel->slots[level][n];
+
+    if (head->left == head) {
+        return;
+    }
+
+    list.left = head->left;
+    list.right = head->right;
+    list.left->right = &list;
+    list.right->left = &list;
+
+    head->left = head;
+    head->right = head;
+
+    wheel->map[level][n / 64] &= ~((uint64_t) 1 << (n % 64));
+
+    while (list.left != &list) {
+        node = list.left;
+
+        node->right->left = node->left;
+        node->left->right = node->right;
+
+        wheel->count--;
+
+        ngx_event_timer_wheel_insert(node);
+    }
+}
+
+
+static void
+ngx_event_timer_wheel_run(ngx_event_timer_wheel_t *wheel,
+    ngx_rbtree_node_t *head)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node;
+
+    while (head->left != head) {
+        node = head->left;
+
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "event timer del: %d: %M",
+                       ngx_event_ident(ev->data), ev->timer.key);
+
+        ngx_event_timer_wheel_delete(node);
+
+#if (NGX_DEBUG)
+        ev->timer.left = NULL;
+        ev->timer.right = NULL;
+        ev->timer.parent = NULL;
+#endif
+
+        ev->timer_set = 0;
+
+        ev->timedout = 1;
+
+        ev->handler(ev);
+    }
+}
+
+
+static ngx_int_t
+ngx_event_timer_wheel_next(uint64_t *map, ngx_uint_t n)
+{
+    uint64_t    bits;
+    ngx_uint_t  i;
+
+    if (n >= NGX_TIMER_WHEEL_SLOTS) {
+        return NGX_ERROR;
+    }
+
+    bits = map[n / 64] & ((uint64_t) -1 << (n % 64));
+    i = n / 64;
+
+    for ( ;; ) {
+        if (bits) {
+            n = i * 64;
+
+            while (!(bits & 1)) {
+                bits >>= 1;
+                n++;
+            }
+
+            return n;
+        }
+
+        if (++i == NGX_TIMER_WHEEL_SLOTS / 64) {
+            return NGX_ERROR;
+        }
+
+        bits = map[i];
+    }
+}
+
+
+static ngx_int_t
+ngx_event_timer_wheel_left(ngx_rbtree_node_t *head)
+{
+    ngx_event_t        *ev;
+    ngx_rbtree_node_t  *node;
+
+    for (node = head->left; node != head; node = node->left) {
+        ev = (ngx_event_t *) ((char *) node - offsetof(ngx_event_t, timer));
+
+        if (!ev->cancelable) {
+            return NGX_AGAIN;
+        }
+    }
+
+    return NGX_OK;
+}
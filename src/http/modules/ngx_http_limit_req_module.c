@@ -16,6 +16,8 @@
 #define NGX_HTTP_LIMIT_REQ_DELAYED_DRY_RUN   4
 #define NGX_HTTP_LIMIT_REQ_REJECTED_DRY_RUN  5
 
+#define NGX_HTTP_LIMIT_REQ_SKETCH_ROWS       4
+
 
 typedef struct {
     u_char                       color;
@@ -37,13 +39,30 @@ typedef struct {
 } ngx_http_limit_req_shctx_t;
 
 
+/*
+ * the sketch is a count-min sketch of leaky buckets: each of the rows
+ * is an array of cells, a key maps to one cell in every row; a cell packs
+ * the time of the last update in the upper 32 bits and the level of the
+ * bucket, that is the excess after the last request plus 1000, in the lower
+ */
+
+typedef struct {
+    ngx_uint_t                   width;
+    ngx_atomic_t                 cells[1];
+} ngx_http_limit_req_sketch_t;
+
+
 typedef struct {
     ngx_http_limit_req_shctx_t  *sh;
+    ngx_http_limit_req_sketch_t *sketch;
     ngx_slab_pool_t             *shpool;
     /* integer value, 1 corresponds to 0.001 r/s */
     ngx_uint_t                   rate;
     ngx_http_complex_value_t     key;
     ngx_http_limit_req_node_t   *node;
+    ngx_uint_t                   use_sketch;
+    ngx_uint_t                   pending;
+    uint32_t                     hash[2];
 } ngx_http_limit_req_ctx_t;
 
 
@@ -71,6 +90,16 @@ static ngx_msec_t ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits,
     ngx_uint_t n, ngx_uint_t *ep, ngx_http_limit_req_limit_t **limit);
 static void ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx,
     ngx_uint_t n);
+static ngx_int_t ngx_http_limit_req_sketch_lookup(
+    ngx_http_limit_req_limit_t *limit, ngx_str_t *key, ngx_uint_t *ep,
+    ngx_uint_t account);
+static ngx_uint_t ngx_http_limit_req_sketch_account(
+    ngx_http_limit_req_ctx_t *ctx);
+static ngx_uint_t ngx_http_limit_req_sketch_excess(
+    ngx_http_limit_req_ctx_t *ctx, ngx_atomic_uint_t cell, uint32_t now);
+
+static ngx_int_t ngx_http_limit_req_init_sketch(ngx_shm_zone_t *shm_zone);
+static ngx_int_t ngx_http_limit_req_init_log_ctx(ngx_shm_zone_t *shm_zone);
 
 static ngx_int_t ngx_http_limit_req_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
@@ -102,7 +131,7 @@ static ngx_conf_num_bounds_t  ngx_http_limit_req_status_bounds = {
 static ngx_command_t  ngx_http_limit_req_commands[] = {
 
     { ngx_string("limit_req_zone"),
-      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3,
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE3|NGX_CONF_TAKE4,
       ngx_http_limit_req_zone,
       0,
       0,
@@ -238,14 +267,20 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
             continue;
         }
 
-        hash = ngx_crc32_short(key.data, key.len);
+        if (ctx->sketch) {
+            rc = ngx_http_limit_req_sketch_lookup(limit, &key, &excess,
+                                               (n == lrcf->limits.nelts - 1));
 
-        ngx_shmtx_lock(&ctx->shpool->mutex);
+        } else {
+            hash = ngx_crc32_short(key.data, key.len);
 
-        rc = ngx_http_limit_req_lookup(limit, hash, &key, &excess,
-                                       (n == lrcf->limits.nelts - 1));
+            ngx_shmtx_lock(&ctx->shpool->mutex);
 
-        ngx_shmtx_unlock(&ctx->shpool->mutex);
+            rc = ngx_http_limit_req_lookup(limit, hash, &key, &excess,
+                                           (n == lrcf->limits.nelts - 1));
+
+            ngx_shmtx_unlock(&ctx->shpool->mutex);
+        }
 
         ngx_log_debug4(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "limit_req[%ui]: %i %ui.%03ui",
@@ -273,6 +308,8 @@ ngx_http_limit_req_handler(ngx_http_request_t *r)
         while (n--) {
             ctx = limits[n].shm_zone->data;
 
+            ctx->pending = 0;
+
             if (ctx->node == NULL) {
                 continue;
             }
@@ -560,6 +597,12 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 
     while (n--) {
         ctx = limits[n].shm_zone->data;
+
+        if (ctx->pending) {
+            excess = ngx_http_limit_req_sketch_account(ctx);
+            goto delay;
+        }
+
         lr = ctx->node;
 
         if (lr == NULL) {
@@ -595,6 +638,8 @@ ngx_http_limit_req_account(ngx_http_limit_req_limit_t *limits, ngx_uint_t n,
 
         ctx->node = NULL;
 
+    delay:
+
         if ((ngx_uint_t) excess <= limits[n].delay) {
             continue;
         }
@@ -678,12 +723,144 @@ ngx_http_limit_req_expire(ngx_http_limit_req_ctx_t *ctx, ngx_uint_t n)
 }
 
 
+static ngx_int_t
+ngx_http_limit_req_sketch_lookup(ngx_http_limit_req_limit_t *limit,
+    ngx_str_t *key, ngx_uint_t *ep, ngx_uint_t account)
+{
+    uint32_t                      now;
+    ngx_uint_t                    i, excess, e;
+    ngx_atomic_t                 *cell;
+    ngx_http_limit_req_ctx_t     *ctx;
+    ngx_http_limit_req_sketch_t  *sketch;
+
+    ctx = limit->shm_zone->data;
+    sketch = ctx->sketch;
+
+    now = (uint32_t) ngx_current_msec;
+
+    ctx->hash[0] = ngx_crc32_short(key->data, key->len);
+    ctx->hash[1] = ngx_murmur_hash2(key->data, key->len) | 1;
+
+    /* the smallest bucket is the closest estimate of the key excess */
+
+    excess = NGX_MAX_UINT32_VALUE;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_SKETCH_ROWS; i++) {
+        cell = &sketch->cells[i * sketch->width
+                              + (uint32_t) (ctx->hash[0] + i * ctx->hash[1])
+                                % sketch->width];
+
+        e = ngx_http_limit_req_sketch_excess(ctx, *cell, now);
+
+        if (e < excess) {
+            excess = e;
+        }
+    }
+
+    *ep = excess;
+
+    if (excess > limit->burst) {
+        return NGX_BUSY;
+    }
+
+    ctx->pending = 1;
+
+    if (account) {
+        (void) ngx_http_limit_req_sketch_account(ctx);
+        return NGX_OK;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+static ngx_uint_t
+ngx_http_limit_req_sketch_account(ngx_http_limit_req_ctx_t *ctx)
+{
+    uint32_t                      now;
+    ngx_uint_t                    i, excess, e, level;
+    ngx_atomic_t                 *cell[NGX_HTTP_LIMIT_REQ_SKETCH_ROWS];
+    ngx_atomic_uint_t             old;
+    ngx_http_limit_req_sketch_t  *sketch;
+
+    sketch = ctx->sketch;
+
+    ctx->pending = 0;
+
+    now = (uint32_t) ngx_current_msec;
+
+    excess = NGX_MAX_UINT32_VALUE;
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_SKETCH_ROWS; i++) {
+        cell[i] = &sketch->cells[i * sketch->width
+                                 + (uint32_t) (ctx->hash[0]
+                                               + i * ctx->hash[1])
+                                   % sketch->width];
+
+        e = ngx_http_limit_req_sketch_excess(ctx, *cell[i], now);
+
+        if (e < excess) {
+            excess = e;
+        }
+    }
+
+    level = ngx_min(excess + 1000, NGX_MAX_UINT32_VALUE);
+
+    /*
+     * conservative update: buckets are only raised up to the new level
+     * of the key, as the rest of them is accounted for other keys
+     */
+
+    for (i = 0; i < NGX_HTTP_LIMIT_REQ_SKETCH_ROWS; i++) {
+
+        do {
+            old = *cell[i];
+            e = ngx_http_limit_req_sketch_excess(ctx, old, now);
+
+        } while (!ngx_atomic_cmp_set(cell[i], old,
+                     (ngx_atomic_uint_t) ((uint64_t) now << 32
+                                          | ngx_max(e, level))));
+    }
+
+    return excess;
+}
+
+
+static ngx_uint_t
+ngx_http_limit_req_sketch_excess(ngx_http_limit_req_ctx_t *ctx,
+    ngx_atomic_uint_t cell, uint32_t now)
+{
+    uint32_t    level;
+    ngx_uint_t  drained;
+    ngx_int_t   ms;
+
+    level = (uint32_t) ((uint64_t) cell & 0xffffffff);
+
+    if (level == 0) {
+        return 0;
+    }
+
+    ms = (int32_t) (now - (uint32_t) ((uint64_t) cell >> 32));
+
+    if (ms < -60000) {
+        /* the time of the cell has wrapped around */
+        return 0;
+
+    } else if (ms < 0) {
+        ms = 0;
+    }
+
+    drained = ctx->rate * ms / 1000;
+
+    return (level > drained) ? level - drained : 0;
+}
+
+
 static ngx_int_t
 ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 {
     ngx_http_limit_req_ctx_t  *octx = data;
 
-    size_t                     len;
     ngx_http_limit_req_ctx_t  *ctx;
 
     ctx = shm_zone->data;
@@ -702,7 +879,18 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
             return NGX_ERROR;
         }
 
+        if (ctx->use_sketch != octx->use_sketch) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "limit_req \"%V\" uses the \"%s\" algorithm "
+                          "while previously it used the \"%s\" algorithm",
+                          &shm_zone->shm.name,
+                          ctx->use_sketch ? "sketch" : "tree",
+                          octx->use_sketch ? "sketch" : "tree");
+            return NGX_ERROR;
+        }
+
         ctx->sh = octx->sh;
+        ctx->sketch = octx->sketch;
         ctx->shpool = octx->shpool;
 
         return NGX_OK;
@@ -711,11 +899,20 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
     ctx->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
 
     if (shm_zone->shm.exists) {
-        ctx->sh = ctx->shpool->data;
+        if (ctx->use_sketch) {
+            ctx->sketch = ctx->shpool->data;
+
+        } else {
+            ctx->sh = ctx->shpool->data;
+        }
 
         return NGX_OK;
     }
 
+    if (ctx->use_sketch) {
+        return ngx_http_limit_req_init_sketch(shm_zone);
+    }
+
     ctx->sh = ngx_slab_alloc(ctx->shpool, sizeof(ngx_http_limit_req_shctx_t));
     if (ctx->sh == NULL) {
         return NGX_ERROR;
@@ -728,6 +925,58 @@ ngx_http_limit_req_init_zone(ngx_shm_zone_t *shm_zone, void *data)
 
     ngx_queue_init(&ctx->sh->queue);
 
+    return ngx_http_limit_req_init_log_ctx(shm_zone);
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_init_sketch(ngx_shm_zone_t *shm_zone)
+{
+    size_t                     size;
+    ngx_uint_t                 width;
+    ngx_http_limit_req_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
+    if (ngx_http_limit_req_init_log_ctx(shm_zone) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    /* the sketch takes all the rest of the zone */
+
+    size = (ctx->shpool->pfree - 1) * ngx_pagesize;
+
+    width = (size - offsetof(ngx_http_limit_req_sketch_t, cells))
+            / (NGX_HTTP_LIMIT_REQ_SKETCH_ROWS * sizeof(ngx_atomic_t));
+
+    size = offsetof(ngx_http_limit_req_sketch_t, cells)
+           + width * NGX_HTTP_LIMIT_REQ_SKETCH_ROWS * sizeof(ngx_atomic_t);
+
+    ctx->sketch = ngx_slab_calloc(ctx->shpool, size);
+    if (ctx->sketch == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->sketch->width = width;
+
+    ctx->shpool->data = ctx->sketch;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, shm_zone->shm.log, 0,
+                   "limit_req sketch \"%V\" width: %ui",
+                   &shm_zone->shm.name, width);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_limit_req_init_log_ctx(ngx_shm_zone_t *shm_zone)
+{
+    size_t                     len;
+    ngx_http_limit_req_ctx_t  *ctx;
+
+    ctx = shm_zone->data;
+
     len = sizeof(" in limit_req zone \"\"") + shm_zone->shm.name.len;
 
     ctx->shpool->log_ctx = ngx_slab_alloc(ctx->shpool, len);
@@ -907,6 +1156,24 @@ ngx_http_limit_req_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strcmp(value[i].data, "algorithm=sketch") == 0) {
+
+            if (sizeof(ngx_atomic_uint_t) < 8) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"%V\" is not supported "
+                                   "on this platform", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            ctx->use_sketch = 1;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "algorithm=tree") == 0) {
+            ctx->use_sketch = 0;
+            continue;
+        }
+
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[i]);
         return NGX_CONF_ERROR;
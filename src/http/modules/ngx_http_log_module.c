@@ -35,6 +35,7 @@ typedef struct {
     ngx_str_t                   name;
     ngx_array_t                *flushes;
     ngx_array_t                *ops;        /* array of ngx_http_log_op_t */
+    ngx_uint_t                  binary;     /* unsigned  binary:1 */
 } ngx_http_log_fmt_t;
 
 
@@ -52,9 +53,36 @@ typedef struct {
     ngx_event_t                *event;
     ngx_msec_t                  flush;
     ngx_int_t                   gzip;
+
+#if (NGX_THREADS)
+    ngx_thread_pool_t          *thread_pool;
+    ngx_thread_task_t         **tasks;      /* ring of buffers */
+    ngx_uint_t                  current;
+    ngx_uint_t                  written;    /* the next buffer to write */
+    ngx_uint_t                  dropped;
+#endif
 } ngx_http_log_buf_t;
 
 
+#if (NGX_THREADS)
+
+#define NGX_HTTP_LOG_THREAD_BUFS  4
+
+typedef struct {
+    ngx_open_file_t            *file;
+    u_char                     *start;
+    size_t                      size;
+    size_t                      len;
+    ngx_fd_t                    fd;
+    ngx_int_t                   gzip;
+    ssize_t                     n;
+    ngx_err_t                   err;
+    ngx_atomic_t                complete;
+} ngx_http_log_thread_ctx_t;
+
+#endif
+
+
 typedef struct {
     ngx_array_t                *lengths;
     ngx_array_t                *values;
@@ -93,6 +121,26 @@ typedef struct {
 #define NGX_HTTP_LOG_ESCAPE_DEFAULT  0
 #define NGX_HTTP_LOG_ESCAPE_JSON     1
 #define NGX_HTTP_LOG_ESCAPE_NONE     2
+#define NGX_HTTP_LOG_ESCAPE_BINARY   3
+
+
+/*
+ * a binary record is a 32-bit little-endian length of the record
+ * followed by the fields, each starting with a type byte:
+ *
+ *     NULL    -
+ *     UINT    unsigned LEB128 varint
+ *     STRING  varint length, bytes
+ *     ADDR    address length byte (4 or 16), address in network order
+ */
+
+#define NGX_HTTP_LOG_BINARY_NULL     0
+#define NGX_HTTP_LOG_BINARY_UINT     1
+#define NGX_HTTP_LOG_BINARY_STRING   2
+#define NGX_HTTP_LOG_BINARY_ADDR     3
+
+#define NGX_HTTP_LOG_VARINT_LEN      10
+#define NGX_HTTP_LOG_BINARY_HEADER   4
 
 
 static void ngx_http_log_write(ngx_http_request_t *r, ngx_http_log_t *log,
@@ -111,6 +159,24 @@ static void ngx_http_log_gzip_free(void *opaque, void *address);
 static void ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log);
 static void ngx_http_log_flush_handler(ngx_event_t *ev);
 
+static void ngx_http_log_binary_header(u_char *start, u_char *last);
+
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_log_thread_post(ngx_open_file_t *file,
+    ngx_log_t *log);
+static void ngx_http_log_thread_write(ngx_open_file_t *file, ngx_log_t *log);
+static ngx_int_t ngx_http_log_thread_grow(ngx_open_file_t *file, size_t len,
+    ngx_log_t *log);
+static void ngx_http_log_thread_flush(ngx_open_file_t *file, ngx_log_t *log);
+static void ngx_http_log_thread_sync(ngx_http_log_thread_ctx_t *ctx,
+    ngx_log_t *log);
+static void ngx_http_log_thread_done(ngx_http_log_thread_ctx_t *ctx,
+    ngx_log_t *log);
+static void ngx_http_log_thread_handler(void *data, ngx_log_t *log);
+static void ngx_http_log_thread_event_handler(ngx_event_t *ev);
+static void ngx_http_log_exit_process(ngx_cycle_t *cycle);
+#endif
+
 static u_char *ngx_http_log_pipe(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op);
 static u_char *ngx_http_log_time(ngx_http_request_t *r, u_char *buf,
@@ -146,6 +212,31 @@ static size_t ngx_http_log_unescaped_variable_getlen(ngx_http_request_t *r,
 static u_char *ngx_http_log_unescaped_variable(ngx_http_request_t *r,
     u_char *buf, ngx_http_log_op_t *op);
 
+static u_char *ngx_http_log_binary_pipe(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_msec(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_request_time(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_bytes_sent(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_body_bytes_sent(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_request_length(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_remote_addr(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static size_t ngx_http_log_binary_variable_getlen(ngx_http_request_t *r,
+    uintptr_t data);
+static u_char *ngx_http_log_binary_variable(ngx_http_request_t *r,
+    u_char *buf, ngx_http_log_op_t *op);
+static u_char *ngx_http_log_binary_uint(u_char *buf, uint64_t n);
+static u_char *ngx_http_log_varint(u_char *buf, uint64_t n);
+
 
 static void *ngx_http_log_create_main_conf(ngx_conf_t *cf);
 static void *ngx_http_log_create_loc_conf(ngx_conf_t *cf);
@@ -215,7 +306,11 @@ ngx_module_t  ngx_http_log_module = {
     NULL,                                  /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
+#if (NGX_THREADS)
+    ngx_http_log_exit_process,             /* exit process */
+#else
     NULL,                                  /* exit process */
+#endif
     NULL,                                  /* exit master */
     NGX_MODULE_V1_PADDING
 };
@@ -250,10 +345,36 @@ static ngx_http_log_var_t  ngx_http_log_vars[] = {
 };
 
 
+static ngx_http_log_var_t  ngx_http_log_binary_vars[] = {
+    { ngx_string("pipe"), 1 + NGX_HTTP_LOG_VARINT_LEN,
+                          ngx_http_log_binary_pipe },
+    { ngx_string("time_local"), 1 + NGX_HTTP_LOG_VARINT_LEN,
+                          ngx_http_log_binary_time },
+    { ngx_string("time_iso8601"), 1 + NGX_HTTP_LOG_VARINT_LEN,
+                          ngx_http_log_binary_time },
+    { ngx_string("msec"), 1 + NGX_HTTP_LOG_VARINT_LEN,
+                          ngx_http_log_binary_msec },
+    { ngx_string("request_time"), 1 + NGX_HTTP_LOG_VARINT_LEN,
+                          ngx_http_log_binary_request_time },
+    { ngx_string("status"), 1 + NGX_HTTP_LOG_VARINT_LEN,
+                          ngx_http_log_binary_status },
+    { ngx_string("bytes_sent"), 1 + NGX_HTTP_LOG_VARINT_LEN,
+                          ngx_http_log_binary_bytes_sent },
+    { ngx_string("body_bytes_sent"), 1 + NGX_HTTP_LOG_VARINT_LEN,
+                          ngx_http_log_binary_body_bytes_sent },
+    { ngx_string("request_length"), 1 + NGX_HTTP_LOG_VARINT_LEN,
+                          ngx_http_log_binary_request_length },
+    { ngx_string("remote_addr"), 2 + 16,
+                          ngx_http_log_binary_remote_addr },
+
+    { ngx_null_string, 0, NULL }
+};
+
+
 static ngx_int_t
 ngx_http_log_handler(ngx_http_request_t *r)
 {
-    u_char                   *line, *p;
+    u_char                   *line, *p, *start;
     size_t                    len, size;
     ssize_t                   n;
     ngx_str_t                 val;
@@ -319,7 +440,8 @@ ngx_http_log_handler(ngx_http_request_t *r)
             goto alloc_line;
         }
 
-        len += NGX_LINEFEED_SIZE;
+        len += log[l].format->binary ? NGX_HTTP_LOG_BINARY_HEADER
+                                     : NGX_LINEFEED_SIZE;
 
         buffer = log[l].file ? log[l].file->data : NULL;
 
@@ -327,12 +449,42 @@ ngx_http_log_handler(ngx_http_request_t *r)
 
             if (len > (size_t) (buffer->last - buffer->pos)) {
 
+#if (NGX_THREADS)
+                if (buffer->thread_pool) {
+
+                    if (ngx_http_log_thread_post(log[l].file,
+                                                 r->connection->log)
+                        == NGX_BUSY)
+                    {
+                        /* all buffers are being written, drop the entry */
+                        buffer->dropped++;
+#if (NGX_STAT_STUB)
+                        (void) ngx_atomic_fetch_add(ngx_stat_log_dropped, 1);
+#endif
+                        continue;
+                    }
+
+                    goto buffered;
+                }
+#endif
+
                 ngx_http_log_write(r, &log[l], buffer->start,
                                    buffer->pos - buffer->start);
 
                 buffer->pos = buffer->start;
             }
 
+#if (NGX_THREADS)
+        buffered:
+
+            if (buffer->thread_pool
+                && len > (size_t) (buffer->last - buffer->pos))
+            {
+                (void) ngx_http_log_thread_grow(log[l].file, len,
+                                                r->connection->log);
+            }
+#endif
+
             if (len <= (size_t) (buffer->last - buffer->pos)) {
 
                 p = buffer->pos;
@@ -341,11 +493,22 @@ ngx_http_log_handler(ngx_http_request_t *r)
                     ngx_add_timer(buffer->event, buffer->flush);
                 }
 
+                start = p;
+
+                if (log[l].format->binary) {
+                    p += NGX_HTTP_LOG_BINARY_HEADER;
+                }
+
                 for (i = 0; i < log[l].format->ops->nelts; i++) {
                     p = op[i].run(r, p, &op[i]);
                 }
 
-                ngx_linefeed(p);
+                if (log[l].format->binary) {
+                    ngx_http_log_binary_header(start, p);
+
+                } else {
+                    ngx_linefeed(p);
+                }
 
                 buffer->pos = p;
 
@@ -370,6 +533,10 @@ ngx_http_log_handler(ngx_http_request_t *r)
             p = ngx_syslog_add_header(log[l].syslog_peer, line);
         }
 
+        if (log[l].format->binary) {
+            p += NGX_HTTP_LOG_BINARY_HEADER;
+        }
+
         for (i = 0; i < log[l].format->ops->nelts; i++) {
             p = op[i].run(r, p, &op[i]);
         }
@@ -393,7 +560,12 @@ ngx_http_log_handler(ngx_http_request_t *r)
             continue;
         }
 
-        ngx_linefeed(p);
+        if (log[l].format->binary) {
+            ngx_http_log_binary_header(line, p);
+
+        } else {
+            ngx_linefeed(p);
+        }
 
         ngx_http_log_write(r, &log[l], line, p - line);
     }
@@ -762,13 +934,395 @@ ngx_http_log_flush(ngx_open_file_t *file, ngx_log_t *log)
 static void
 ngx_http_log_flush_handler(ngx_event_t *ev)
 {
+#if (NGX_THREADS)
+    ngx_open_file_t     *file;
+    ngx_http_log_buf_t  *buffer;
+#endif
+
     ngx_log_debug0(NGX_LOG_DEBUG_EVENT, ev->log, 0,
                    "http log buffer flush handler");
 
+#if (NGX_THREADS)
+
+    file = ev->data;
+    buffer = file->data;
+
+    if (buffer->thread_pool) {
+
+        if (ngx_http_log_thread_post(file, ev->log) == NGX_BUSY) {
+            ngx_add_timer(ev, buffer->flush);
+        }
+
+        return;
+    }
+
+#endif
+
     ngx_http_log_flush(ev->data, ev->log);
 }
 
 
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_log_thread_post(ngx_open_file_t *file, ngx_log_t *log)
+{
+    ngx_uint_t                  next;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    buffer = file->data;
+
+    if (buffer->pos == buffer->start) {
+        return NGX_OK;
+    }
+
+    next = (buffer->current + 1) % NGX_HTTP_LOG_THREAD_BUFS;
+
+    ctx = buffer->tasks[next]->ctx;
+
+    if (ctx->len) {
+        return NGX_BUSY;
+    }
+
+    ctx = buffer->tasks[buffer->current]->ctx;
+
+    ctx->len = buffer->pos - buffer->start;
+    ctx->gzip = buffer->gzip;
+
+    /*
+     * the descriptor is duplicated when the buffer is handed over,
+     * so the buffer is written to the file it was filled for even
+     * if the file is reopened before the write
+     */
+
+    ctx->fd = dup(file->fd);
+
+    if (ctx->fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "dup(\"%s\") failed", file->name.data);
+    }
+
+    buffer->current = next;
+
+    ctx = buffer->tasks[next]->ctx;
+
+    buffer->start = ctx->start;
+    buffer->pos = ctx->start;
+    buffer->last = ctx->start + ctx->size;
+
+    if (buffer->event && buffer->event->timer_set) {
+        ngx_del_timer(buffer->event);
+    }
+
+    ngx_http_log_thread_write(file, log);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_log_thread_write(ngx_open_file_t *file, ngx_log_t *log)
+{
+    ngx_thread_task_t          *task;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    buffer = file->data;
+
+    /*
+     * only one buffer of a file is written at a time, as threads
+     * of a pool may complete the writes in any order
+     */
+
+    while (buffer->written != buffer->current) {
+
+        task = buffer->tasks[buffer->written];
+        ctx = task->ctx;
+
+        if (task->event.active) {
+            return;
+        }
+
+        if (ctx->len == 0) {
+            /* already written by ngx_http_log_thread_flush() */
+            buffer->written = (buffer->written + 1) % NGX_HTTP_LOG_THREAD_BUFS;
+            continue;
+        }
+
+        if (ctx->fd != NGX_INVALID_FILE) {
+            ctx->complete = 0;
+
+            if (ngx_thread_task_post(buffer->thread_pool, task) == NGX_OK) {
+                ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                               "http log thread post: %uz to \"%s\"",
+                               ctx->len, file->name.data);
+                return;
+            }
+        }
+
+        ngx_http_log_thread_sync(ctx, log);
+        ngx_http_log_thread_done(ctx, log);
+    }
+}
+
+
+/*
+ * A line longer than the buffer is not written synchronously: the current
+ * buffer, which is empty at this point, is replaced with a larger one.
+ * The buffers only grow, to twice the previous size or more.
+ */
+
+static ngx_int_t
+ngx_http_log_thread_grow(ngx_open_file_t *file, size_t len, ngx_log_t *log)
+{
+    u_char                     *p;
+    size_t                      size;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    buffer = file->data;
+
+    if (buffer->pos != buffer->start) {
+        return NGX_DECLINED;
+    }
+
+    ctx = buffer->tasks[buffer->current]->ctx;
+
+    for (size = 2 * ctx->size; size < len; size *= 2) {
+        /* void */
+    }
+
+    p = ngx_pnalloc(ngx_cycle->pool, size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http log buffer of \"%s\" grown to %uz",
+                   file->name.data, size);
+
+    (void) ngx_pfree(ngx_cycle->pool, ctx->start);
+
+    ctx->start = p;
+    ctx->size = size;
+
+    buffer->start = p;
+    buffer->pos = p;
+    buffer->last = p + size;
+
+    return NGX_OK;
+}
+
+
+/*
+ * The file is reopened, or the process exits: the current buffer is handed
+ * over to be written to the file it was filled for, without waiting for
+ * the buffers being written.  If all of them are busy, the buffer is kept
+ * and goes to the reopened file.
+ */
+
+static void
+ngx_http_log_thread_flush(ngx_open_file_t *file, ngx_log_t *log)
+{
+    if (ngx_http_log_thread_post(file, log) == NGX_BUSY) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                       "http log buffer of \"%s\" kept", file->name.data);
+    }
+}
+
+
+static void
+ngx_http_log_thread_sync(ngx_http_log_thread_ctx_t *ctx, ngx_log_t *log)
+{
+    ngx_fd_t  fd;
+
+    fd = (ctx->fd != NGX_INVALID_FILE) ? ctx->fd : ctx->file->fd;
+
+#if (NGX_ZLIB)
+    if (ctx->gzip) {
+        ctx->n = ngx_http_log_gzip(fd, ctx->start, ctx->len, ctx->gzip, log);
+    } else {
+        ctx->n = ngx_write_fd(fd, ctx->start, ctx->len);
+    }
+#else
+    ctx->n = ngx_write_fd(fd, ctx->start, ctx->len);
+#endif
+
+    ctx->err = (ctx->n == -1) ? ngx_errno : 0;
+
+    if (ctx->fd == NGX_INVALID_FILE) {
+        return;
+    }
+
+    if (ngx_close_file(ctx->fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed",
+                      ctx->file->name.data);
+    }
+
+    ctx->fd = NGX_INVALID_FILE;
+}
+
+
+static void
+ngx_http_log_thread_handler(void *data, ngx_log_t *log)
+{
+    ngx_http_log_thread_ctx_t  *ctx = data;
+
+    ssize_t  n;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http log thread: %uz", ctx->len);
+
+#if (NGX_ZLIB)
+    if (ctx->gzip) {
+        n = ngx_http_log_gzip(ctx->fd, ctx->start, ctx->len, ctx->gzip, log);
+    } else {
+        n = ngx_write_fd(ctx->fd, ctx->start, ctx->len);
+    }
+#else
+    n = ngx_write_fd(ctx->fd, ctx->start, ctx->len);
+#endif
+
+    ctx->n = n;
+    ctx->err = (n == -1) ? ngx_errno : 0;
+
+    if (ngx_close_file(ctx->fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed",
+                      ctx->file->name.data);
+    }
+
+    ngx_memory_barrier();
+
+    ctx->complete = 1;
+}
+
+
+static void
+ngx_http_log_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    ctx = ev->data;
+    buffer = ctx->file->data;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "http log thread event handler");
+
+    ngx_http_log_thread_done(ctx, ev->log);
+
+    if (buffer->dropped) {
+        ngx_log_error(NGX_LOG_WARN, ev->log, 0,
+                      "%ui entries of access log \"%s\" were dropped",
+                      buffer->dropped, ctx->file->name.data);
+
+        buffer->dropped = 0;
+    }
+
+    ngx_http_log_thread_write(ctx->file, ev->log);
+}
+
+
+static void
+ngx_http_log_thread_done(ngx_http_log_thread_ctx_t *ctx, ngx_log_t *log)
+{
+    ngx_http_log_buf_t  *buffer;
+
+    buffer = ctx->file->data;
+
+    if (ctx->n == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ctx->err,
+                      ngx_write_fd_n " to \"%s\" failed",
+                      ctx->file->name.data);
+
+    } else if ((size_t) ctx->n != ctx->len) {
+        ngx_log_error(NGX_LOG_ALERT, log, 0,
+                      ngx_write_fd_n " to \"%s\" was incomplete: %z of %uz",
+                      ctx->file->name.data, ctx->n, ctx->len);
+    }
+
+    ctx->len = 0;
+
+    if (ctx == buffer->tasks[buffer->written]->ctx) {
+        buffer->written = (buffer->written + 1) % NGX_HTTP_LOG_THREAD_BUFS;
+    }
+}
+
+
+/*
+ * The files were flushed by ngx_conf_module, and the thread pools are
+ * destroyed by now, so the buffer being written is complete, though its
+ * completion event is not handled.  The rest are written synchronously
+ * in order.
+ */
+
+static void
+ngx_http_log_exit_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                  i, n;
+    ngx_list_part_t            *part;
+    ngx_open_file_t            *file;
+    ngx_thread_task_t          *task;
+    ngx_http_log_buf_t         *buffer;
+    ngx_http_log_thread_ctx_t  *ctx;
+
+    part = &cycle->open_files.part;
+    file = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            file = part->elts;
+            i = 0;
+        }
+
+        if (file[i].flush != ngx_http_log_thread_flush) {
+            continue;
+        }
+
+        buffer = file[i].data;
+
+        for (n = buffer->written; n != buffer->current;
+             n = (n + 1) % NGX_HTTP_LOG_THREAD_BUFS)
+        {
+            task = buffer->tasks[n];
+            ctx = task->ctx;
+
+            if (ctx->len == 0) {
+                continue;
+            }
+
+            if (task->event.active) {
+                if (!ctx->complete) {
+                    ngx_log_error(NGX_LOG_ALERT, cycle->log, 0,
+                                  "write to \"%s\" is not complete",
+                                  file[i].name.data);
+                    continue;
+                }
+
+                ngx_memory_barrier();
+
+            } else {
+                ngx_http_log_thread_sync(ctx, cycle->log);
+            }
+
+            ngx_http_log_thread_done(ctx, cycle->log);
+        }
+
+        ngx_http_log_flush(&file[i], cycle->log);
+    }
+}
+
+#endif
+
+
 static u_char *
 ngx_http_log_copy_short(ngx_http_request_t *r, u_char *buf,
     ngx_http_log_op_t *op)
@@ -912,6 +1466,211 @@ ngx_http_log_request_length(ngx_http_request_t *r, u_char *buf,
 }
 
 
+static void
+ngx_http_log_binary_header(u_char *start, u_char *last)
+{
+    uint32_t  len;
+
+    len = (uint32_t) (last - start - NGX_HTTP_LOG_BINARY_HEADER);
+
+    start[0] = (u_char) len;
+    start[1] = (u_char) (len >> 8);
+    start[2] = (u_char) (len >> 16);
+    start[3] = (u_char) (len >> 24);
+}
+
+
+static u_char *
+ngx_http_log_binary_pipe(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_binary_uint(buf, r->pipeline);
+}
+
+
+static u_char *
+ngx_http_log_binary_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_binary_uint(buf, ngx_time());
+}
+
+
+static u_char *
+ngx_http_log_binary_msec(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_time_t  *tp;
+
+    tp = ngx_timeofday();
+
+    return ngx_http_log_binary_uint(buf, (uint64_t) tp->sec * 1000 + tp->msec);
+}
+
+
+static u_char *
+ngx_http_log_binary_request_time(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_time_t      *tp;
+    ngx_msec_int_t   ms;
+
+    tp = ngx_timeofday();
+
+    ms = (ngx_msec_int_t)
+             ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+    ms = ngx_max(ms, 0);
+
+    return ngx_http_log_binary_uint(buf, ms);
+}
+
+
+static u_char *
+ngx_http_log_binary_status(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_uint_t  status;
+
+    if (r->err_status) {
+        status = r->err_status;
+
+    } else if (r->headers_out.status) {
+        status = r->headers_out.status;
+
+    } else if (r->http_version == NGX_HTTP_VERSION_9) {
+        status = 9;
+
+    } else {
+        status = 0;
+    }
+
+    return ngx_http_log_binary_uint(buf, status);
+}
+
+
+static u_char *
+ngx_http_log_binary_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_binary_uint(buf, r->connection->sent);
+}
+
+
+static u_char *
+ngx_http_log_binary_body_bytes_sent(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    off_t  length;
+
+    length = r->connection->sent - r->header_size;
+
+    return ngx_http_log_binary_uint(buf, length > 0 ? length : 0);
+}
+
+
+static u_char *
+ngx_http_log_binary_request_length(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    return ngx_http_log_binary_uint(buf, r->request_length);
+}
+
+
+static u_char *
+ngx_http_log_binary_remote_addr(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (r->connection->sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) r->connection->sockaddr;
+
+        *buf++ = NGX_HTTP_LOG_BINARY_ADDR;
+        *buf++ = 16;
+
+        return ngx_cpymem(buf, sin6->sin6_addr.s6_addr, 16);
+#endif
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) r->connection->sockaddr;
+
+        *buf++ = NGX_HTTP_LOG_BINARY_ADDR;
+        *buf++ = 4;
+
+        return ngx_cpymem(buf, &sin->sin_addr.s_addr, 4);
+
+    default: /* AF_UNIX */
+        *buf++ = NGX_HTTP_LOG_BINARY_NULL;
+        return buf;
+    }
+}
+
+
+static size_t
+ngx_http_log_binary_variable_getlen(ngx_http_request_t *r, uintptr_t data)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, data);
+
+    if (value == NULL || value->not_found) {
+        return 1;
+    }
+
+    return 1 + NGX_HTTP_LOG_VARINT_LEN + value->len;
+}
+
+
+static u_char *
+ngx_http_log_binary_variable(ngx_http_request_t *r, u_char *buf,
+    ngx_http_log_op_t *op)
+{
+    ngx_http_variable_value_t  *value;
+
+    value = ngx_http_get_indexed_variable(r, op->data);
+
+    if (value == NULL || value->not_found) {
+        *buf++ = NGX_HTTP_LOG_BINARY_NULL;
+        return buf;
+    }
+
+    *buf++ = NGX_HTTP_LOG_BINARY_STRING;
+
+    buf = ngx_http_log_varint(buf, value->len);
+
+    return ngx_cpymem(buf, value->data, value->len);
+}
+
+
+static u_char *
+ngx_http_log_binary_uint(u_char *buf, uint64_t n)
+{
+    *buf++ = NGX_HTTP_LOG_BINARY_UINT;
+
+    return ngx_http_log_varint(buf, n);
+}
+
+
+static u_char *
+ngx_http_log_varint(u_char *buf, uint64_t n)
+{
+    while (n >= 0x80) {
+        *buf++ = (u_char) (n | 0x80);
+        n >>= 7;
+    }
+
+    *buf++ = (u_char) n;
+
+    return buf;
+}
+
+
 static ngx_int_t
 ngx_http_log_variable_compile(ngx_conf_t *cf, ngx_http_log_op_t *op,
     ngx_str_t *value, ngx_uint_t escape)
@@ -936,6 +1695,11 @@ ngx_http_log_variable_compile(ngx_conf_t *cf, ngx_http_log_op_t *op,
         op->run = ngx_http_log_unescaped_variable;
         break;
 
+    case NGX_HTTP_LOG_ESCAPE_BINARY:
+        op->getlen = ngx_http_log_binary_variable_getlen;
+        op->run = ngx_http_log_binary_variable;
+        break;
+
     default: /* NGX_HTTP_LOG_ESCAPE_DEFAULT */
         op->getlen = ngx_http_log_variable_getlen;
         op->run = ngx_http_log_variable;
@@ -1148,6 +1912,7 @@ ngx_http_log_create_main_conf(ngx_conf_t *cf)
     ngx_str_set(&fmt->name, "combined");
 
     fmt->flushes = NULL;
+    fmt->binary = 0;
 
     fmt->ops = ngx_array_create(cf->pool, 16, sizeof(ngx_http_log_op_t));
     if (fmt->ops == NULL) {
@@ -1251,6 +2016,11 @@ ngx_http_log_set_log(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_log_main_conf_t          *lmcf;
     ngx_http_script_compile_t          sc;
     ngx_http_compile_complex_value_t   ccv;
+#if (NGX_THREADS)
+    ngx_thread_task_t                 *task;
+    ngx_thread_pool_t                 *tp;
+    ngx_http_log_thread_ctx_t         *ctx;
+#endif
 
     value = cf->args->elts;
 
@@ -1361,9 +2131,18 @@ process_formats:
         return NGX_CONF_ERROR;
     }
 
+    if (log->syslog_peer && log->format->binary) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "logs to syslog cannot use binary log format");
+        return NGX_CONF_ERROR;
+    }
+
     size = 0;
     flush = 0;
     gzip = 0;
+#if (NGX_THREADS)
+    tp = NULL;
+#endif
 
     for (i = 3; i < cf->args->nelts; i++) {
 
@@ -1430,6 +2209,36 @@ process_formats:
 #endif
         }
 
+        if (ngx_strncmp(value[i].data, "async", 5) == 0
+            && (value[i].len == 5 || value[i].data[5] == '='))
+        {
+#if (NGX_THREADS)
+            if (size == 0) {
+                size = 64 * 1024;
+            }
+
+            if (value[i].len == 5) {
+                tp = ngx_thread_pool_add(cf, NULL);
+
+            } else {
+                s.len = value[i].len - 6;
+                s.data = value[i].data + 6;
+
+                tp = ngx_thread_pool_add(cf, &s);
+            }
+
+            if (tp == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"async\" is unsupported on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
         if (ngx_strncmp(value[i].data, "if=", 3) == 0) {
             s.len = value[i].len - 3;
             s.data = value[i].data + 3;
@@ -1484,7 +2293,11 @@ process_formats:
 
             if (buffer->last - buffer->start != size
                 || buffer->flush != flush
-                || buffer->gzip != gzip)
+                || buffer->gzip != gzip
+#if (NGX_THREADS)
+                || buffer->thread_pool != tp
+#endif
+               )
             {
                 ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                                    "access_log \"%V\" already defined "
@@ -1525,8 +2338,58 @@ process_formats:
 
         buffer->gzip = gzip;
 
+#if (NGX_THREADS)
+
+        if (tp) {
+            buffer->tasks = ngx_palloc(cf->pool, NGX_HTTP_LOG_THREAD_BUFS
+                                                 * sizeof(ngx_thread_task_t *));
+            if (buffer->tasks == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            for (n = 0; n < NGX_HTTP_LOG_THREAD_BUFS; n++) {
+                task = ngx_thread_task_alloc(cf->pool,
+                                            sizeof(ngx_http_log_thread_ctx_t));
+                if (task == NULL) {
+                    return NGX_CONF_ERROR;
+                }
+
+                ctx = task->ctx;
+
+                ctx->file = log->file;
+                ctx->size = size;
+
+                if (n == 0) {
+                    ctx->start = buffer->start;
+
+                } else {
+                    ctx->start = ngx_pnalloc(cf->pool, size);
+                    if (ctx->start == NULL) {
+                        return NGX_CONF_ERROR;
+                    }
+                }
+
+                task->handler = ngx_http_log_thread_handler;
+                task->event.handler = ngx_http_log_thread_event_handler;
+                task->event.data = ctx;
+                task->event.log = &cf->cycle->new_log;
+
+                buffer->tasks[n] = task;
+            }
+
+            buffer->thread_pool = tp;
+        }
+
+#endif
+
         log->file->flush = ngx_http_log_flush;
         log->file->data = buffer;
+
+#if (NGX_THREADS)
+        if (tp) {
+            log->file->flush = ngx_http_log_thread_flush;
+        }
+#endif
     }
 
     return NGX_CONF_OK;
@@ -1562,6 +2425,7 @@ ngx_http_log_set_format(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     fmt->name = value[1];
+    fmt->binary = (ngx_strcmp(value[2].data, "binary") == 0);
 
     fmt->flushes = ngx_array_create(cf->pool, 4, sizeof(ngx_int_t));
     if (fmt->flushes == NULL) {
@@ -1587,12 +2451,20 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
     ngx_int_t           *flush;
     ngx_uint_t           bracket, escape;
     ngx_http_log_op_t   *op;
-    ngx_http_log_var_t  *v;
+    ngx_http_log_var_t  *v, *vars;
 
     escape = NGX_HTTP_LOG_ESCAPE_DEFAULT;
+    vars = ngx_http_log_vars;
     value = args->elts;
 
-    if (s < args->nelts && ngx_strncmp(value[s].data, "escape=", 7) == 0) {
+    if (s < args->nelts && ngx_strcmp(value[s].data, "binary") == 0) {
+        escape = NGX_HTTP_LOG_ESCAPE_BINARY;
+        vars = ngx_http_log_binary_vars;
+        s++;
+
+    } else if (s < args->nelts
+               && ngx_strncmp(value[s].data, "escape=", 7) == 0)
+    {
         data = value[s].data + 7;
 
         if (ngx_strcmp(data, "json") == 0) {
@@ -1674,7 +2546,7 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
                     goto invalid;
                 }
 
-                for (v = ngx_http_log_vars; v->name.len; v++) {
+                for (v = vars; v->name.len; v++) {
 
                     if (v->name.len == var.len
                         && ngx_strncmp(v->name.data, var.data, var.len) == 0)
@@ -1717,6 +2589,14 @@ ngx_http_log_compile_format(ngx_conf_t *cf, ngx_array_t *flushes,
 
             len = &value[s].data[i] - data;
 
+            if (escape == NGX_HTTP_LOG_ESCAPE_BINARY) {
+
+                /* binary records consist of variables only */
+
+                ops->nelts--;
+                continue;
+            }
+
             if (len) {
 
                 op->len = len;
@@ -186,6 +186,10 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_http_variable_t               *var;
     ngx_http_map_conf_ctx_t            ctx;
     ngx_http_compile_complex_value_t   ccv;
+#if (NGX_PCRE)
+    ngx_uint_t                         i;
+    ngx_http_regex_t                 **regex;
+#endif
 
     if (mcf->hash_max_size == NGX_CONF_UNSET_UINT) {
         mcf->hash_max_size = 2048;
@@ -355,6 +359,24 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     if (ctx.regexes.nelts) {
         map->map.regex = ctx.regexes.elts;
         map->map.nregex = ctx.regexes.nelts;
+
+        regex = ngx_palloc(cf->pool,
+                           map->map.nregex * sizeof(ngx_http_regex_t *));
+        if (regex == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < map->map.nregex; i++) {
+            regex[i] = map->map.regex[i].regex;
+        }
+
+        map->map.regex_multi = ngx_http_regex_multi_create(cf, regex,
+                                                           map->map.nregex);
+        if (map->map.regex_multi == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
     }
 
 #endif
@@ -547,7 +569,16 @@ found:
             rc.options = NGX_REGEX_CASELESS;
         }
 
-        rc.pattern = value[0];
+        /* the pattern is kept as the regex name, copy it from the temp pool */
+
+        rc.pattern.len = value[0].len;
+        rc.pattern.data = ngx_pnalloc(ctx->cf->pool, value[0].len + 1);
+        if (rc.pattern.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_cpystrn(rc.pattern.data, value[0].data, value[0].len + 1);
+
         rc.err.len = NGX_MAX_CONF_ERRSTR;
         rc.err.data = errstr;
 
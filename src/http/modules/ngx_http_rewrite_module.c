@@ -965,9 +965,13 @@ static char *
 ngx_http_rewrite_value(ngx_conf_t *cf, ngx_http_rewrite_loc_conf_t *lcf,
     ngx_str_t *value)
 {
-    ngx_int_t                              n;
+    u_char                                *start, *end;
+    size_t                                 off;
+    ngx_int_t                              n, rc;
+    ngx_http_script_segment_t             *segments;
     ngx_http_script_compile_t              sc;
     ngx_http_script_value_code_t          *val;
+    ngx_http_script_segments_code_t       *code;
     ngx_http_script_complex_value_code_t  *complex;
 
     n = ngx_http_script_variables_count(value);
@@ -1011,9 +1015,38 @@ ngx_http_rewrite_value(ngx_conf_t *cf, ngx_http_rewrite_loc_conf_t *lcf,
     sc.variables = n;
     sc.complete_lengths = 1;
 
+    off = (u_char *) complex - (u_char *) lcf->codes->elts;
+
     if (ngx_http_script_compile(&sc) != NGX_OK) {
         return NGX_CONF_ERROR;
     }
 
+    /* replace the complex value and its values codes with segments */
+
+    start = (u_char *) lcf->codes->elts + off
+            + sizeof(ngx_http_script_complex_value_code_t);
+    end = (u_char *) lcf->codes->elts + lcf->codes->nelts;
+
+    rc = ngx_http_script_compile_segments(cf, start, end, &segments);
+
+    if (rc == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        return NGX_CONF_OK;
+    }
+
+    lcf->codes->nelts = off;
+
+    code = ngx_http_script_start_code(cf->pool, &lcf->codes,
+                                      sizeof(ngx_http_script_segments_code_t));
+    if (code == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    code->code = ngx_http_script_segments_code;
+    code->segments = segments;
+
     return NGX_CONF_OK;
 }
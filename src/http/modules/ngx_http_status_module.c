@@ -0,0 +1,1608 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_STATUS_JSON        1
+#define NGX_HTTP_STATUS_PROMETHEUS  2
+
+#define NGX_HTTP_STATUS_BUCKETS     12
+
+
+/*
+ * Each worker process updates its own slot of counters without
+ * contention, the slots are padded to a cache line size and
+ * are summed up only by the status handler.
+ */
+
+typedef struct {
+    ngx_atomic_t                    requests;
+    ngx_atomic_t                    responses[5];
+    ngx_atomic_t                    received;
+    ngx_atomic_t                    sent;
+    ngx_atomic_t                    time;
+    ngx_atomic_t                    buckets[NGX_HTTP_STATUS_BUCKETS];
+    ngx_atomic_t                    reused;
+} ngx_http_status_counters_t;
+
+
+typedef struct {
+    uint32_t                        layout;
+    size_t                          size;
+    u_char                         *counters;
+} ngx_http_status_sh_t;
+
+
+typedef struct {
+    ngx_str_t                       name;
+    ngx_http_upstream_srv_conf_t   *upstream;
+    ngx_uint_t                      index;
+    ngx_array_t                     peers;       /* ngx_str_t */
+} ngx_http_status_upstream_t;
+
+
+typedef struct {
+    ngx_array_t                     zones;       /* ngx_str_t */
+    ngx_array_t                     upstreams;   /* ngx_http_status_upstream_t */
+
+    ngx_uint_t                      enable;
+    ngx_uint_t                      ncounters;
+    ngx_uint_t                      nslots;
+    size_t                          stride;
+    uint32_t                        layout;
+
+    ngx_http_status_sh_t           *sh;
+    ngx_shm_zone_t                 *shm_zone;
+} ngx_http_status_main_conf_t;
+
+
+typedef struct {
+    ngx_uint_t                      zone;
+} ngx_http_status_srv_conf_t;
+
+
+typedef struct {
+    ngx_uint_t                      format;
+} ngx_http_status_loc_conf_t;
+
+
+typedef struct {
+    ngx_str_t                       label;
+    ngx_str_t                       name;
+    ngx_str_t                       upstream;
+    ngx_http_status_counters_t      counters;
+} ngx_http_status_entry_t;
+
+
+static ngx_int_t ngx_http_status_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_status_collect(ngx_http_request_t *r,
+    ngx_http_status_main_conf_t *smcf, ngx_array_t *zones,
+    ngx_array_t *peers, size_t *max);
+static u_char *ngx_http_status_json(u_char *p, ngx_array_t *zones,
+    ngx_array_t *peers);
+static u_char *ngx_http_status_json_counters(u_char *p,
+    ngx_http_status_counters_t *c, char *time);
+static u_char *ngx_http_status_prometheus(u_char *p, ngx_array_t *zones,
+    ngx_array_t *peers);
+static u_char *ngx_http_status_prometheus_counters(u_char *p,
+    ngx_array_t *entries, char *prefix, char *time);
+#if (NGX_SSL)
+static size_t ngx_http_status_ssl_len(void);
+static u_char *ngx_http_status_ssl(u_char *p, ngx_uint_t format);
+#endif
+#if (NGX_THREADS)
+static size_t ngx_http_status_threads_len(void);
+static u_char *ngx_http_status_threads(u_char *p, ngx_uint_t format);
+#endif
+#if (NGX_PCRE)
+static size_t ngx_http_status_regex_len(void);
+static u_char *ngx_http_status_regex(u_char *p, ngx_uint_t format);
+#endif
+static ngx_int_t ngx_http_status_escape(ngx_pool_t *pool, ngx_str_t *dst,
+    ngx_str_t *src);
+static ngx_int_t ngx_http_status_log_handler(ngx_http_request_t *r);
+static void ngx_http_status_count(ngx_http_status_counters_t *c,
+    ngx_uint_t status, off_t received, off_t sent, ngx_msec_int_t ms);
+static ngx_int_t ngx_http_status_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+
+static void *ngx_http_status_create_main_conf(ngx_conf_t *cf);
+static void *ngx_http_status_create_srv_conf(ngx_conf_t *cf);
+static char *ngx_http_status_merge_srv_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static void *ngx_http_status_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_status_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
+static char *ngx_http_status_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_status_init(ngx_conf_t *cf);
+
+
+static ngx_command_t  ngx_http_status_commands[] = {
+
+    { ngx_string("status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_status,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("status_zone"),
+      NGX_HTTP_SRV_CONF|NGX_CONF_TAKE1,
+      ngx_http_status_zone,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_status_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_status_init,                  /* postconfiguration */
+
+    ngx_http_status_create_main_conf,      /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_status_create_srv_conf,       /* create server configuration */
+    ngx_http_status_merge_srv_conf,        /* merge server configuration */
+
+    ngx_http_status_create_loc_conf,       /* create location configuration */
+    ngx_http_status_merge_loc_conf         /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_status_module = {
+    NGX_MODULE_V1,
+    &ngx_http_status_module_ctx,           /* module context */
+    ngx_http_status_commands,              /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+/* upper bounds of the latency histogram buckets, in milliseconds */
+
+static ngx_msec_t  ngx_http_status_buckets[NGX_HTTP_STATUS_BUCKETS - 1] = {
+    5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000
+};
+
+
+static ngx_str_t  ngx_http_status_json_type =
+    ngx_string("application/json");
+static ngx_str_t  ngx_http_status_prometheus_type =
+    ngx_string("text/plain; version=0.0.4");
+
+
+#if (NGX_SSL)
+
+static char  *ngx_http_status_ssl_names[] = {
+    "sessions", "hits_total", "misses_total", "evictions_total"
+};
+
+#endif
+
+
+#if (NGX_THREADS)
+
+static char  *ngx_http_status_threads_names[] = {
+    "queue", "max_queue", "overflows_total", "tasks_total",
+    "wait_seconds_total", "run_seconds_total"
+};
+
+#endif
+
+
+#if (NGX_PCRE)
+
+static char  *ngx_http_status_regex_names[] = {
+    "calls_total", "matches_total", "seconds_total"
+};
+
+#endif
+
+
+static ngx_int_t
+ngx_http_status_handler(ngx_http_request_t *r)
+{
+    size_t                        size, max;
+    ngx_int_t                     rc;
+    ngx_buf_t                    *b;
+    ngx_chain_t                   out;
+    ngx_array_t                   zones, peers;
+    ngx_http_status_loc_conf_t   *slcf;
+    ngx_http_status_main_conf_t  *smcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_status_module);
+
+    if (slcf->format == NGX_HTTP_STATUS_PROMETHEUS) {
+        r->headers_out.content_type = ngx_http_status_prometheus_type;
+
+    } else {
+        r->headers_out.content_type = ngx_http_status_json_type;
+    }
+
+    r->headers_out.content_type_len = r->headers_out.content_type.len;
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_status_module);
+
+    if (ngx_http_status_collect(r, smcf, &zones, &peers, &max) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    /*
+     * each entry takes less than 32 lines, and each line is shorter
+     * than 128 bytes plus the labels and a number
+     */
+
+    size = (zones.nelts + peers.nelts + 1) * 32
+           * (128 + max + NGX_ATOMIC_T_LEN);
+
+#if (NGX_SSL)
+    size += ngx_http_status_ssl_len();
+#endif
+
+#if (NGX_THREADS)
+    size += ngx_http_status_threads_len();
+#endif
+
+#if (NGX_PCRE)
+    size += ngx_http_status_regex_len();
+#endif
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    if (slcf->format == NGX_HTTP_STATUS_PROMETHEUS) {
+        b->last = ngx_http_status_prometheus(b->last, &zones, &peers);
+
+    } else {
+        b->last = ngx_http_status_json(b->last, &zones, &peers);
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_int_t
+ngx_http_status_collect(ngx_http_request_t *r,
+    ngx_http_status_main_conf_t *smcf, ngx_array_t *zones,
+    ngx_array_t *peers, size_t *max)
+{
+    u_char                      *p;
+    ngx_str_t                   *name, upstream;
+    ngx_uint_t                   i, j, n;
+    ngx_http_status_entry_t     *e;
+    ngx_http_status_upstream_t  *u;
+    ngx_http_status_counters_t  *c;
+
+    if (ngx_array_init(zones, r->pool, 4, sizeof(ngx_http_status_entry_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(peers, r->pool, 4, sizeof(ngx_http_status_entry_t))
+        != NGX_OK)
+    {
+        return NGX_ERROR;
+    }
+
+    *max = 0;
+
+    if (smcf->sh == NULL) {
+        return NGX_OK;
+    }
+
+    u = NULL;
+    ngx_str_null(&upstream);
+
+    for (n = 0; n < smcf->ncounters; n++) {
+
+        if (n < smcf->zones.nelts) {
+            e = ngx_array_push(zones);
+            if (e == NULL) {
+                return NGX_ERROR;
+            }
+
+            name = smcf->zones.elts;
+
+            if (ngx_http_status_escape(r->pool, &e->name, &name[n])
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            ngx_str_null(&e->upstream);
+
+            e->label.len = sizeof("zone=\"\"") - 1 + e->name.len;
+
+        } else {
+            e = ngx_array_push(peers);
+            if (e == NULL) {
+                return NGX_ERROR;
+            }
+
+            /* peers of an upstream take adjacent counters */
+
+            if (u == NULL || n >= u->index + u->peers.nelts) {
+                u = (u == NULL) ? smcf->upstreams.elts : u + 1;
+
+                while (n >= u->index + u->peers.nelts) {
+                    u++;
+                }
+
+                if (ngx_http_status_escape(r->pool, &upstream, &u->name)
+                    != NGX_OK)
+                {
+                    return NGX_ERROR;
+                }
+            }
+
+            name = u->peers.elts;
+
+            if (ngx_http_status_escape(r->pool, &e->name,
+                                       &name[n - u->index])
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            e->upstream = upstream;
+
+            e->label.len = sizeof("upstream=\"\",peer=\"\"") - 1
+                           + e->upstream.len + e->name.len;
+        }
+
+        e->label.data = ngx_pnalloc(r->pool, e->label.len);
+        if (e->label.data == NULL) {
+            return NGX_ERROR;
+        }
+
+        if (e->upstream.len) {
+            p = ngx_sprintf(e->label.data, "upstream=\"%V\",peer=\"%V\"",
+                            &e->upstream, &e->name);
+
+        } else {
+            p = ngx_sprintf(e->label.data, "zone=\"%V\"", &e->name);
+        }
+
+        e->label.len = p - e->label.data;
+
+        if (e->label.len > *max) {
+            *max = e->label.len;
+        }
+
+        ngx_memzero(&e->counters, sizeof(ngx_http_status_counters_t));
+
+        for (i = 0; i < smcf->nslots; i++) {
+            c = (ngx_http_status_counters_t *)
+                    (smcf->sh->counters + i * smcf->stride) + n;
+
+            e->counters.requests += c->requests;
+            e->counters.received += c->received;
+            e->counters.sent += c->sent;
+            e->counters.time += c->time;
+            e->counters.reused += c->reused;
+
+            for (j = 0; j < 5; j++) {
+                e->counters.responses[j] += c->responses[j];
+            }
+
+            for (j = 0; j < NGX_HTTP_STATUS_BUCKETS; j++) {
+                e->counters.buckets[j] += c->buckets[j];
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static u_char *
+ngx_http_status_json(u_char *p, ngx_array_t *zones, ngx_array_t *peers)
+{
+    ngx_uint_t                i;
+    ngx_http_status_entry_t  *e;
+#if (NGX_STAT_STUB)
+    ngx_stat_slot_t           stat;
+#endif
+
+    p = ngx_sprintf(p, "{\"version\":\"" NGINX_VERSION "\",\"pid\":%P",
+                    ngx_pid);
+
+#if (NGX_STAT_STUB)
+
+    ngx_stat_collect(&stat);
+
+    p = ngx_sprintf(p, ",\"connections\":{\"accepted\":%uA,\"handled\":%uA,"
+                    "\"active\":%uA,\"reading\":%uA,\"writing\":%uA,"
+                    "\"waiting\":%uA},\"requests\":{\"total\":%uA},"
+                    "\"access_log\":{\"dropped\":%uA},"
+                    "\"pool_cache\":{\"hits\":%uA,\"misses\":%uA,"
+                    "\"released\":%uA,\"retained\":%uA}",
+                    stat.accepted, stat.handled, stat.active, stat.reading,
+                    stat.writing, stat.waiting, stat.requests,
+                    stat.log_dropped, stat.pool_cache_hits,
+                    stat.pool_cache_misses, stat.pool_cache_released,
+                    stat.pool_cache_retained);
+
+#endif
+
+    p = ngx_cpymem(p, ",\"server_zones\":{", sizeof(",\"server_zones\":{") - 1);
+
+    e = zones->elts;
+
+    for (i = 0; i < zones->nelts; i++) {
+        p = ngx_sprintf(p, "%s\"%V\":{", i ? "," : "", &e[i].name);
+        p = ngx_http_status_json_counters(p, &e[i].counters, "request_time");
+        *p++ = '}';
+    }
+
+    p = ngx_cpymem(p, "},\"upstreams\":{", sizeof("},\"upstreams\":{") - 1);
+
+    e = peers->elts;
+
+    for (i = 0; i < peers->nelts; i++) {
+
+        if (i == 0 || e[i].upstream.data != e[i - 1].upstream.data) {
+            p = ngx_sprintf(p, "%s\"%V\":{\"peers\":[",
+                            i ? "]}," : "", &e[i].upstream);
+
+        } else {
+            *p++ = ',';
+        }
+
+        p = ngx_sprintf(p, "{\"server\":\"%V\",\"reused\":%uA,",
+                        &e[i].name, e[i].counters.reused);
+        p = ngx_http_status_json_counters(p, &e[i].counters, "response_time");
+        *p++ = '}';
+    }
+
+    if (peers->nelts) {
+        p = ngx_cpymem(p, "]}", sizeof("]}") - 1);
+    }
+
+    *p++ = '}';
+
+#if (NGX_SSL)
+    p = ngx_http_status_ssl(p, NGX_HTTP_STATUS_JSON);
+#endif
+
+#if (NGX_THREADS)
+    p = ngx_http_status_threads(p, NGX_HTTP_STATUS_JSON);
+#endif
+
+#if (NGX_PCRE)
+    p = ngx_http_status_regex(p, NGX_HTTP_STATUS_JSON);
+#endif
+
+    *p++ = '}';
+    *p++ = LF;
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_json_counters(u_char *p, ngx_http_status_counters_t *c,
+    char *time)
+{
+    ngx_uint_t  i;
+
+    p = ngx_sprintf(p, "\"requests\":%uA,\"responses\":{\"1xx\":%uA,"
+                    "\"2xx\":%uA,\"3xx\":%uA,\"4xx\":%uA,\"5xx\":%uA},"
+                    "\"received\":%uA,\"sent\":%uA,"
+                    "\"%s\":{\"sum\":%uA,\"buckets\":{",
+                    c->requests, c->responses[0], c->responses[1],
+                    c->responses[2], c->responses[3], c->responses[4],
+                    c->received, c->sent, time, c->time);
+
+    for (i = 0; i < NGX_HTTP_STATUS_BUCKETS - 1; i++) {
+        p = ngx_sprintf(p, "\"%M\":%uA,",
+                        ngx_http_status_buckets[i], c->buckets[i]);
+    }
+
+    p = ngx_sprintf(p, "\"+Inf\":%uA}}", c->buckets[i]);
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_prometheus(u_char *p, ngx_array_t *zones, ngx_array_t *peers)
+{
+    ngx_uint_t                i;
+    ngx_http_status_entry_t  *e;
+#if (NGX_STAT_STUB)
+    ngx_stat_slot_t           stat;
+
+    ngx_stat_collect(&stat);
+
+    p = ngx_sprintf(p,
+                    "# TYPE nginx_connections_accepted_total counter\n"
+                    "nginx_connections_accepted_total %uA\n"
+                    "# TYPE nginx_connections_handled_total counter\n"
+                    "nginx_connections_handled_total %uA\n"
+                    "# TYPE nginx_connections_active gauge\n"
+                    "nginx_connections_active %uA\n"
+                    "# TYPE nginx_connections_reading gauge\n"
+                    "nginx_connections_reading %uA\n"
+                    "# TYPE nginx_connections_writing gauge\n"
+                    "nginx_connections_writing %uA\n"
+                    "# TYPE nginx_connections_waiting gauge\n"
+                    "nginx_connections_waiting %uA\n"
+                    "# TYPE nginx_http_requests_total counter\n"
+                    "nginx_http_requests_total %uA\n"
+                    "# TYPE nginx_http_access_log_dropped_total counter\n"
+                    "nginx_http_access_log_dropped_total %uA\n"
+                    "# TYPE nginx_pool_cache_hits_total counter\n"
+                    "nginx_pool_cache_hits_total %uA\n"
+                    "# TYPE nginx_pool_cache_misses_total counter\n"
+                    "nginx_pool_cache_misses_total %uA\n"
+                    "# TYPE nginx_pool_cache_released_total counter\n"
+                    "nginx_pool_cache_released_total %uA\n"
+                    "# TYPE nginx_pool_cache_retained_bytes gauge\n"
+                    "nginx_pool_cache_retained_bytes %uA\n",
+                    stat.accepted, stat.handled, stat.active, stat.reading,
+                    stat.writing, stat.waiting, stat.requests,
+                    stat.log_dropped, stat.pool_cache_hits,
+                    stat.pool_cache_misses, stat.pool_cache_released,
+                    stat.pool_cache_retained);
+#endif
+
+    p = ngx_http_status_prometheus_counters(p, zones,
+                                            "nginx_http_server_zone",
+                                            "request_duration_seconds");
+
+    p = ngx_http_status_prometheus_counters(p, peers,
+                                            "nginx_http_upstream_peer",
+                                            "response_duration_seconds");
+
+    e = peers->elts;
+
+    if (peers->nelts) {
+        p = ngx_sprintf(p, "# TYPE nginx_http_upstream_peer_reused_total "
+                        "counter\n");
+    }
+
+    for (i = 0; i < peers->nelts; i++) {
+        p = ngx_sprintf(p, "nginx_http_upstream_peer_reused_total{%V} %uA\n",
+                        &e[i].label, e[i].counters.reused);
+    }
+
+#if (NGX_SSL)
+    p = ngx_http_status_ssl(p, NGX_HTTP_STATUS_PROMETHEUS);
+#endif
+
+#if (NGX_THREADS)
+    p = ngx_http_status_threads(p, NGX_HTTP_STATUS_PROMETHEUS);
+#endif
+
+#if (NGX_PCRE)
+    p = ngx_http_status_regex(p, NGX_HTTP_STATUS_PROMETHEUS);
+#endif
+
+    return p;
+}
+
+
+static u_char *
+ngx_http_status_prometheus_counters(u_char *p, ngx_array_t *entries,
+    char *prefix, char *time)
+{
+    ngx_uint_t                   i, j;
+    ngx_atomic_uint_t            count;
+    ngx_http_status_entry_t     *e;
+    ngx_http_status_counters_t  *c;
+
+    if (entries->nelts == 0) {
+        return p;
+    }
+
+    e = entries->elts;
+
+    p = ngx_sprintf(p, "# TYPE %s_requests_total counter\n", prefix);
+
+    for (i = 0; i < entries->nelts; i++) {
+        p = ngx_sprintf(p, "%s_requests_total{%V} %uA\n",
+                        prefix, &e[i].label, e[i].counters.requests);
+    }
+
+    p = ngx_sprintf(p, "# TYPE %s_responses_total counter\n", prefix);
+
+    for (i = 0; i < entries->nelts; i++) {
+        for (j = 0; j < 5; j++) {
+            p = ngx_sprintf(p, "%s_responses_total{%V,code=\"%uixx\"} %uA\n",
+                            prefix, &e[i].label, j + 1,
+                            e[i].counters.responses[j]);
+        }
+    }
+
+    p = ngx_sprintf(p, "# TYPE %s_received_bytes_total counter\n", prefix);
+
+    for (i = 0; i < entries->nelts; i++) {
+        p = ngx_sprintf(p, "%s_received_bytes_total{%V} %uA\n",
+                        prefix, &e[i].label, e[i].counters.received);
+    }
+
+    p = ngx_sprintf(p, "# TYPE %s_sent_bytes_total counter\n", prefix);
+
+    for (i = 0; i < entries->nelts; i++) {
+        p = ngx_sprintf(p, "%s_sent_bytes_total{%V} %uA\n",
+                        prefix, &e[i].label, e[i].counters.sent);
+    }
+
+    p = ngx_sprintf(p, "# TYPE %s_%s histogram\n", prefix, time);
+
+    for (i = 0; i < entries->nelts; i++) {
+        c = &e[i].counters;
+        count = 0;
+
+        for (j = 0; j < NGX_HTTP_STATUS_BUCKETS - 1; j++) {
+            count += c->buckets[j];
+
+            p = ngx_sprintf(p, "%s_%s_bucket{%V,le=\"%M.%03M\"} %uA\n",
+                            prefix, time, &e[i].label,
+                            ngx_http_status_buckets[j] / 1000,
+                            ngx_http_status_buckets[j] % 1000, count);
+        }
+
+        count += c->buckets[j];
+
+        p = ngx_sprintf(p, "%s_%s_bucket{%V,le=\"+Inf\"} %uA\n"
+                        "%s_%s_sum{%V} %uA.%03uA\n"
+                        "%s_%s_count{%V} %uA\n",
+                        prefix, time, &e[i].label, count,
+                        prefix, time, &e[i].label,
+                        c->time / 1000, c->time % 1000,
+                        prefix, time, &e[i].label, count);
+    }
+
+    return p;
+}
+
+
+#if (NGX_SSL)
+
+static size_t
+ngx_http_status_ssl_len(void)
+{
+    size_t            len;
+    ngx_uint_t        i;
+    ngx_list_part_t  *part;
+    ngx_shm_zone_t   *shm_zone;
+
+    len = 256;
+
+    part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].init == ngx_ssl_session_cache_init) {
+            len += 8 * (128 + 6 * shm_zone[i].shm.name.len + NGX_ATOMIC_T_LEN);
+        }
+    }
+
+    return len;
+}
+
+
+/* SSL session caches of all modules are reported */
+
+static u_char *
+ngx_http_status_ssl(u_char *p, ngx_uint_t format)
+{
+    ngx_str_t                      *name;
+    ngx_uint_t                      i, n, first;
+    ngx_list_part_t                *part;
+    ngx_shm_zone_t                 *shm_zone;
+    ngx_ssl_session_cache_stats_t   st;
+
+    if (format == NGX_HTTP_STATUS_JSON) {
+        p = ngx_cpymem(p, ",\"ssl_session_caches\":{",
+                       sizeof(",\"ssl_session_caches\":{") - 1);
+    }
+
+    first = 1;
+
+    for (n = 0; n < 4; n++) {
+
+        if (format == NGX_HTTP_STATUS_JSON && n > 0) {
+            break;
+        }
+
+        if (format == NGX_HTTP_STATUS_PROMETHEUS) {
+            p = ngx_sprintf(p, "# TYPE nginx_ssl_session_cache_%s %s\n",
+                            ngx_http_status_ssl_names[n],
+                            n ? "counter" : "gauge");
+        }
+
+        part = (ngx_list_part_t *) &ngx_cycle->shared_memory.part;
+        shm_zone = part->elts;
+
+        for (i = 0; /* void */ ; i++) {
+
+            if (i >= part->nelts) {
+                if (part->next == NULL) {
+                    break;
+                }
+
+                part = part->next;
+                shm_zone = part->elts;
+                i = 0;
+            }
+
+            if (shm_zone[i].init != ngx_ssl_session_cache_init) {
+                continue;
+            }
+
+            name = &shm_zone[i].shm.name;
+
+            ngx_ssl_session_cache_stats(&shm_zone[i], &st);
+
+            if (format == NGX_HTTP_STATUS_JSON) {
+                p = ngx_sprintf(p, "%s\"", first ? "" : ",");
+                p = (u_char *) ngx_escape_json(p, name->data, name->len);
+
+                p = ngx_sprintf(p, "\":{\"shards\":%ui,\"sessions\":%ui,"
+                                "\"hits\":%uA,\"misses\":%uA,"
+                                "\"evictions\":%uA}",
+                                st.shards, st.sessions, st.hits, st.misses,
+                                st.evictions);
+
+                first = 0;
+                continue;
+            }
+
+            p = ngx_sprintf(p, "nginx_ssl_session_cache_%s{zone=\"",
+                            ngx_http_status_ssl_names[n]);
+            p = (u_char *) ngx_escape_json(p, name->data, name->len);
+
+            switch (n) {
+
+            case 0:
+                p = ngx_sprintf(p, "\"} %ui\n", st.sessions);
+                break;
+
+            case 1:
+                p = ngx_sprintf(p, "\"} %uA\n", st.hits);
+                break;
+
+            case 2:
+                p = ngx_sprintf(p, "\"} %uA\n", st.misses);
+                break;
+
+            default: /* 3 */
+                p = ngx_sprintf(p, "\"} %uA\n", st.evictions);
+                break;
+            }
+        }
+    }
+
+    if (format == NGX_HTTP_STATUS_JSON) {
+        *p++ = '}';
+    }
+
+    return p;
+}
+
+#endif
+
+
+#if (NGX_THREADS)
+
+static size_t
+ngx_http_status_threads_len(void)
+{
+    size_t                    len;
+    ngx_str_t                *name;
+    ngx_uint_t                n;
+    ngx_thread_pool_stats_t   st;
+
+    len = 256;
+
+    for (n = 0; /* void */ ; n++) {
+        name = ngx_thread_pool_stats((ngx_cycle_t *) ngx_cycle, n, &st);
+
+        if (name == NULL) {
+            break;
+        }
+
+        len += 8 * (128 + 6 * name->len + NGX_ATOMIC_T_LEN);
+    }
+
+    return len;
+}
+
+
+/*
+ * the wait and run times of the tasks are kept in microseconds, and are
+ * reported in milliseconds in JSON, like the request times, and in seconds
+ * to Prometheus
+ */
+
+static u_char *
+ngx_http_status_threads(u_char *p, ngx_uint_t format)
+{
+    ngx_str_t                *name;
+    ngx_uint_t                i, n;
+    ngx_thread_pool_stats_t   st;
+
+    if (format == NGX_HTTP_STATUS_JSON) {
+        p = ngx_cpymem(p, ",\"thread_pools\":{",
+                       sizeof(",\"thread_pools\":{") - 1);
+    }
+
+    for (n = 0; n < 6; n++) {
+
+        if (format == NGX_HTTP_STATUS_JSON && n > 0) {
+            break;
+        }
+
+        for (i = 0; /* void */ ; i++) {
+
+            name = ngx_thread_pool_stats((ngx_cycle_t *) ngx_cycle, i, &st);
+
+            if (name == NULL) {
+                break;
+            }
+
+            if (format == NGX_HTTP_STATUS_JSON) {
+                p = ngx_sprintf(p, "%s\"", i ? "," : "");
+                p = (u_char *) ngx_escape_json(p, name->data, name->len);
+
+                p = ngx_sprintf(p, "\":{\"queue\":%uA,\"max_queue\":%uA,"
+                                "\"overflows\":%uA,\"tasks\":%uA,"
+                                "\"wait_time\":%uA,\"run_time\":%uA}",
+                                st.waiting, st.max_queue, st.overflows,
+                                st.tasks, st.wait_time / 1000,
+                                st.run_time / 1000);
+                continue;
+            }
+
+            if (i == 0) {
+                p = ngx_sprintf(p, "# TYPE nginx_thread_pool_%s %s\n",
+                                ngx_http_status_threads_names[n],
+                                n > 1 ? "counter" : "gauge");
+            }
+
+            p = ngx_sprintf(p, "nginx_thread_pool_%s{pool=\"",
+                            ngx_http_status_threads_names[n]);
+            p = (u_char *) ngx_escape_json(p, name->data, name->len);
+
+            switch (n) {
+
+            case 0:
+                p = ngx_sprintf(p, "\"} %uA\n", st.waiting);
+                break;
+
+            case 1:
+                p = ngx_sprintf(p, "\"} %uA\n", st.max_queue);
+                break;
+
+            case 2:
+                p = ngx_sprintf(p, "\"} %uA\n", st.overflows);
+                break;
+
+            case 3:
+                p = ngx_sprintf(p, "\"} %uA\n", st.tasks);
+                break;
+
+            case 4:
+                p = ngx_sprintf(p, "\"} %uA.%06uA\n",
+                                st.wait_time / 1000000,
+                                st.wait_time % 1000000);
+                break;
+
+            default: /* 5 */
+                p = ngx_sprintf(p, "\"} %uA.%06uA\n",
+                                st.run_time / 1000000,
+                                st.run_time % 1000000);
+                break;
+            }
+        }
+    }
+
+    if (format == NGX_HTTP_STATUS_JSON) {
+        *p++ = '}';
+    }
+
+    return p;
+}
+
+#endif
+
+
+#if (NGX_PCRE)
+
+static size_t
+ngx_http_status_regex_len(void)
+{
+    size_t              len;
+    u_char             *name;
+    ngx_uint_t          n;
+    ngx_regex_stats_t   st;
+
+    len = 256;
+
+    for (n = 0; /* void */ ; n++) {
+        name = ngx_regex_stats((ngx_cycle_t *) ngx_cycle, n, &st);
+
+        if (name == NULL) {
+            break;
+        }
+
+        len += 4 * (128 + 6 * ngx_strlen(name) + NGX_ATOMIC_T_LEN);
+    }
+
+    return len;
+}
+
+
+/*
+ * only the regexes which were executed are reported, with the patterns
+ * as written in the configuration, or as combined by regex locations and
+ * maps; the execution time is reported in milliseconds in JSON
+ */
+
+static u_char *
+ngx_http_status_regex(u_char *p, ngx_uint_t format)
+{
+    u_char             *name;
+    ngx_uint_t          i, n, first;
+    ngx_regex_stats_t   st;
+
+    if (format == NGX_HTTP_STATUS_JSON) {
+        p = ngx_cpymem(p, ",\"regexes\":[", sizeof(",\"regexes\":[") - 1);
+    }
+
+    for (n = 0; n < 3; n++) {
+
+        if (format == NGX_HTTP_STATUS_JSON && n > 0) {
+            break;
+        }
+
+        first = 1;
+
+        for (i = 0; /* void */ ; i++) {
+
+            name = ngx_regex_stats((ngx_cycle_t *) ngx_cycle, i, &st);
+
+            if (name == NULL) {
+                break;
+            }
+
+            if (st.calls == 0) {
+                continue;
+            }
+
+            if (format == NGX_HTTP_STATUS_JSON) {
+                p = ngx_sprintf(p, "%s{\"pattern\":\"", first ? "" : ",");
+                p = (u_char *) ngx_escape_json(p, name, ngx_strlen(name));
+
+                p = ngx_sprintf(p, "\",\"calls\":%ui,\"matches\":%ui,"
+                                "\"time\":%uL}",
+                                st.calls, st.matches, st.time / 1000000);
+
+                first = 0;
+                continue;
+            }
+
+            if (first) {
+                p = ngx_sprintf(p, "# TYPE nginx_regex_%s counter\n",
+                                ngx_http_status_regex_names[n]);
+                first = 0;
+            }
+
+            p = ngx_sprintf(p, "nginx_regex_%s{pattern=\"",
+                            ngx_http_status_regex_names[n]);
+            p = (u_char *) ngx_escape_json(p, name, ngx_strlen(name));
+
+            switch (n) {
+
+            case 0:
+                p = ngx_sprintf(p, "\"} %ui\n", st.calls);
+                break;
+
+            case 1:
+                p = ngx_sprintf(p, "\"} %ui\n", st.matches);
+                break;
+
+            default: /* 2 */
+                p = ngx_sprintf(p, "\"} %uL.%06uL\n",
+                                st.time / 1000000000,
+                                st.time / 1000 % 1000000);
+                break;
+            }
+        }
+    }
+
+    if (format == NGX_HTTP_STATUS_JSON) {
+        *p++ = ']';
+    }
+
+    return p;
+}
+
+#endif
+
+
+static ngx_int_t
+ngx_http_status_escape(ngx_pool_t *pool, ngx_str_t *dst, ngx_str_t *src)
+{
+    size_t  len;
+
+    len = ngx_escape_json(NULL, src->data, src->len);
+
+    if (len == 0) {
+        *dst = *src;
+        return NGX_OK;
+    }
+
+    dst->len = src->len + len;
+
+    dst->data = ngx_pnalloc(pool, dst->len);
+    if (dst->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    (void) ngx_escape_json(dst->data, src->data, src->len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_status_log_handler(ngx_http_request_t *r)
+{
+    u_char                        *slot;
+    ngx_str_t                     *name;
+    ngx_uint_t                     i, n;
+    ngx_time_t                    *tp;
+    ngx_msec_int_t                 ms;
+    ngx_http_status_upstream_t    *u;
+    ngx_http_status_counters_t    *counters;
+    ngx_http_upstream_state_t     *state;
+    ngx_http_status_srv_conf_t    *sscf;
+    ngx_http_status_main_conf_t   *smcf;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    smcf = ngx_http_get_module_main_conf(r, ngx_http_status_module);
+
+    if (smcf->sh == NULL || r != r->main) {
+        return NGX_OK;
+    }
+
+    slot = smcf->sh->counters + (ngx_worker % smcf->nslots) * smcf->stride;
+    counters = (ngx_http_status_counters_t *) slot;
+
+    sscf = ngx_http_get_module_srv_conf(r, ngx_http_status_module);
+
+    if (sscf->zone != NGX_CONF_UNSET_UINT) {
+        tp = ngx_timeofday();
+
+        ms = (ngx_msec_int_t)
+                 ((tp->sec - r->start_sec) * 1000 + (tp->msec - r->start_msec));
+
+        ngx_http_status_count(&counters[sscf->zone],
+                              r->err_status ? r->err_status
+                                            : r->headers_out.status,
+                              r->request_length, r->connection->sent, ms);
+    }
+
+    if (r->upstream == NULL || r->upstream_states == NULL) {
+        return NGX_OK;
+    }
+
+    uscf = r->upstream->upstream;
+
+    u = smcf->upstreams.elts;
+
+    for (i = 0; i < smcf->upstreams.nelts; i++) {
+        if (u[i].upstream == uscf) {
+            break;
+        }
+    }
+
+    if (i == smcf->upstreams.nelts) {
+        return NGX_OK;
+    }
+
+    u = &u[i];
+    name = u->peers.elts;
+    state = r->upstream_states->elts;
+
+    for (i = 0; i < r->upstream_states->nelts; i++) {
+
+        if (state[i].peer == NULL) {
+            continue;
+        }
+
+        for (n = 0; n < u->peers.nelts; n++) {
+            if (name[n].len == state[i].peer->len
+                && ngx_strncmp(name[n].data, state[i].peer->data,
+                               name[n].len)
+                   == 0)
+            {
+                ngx_http_status_count(&counters[u->index + n],
+                                      state[i].status,
+                                      state[i].bytes_received,
+                                      state[i].bytes_sent,
+                                      state[i].response_time);
+
+                if (state[i].cached) {
+                    (void) ngx_atomic_fetch_add(
+                                       &counters[u->index + n].reused, 1);
+                }
+
+                break;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_status_count(ngx_http_status_counters_t *c, ngx_uint_t status,
+    off_t received, off_t sent, ngx_msec_int_t ms)
+{
+    ngx_uint_t  i;
+
+    (void) ngx_atomic_fetch_add(&c->requests, 1);
+
+    if (status >= 100 && status < 600) {
+        (void) ngx_atomic_fetch_add(&c->responses[status / 100 - 1], 1);
+    }
+
+    (void) ngx_atomic_fetch_add(&c->received, (ngx_atomic_int_t) received);
+    (void) ngx_atomic_fetch_add(&c->sent, (ngx_atomic_int_t) sent);
+
+    if (ms < 0) {
+        ms = 0;
+    }
+
+    (void) ngx_atomic_fetch_add(&c->time, (ngx_atomic_int_t) ms);
+
+    for (i = 0; i < NGX_HTTP_STATUS_BUCKETS - 1; i++) {
+        if ((ngx_msec_t) ms <= ngx_http_status_buckets[i]) {
+            break;
+        }
+    }
+
+    (void) ngx_atomic_fetch_add(&c->buckets[i], 1);
+}
+
+
+static ngx_int_t
+ngx_http_status_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_status_main_conf_t  *osmcf = data;
+
+    size_t                        size;
+    ngx_slab_pool_t              *shpool;
+    ngx_http_status_sh_t         *sh;
+    ngx_http_status_main_conf_t  *smcf;
+
+    smcf = shm_zone->data;
+
+    size = ngx_align(smcf->nslots * smcf->stride, ngx_pagesize);
+
+    if (osmcf) {
+        sh = osmcf->sh;
+
+        /*
+         * the counters are preserved across reconfiguration
+         * unless the set of zones and peers has been changed
+         */
+
+        if (sh->layout != smcf->layout) {
+            ngx_memzero(sh->counters, sh->size);
+            sh->layout = smcf->layout;
+        }
+
+        smcf->sh = sh;
+
+        return NGX_OK;
+    }
+
+    shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        smcf->sh = shpool->data;
+        return NGX_OK;
+    }
+
+    sh = ngx_slab_alloc(shpool, sizeof(ngx_http_status_sh_t));
+    if (sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    sh->counters = ngx_slab_calloc(shpool, size);
+    if (sh->counters == NULL) {
+        return NGX_ERROR;
+    }
+
+    sh->size = size;
+    sh->layout = smcf->layout;
+
+    shpool->data = sh;
+    smcf->sh = sh;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_status_create_main_conf(ngx_conf_t *cf)
+{
+    ngx_http_status_main_conf_t  *smcf;
+
+    smcf = ngx_pcalloc(cf->pool, sizeof(ngx_http_status_main_conf_t));
+    if (smcf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     smcf->enable = 0;
+     *     smcf->sh = NULL;
+     *     smcf->shm_zone = NULL;
+     */
+
+    if (ngx_array_init(&smcf->zones, cf->pool, 4, sizeof(ngx_str_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    if (ngx_array_init(&smcf->upstreams, cf->pool, 4,
+                       sizeof(ngx_http_status_upstream_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    return smcf;
+}
+
+
+static void *
+ngx_http_status_create_srv_conf(ngx_conf_t *cf)
+{
+    ngx_http_status_srv_conf_t  *sscf;
+
+    sscf = ngx_palloc(cf->pool, sizeof(ngx_http_status_srv_conf_t));
+    if (sscf == NULL) {
+        return NULL;
+    }
+
+    sscf->zone = NGX_CONF_UNSET_UINT;
+
+    return sscf;
+}
+
+
+static char *
+ngx_http_status_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_status_srv_conf_t *prev = parent;
+    ngx_http_status_srv_conf_t *conf = child;
+
+    ngx_conf_merge_uint_value(conf->zone, prev->zone, NGX_CONF_UNSET_UINT);
+
+    return NGX_CONF_OK;
+}
+
+
+static void *
+ngx_http_status_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_status_loc_conf_t  *slcf;
+
+    slcf = ngx_palloc(cf->pool, sizeof(ngx_http_status_loc_conf_t));
+    if (slcf == NULL) {
+        return NULL;
+    }
+
+    slcf->format = NGX_CONF_UNSET_UINT;
+
+    return slcf;
+}
+
+
+static char *
+ngx_http_status_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_status_loc_conf_t *prev = parent;
+    ngx_http_status_loc_conf_t *conf = child;
+
+    ngx_conf_merge_uint_value(conf->format, prev->format,
+                              NGX_HTTP_STATUS_JSON);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_status(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_status_loc_conf_t *slcf = conf;
+
+    ngx_str_t                    *value;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_status_main_conf_t  *smcf;
+
+    if (slcf->format != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    slcf->format = NGX_HTTP_STATUS_JSON;
+
+    if (cf->args->nelts == 2) {
+
+        if (ngx_strcmp(value[1].data, "prometheus") == 0) {
+            slcf->format = NGX_HTTP_STATUS_PROMETHEUS;
+
+        } else if (ngx_strcmp(value[1].data, "json") != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid status format \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_status_handler;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_status_module);
+    smcf->enable = 1;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_status_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_status_srv_conf_t *sscf = conf;
+
+    ngx_str_t                    *value, *name;
+    ngx_uint_t                    i;
+    ngx_http_status_main_conf_t  *smcf;
+
+    if (sscf->zone != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_status_module);
+
+    name = smcf->zones.elts;
+
+    for (i = 0; i < smcf->zones.nelts; i++) {
+        if (name[i].len == value[1].len
+            && ngx_strncmp(name[i].data, value[1].data, value[1].len) == 0)
+        {
+            sscf->zone = i;
+            return NGX_CONF_OK;
+        }
+    }
+
+    name = ngx_array_push(&smcf->zones);
+    if (name == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *name = value[1];
+
+    sscf->zone = i;
+    smcf->enable = 1;
+
+    return NGX_CONF_OK;
+}
+
+
+static ngx_int_t
+ngx_http_status_init(ngx_conf_t *cf)
+{
+    size_t                          size;
+    uint32_t                        crc;
+    ngx_str_t                       name, *peer;
+    ngx_uint_t                      i, j, k;
+    ngx_core_conf_t                *ccf;
+    ngx_http_handler_pt            *h;
+    ngx_http_status_upstream_t     *u;
+    ngx_http_core_main_conf_t      *cmcf;
+    ngx_http_upstream_server_t     *server;
+    ngx_http_status_main_conf_t    *smcf;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    smcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_status_module);
+
+    if (!smcf->enable) {
+        return NGX_OK;
+    }
+
+    ngx_crc32_init(crc);
+
+    peer = smcf->zones.elts;
+
+    for (i = 0; i < smcf->zones.nelts; i++) {
+        ngx_crc32_update(&crc, peer[i].data, peer[i].len);
+        ngx_crc32_update(&crc, (u_char *) "", 1);
+    }
+
+    smcf->ncounters = smcf->zones.nelts;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL || uscfp[i]->servers == NULL) {
+            continue;
+        }
+
+        u = ngx_array_push(&smcf->upstreams);
+        if (u == NULL) {
+            return NGX_ERROR;
+        }
+
+        u->name = uscfp[i]->host;
+        u->upstream = uscfp[i];
+        u->index = smcf->ncounters;
+
+        if (ngx_array_init(&u->peers, cf->pool, 4, sizeof(ngx_str_t))
+            != NGX_OK)
+        {
+            return NGX_ERROR;
+        }
+
+        ngx_crc32_update(&crc, u->name.data, u->name.len);
+        ngx_crc32_update(&crc, (u_char *) "", 1);
+
+        server = uscfp[i]->servers->elts;
+
+        for (j = 0; j < uscfp[i]->servers->nelts; j++) {
+            for (k = 0; k < server[j].naddrs; k++) {
+
+                name = server[j].addrs[k].name;
+
+                peer = ngx_array_push(&u->peers);
+                if (peer == NULL) {
+                    return NGX_ERROR;
+                }
+
+                *peer = name;
+
+                ngx_crc32_update(&crc, name.data, name.len);
+                ngx_crc32_update(&crc, (u_char *) "", 1);
+            }
+        }
+
+        smcf->ncounters += u->peers.nelts;
+    }
+
+    if (smcf->ncounters == 0) {
+        return NGX_OK;
+    }
+
+    /*
+     * the number of slots is fixed at configuration time,
+     * if more worker processes are started they share slots
+     */
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cf->cycle->conf_ctx,
+                                           ngx_core_module);
+
+    smcf->nslots = (ccf->worker_processes == NGX_CONF_UNSET)
+                   ? 1 : ngx_max(ccf->worker_processes, 1);
+
+    smcf->stride = ngx_align(smcf->ncounters
+                             * sizeof(ngx_http_status_counters_t),
+                             NGX_STAT_SLOT_SIZE);
+
+    ngx_crc32_update(&crc, (u_char *) &smcf->nslots, sizeof(ngx_uint_t));
+    ngx_crc32_final(crc);
+
+    smcf->layout = crc;
+
+    size = ngx_align(smcf->nslots * smcf->stride, ngx_pagesize);
+    size += ngx_align(size / ngx_pagesize * sizeof(ngx_slab_page_t),
+                      ngx_pagesize)
+            + 8 * ngx_pagesize;
+
+    ngx_str_set(&name, "ngx_http_status");
+
+    smcf->shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                           &ngx_http_status_module);
+    if (smcf->shm_zone == NULL) {
+        return NGX_ERROR;
+    }
+
+    smcf->shm_zone->init = ngx_http_status_init_zone;
+    smcf->shm_zone->data = smcf;
+
+    cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
+
+    h = ngx_array_push(&cmcf->phases[NGX_HTTP_LOG_PHASE].handlers);
+    if (h == NULL) {
+        return NGX_ERROR;
+    }
+
+    *h = ngx_http_status_log_handler;
+
+    return NGX_OK;
+}
@@ -87,7 +87,7 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     ngx_int_t          rc;
     ngx_buf_t         *b;
     ngx_chain_t        out;
-    ngx_atomic_int_t   ap, hn, ac, rq, rd, wr, wa;
+    ngx_stat_slot_t    stat;
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -126,23 +126,18 @@ ngx_http_stub_status_handler(ngx_http_request_t *r)
     out.buf = b;
     out.next = NULL;
 
-    ap = *ngx_stat_accepted;
-    hn = *ngx_stat_handled;
-    ac = *ngx_stat_active;
-    rq = *ngx_stat_requests;
-    rd = *ngx_stat_reading;
-    wr = *ngx_stat_writing;
-    wa = *ngx_stat_waiting;
+    ngx_stat_collect(&stat);
 
-    b->last = ngx_sprintf(b->last, "Active connections: %uA \n", ac);
+    b->last = ngx_sprintf(b->last, "Active connections: %uA \n", stat.active);
 
     b->last = ngx_cpymem(b->last, "server accepts handled requests\n",
                          sizeof("server accepts handled requests\n") - 1);
 
-    b->last = ngx_sprintf(b->last, " %uA %uA %uA \n", ap, hn, rq);
+    b->last = ngx_sprintf(b->last, " %uA %uA %uA \n",
+                          stat.accepted, stat.handled, stat.requests);
 
     b->last = ngx_sprintf(b->last, "Reading: %uA Writing: %uA Waiting: %uA \n",
-                          rd, wr, wa);
+                          stat.reading, stat.writing, stat.waiting);
 
     r->headers_out.status = NGX_HTTP_OK;
     r->headers_out.content_length_n = b->last - b->pos;
@@ -165,6 +160,7 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
     u_char            *p;
+    ngx_stat_slot_t    stat;
     ngx_atomic_int_t   value;
 
     p = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
@@ -172,21 +168,23 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
         return NGX_ERROR;
     }
 
+    ngx_stat_collect(&stat);
+
     switch (data) {
     case 0:
-        value = *ngx_stat_active;
+        value = stat.active;
         break;
 
     case 1:
-        value = *ngx_stat_reading;
+        value = stat.reading;
         break;
 
     case 2:
-        value = *ngx_stat_writing;
+        value = stat.writing;
         break;
 
     case 3:
-        value = *ngx_stat_waiting;
+        value = stat.waiting;
         break;
 
     /* suppress warning */
@@ -22,9 +22,25 @@ typedef struct {
 } ngx_http_upstream_chash_points_t;
 
 
+/*
+ * Maglev lookup table: every entry holds the index of a peer in the list,
+ * peers fill the entries in turns along their own permutations of the
+ * table, so a change of the peer list moves only a small part of entries
+ */
+
+typedef struct {
+    ngx_uint_t                          config;
+    ngx_uint_t                          size;
+    ngx_uint_t                          number;
+    ngx_http_upstream_rr_peer_t       **peer;
+    uint32_t                           *lookup;
+} ngx_http_upstream_maglev_t;
+
+
 typedef struct {
     ngx_http_complex_value_t            key;
     ngx_http_upstream_chash_points_t   *points;
+    ngx_http_upstream_maglev_t         *maglev;
 } ngx_http_upstream_hash_srv_conf_t;
 
 
@@ -58,6 +74,15 @@ static ngx_int_t ngx_http_upstream_init_chash_peer(ngx_http_request_t *r,
 static ngx_int_t ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc,
     void *data);
 
+static ngx_int_t ngx_http_upstream_init_maglev(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_update_maglev(ngx_pool_t *pool,
+    ngx_http_upstream_srv_conf_t *us, ngx_log_t *log);
+static ngx_int_t ngx_http_upstream_init_maglev_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_maglev_peer(ngx_peer_connection_t *pc,
+    void *data);
+
 static void *ngx_http_upstream_hash_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
@@ -76,6 +101,14 @@ static ngx_command_t  ngx_http_upstream_hash_commands[] = {
 };
 
 
+/* primes for the size of the maglev table */
+
+static ngx_uint_t  ngx_http_upstream_maglev_sizes[] = {
+    251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521, 131071,
+    262139, 524287, 1048573, 0
+};
+
+
 static ngx_http_module_t  ngx_http_upstream_hash_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
@@ -178,7 +211,9 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
+    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0
+        || ngx_http_upstream_rr_peers_changed(&hp->rrp))
+    {
         ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -509,7 +544,9 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0) {
+    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0
+        || ngx_http_upstream_rr_peers_changed(&hp->rrp))
+    {
         ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -619,6 +656,318 @@ found:
 }
 
 
+static ngx_int_t
+ngx_http_upstream_init_maglev(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_maglev_peer;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (us->shm_zone) {
+        /* built by worker processes from the peers in the shared zone */
+        return NGX_OK;
+    }
+#endif
+
+    return ngx_http_upstream_update_maglev(cf->pool, us, cf->log);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_update_maglev(ngx_pool_t *pool,
+    ngx_http_upstream_srv_conf_t *us, ngx_log_t *log)
+{
+    size_t                              size;
+    uint32_t                           *lookup, *offset, *skip, *next;
+    ngx_uint_t                          i, j, w, n, filled, moved;
+    ngx_http_upstream_rr_peer_t        *peer, **peerp;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_maglev_t         *maglev, *old;
+    ngx_http_upstream_hash_srv_conf_t  *hcf;
+
+    hcf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_hash_module);
+
+    peers = us->peer.data;
+    n = peers->number;
+
+    /* about 100 entries per peer keep the imbalance within a percent */
+
+    for (i = 0; ngx_http_upstream_maglev_sizes[i + 1]; i++) {
+        if (ngx_http_upstream_maglev_sizes[i] >= 100 * n) {
+            break;
+        }
+    }
+
+    size = sizeof(ngx_http_upstream_maglev_t)
+           + n * sizeof(ngx_http_upstream_rr_peer_t *)
+           + ngx_http_upstream_maglev_sizes[i] * sizeof(uint32_t);
+
+    maglev = pool ? ngx_palloc(pool, size) : ngx_alloc(size, log);
+    if (maglev == NULL) {
+        return NGX_ERROR;
+    }
+
+    maglev->size = ngx_http_upstream_maglev_sizes[i];
+    maglev->number = n;
+    maglev->peer = (ngx_http_upstream_rr_peer_t **) &maglev[1];
+    maglev->lookup = (uint32_t *) &maglev->peer[n];
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    maglev->config = peers->config ? *peers->config : 0;
+#else
+    maglev->config = 0;
+#endif
+
+    offset = ngx_alloc(3 * n * sizeof(uint32_t), log);
+    if (offset == NULL) {
+        if (pool == NULL) {
+            ngx_free(maglev);
+        }
+
+        return NGX_ERROR;
+    }
+
+    skip = &offset[n];
+    next = &skip[n];
+
+    /*
+     * the permutation of a peer depends on its address only,
+     * hence it is preserved when other peers are added or removed
+     */
+
+    for (peer = peers->peer, peerp = maglev->peer, j = 0;
+         peer;
+         peer = peer->next, j++)
+    {
+        *peerp++ = peer;
+
+        offset[j] = ngx_crc32_long(peer->name.data, peer->name.len)
+                    % maglev->size;
+        skip[j] = ngx_murmur_hash2(peer->name.data, peer->name.len)
+                  % (maglev->size - 1) + 1;
+        next[j] = 0;
+    }
+
+    lookup = maglev->lookup;
+
+    for (i = 0; i < maglev->size; i++) {
+        lookup[i] = (uint32_t) -1;
+    }
+
+    /* peers take as many turns in each round as their weight */
+
+    for (filled = 0; filled < maglev->size; /* void */) {
+
+        for (j = 0; j < n && filled < maglev->size; j++) {
+
+            for (w = maglev->peer[j]->weight;
+                 w && filled < maglev->size;
+                 w--)
+            {
+                do {
+                    i = (offset[j] + (uint64_t) next[j] * skip[j])
+                        % maglev->size;
+                    next[j]++;
+                } while (lookup[i] != (uint32_t) -1);
+
+                lookup[i] = j;
+                filled++;
+            }
+        }
+    }
+
+    ngx_free(offset);
+
+    old = hcf->maglev;
+    hcf->maglev = maglev;
+
+    if (pool || old == NULL) {
+        return NGX_OK;
+    }
+
+    /* report how many keys were moved to other peers by the change */
+
+    moved = 0;
+
+    if (old->size == maglev->size) {
+
+        for (i = 0; i < maglev->size; i++) {
+            peer = maglev->peer[lookup[i]];
+            peerp = &old->peer[old->lookup[i]];
+
+            /* the old peers may be freed, only the pointers are compared */
+
+            if (peer != *peerp) {
+                moved++;
+            }
+        }
+
+    } else {
+        moved = maglev->size;
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, log, 0,
+                  "maglev table of upstream \"%V\" rebuilt for %ui peers, "
+                  "%ui of %ui entries moved", &us->host, n, moved,
+                  maglev->size);
+
+    ngx_free(old);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_maglev_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_hash_peer_data_t  *hp;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_hash_srv_conf_t   *hcf;
+#endif
+
+    if (ngx_http_upstream_init_hash_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.get = ngx_http_upstream_get_maglev_peer;
+
+    hp = r->upstream->peer.data;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    hcf = hp->conf;
+
+    ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
+
+    if (hp->rrp.peers->shpool
+        && hp->rrp.peers->number
+        && (hcf->maglev == NULL
+            || hcf->maglev->config != *hp->rrp.peers->config))
+    {
+        if (ngx_http_upstream_update_maglev(NULL, us, r->connection->log)
+            != NGX_OK)
+        {
+            ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+            return NGX_ERROR;
+        }
+    }
+
+    ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+
+#endif
+
+    hp->hash = ngx_crc32_long(hp->key.data, hp->key.len);
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_maglev_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_hash_peer_data_t  *hp = data;
+
+    time_t                        now;
+    uintptr_t                     m;
+    ngx_uint_t                    n, p;
+    ngx_http_upstream_rr_peer_t  *peer;
+    ngx_http_upstream_maglev_t   *maglev;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get maglev hash peer, try: %ui", pc->tries);
+
+    ngx_http_upstream_rr_peers_rlock(hp->rrp.peers);
+
+    maglev = hp->conf->maglev;
+
+    if (hp->tries > 20 || hp->rrp.peers->single || hp->key.len == 0
+        || maglev == NULL || maglev->config != hp->rrp.config
+        || ngx_http_upstream_rr_peers_changed(&hp->rrp))
+    {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+
+    now = ngx_time();
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    for ( ;; ) {
+
+        /* the following entries are used as fallbacks */
+
+        p = maglev->lookup[hp->hash % maglev->size];
+        peer = maglev->peer[p];
+
+        hp->hash++;
+
+        n = p / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+        if (hp->rrp.tried[n] & m) {
+            goto next;
+        }
+
+        ngx_http_upstream_rr_peer_lock(hp->rrp.peers, peer);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get maglev hash peer, entry:%uD, peer:%ui",
+                       (uint32_t) ((hp->hash - 1) % maglev->size), p);
+
+        if (peer->down) {
+            ngx_http_upstream_rr_peer_unlock(hp->rrp.peers, peer);
+            goto next;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            ngx_http_upstream_rr_peer_unlock(hp->rrp.peers, peer);
+            goto next;
+        }
+
+        if (peer->max_conns && peer->conns >= peer->max_conns) {
+            ngx_http_upstream_rr_peer_unlock(hp->rrp.peers, peer);
+            goto next;
+        }
+
+        break;
+
+    next:
+
+        if (++hp->tries > 20) {
+            ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+            return hp->get_rr_peer(pc, &hp->rrp);
+        }
+    }
+
+    hp->rrp.current = peer;
+
+    pc->sockaddr = peer->sockaddr;
+    pc->socklen = peer->socklen;
+    pc->name = &peer->name;
+
+    peer->conns++;
+
+    if (now - peer->checked > peer->fail_timeout) {
+        peer->checked = now;
+    }
+
+    ngx_http_upstream_rr_peer_unlock(hp->rrp.peers, peer);
+    ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+
+    hp->rrp.tried[n] |= m;
+
+    return NGX_OK;
+}
+
+
 static void *
 ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
 {
@@ -630,6 +979,7 @@ ngx_http_upstream_hash_create_conf(ngx_conf_t *cf)
     }
 
     conf->points = NULL;
+    conf->maglev = NULL;
 
     return conf;
 }
@@ -676,6 +1026,9 @@ ngx_http_upstream_hash(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     } else if (ngx_strcmp(value[2].data, "consistent") == 0) {
         uscf->peer.init_upstream = ngx_http_upstream_init_chash;
 
+    } else if (ngx_strcmp(value[2].data, "consistent=maglev") == 0) {
+        uscf->peer.init_upstream = ngx_http_upstream_init_maglev;
+
     } else {
         ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
                            "invalid parameter \"%V\"", &value[2]);
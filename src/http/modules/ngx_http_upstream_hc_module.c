@@ -0,0 +1,830 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * Active health checks of upstream servers.  Every worker process runs
+ * a timer for each upstream group with the "health_check" directive, and
+ * the first worker to advance the time of the next check stored in a peer
+ * in the shared zone probes the server.  The result is published to all
+ * workers through the "down" flag of the shared peer, so balancers skip
+ * unhealthy servers without connecting to them.  As servers may be added
+ * and removed at run time, the peer list is walked on each timer event.
+ */
+
+
+#define NGX_HTTP_UPSTREAM_HC_TCP     0
+#define NGX_HTTP_UPSTREAM_HC_HTTP    1
+
+#define NGX_HTTP_UPSTREAM_HC_BUFFER  32
+
+/* distinguishes servers marked down by checks from "down" servers */
+#define NGX_HTTP_UPSTREAM_HC_DOWN    2
+
+
+typedef struct {
+    ngx_uint_t                         type;
+    ngx_msec_t                         interval;
+    ngx_msec_t                         timeout;
+    ngx_uint_t                         fails;
+    ngx_uint_t                         passes;
+    ngx_str_t                          request;
+} ngx_http_upstream_hc_srv_conf_t;
+
+
+typedef struct {
+    ngx_http_upstream_hc_srv_conf_t   *conf;
+    ngx_http_upstream_srv_conf_t      *upstream;
+
+    ngx_event_t                        event;
+    ngx_log_t                          log;
+} ngx_http_upstream_hc_t;
+
+
+typedef struct {
+    ngx_http_upstream_hc_t            *hc;
+    ngx_http_upstream_hc_srv_conf_t   *conf;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_rr_peer_t       *peer;
+
+    ngx_sockaddr_t                     sockaddr;
+    socklen_t                          socklen;
+    ngx_str_t                          name;
+
+    ngx_peer_connection_t              pc;
+    ngx_log_t                          log;
+
+    unsigned                           connected:1;
+
+    size_t                             sent;
+    u_char                            *last;
+    u_char                             buffer[NGX_HTTP_UPSTREAM_HC_BUFFER];
+    u_char                             name_data[NGX_SOCKADDR_STRLEN];
+} ngx_http_upstream_hc_peer_t;
+
+
+static void ngx_http_upstream_hc_handler(ngx_event_t *ev);
+static void ngx_http_upstream_hc_check_peers(ngx_http_upstream_hc_t *hc,
+    ngx_http_upstream_rr_peers_t *peers);
+static void ngx_http_upstream_hc_connect(ngx_http_upstream_hc_peer_t *hp);
+static void ngx_http_upstream_hc_send_handler(ngx_event_t *wev);
+static void ngx_http_upstream_hc_recv_handler(ngx_event_t *rev);
+static void ngx_http_upstream_hc_dummy_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_hc_test_connect(ngx_connection_t *c);
+static ngx_int_t ngx_http_upstream_hc_parse_status(
+    ngx_http_upstream_hc_peer_t *hp);
+static void ngx_http_upstream_hc_done(ngx_http_upstream_hc_peer_t *hp,
+    ngx_int_t rc);
+static u_char *ngx_http_upstream_hc_log_error(ngx_log_t *log, u_char *buf,
+    size_t len);
+
+static ngx_int_t ngx_http_upstream_hc_init(ngx_conf_t *cf);
+static void *ngx_http_upstream_hc_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_hc(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_upstream_hc_commands[] = {
+
+    { ngx_string("health_check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_hc,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_hc_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_upstream_hc_init,             /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_hc_create_conf,      /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_hc_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_hc_module_ctx,      /* module context */
+    ngx_http_upstream_hc_commands,         /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_hc_init_process,     /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                        i;
+    ngx_http_upstream_hc_t           *hc;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+    ngx_http_upstream_srv_conf_t    **uscfp;
+    ngx_http_upstream_main_conf_t    *umcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL || uscfp[i]->shm_zone == NULL) {
+            continue;
+        }
+
+        hcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                              ngx_http_upstream_hc_module);
+
+        if (hcf->interval == 0) {
+            continue;
+        }
+
+        hc = ngx_pcalloc(cycle->pool, sizeof(ngx_http_upstream_hc_t));
+        if (hc == NULL) {
+            return NGX_ERROR;
+        }
+
+        hc->conf = hcf;
+        hc->upstream = uscfp[i];
+
+        hc->log = *cycle->log;
+
+        hc->event.handler = ngx_http_upstream_hc_handler;
+        hc->event.data = hc;
+        hc->event.log = &hc->log;
+        hc->event.cancelable = 1;
+
+        /* spread the first checks of the workers over the interval */
+
+        ngx_add_timer(&hc->event, ngx_random() % hcf->interval);
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_hc_handler(ngx_event_t *ev)
+{
+    ngx_http_upstream_hc_t        *hc;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    hc = ev->data;
+
+    if (ngx_exiting || ngx_terminate || ngx_quit) {
+        return;
+    }
+
+    ngx_add_timer(ev, hc->conf->interval);
+
+    peers = hc->upstream->peer.data;
+
+    ngx_http_upstream_hc_check_peers(hc, peers);
+
+    if (peers->next) {
+        ngx_http_upstream_hc_check_peers(hc, peers->next);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_check_peers(ngx_http_upstream_hc_t *hc,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_msec_t                    next;
+    ngx_http_upstream_hc_peer_t  *hp, *probes;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    probes = NULL;
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+
+        if (peer->down == 1) {
+            continue;
+        }
+
+        next = peer->check_next;
+
+        if ((ngx_msec_int_t) (next - ngx_current_msec) > 0) {
+            continue;
+        }
+
+        if (!ngx_atomic_cmp_set(&peer->check_next, next,
+                                ngx_current_msec + hc->conf->interval))
+        {
+            /* the server is checked by another worker process */
+            continue;
+        }
+
+        /*
+         * the peer may be removed while the check is in progress,
+         * so the probe keeps its own copy of the address
+         */
+
+        hp = ngx_alloc(sizeof(ngx_http_upstream_hc_peer_t), hc->event.log);
+        if (hp == NULL) {
+            break;
+        }
+
+        ngx_memzero(hp, sizeof(ngx_http_upstream_hc_peer_t));
+
+        hp->hc = hc;
+        hp->conf = hc->conf;
+        hp->peers = peers;
+        hp->peer = peer;
+
+        ngx_memcpy(&hp->sockaddr, peer->sockaddr, peer->socklen);
+        hp->socklen = peer->socklen;
+
+        hp->name.len = ngx_min(peer->name.len, NGX_SOCKADDR_STRLEN);
+        hp->name.data = hp->name_data;
+        ngx_memcpy(hp->name_data, peer->name.data, hp->name.len);
+
+        hp->log = *hc->event.log;
+        hp->log.handler = ngx_http_upstream_hc_log_error;
+        hp->log.data = hp;
+        hp->log.action = NULL;
+
+        /* the connection is still unused, so chain the probes through it */
+
+        hp->pc.data = probes;
+        probes = hp;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    while (probes) {
+        hp = probes;
+        probes = hp->pc.data;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &hc->log, 0,
+                       "health check of %V in upstream \"%V\"",
+                       &hp->name, &hc->upstream->host);
+
+        ngx_http_upstream_hc_connect(hp);
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_connect(ngx_http_upstream_hc_peer_t *hp)
+{
+    ngx_int_t          rc;
+    ngx_connection_t  *c;
+
+    ngx_memzero(&hp->pc, sizeof(ngx_peer_connection_t));
+
+    hp->pc.sockaddr = &hp->sockaddr.sockaddr;
+    hp->pc.socklen = hp->socklen;
+    hp->pc.name = &hp->name;
+    hp->pc.get = ngx_event_get_peer;
+    hp->pc.log = &hp->log;
+    hp->pc.log_error = NGX_ERROR_ERR;
+
+    hp->connected = 0;
+    hp->sent = 0;
+    hp->last = hp->buffer;
+
+    rc = ngx_event_connect_peer(&hp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_hc_done(hp, NGX_ERROR);
+        return;
+    }
+
+    /* rc == NGX_OK || rc == NGX_AGAIN || rc == NGX_DONE */
+
+    c = hp->pc.connection;
+
+    c->data = hp;
+
+    c->write->handler = ngx_http_upstream_hc_send_handler;
+    c->read->handler = ngx_http_upstream_hc_recv_handler;
+
+    ngx_add_timer(c->read, hp->conf->timeout);
+
+    if (rc == NGX_AGAIN) {
+        return;
+    }
+
+    ngx_http_upstream_hc_send_handler(c->write);
+}
+
+
+static void
+ngx_http_upstream_hc_send_handler(ngx_event_t *wev)
+{
+    ssize_t                       n;
+    ngx_str_t                    *request;
+    ngx_connection_t             *c;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    c = wev->data;
+    hp = c->data;
+
+    if (!hp->connected) {
+        if (ngx_http_upstream_hc_test_connect(c) != NGX_OK) {
+            ngx_http_upstream_hc_done(hp, NGX_ERROR);
+            return;
+        }
+
+        hp->connected = 1;
+
+        if (hp->conf->type == NGX_HTTP_UPSTREAM_HC_TCP) {
+            ngx_http_upstream_hc_done(hp, NGX_OK);
+            return;
+        }
+    }
+
+    request = &hp->conf->request;
+
+    while (hp->sent < request->len) {
+        n = c->send(c, request->data + hp->sent, request->len - hp->sent);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_hc_done(hp, NGX_ERROR);
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_upstream_hc_done(hp, NGX_ERROR);
+            }
+
+            return;
+        }
+
+        hp->sent += n;
+    }
+
+    wev->handler = ngx_http_upstream_hc_dummy_handler;
+
+    ngx_http_upstream_hc_recv_handler(c->read);
+}
+
+
+static void
+ngx_http_upstream_hc_recv_handler(ngx_event_t *rev)
+{
+    ssize_t                       n;
+    ngx_int_t                     rc;
+    ngx_connection_t             *c;
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    c = rev->data;
+    hp = c->data;
+
+    if (rev->timedout) {
+        ngx_log_error(NGX_LOG_ERR, rev->log, NGX_ETIMEDOUT,
+                      "upstream timed out");
+        ngx_http_upstream_hc_done(hp, NGX_ERROR);
+        return;
+    }
+
+    if (!hp->connected || hp->sent < hp->conf->request.len) {
+        return;
+    }
+
+    for ( ;; ) {
+        n = c->recv(c, hp->last, hp->buffer + NGX_HTTP_UPSTREAM_HC_BUFFER
+                                 - hp->last);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_hc_done(hp, NGX_ERROR);
+            }
+
+            return;
+        }
+
+        if (n == 0) {
+            ngx_log_error(NGX_LOG_ERR, rev->log, 0,
+                          "upstream prematurely closed connection");
+        }
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_http_upstream_hc_done(hp, NGX_ERROR);
+            return;
+        }
+
+        hp->last += n;
+
+        rc = ngx_http_upstream_hc_parse_status(hp);
+
+        if (rc == NGX_AGAIN) {
+            continue;
+        }
+
+        ngx_http_upstream_hc_done(hp, rc);
+        return;
+    }
+}
+
+
+static void
+ngx_http_upstream_hc_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "health check dummy handler");
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            if (c->write->pending_eof) {
+                err = c->write->kq_errno;
+
+            } else {
+                err = c->read->kq_errno;
+            }
+
+            (void) ngx_connection_error(c, err,
+                                    "kevent() reported that connect() failed");
+            return NGX_ERROR;
+        }
+
+    } else
+#endif
+    {
+        err = 0;
+        len = sizeof(int);
+
+        /*
+         * BSDs and Linux return 0 and set a pending error in err
+         * Solaris returns -1 and sets errno
+         */
+
+        if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len)
+            == -1)
+        {
+            err = ngx_socket_errno;
+        }
+
+        if (err) {
+            (void) ngx_connection_error(c, err, "connect() failed");
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_parse_status(ngx_http_upstream_hc_peer_t *hp)
+{
+    u_char      *p;
+    ngx_uint_t   status;
+
+    /* "HTTP/1.1 200" */
+
+    if (hp->last - hp->buffer < 12) {
+        return NGX_AGAIN;
+    }
+
+    p = hp->buffer;
+
+    if (ngx_strncmp(p, "HTTP/", 5) != 0
+        || p[5] < '0' || p[5] > '9' || p[6] != '.'
+        || p[7] < '0' || p[7] > '9' || p[8] != ' '
+        || p[9] < '1' || p[9] > '5'
+        || p[10] < '0' || p[10] > '9'
+        || p[11] < '0' || p[11] > '9')
+    {
+        ngx_log_error(NGX_LOG_ERR, &hp->log, 0,
+                      "upstream sent invalid status line");
+        return NGX_ERROR;
+    }
+
+    status = (p[9] - '0') * 100 + (p[10] - '0') * 10 + p[11] - '0';
+
+    if (status >= 400) {
+        ngx_log_error(NGX_LOG_ERR, &hp->log, 0,
+                      "upstream responded with status %ui", status);
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_hc_done(ngx_http_upstream_hc_peer_t *hp, ngx_int_t rc)
+{
+    ngx_http_upstream_rr_peer_t   *peer;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    if (hp->pc.connection) {
+        ngx_close_connection(hp->pc.connection);
+        hp->pc.connection = NULL;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, &hp->log, 0,
+                   "health check of %V done: %i", &hp->name, rc);
+
+    peers = hp->peers;
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+
+    for (peer = peers->peer; peer; peer = peer->next) {
+
+        if (peer == hp->peer
+            && ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                &hp->sockaddr.sockaddr, hp->socklen, 1)
+               == NGX_OK)
+        {
+            break;
+        }
+    }
+
+    if (peer == NULL || peer->down == 1) {
+        /* the server was removed while being checked */
+        goto done;
+    }
+
+    ngx_http_upstream_rr_peer_lock(peers, peer);
+
+    if (rc == NGX_OK) {
+        peer->check_fails = 0;
+
+        if (peer->down && ++peer->check_passes >= hp->conf->passes) {
+            peer->check_passes = 0;
+            peer->down = 0;
+
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "upstream server %V in upstream \"%V\" "
+                          "is healthy", &hp->name, &hp->hc->upstream->host);
+        }
+
+    } else {
+        peer->check_passes = 0;
+
+        if (!peer->down && ++peer->check_fails >= hp->conf->fails) {
+            peer->check_fails = 0;
+            peer->down = NGX_HTTP_UPSTREAM_HC_DOWN;
+
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "upstream server %V in upstream \"%V\" "
+                          "is unhealthy", &hp->name, &hp->hc->upstream->host);
+        }
+    }
+
+    ngx_http_upstream_rr_peer_unlock(peers, peer);
+
+done:
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    ngx_free(hp);
+}
+
+
+static u_char *
+ngx_http_upstream_hc_log_error(ngx_log_t *log, u_char *buf, size_t len)
+{
+    ngx_http_upstream_hc_peer_t  *hp;
+
+    hp = log->data;
+
+    return ngx_snprintf(buf, len,
+                        " while checking health of %V in upstream \"%V\"",
+                        &hp->name, &hp->hc->upstream->host);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_hc_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                        i;
+    ngx_http_upstream_hc_srv_conf_t  *hcf;
+    ngx_http_upstream_srv_conf_t    **uscfp;
+    ngx_http_upstream_main_conf_t    *umcf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        hcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                              ngx_http_upstream_hc_module);
+
+        if (hcf->interval && uscfp[i]->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "\"health_check\" requires \"zone\" "
+                          "in upstream \"%V\" in %s:%ui",
+                          &uscfp[i]->host, uscfp[i]->file_name,
+                          uscfp[i]->line);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_upstream_hc_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_hc_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_hc_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->type = 0;
+     *     conf->interval = 0;
+     *     conf->timeout = 0;
+     *     conf->fails = 0;
+     *     conf->passes = 0;
+     *     conf->request = { 0, NULL };
+     */
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_hc(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_hc_srv_conf_t *hcf = conf;
+
+    ngx_int_t                      n;
+    ngx_str_t                     *value, s, uri;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (hcf->interval) {
+        return "is duplicate";
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    hcf->type = NGX_HTTP_UPSTREAM_HC_HTTP;
+    hcf->interval = 5000;
+    hcf->timeout = 1000;
+    hcf->fails = 1;
+    hcf->passes = 1;
+
+    ngx_str_set(&uri, "/");
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = &value[i].data[9];
+
+            hcf->interval = ngx_parse_time(&s, 0);
+            if (hcf->interval == (ngx_msec_t) NGX_ERROR
+                || hcf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = &value[i].data[8];
+
+            hcf->timeout = ngx_parse_time(&s, 0);
+            if (hcf->timeout == (ngx_msec_t) NGX_ERROR || hcf->timeout == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            hcf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+
+            uri.len = value[i].len - 4;
+            uri.data = &value[i].data[4];
+
+            if (uri.len == 0 || uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=http") == 0) {
+            hcf->type = NGX_HTTP_UPSTREAM_HC_HTTP;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=tcp") == 0) {
+            hcf->type = NGX_HTTP_UPSTREAM_HC_TCP;
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (hcf->type == NGX_HTTP_UPSTREAM_HC_TCP) {
+        return NGX_CONF_OK;
+    }
+
+    hcf->request.len = sizeof("GET  HTTP/1.0" CRLF) - 1 + uri.len
+                       + sizeof("Host: " CRLF) - 1 + uscf->host.len
+                       + sizeof("Connection: close" CRLF CRLF) - 1;
+
+    hcf->request.data = ngx_pnalloc(cf->pool, hcf->request.len);
+    if (hcf->request.data == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_sprintf(hcf->request.data,
+                "GET %V HTTP/1.0" CRLF
+                "Host: %V" CRLF
+                "Connection: close" CRLF CRLF,
+                &uri, &uscf->host);
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
@@ -15,6 +15,12 @@ typedef struct {
     ngx_uint_t                         requests;
     ngx_msec_t                         timeout;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                         total;
+    ngx_uint_t                         per_server;
+    ngx_http_upstream_srv_conf_t      *upstream;
+#endif
+
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
 
@@ -33,6 +39,10 @@ typedef struct {
     socklen_t                          socklen;
     ngx_sockaddr_t                     sockaddr;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_rr_peer_t       *peer;
+#endif
+
 } ngx_http_upstream_keepalive_cache_t;
 
 
@@ -51,6 +61,10 @@ typedef struct {
     ngx_event_save_peer_session_pt     original_save_session;
 #endif
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_rr_peer_t       *peer;
+#endif
+
 } ngx_http_upstream_keepalive_peer_data_t;
 
 
@@ -65,6 +79,20 @@ static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close(ngx_connection_t *c);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+static ngx_int_t ngx_http_upstream_keepalive_acquire(
+    ngx_http_upstream_keepalive_peer_data_t *kp, ngx_uint_t limit);
+static void ngx_http_upstream_keepalive_release(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_rr_peer_t *peer);
+static ngx_atomic_t *ngx_http_upstream_keepalive_worker(
+    ngx_http_upstream_rr_peers_t *peers, ngx_atomic_t **workers);
+static void ngx_http_upstream_keepalive_reap(ngx_shm_zone_t *shm_zone,
+    ngx_uint_t worker);
+static ngx_uint_t ngx_http_upstream_keepalive_reset(ngx_atomic_t *keepalive,
+    ngx_atomic_t *workers, ngx_uint_t worker);
+#endif
+
 #if (NGX_HTTP_SSL)
 static ngx_int_t ngx_http_upstream_keepalive_set_session(
     ngx_peer_connection_t *pc, void *data);
@@ -80,7 +108,7 @@ static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
 static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
 
     { ngx_string("keepalive"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE123,
       ngx_http_upstream_keepalive,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
@@ -152,6 +180,24 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     ngx_conf_init_msec_value(kcf->timeout, 60000);
     ngx_conf_init_uint_value(kcf->requests, 100);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if ((kcf->total || kcf->per_server) && us->shm_zone == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "\"keepalive\" limits require \"zone\" "
+                      "in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
+
+    kcf->upstream = us;
+
+    if (kcf->total || kcf->per_server) {
+        us->shm_zone->reap = ngx_http_upstream_keepalive_reap;
+    }
+
+#endif
+
     if (kcf->original_init_upstream(cf, us) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -212,6 +258,10 @@ ngx_http_upstream_init_keepalive_peer(ngx_http_request_t *r,
     r->upstream->peer.get = ngx_http_upstream_get_keepalive_peer;
     r->upstream->peer.free = ngx_http_upstream_free_keepalive_peer;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    kp->peer = NULL;
+#endif
+
 #if (NGX_HTTP_SSL)
     kp->original_set_session = r->upstream->peer.set_session;
     kp->original_save_session = r->upstream->peer.save_session;
@@ -229,13 +279,20 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
     ngx_http_upstream_keepalive_cache_t      *item;
 
-    ngx_int_t          rc;
-    ngx_queue_t       *q, *cache;
-    ngx_connection_t  *c;
+    ngx_int_t                          rc;
+    ngx_queue_t                       *q, *cache;
+    ngx_connection_t                  *c;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_rr_peer_data_t  *rrp;
+#endif
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer");
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+again:
+#endif
+
     /* ask balancer */
 
     rc = kp->original_get_peer(pc, kp->data);
@@ -266,10 +323,53 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
         }
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (ngx_http_upstream_keepalive_acquire(kp, 1) == NGX_DECLINED) {
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get keepalive peer: limit reached for %V", pc->name);
+
+        /* the server is busy, the balancer may select another one */
+
+        kp->original_free_peer(pc, kp->data, NGX_PEER_NEXT);
+        pc->sockaddr = NULL;
+
+        if (pc->tries == 0) {
+            return NGX_BUSY;
+        }
+
+        goto again;
+    }
+
+#endif
+
     return NGX_OK;
 
 found:
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * the connection stays counted; if the server was removed from the zone
+     * and added again since the connection was cached, the count moves
+     * to the new peer
+     */
+
+    rrp = kp->data;
+
+    if (item->peer == rrp->current) {
+        kp->peer = item->peer;
+
+    } else {
+        ngx_http_upstream_keepalive_release(kp->conf, item->peer);
+        (void) ngx_http_upstream_keepalive_acquire(kp, 0);
+    }
+
+    item->peer = NULL;
+
+#endif
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer: using connection %p", c);
 
@@ -352,6 +452,11 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
 
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        ngx_http_upstream_keepalive_release(item->conf, item->peer);
+        item->peer = NULL;
+#endif
+
         ngx_http_upstream_keepalive_close(item->connection);
 
     } else {
@@ -361,10 +466,18 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
     }
 
+    item->socklen = pc->socklen;
+    ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
+
     ngx_queue_insert_head(&kp->conf->cache, q);
 
     item->connection = c;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    item->peer = kp->peer;
+    kp->peer = NULL;
+#endif
+
     pc->connection = NULL;
 
     c->read->delayed = 0;
@@ -384,15 +497,17 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     c->write->log = ngx_cycle->log;
     c->pool->log = ngx_cycle->log;
 
-    item->socklen = pc->socklen;
-    ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
-
     if (c->read->ready) {
         ngx_http_upstream_keepalive_close_handler(c->read);
     }
 
 invalid:
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_keepalive_release(kp->conf, kp->peer);
+    kp->peer = NULL;
+#endif
+
     kp->original_free_peer(pc, kp->data, state);
 }
 
@@ -441,6 +556,11 @@ close:
     item = c->data;
     conf = item->conf;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_keepalive_release(conf, item->peer);
+    item->peer = NULL;
+#endif
+
     ngx_http_upstream_keepalive_close(c);
 
     ngx_queue_remove(&item->queue);
@@ -471,6 +591,225 @@ ngx_http_upstream_keepalive_close(ngx_connection_t *c)
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t
+ngx_http_upstream_keepalive_acquire(ngx_http_upstream_keepalive_peer_data_t *kp,
+    ngx_uint_t limit)
+{
+    ngx_atomic_t                            *total, *per_server;
+    ngx_http_upstream_rr_peer_t             *peer;
+    ngx_http_upstream_rr_peers_t            *peers;
+    ngx_http_upstream_rr_peer_data_t        *rrp;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    kcf = kp->conf;
+
+    if (kcf->total == 0 && kcf->per_server == 0) {
+        return NGX_OK;
+    }
+
+    /*
+     * the connections to the servers, both active and cached, are counted
+     * in the shared zone of the upstream, in all worker processes and in
+     * each of them; the balancer data start with the round robin data,
+     * so the server selected is known without searching for it
+     */
+
+    rrp = kp->data;
+    peer = rrp->current;
+    peers = kcf->upstream->peer.data;
+
+    total = ngx_http_upstream_keepalive_worker(peers, &peers->keepalive_worker);
+    per_server = ngx_http_upstream_keepalive_worker(peers,
+                                                    &peer->keepalive_worker);
+
+    if (total == NULL || per_server == NULL) {
+        return NGX_OK;
+    }
+
+    if (ngx_atomic_fetch_add(&peers->keepalive, 1) >= kcf->total
+        && kcf->total && limit)
+    {
+        (void) ngx_atomic_fetch_add(&peers->keepalive, -1);
+        return NGX_DECLINED;
+    }
+
+    if (ngx_atomic_fetch_add(&peer->keepalive, 1) >= kcf->per_server
+        && kcf->per_server && limit)
+    {
+        (void) ngx_atomic_fetch_add(&peer->keepalive, -1);
+        (void) ngx_atomic_fetch_add(&peers->keepalive, -1);
+        return NGX_DECLINED;
+    }
+
+    (void) ngx_atomic_fetch_add(total, 1);
+    (void) ngx_atomic_fetch_add(per_server, 1);
+
+    kp->peer = peer;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_keepalive_release(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_uint_t                     zombie;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    if (peer == NULL) {
+        return;
+    }
+
+    peers = kcf->upstream->peer.data;
+
+    (void) ngx_atomic_fetch_add(&peers->keepalive_worker[ngx_worker], -1);
+    (void) ngx_atomic_fetch_add(&peers->keepalive, -1);
+
+    ngx_http_upstream_rr_peers_rlock(peers);
+    ngx_http_upstream_rr_peer_lock(peers, peer);
+
+    (void) ngx_atomic_fetch_add(&peer->keepalive_worker[ngx_worker], -1);
+    (void) ngx_atomic_fetch_add(&peer->keepalive, -1);
+
+    /* the peer may have been removed from the zone in the meantime */
+
+    zombie = (peer->zombie && peer->conns == 0 && peer->keepalive == 0);
+
+    ngx_http_upstream_rr_peer_unlock(peers, peer);
+
+    if (zombie) {
+        ngx_http_upstream_zone_free_peer(peers, peer);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+}
+
+
+static ngx_atomic_t *
+ngx_http_upstream_keepalive_worker(ngx_http_upstream_rr_peers_t *peers,
+    ngx_atomic_t **workers)
+{
+    ngx_core_conf_t  *ccf;
+
+    if (*workers == NULL) {
+
+        ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                               ngx_core_module);
+
+        ngx_shmtx_lock(&peers->shpool->mutex);
+
+        if (*workers == NULL) {
+            *workers = ngx_slab_calloc_locked(peers->shpool,
+                                  ccf->worker_processes * sizeof(ngx_atomic_t));
+        }
+
+        ngx_shmtx_unlock(&peers->shpool->mutex);
+
+        if (*workers == NULL) {
+            return NULL;
+        }
+    }
+
+    return &(*workers)[ngx_worker];
+}
+
+
+static void
+ngx_http_upstream_keepalive_reap(ngx_shm_zone_t *shm_zone, ngx_uint_t worker)
+{
+    ngx_uint_t                               i, n;
+    ngx_core_conf_t                         *ccf;
+    ngx_http_upstream_rr_peer_t             *peer;
+    ngx_http_upstream_rr_peers_t            *peers, *list;
+    ngx_http_upstream_srv_conf_t           **uscfp;
+    ngx_http_upstream_main_conf_t           *umcf;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(ngx_cycle->conf_ctx,
+                                           ngx_core_module);
+
+    if (worker >= (ngx_uint_t) ccf->worker_processes) {
+        return;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(ngx_cycle,
+                                               ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->shm_zone != shm_zone) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                            ngx_http_upstream_keepalive_module);
+
+        if (kcf->total == 0 && kcf->per_server == 0) {
+            continue;
+        }
+
+        /*
+         * the connections counted by the exited worker process are gone;
+         * the master process cannot take the locks of the peers that
+         * the process might have held, and walks the lists under
+         * the zone mutex, which keeps the peers from being freed;
+         * the peers removed from the zone are not reset, they are
+         * not selected anymore and are freed with the zone
+         */
+
+        peers = uscfp[i]->peer.data;
+
+        ngx_shmtx_lock(&peers->shpool->mutex);
+
+        n = ngx_http_upstream_keepalive_reset(&peers->keepalive,
+                                              peers->keepalive_worker, worker);
+
+        for (list = peers; list; list = list->next) {
+            for (peer = list->peer; peer; peer = peer->next) {
+                (void) ngx_http_upstream_keepalive_reset(&peer->keepalive,
+                                                         peer->keepalive_worker,
+                                                         worker);
+            }
+        }
+
+        ngx_shmtx_unlock(&peers->shpool->mutex);
+
+        if (n) {
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "%ui keepalive connections of worker process %ui "
+                          "released in upstream \"%V\"",
+                          n, worker, &uscfp[i]->host);
+        }
+    }
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_keepalive_reset(ngx_atomic_t *keepalive,
+    ngx_atomic_t *workers, ngx_uint_t worker)
+{
+    ngx_uint_t  n;
+
+    if (workers == NULL) {
+        return 0;
+    }
+
+    n = workers[worker];
+    workers[worker] = 0;
+
+    (void) ngx_atomic_fetch_add(keepalive, -(ngx_atomic_int_t) n);
+
+    return n;
+}
+
+#endif
+
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t
@@ -511,6 +850,8 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      *     conf->original_init_upstream = NULL;
      *     conf->original_init_peer = NULL;
      *     conf->max_cached = 0;
+     *     conf->total = 0;
+     *     conf->per_server = 0;
      */
 
     conf->timeout = NGX_CONF_UNSET_MSEC;
@@ -528,6 +869,9 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ngx_int_t    n;
     ngx_str_t   *value;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t   i;
+#endif
 
     if (kcf->max_cached) {
         return "is duplicate";
@@ -548,6 +892,49 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     kcf->max_cached = n;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "total=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            kcf->total = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "per_server=", 11) == 0) {
+
+            n = ngx_atoi(&value[i].data[11], value[i].len - 11);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            kcf->per_server = n;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+#else
+
+    if (cf->args->nelts > 2) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[2]);
+        return NGX_CONF_ERROR;
+    }
+
+#endif
+
     /* init upstream handler */
 
     uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
@@ -559,4 +946,15 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     uscf->peer.init_upstream = ngx_http_upstream_init_keepalive;
 
     return NGX_CONF_OK;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+
+#endif
 }
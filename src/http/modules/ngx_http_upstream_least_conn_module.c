@@ -124,6 +124,11 @@ ngx_http_upstream_get_least_conn_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(peers);
 
+    if (ngx_http_upstream_rr_peers_changed(rrp)) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
     best = NULL;
     total = 0;
 
@@ -265,6 +270,12 @@ failed:
         n = (rrp->peers->number + (8 * sizeof(uintptr_t) - 1))
                 / (8 * sizeof(uintptr_t));
 
+        /* the backup servers may be re-resolved after the bitmap was sized */
+
+        if (n > rrp->ntried) {
+            n = rrp->ntried;
+        }
+
         for (i = 0; i < n; i++) {
             rrp->tried[i] = 0;
         }
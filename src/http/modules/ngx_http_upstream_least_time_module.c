@@ -0,0 +1,486 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+/*
+ * The latency of each peer is tracked as a peak exponentially weighted
+ * moving average: a sample above the average replaces it at once, while
+ * lower samples and idle time decay it with the "decay" time constant.
+ * A request goes to the cheaper of two randomly chosen peers, the cost
+ * being the average latency multiplied by the number of active requests.
+ * With "zone", the averages and the active requests are shared by all
+ * worker processes.
+ */
+
+
+#define NGX_HTTP_UPSTREAM_LT_HEADER     0
+#define NGX_HTTP_UPSTREAM_LT_LAST_BYTE  1
+
+/* averages are kept in 1/256 of milliseconds */
+#define NGX_HTTP_UPSTREAM_LT_SHIFT      8
+
+
+typedef struct {
+    ngx_uint_t                         mode;
+    ngx_msec_t                         decay;
+} ngx_http_upstream_least_time_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t          rrp;
+
+    ngx_http_upstream_least_time_srv_conf_t  *conf;
+    ngx_http_upstream_t                      *upstream;
+} ngx_http_upstream_least_time_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_least_time_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_least_time_peer(
+    ngx_peer_connection_t *pc, void *data);
+static void ngx_http_upstream_free_least_time_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static uint64_t ngx_http_upstream_least_time_cost(
+    ngx_http_upstream_rr_peer_t *peer, ngx_msec_t decay);
+static void *ngx_http_upstream_least_time_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_least_time_commands[] = {
+
+    { ngx_string("least_time"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
+      ngx_http_upstream_least_time,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_least_time_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_least_time_create_conf, /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_least_time_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_least_time_module_ctx, /* module context */
+    ngx_http_upstream_least_time_commands, /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_time(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init least time");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    us->peer.init = ngx_http_upstream_init_least_time_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_least_time_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_least_time_peer_data_t  *ltp;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init least time peer");
+
+    ltp = ngx_palloc(r->pool, sizeof(ngx_http_upstream_least_time_peer_data_t));
+    if (ltp == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &ltp->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ltp->conf = ngx_http_conf_upstream_srv_conf(us,
+                                          ngx_http_upstream_least_time_module);
+    ltp->upstream = r->upstream;
+
+    r->upstream->peer.get = ngx_http_upstream_get_least_time_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_least_time_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_get_least_time_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_least_time_peer_data_t  *ltp = data;
+
+    time_t                             now;
+    uint64_t                           cost[2];
+    uintptr_t                          m;
+    ngx_int_t                          rc;
+    ngx_uint_t                         i, n, k, r, p[2];
+    ngx_http_upstream_rr_peer_t       *peer, *best, *candidate[2];
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_rr_peer_data_t  *rrp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get least time peer, try: %ui", pc->tries);
+
+    rrp = &ltp->rrp;
+
+    if (rrp->peers->single) {
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    peers = rrp->peers;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    if (ngx_http_upstream_rr_peers_changed(rrp)) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    /* pick two of the available peers at random in a single pass */
+
+    candidate[0] = NULL;
+    candidate[1] = NULL;
+    p[0] = 0;
+    p[1] = 0;
+    k = 0;
+
+    for (peer = peers->peer, i = 0;
+         peer;
+         peer = peer->next, i++)
+    {
+        n = i / (8 * sizeof(uintptr_t));
+        m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+        if (rrp->tried[n] & m) {
+            continue;
+        }
+
+        if (peer->down) {
+            continue;
+        }
+
+        if (peer->max_fails
+            && peer->fails >= peer->max_fails
+            && now - peer->checked <= peer->fail_timeout)
+        {
+            continue;
+        }
+
+        if (peer->max_conns && peer->conns >= peer->max_conns) {
+            continue;
+        }
+
+        r = (k < 2) ? k : (ngx_uint_t) ngx_random() % (k + 1);
+
+        if (r < 2) {
+            candidate[r] = peer;
+            p[r] = i;
+        }
+
+        k++;
+    }
+
+    if (candidate[0] == NULL) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get least time peer, no peer found");
+
+        goto failed;
+    }
+
+    best = candidate[0];
+    i = p[0];
+
+    if (candidate[1]) {
+        cost[0] = ngx_http_upstream_least_time_cost(candidate[0],
+                                                    ltp->conf->decay);
+        cost[1] = ngx_http_upstream_least_time_cost(candidate[1],
+                                                    ltp->conf->decay);
+
+        ngx_log_debug4(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get least time peer, %V:%uL %V:%uL",
+                       &candidate[0]->name, cost[0],
+                       &candidate[1]->name, cost[1]);
+
+        if (cost[1] * candidate[0]->weight < cost[0] * candidate[1]->weight) {
+            best = candidate[1];
+            i = p[1];
+        }
+    }
+
+    if (now - best->checked > best->fail_timeout) {
+        best->checked = now;
+    }
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    best->conns++;
+
+    rrp->current = best;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (uintptr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+
+failed:
+
+    if (peers->next) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get least time peer, backup servers");
+
+        rrp->peers = peers->next;
+
+        n = (rrp->peers->number + (8 * sizeof(uintptr_t) - 1))
+                / (8 * sizeof(uintptr_t));
+
+        /* the backup servers may be re-resolved after the bitmap was sized */
+
+        if (n > rrp->ntried) {
+            n = rrp->ntried;
+        }
+
+        for (i = 0; i < n; i++) {
+            rrp->tried[i] = 0;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+
+        rc = ngx_http_upstream_get_least_time_peer(pc, ltp);
+
+        if (rc != NGX_BUSY) {
+            return rc;
+        }
+
+        ngx_http_upstream_rr_peers_wlock(peers);
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    pc->name = peers->name;
+
+    return NGX_BUSY;
+}
+
+
+static void
+ngx_http_upstream_free_least_time_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state)
+{
+    ngx_http_upstream_least_time_peer_data_t  *ltp = data;
+
+    ngx_msec_t                    elapsed, sample, latency;
+    ngx_http_upstream_t          *u;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    peer = ltp->rrp.current;
+    u = ltp->upstream;
+
+    if (peer == NULL || u->state == NULL) {
+        goto done;
+    }
+
+    sample = ngx_current_msec - u->start_time;
+
+    if (ltp->conf->mode == NGX_HTTP_UPSTREAM_LT_HEADER
+        && u->state->header_time != (ngx_msec_t) -1)
+    {
+        sample = u->state->header_time;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free least time peer, sample: %M, state: %ui",
+                   sample, state);
+
+    sample <<= NGX_HTTP_UPSTREAM_LT_SHIFT;
+
+    ngx_http_upstream_rr_peers_rlock(ltp->rrp.peers);
+    ngx_http_upstream_rr_peer_lock(ltp->rrp.peers, peer);
+
+    latency = peer->latency;
+
+    if (sample > latency) {
+        /* a peak is taken at once */
+        latency = sample;
+
+    } else if (!(state & NGX_PEER_FAILED)) {
+        /* failures may only raise the average */
+
+        elapsed = ngx_current_msec - peer->latency_updated;
+
+        latency -= (uint64_t) (latency - sample) * elapsed
+                   / (elapsed + ltp->conf->decay);
+    }
+
+    peer->latency = latency;
+    peer->latency_updated = ngx_current_msec;
+
+    ngx_http_upstream_rr_peer_unlock(ltp->rrp.peers, peer);
+    ngx_http_upstream_rr_peers_unlock(ltp->rrp.peers);
+
+done:
+
+    ngx_http_upstream_free_round_robin_peer(pc, &ltp->rrp, state);
+}
+
+
+static uint64_t
+ngx_http_upstream_least_time_cost(ngx_http_upstream_rr_peer_t *peer,
+    ngx_msec_t decay)
+{
+    uint64_t    latency;
+    ngx_msec_t  elapsed;
+
+    /* the average decays while the peer is not used */
+
+    elapsed = ngx_current_msec - peer->latency_updated;
+
+    latency = (uint64_t) peer->latency * decay / (elapsed + decay);
+
+    return (latency + 1) * (peer->conns + 1);
+}
+
+
+static void *
+ngx_http_upstream_least_time_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_least_time_srv_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool,
+                      sizeof(ngx_http_upstream_least_time_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->mode = NGX_CONF_UNSET_UINT;
+    conf->decay = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_least_time(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_least_time_srv_conf_t  *ltcf = conf;
+
+    ngx_str_t                     *value, s;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (ltcf->mode != NGX_CONF_UNSET_UINT) {
+        return "is duplicate";
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "header") == 0) {
+        ltcf->mode = NGX_HTTP_UPSTREAM_LT_HEADER;
+
+    } else if (ngx_strcmp(value[1].data, "last_byte") == 0) {
+        ltcf->mode = NGX_HTTP_UPSTREAM_LT_LAST_BYTE;
+
+    } else {
+        i = 1;
+        goto invalid;
+    }
+
+    ltcf->decay = 10000;
+
+    for (i = 2; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "decay=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = &value[i].data[6];
+
+            ltcf->decay = ngx_parse_time(&s, 0);
+            if (ltcf->decay == (ngx_msec_t) NGX_ERROR || ltcf->decay == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_least_time;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_CONNS
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
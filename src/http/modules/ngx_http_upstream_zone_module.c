@@ -10,6 +10,19 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_http_upstream_srv_conf_t   *upstream;
+    ngx_http_upstream_server_t     *server;
+    ngx_http_upstream_rr_peers_t   *peers;
+
+    ngx_resolver_t                 *resolver;
+    ngx_msec_t                      resolver_timeout;
+    in_port_t                       port;
+
+    ngx_event_t                     event;
+} ngx_http_upstream_zone_host_t;
+
+
 static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
@@ -18,6 +31,11 @@ static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
     ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
+static ngx_int_t ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle);
+static void ngx_http_upstream_zone_resolve_timer(ngx_event_t *event);
+static void ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
+static void ngx_http_upstream_zone_update_peers(
+    ngx_http_upstream_zone_host_t *host, ngx_resolver_ctx_t *ctx);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -55,7 +73,7 @@ ngx_module_t  ngx_http_upstream_zone_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_zone_init_worker,    /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -215,6 +233,13 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
     peers->shpool = shpool;
 
+    /* shared by the backup list, changed when servers are re-resolved */
+
+    peers->config = ngx_slab_calloc(shpool, sizeof(ngx_uint_t));
+    if (peers->config == NULL) {
+        return NULL;
+    }
+
     for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
         peer = ngx_http_upstream_zone_copy_peer(peers, *peerp);
@@ -240,6 +265,8 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
 
     backup->shpool = shpool;
 
+    backup->config = peers->config;
+
     for (peerp = &backup->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
         peer = ngx_http_upstream_zone_copy_peer(backup, *peerp);
@@ -323,3 +350,369 @@ failed:
 
     return NULL;
 }
+
+
+void
+ngx_http_upstream_zone_free_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_slab_pool_t  *pool;
+
+    pool = peers->shpool;
+
+    ngx_shmtx_lock(&pool->mutex);
+
+    if (peer->server.data) {
+        ngx_slab_free_locked(pool, peer->server.data);
+    }
+
+    if (peer->name.data) {
+        ngx_slab_free_locked(pool, peer->name.data);
+    }
+
+    if (peer->sockaddr) {
+        ngx_slab_free_locked(pool, peer->sockaddr);
+    }
+
+#if (NGX_HTTP_SSL)
+    if (peer->ssl_session) {
+        ngx_slab_free_locked(pool, peer->ssl_session);
+    }
+#endif
+
+    if (peer->keepalive_worker) {
+        ngx_slab_free_locked(pool, (void *) peer->keepalive_worker);
+    }
+
+    ngx_slab_free_locked(pool, peer);
+
+    ngx_shmtx_unlock(&pool->mutex);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_init_worker(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                      i, j, k;
+    ngx_core_conf_t                *ccf;
+    ngx_http_conf_ctx_t            *ctx;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_upstream_server_t     *server;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t  **uscfp;
+    ngx_http_upstream_zone_host_t  *host;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle, ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    ctx = (ngx_http_conf_ctx_t *) cycle->conf_ctx[ngx_http_module.index];
+    clcf = ctx->loc_conf[ngx_http_core_module.ctx_index];
+
+    uscfp = umcf->upstreams.elts;
+
+    /* each name is re-resolved by one worker process only */
+
+    k = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (!uscfp[i]->resolve) {
+            continue;
+        }
+
+        server = uscfp[i]->servers->elts;
+
+        for (j = 0; j < uscfp[i]->servers->nelts; j++) {
+
+            if (!server[j].resolve) {
+                continue;
+            }
+
+            if (ngx_process == NGX_PROCESS_WORKER
+                && k++ % ccf->worker_processes != ngx_worker)
+            {
+                continue;
+            }
+
+            host = ngx_pcalloc(cycle->pool,
+                               sizeof(ngx_http_upstream_zone_host_t));
+            if (host == NULL) {
+                return NGX_ERROR;
+            }
+
+            peers = uscfp[i]->peer.data;
+
+            host->upstream = uscfp[i];
+            host->server = &server[j];
+            host->peers = server[j].backup ? peers->next : peers;
+            host->resolver = clcf->resolver;
+            host->resolver_timeout = clcf->resolver_timeout;
+            host->port = ngx_inet_get_port(server[j].addrs[0].sockaddr);
+
+            host->event.handler = ngx_http_upstream_zone_resolve_timer;
+            host->event.data = host;
+            host->event.log = cycle->log;
+            host->event.cancelable = 1;
+
+            ngx_add_timer(&host->event, 1);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_timer(ngx_event_t *event)
+{
+    ngx_resolver_ctx_t             *ctx;
+    ngx_http_upstream_zone_host_t  *host;
+
+    host = event->data;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    if (host->resolver == NULL) {
+        ctx = NGX_NO_RESOLVER;
+
+    } else {
+        ctx = ngx_resolve_start(host->resolver, NULL);
+        if (ctx == NULL) {
+            goto retry;
+        }
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "no resolver defined to resolve %V", &host->server->host);
+        return;
+    }
+
+    ctx->name = host->server->host;
+    ctx->handler = ngx_http_upstream_zone_resolve_handler;
+    ctx->data = host;
+    ctx->timeout = host->resolver_timeout;
+    ctx->cancelable = 1;
+
+    if (ngx_resolve_name(ctx) == NGX_OK) {
+        return;
+    }
+
+    /* the context is freed by ngx_resolve_name() on failure */
+
+retry:
+
+    ngx_add_timer(event, 1000);
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    time_t                          valid;
+    ngx_http_upstream_zone_host_t  *host;
+
+    host = ctx->data;
+
+    if (ctx->state || ctx->naddrs == 0) {
+        ngx_log_error(NGX_LOG_ERR, host->event.log, 0,
+                      "%V could not be resolved (%i: %s)",
+                      &ctx->name, ctx->state,
+                      ngx_resolver_strerror(ctx->state));
+
+        /* the servers are kept until the name is resolved again */
+
+        valid = ngx_time() + 1;
+
+    } else {
+        ngx_http_upstream_zone_update_peers(host, ctx);
+        valid = ctx->valid;
+    }
+
+    ngx_resolve_name_done(ctx);
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    valid -= ngx_time();
+
+    ngx_add_timer(&host->event, valid > 1 ? valid * 1000 : 1000);
+}
+
+
+static void
+ngx_http_upstream_zone_update_peers(ngx_http_upstream_zone_host_t *host,
+    ngx_resolver_ctx_t *ctx)
+{
+    u_char                         *found;
+    ngx_uint_t                      i, changed;
+    ngx_slab_pool_t                *pool;
+    ngx_http_upstream_server_t     *server;
+    ngx_http_upstream_rr_peer_t    *peer, **peerp;
+    ngx_http_upstream_rr_peers_t   *peers;
+
+    found = ngx_calloc(ctx->naddrs, host->event.log);
+    if (found == NULL) {
+        return;
+    }
+
+    for (i = 0; i < ctx->naddrs; i++) {
+        ngx_inet_set_port(ctx->addrs[i].sockaddr, host->port);
+    }
+
+    server = host->server;
+    peers = host->peers;
+    pool = peers->shpool;
+
+    changed = 0;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    /* remove the peers which are no longer resolved */
+
+    for (peerp = &peers->peer; *peerp; /* void */) {
+        peer = *peerp;
+
+        if (peer->host != server) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        for (i = 0; i < ctx->naddrs; i++) {
+            if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                 ctx->addrs[i].sockaddr,
+                                 ctx->addrs[i].socklen, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i < ctx->naddrs) {
+            found[i] = 1;
+            peerp = &peer->next;
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, host->event.log, 0,
+                      "upstream server %V of %V in upstream \"%V\" "
+                      "is removed", &peer->name, &server->host,
+                      &host->upstream->host);
+
+        *peerp = peer->next;
+
+        peers->number--;
+        peers->total_weight -= peer->weight;
+        changed = 1;
+
+        ngx_http_upstream_rr_peer_lock(peers, peer);
+
+        if (peer->conns || peer->keepalive) {
+            /* freed by the last request or connection which uses the peer */
+            peer->zombie = 1;
+            ngx_http_upstream_rr_peer_unlock(peers, peer);
+            continue;
+        }
+
+        ngx_http_upstream_rr_peer_unlock(peers, peer);
+
+        ngx_http_upstream_zone_free_peer(peers, peer);
+    }
+
+    /* add the new addresses to the end of the list */
+
+    for (i = 0; i < ctx->naddrs; i++) {
+
+        if (found[i]) {
+            continue;
+        }
+
+        ngx_shmtx_lock(&pool->mutex);
+        peer = ngx_http_upstream_zone_copy_peer(peers, NULL);
+        ngx_shmtx_unlock(&pool->mutex);
+
+        if (peer) {
+            peer->server.data = ngx_slab_alloc(pool, server->name.len);
+
+            if (peer->server.data == NULL) {
+                ngx_http_upstream_zone_free_peer(peers, peer);
+                peer = NULL;
+            }
+        }
+
+        if (peer == NULL) {
+            ngx_log_error(NGX_LOG_ERR, host->event.log, 0,
+                          "could not add upstream server %V of %V "
+                          "in upstream \"%V\"%s", &ctx->addrs[i].name,
+                          &server->host, &host->upstream->host,
+                          pool->log_ctx);
+            break;
+        }
+
+        ngx_memcpy(peer->sockaddr, ctx->addrs[i].sockaddr,
+                   ctx->addrs[i].socklen);
+        peer->socklen = ctx->addrs[i].socklen;
+        peer->name.len = ngx_sock_ntop(peer->sockaddr, peer->socklen,
+                                       peer->name.data, NGX_SOCKADDR_STRLEN,
+                                       1);
+
+        ngx_memcpy(peer->server.data, server->name.data, server->name.len);
+        peer->server.len = server->name.len;
+
+        peer->weight = server->weight;
+        peer->effective_weight = server->weight;
+        peer->current_weight = 0;
+        peer->max_conns = server->max_conns;
+        peer->max_fails = server->max_fails;
+        peer->fail_timeout = server->fail_timeout;
+        peer->down = server->down;
+        peer->host = server;
+
+        for (peerp = &peers->peer; *peerp; peerp = &(*peerp)->next) {
+            /* void */
+        }
+
+        *peerp = peer;
+
+        peers->number++;
+        peers->total_weight += peer->weight;
+        changed = 1;
+
+        ngx_log_error(NGX_LOG_NOTICE, host->event.log, 0,
+                      "upstream server %V of %V in upstream \"%V\" "
+                      "is added", &peer->name, &server->host,
+                      &host->upstream->host);
+    }
+
+    if (changed) {
+        if (!server->backup) {
+            peers->single = (peers->number == 1 && peers->next == NULL);
+        }
+
+        peers->weighted = (peers->total_weight != peers->number);
+
+        /* invalidates the per-request state of the balancers */
+
+        (*((ngx_http_upstream_rr_peers_t *)
+           host->upstream->peer.data)->config)++;
+    }
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    ngx_free(found);
+}
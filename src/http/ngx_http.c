@@ -693,8 +693,9 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
     ngx_http_location_queue_t   *lq;
     ngx_http_core_loc_conf_t   **clcfp;
 #if (NGX_PCRE)
-    ngx_uint_t                   r;
+    ngx_uint_t                   i, r;
     ngx_queue_t                 *regex;
+    ngx_http_regex_t           **regexes;
 #endif
 
     locations = pclcf->locations;
@@ -804,6 +805,20 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
         *clcfp = NULL;
 
         ngx_queue_split(locations, regex, &tail);
+
+        regexes = ngx_palloc(cf->pool, r * sizeof(ngx_http_regex_t *));
+        if (regexes == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (i = 0; i < r; i++) {
+            regexes[i] = pclcf->regex_locations[i]->regex;
+        }
+
+        pclcf->regex_multi = ngx_http_regex_multi_create(cf, regexes, r);
+        if (pclcf->regex_multi == NULL) {
+            return NGX_ERROR;
+        }
     }
 
 #endif
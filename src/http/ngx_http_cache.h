@@ -51,7 +51,10 @@ typedef struct {
     unsigned                         updating:1;
     unsigned                         deleting:1;
     unsigned                         purged:1;
-                                     /* 10 unused bits */
+
+    /* loaded from the cache index, the file is not yet seen by the loader */
+    unsigned                         indexed:1;
+                                     /* 9 unused bits */
 
     ngx_file_uniq_t                  uniq;
     time_t                           expire;
@@ -62,6 +65,20 @@ typedef struct {
 } ngx_http_file_cache_node_t;
 
 
+typedef struct {
+    ngx_rbtree_node_t                node;
+    ngx_queue_t                      queue;
+
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN
+                                         - sizeof(ngx_rbtree_key_t)];
+
+    ngx_file_uniq_t                  uniq;
+    off_t                            fs_size;
+    size_t                           len;
+    u_char                           data[1];
+} ngx_http_file_cache_object_t;
+
+
 struct ngx_http_cache_s {
     ngx_file_t                       file;
     ngx_array_t                      keys;
@@ -120,6 +137,8 @@ struct ngx_http_cache_s {
 
     unsigned                         stale_updating:1;
     unsigned                         stale_error:1;
+
+    unsigned                         memory:1;
 };
 
 
@@ -146,14 +165,28 @@ typedef struct {
     ngx_rbtree_t                     rbtree;
     ngx_rbtree_node_t                sentinel;
     ngx_queue_t                      queue;
-    ngx_atomic_t                     cold;
-    ngx_atomic_t                     loading;
     off_t                            size;
     ngx_uint_t                       count;
     ngx_uint_t                       watermark;
+    ngx_slab_pool_t                 *shpool;
+} ngx_http_file_cache_shard_t;
+
+
+typedef struct {
+    ngx_atomic_t                     cold;
+    ngx_atomic_t                     loading;
+    ngx_uint_t                       nshards;
+    ngx_http_file_cache_shard_t    **shards;
 } ngx_http_file_cache_sh_t;
 
 
+typedef struct {
+    ngx_rbtree_t                     rbtree;
+    ngx_rbtree_node_t                sentinel;
+    ngx_queue_t                      queue;
+} ngx_http_file_cache_memory_t;
+
+
 struct ngx_http_file_cache_s {
     ngx_http_file_cache_sh_t        *sh;
     ngx_slab_pool_t                 *shpool;
@@ -172,12 +205,26 @@ struct ngx_http_file_cache_s {
     ngx_msec_t                       last;
     ngx_msec_t                       loader_sleep;
     ngx_msec_t                       loader_threshold;
+#if (NGX_THREADS || NGX_COMPAT)
+    ngx_thread_pool_t               *loader_thread_pool;
+#endif
 
     ngx_uint_t                       manager_files;
     ngx_msec_t                       manager_sleep;
     ngx_msec_t                       manager_threshold;
 
     ngx_shm_zone_t                  *shm_zone;
+    ngx_uint_t                       shards;
+
+    ngx_http_file_cache_memory_t    *memory;
+    ngx_slab_pool_t                 *memory_shpool;
+    ngx_shm_zone_t                  *memory_zone;
+    size_t                           max_object;
+
+    ngx_str_t                        index;
+    ngx_str_t                        index_temp;
+    time_t                           index_interval;
+    time_t                           index_time;
 
     ngx_uint_t                       use_temp_path;
                                      /* unsigned use_temp_path:1 */
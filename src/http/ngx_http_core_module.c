@@ -1383,7 +1383,7 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 #if (NGX_PCRE)
     ngx_int_t                  n;
     ngx_uint_t                 noregex;
-    ngx_http_core_loc_conf_t  *clcf, **clcfp;
+    ngx_http_core_loc_conf_t  *clcf;
 
     noregex = 0;
 #endif
@@ -1415,27 +1415,24 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
-        for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
-
-            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                           "test location: ~ \"%V\"", &(*clcfp)->name);
+        n = ngx_http_regex_multi_exec(r, pclcf->regex_multi, &r->uri);
 
-            n = ngx_http_regex_exec(r, (*clcfp)->regex, &r->uri);
+        if (n >= 0) {
+            clcf = pclcf->regex_locations[n];
 
-            if (n == NGX_OK) {
-                r->loc_conf = (*clcfp)->loc_conf;
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "test location: ~ \"%V\"", &clcf->name);
 
-                /* look up nested locations */
+            r->loc_conf = clcf->loc_conf;
 
-                rc = ngx_http_core_find_location(r);
+            /* look up nested locations */
 
-                return (rc == NGX_ERROR) ? rc : NGX_OK;
-            }
+            rc = ngx_http_core_find_location(r);
 
-            if (n == NGX_DECLINED) {
-                continue;
-            }
+            return (rc == NGX_ERROR) ? rc : NGX_OK;
+        }
 
+        if (n == NGX_ERROR) {
             return NGX_ERROR;
         }
     }
@@ -11,6 +11,66 @@
 #include <ngx_md5.h>
 
 
+#define NGX_HTTP_CACHE_INDEX_VERSION  1
+#define NGX_HTTP_CACHE_INDEX_RECORDS  1024
+
+
+#define NGX_HTTP_CACHE_LOAD_WALK       0
+#define NGX_HTTP_CACHE_LOAD_INDEX      1
+#define NGX_HTTP_CACHE_LOAD_RECONCILE  2
+
+
+typedef struct {
+    ngx_http_file_cache_t           *cache;
+    ngx_uint_t                       files;
+    ngx_msec_t                       last;
+    unsigned                         reconcile:1;
+    unsigned                         thread:1;
+#if (NGX_THREADS)
+    ngx_thread_pool_t               *thread_pool;
+    ngx_uint_t                      *pending;
+#endif
+} ngx_http_file_cache_loader_t;
+
+
+#if (NGX_THREADS)
+
+typedef struct {
+    ngx_http_file_cache_loader_t     loader;
+    ngx_str_t                        path;
+} ngx_http_file_cache_loader_task_t;
+
+#endif
+
+
+/*
+ * The index is a snapshot of the keys zone written by the cache manager,
+ * the records of each shard are stored from the least recently used ones.
+ */
+
+typedef struct {
+    u_char                           magic[8];
+    uint32_t                         version;
+    uint32_t                         record_size;
+    uint64_t                         bsize;
+    uint64_t                         records;
+    uint64_t                         time;
+} ngx_http_file_cache_index_header_t;
+
+
+typedef struct {
+    u_char                           key[NGX_HTTP_CACHE_KEY_LEN];
+    uint64_t                         uniq;
+    uint64_t                         fs_size;
+} ngx_http_file_cache_index_record_t;
+
+
+typedef struct {
+    time_t                           expire;
+    ngx_http_file_cache_index_record_t  record;
+} ngx_http_file_cache_index_entry_t;
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
@@ -32,8 +92,11 @@ static ngx_int_t ngx_http_file_cache_exists(ngx_http_file_cache_t *cache,
     ngx_http_cache_t *c);
 static ngx_int_t ngx_http_file_cache_name(ngx_http_request_t *r,
     ngx_path_t *path);
+static ngx_http_file_cache_shard_t *
+    ngx_http_file_cache_shard(ngx_http_file_cache_t *cache, u_char *key);
 static ngx_http_file_cache_node_t *
-    ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key);
+    ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard,
+    u_char *key);
 static void ngx_http_file_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
     ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 static void ngx_http_file_cache_vary(ngx_http_request_t *r, u_char *vary,
@@ -45,11 +108,34 @@ static ngx_int_t ngx_http_file_cache_reopen(ngx_http_request_t *r,
 static ngx_int_t ngx_http_file_cache_update_variant(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_cleanup(void *data);
-static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard);
 static time_t ngx_http_file_cache_expire(ngx_http_file_cache_t *cache);
+static time_t ngx_http_file_cache_expire_shard(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, u_char *name);
 static void ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
-    ngx_queue_t *q, u_char *name);
-static void ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache);
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name);
+static void ngx_http_file_cache_write_index(ngx_http_file_cache_t *cache);
+static int ngx_libc_cdecl ngx_http_file_cache_index_cmp(const void *one,
+    const void *two);
+static ngx_int_t ngx_http_file_cache_load_index(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_prune_index(ngx_http_file_cache_t *cache);
+static ngx_rbtree_node_t *ngx_http_file_cache_lower_bound(
+    ngx_http_file_cache_shard_t *shard, u_char *key);
+static void ngx_http_file_cache_node_key(ngx_rbtree_node_t *node,
+    u_char *key);
+static ngx_int_t ngx_http_file_cache_loader_walk(
+    ngx_http_file_cache_loader_t *loader, ngx_str_t *path, ngx_log_t *log);
+#if (NGX_THREADS)
+static ngx_int_t ngx_http_file_cache_loader_post(
+    ngx_http_file_cache_loader_t *loader, ngx_str_t *path);
+static void ngx_http_file_cache_loader_thread(void *data, ngx_log_t *log);
+static void ngx_http_file_cache_loader_thread_event_handler(ngx_event_t *ev);
+#endif
+static void ngx_http_file_cache_loader_sleep(
+    ngx_http_file_cache_loader_t *loader);
+static ngx_msec_t ngx_http_file_cache_loader_time(
+    ngx_http_file_cache_loader_t *loader);
 static ngx_int_t ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static ngx_int_t ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx,
@@ -59,10 +145,25 @@ static ngx_int_t ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx,
 static ngx_int_t ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
 static ngx_int_t ngx_http_file_cache_add(ngx_http_file_cache_t *cache,
-    ngx_http_cache_t *c);
+    ngx_http_cache_t *c, ngx_uint_t source);
 static ngx_int_t ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx,
     ngx_str_t *path);
-static void ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache);
+static void ngx_http_file_cache_set_watermark(
+    ngx_http_file_cache_shard_t *shard);
+static ngx_int_t ngx_http_file_cache_init_shards(ngx_shm_zone_t *shm_zone,
+    ngx_http_file_cache_t *cache);
+static ngx_int_t ngx_http_file_cache_memory_init(ngx_shm_zone_t *shm_zone,
+    void *data);
+static ngx_int_t ngx_http_file_cache_memory_get(ngx_http_request_t *r,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_memory_set(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
+static void ngx_http_file_cache_memory_delete(ngx_http_file_cache_t *cache,
+    u_char *key);
+static ngx_http_file_cache_object_t *ngx_http_file_cache_memory_lookup(
+    ngx_http_file_cache_memory_t *memory, u_char *key);
+static void ngx_http_file_cache_memory_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
 
 
 ngx_str_t  ngx_http_cache_status[] = {
@@ -78,6 +179,8 @@ ngx_str_t  ngx_http_cache_status[] = {
 
 static u_char  ngx_http_file_cache_key[] = { LF, 'K', 'E', 'Y', ':', ' ' };
 
+static u_char  ngx_http_file_cache_index_magic[] = "NGXCIDX";
+
 
 static ngx_int_t
 ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
@@ -110,6 +213,13 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
             }
         }
 
+        if (cache->shards != ocache->shards) {
+            ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                          "cache \"%V\" had previously different shards",
+                          &shm_zone->shm.name);
+            return NGX_ERROR;
+        }
+
         cache->sh = ocache->sh;
 
         cache->shpool = ocache->shpool;
@@ -141,16 +251,16 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache->shpool->data = cache->sh;
 
-    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
-                    ngx_http_file_cache_rbtree_insert_value);
-
-    ngx_queue_init(&cache->sh->queue);
-
     cache->sh->cold = 1;
     cache->sh->loading = 0;
-    cache->sh->size = 0;
-    cache->sh->count = 0;
-    cache->sh->watermark = (ngx_uint_t) -1;
+    cache->sh->nshards = cache->shards;
+
+    cache->sh->shards = ngx_slab_alloc(cache->shpool,
+                               cache->shards
+                               * sizeof(ngx_http_file_cache_shard_t *));
+    if (cache->sh->shards == NULL) {
+        return NGX_ERROR;
+    }
 
     cache->bsize = ngx_fs_bsize(cache->path->name.data);
 
@@ -168,6 +278,152 @@ ngx_http_file_cache_init(ngx_shm_zone_t *shm_zone, void *data)
 
     cache->shpool->log_nomem = 0;
 
+    return ngx_http_file_cache_init_shards(shm_zone, cache);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_init_shards(ngx_shm_zone_t *shm_zone,
+    ngx_http_file_cache_t *cache)
+{
+    u_char                       *p;
+    size_t                        len, size;
+    ngx_uint_t                    i;
+    ngx_slab_pool_t              *shpool;
+    ngx_http_file_cache_shard_t  *shard;
+
+    /*
+     * with several shards the rest of the zone is split into
+     * separate slab pools, so each shard has its own mutex
+     */
+
+    size = (cache->shpool->pfree / cache->shards) << ngx_pagesize_shift;
+
+    if (cache->shards > 1 && size < 8 * ngx_pagesize) {
+        ngx_log_error(NGX_LOG_EMERG, shm_zone->shm.log, 0,
+                      "cache keys zone \"%V\" is too small for %ui shards",
+                      &shm_zone->shm.name, cache->shards);
+        return NGX_ERROR;
+    }
+
+    len = sizeof(" in cache keys zone \"\" shard ") + shm_zone->shm.name.len
+          + NGX_INT_T_LEN;
+
+    for (i = 0; i < cache->shards; i++) {
+
+        if (cache->shards == 1) {
+            shpool = cache->shpool;
+
+        } else {
+            p = ngx_slab_alloc(cache->shpool, size);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            shpool = (ngx_slab_pool_t *) p;
+
+            ngx_memzero(shpool, sizeof(ngx_slab_pool_t));
+
+            shpool->end = p + size;
+            shpool->min_shift = 3;
+            shpool->addr = p;
+
+            if (ngx_shmtx_create(&shpool->mutex, &shpool->lock, NULL)
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+
+            ngx_slab_init(shpool);
+
+            shpool->log_ctx = ngx_slab_alloc(shpool, len);
+            if (shpool->log_ctx == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_sprintf(shpool->log_ctx,
+                        " in cache keys zone \"%V\" shard %ui%Z",
+                        &shm_zone->shm.name, i);
+
+            shpool->log_nomem = 0;
+        }
+
+        shard = ngx_slab_alloc(shpool, sizeof(ngx_http_file_cache_shard_t));
+        if (shard == NULL) {
+            return NGX_ERROR;
+        }
+
+        ngx_rbtree_init(&shard->rbtree, &shard->sentinel,
+                        ngx_http_file_cache_rbtree_insert_value);
+
+        ngx_queue_init(&shard->queue);
+
+        shard->size = 0;
+        shard->count = 0;
+        shard->watermark = (ngx_uint_t) -1;
+        shard->shpool = shpool;
+
+        if (shpool != cache->shpool) {
+            shpool->data = shard;
+        }
+
+        cache->sh->shards[i] = shard;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_memory_init(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_file_cache_t  *ocache = data;
+
+    size_t                  len;
+    ngx_http_file_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->memory = ocache->memory;
+        cache->memory_shpool = ocache->memory_shpool;
+        return NGX_OK;
+    }
+
+    cache->memory_shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->memory = cache->memory_shpool->data;
+        return NGX_OK;
+    }
+
+    cache->memory = ngx_slab_alloc(cache->memory_shpool,
+                                   sizeof(ngx_http_file_cache_memory_t));
+    if (cache->memory == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->memory_shpool->data = cache->memory;
+
+    ngx_rbtree_init(&cache->memory->rbtree, &cache->memory->sentinel,
+                    ngx_http_file_cache_memory_insert_value);
+
+    ngx_queue_init(&cache->memory->queue);
+
+    len = sizeof(" in cache memory zone \"\"") + shm_zone->shm.name.len;
+
+    cache->memory_shpool->log_ctx = ngx_slab_alloc(cache->memory_shpool, len);
+    if (cache->memory_shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->memory_shpool->log_ctx,
+                " in cache memory zone \"%V\"%Z", &shm_zone->shm.name);
+
+    /* allocation failures are expected, old objects are evicted then */
+
+    cache->memory_shpool->log_nomem = 0;
+
     return NGX_OK;
 }
 
@@ -264,6 +520,7 @@ ngx_http_file_cache_create_key(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_file_cache_open(ngx_http_request_t *r)
 {
+    size_t                     size;
     ngx_int_t                  rc, rv;
     ngx_uint_t                 test;
     ngx_http_cache_t          *c;
@@ -343,6 +600,18 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         goto done;
     }
 
+    if (c->exists && cache->memory) {
+        rc = ngx_http_file_cache_memory_get(r, c);
+
+        if (rc == NGX_OK) {
+            return ngx_http_file_cache_read(r, c);
+        }
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -382,7 +651,17 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
     c->length = of.size;
     c->fs_size = (of.fs_size + cache->bsize - 1) / cache->bsize;
 
-    c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+    size = c->body_start;
+
+    if (cache->memory
+        && c->length > (off_t) size
+        && c->length <= (off_t) cache->max_object)
+    {
+        /* read the whole response to place it into the memory tier */
+        size = (size_t) c->length;
+    }
+
+    c->buf = ngx_create_temp_buf(r->pool, size);
     if (c->buf == NULL) {
         return NGX_ERROR;
     }
@@ -402,8 +681,8 @@ done:
 static ngx_int_t
 ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_msec_t                 now, timer;
-    ngx_http_file_cache_t     *cache;
+    ngx_msec_t                    now, timer;
+    ngx_http_file_cache_shard_t  *shard;
 
     if (!c->lock) {
         return NGX_DECLINED;
@@ -411,9 +690,9 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     now = ngx_current_msec;
 
-    cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     timer = c->node->lock_time - now;
 
@@ -424,7 +703,7 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->lock_time = c->node->lock_time;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache lock u:%d wt:%M",
@@ -481,9 +760,9 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 static void
 ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_uint_t              wait;
-    ngx_msec_t              now, timer;
-    ngx_http_file_cache_t  *cache;
+    ngx_uint_t                    wait;
+    ngx_msec_t                    now, timer;
+    ngx_http_file_cache_shard_t  *shard;
 
     now = ngx_current_msec;
 
@@ -496,10 +775,10 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
         goto wakeup;
     }
 
-    cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
     wait = 0;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     timer = c->node->lock_time - now;
 
@@ -507,7 +786,7 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
         wait = 1;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     if (wait) {
         ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
@@ -532,6 +811,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_int_t                      rc;
     ngx_uint_t                     i;
     ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_shard_t   *shard;
     ngx_http_file_cache_header_t  *h;
 
     n = ngx_http_file_cache_aio_read(r, c);
@@ -614,10 +894,23 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
     r->cached = 1;
 
     cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    if (cache->memory && (off_t) n == c->length
+        && c->length <= (off_t) cache->max_object)
+    {
+        if (!c->memory) {
+            ngx_http_file_cache_memory_set(cache, c);
+            c->memory = 1;
+        }
+
+        /* the response body is sent from the buffer */
+        c->buf->last = c->buf->pos + c->body_start;
+    }
 
     if (cache->sh->cold) {
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
         if (!c->node->exists) {
             c->node->uses = 1;
@@ -626,10 +919,10 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             c->node->uniq = c->uniq;
             c->node->fs_size = c->fs_size;
 
-            cache->sh->size += c->fs_size;
+            shard->size += c->fs_size;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
     }
 
     now = ngx_time();
@@ -638,7 +931,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->stale_updating = c->valid_sec + c->updating_sec >= now;
         c->stale_error = c->valid_sec + c->error_sec >= now;
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
         if (c->node->updating) {
             rc = NGX_HTTP_CACHE_UPDATING;
@@ -650,7 +943,7 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
             rc = NGX_HTTP_CACHE_STALE;
         }
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
         ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http file cache expired: %i %T %T",
@@ -666,17 +959,26 @@ ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 static ssize_t
 ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
+    size_t                     size;
 #if (NGX_HAVE_FILE_AIO || NGX_THREADS)
     ssize_t                    n;
     ngx_http_core_loc_conf_t  *clcf;
+#endif
+
+    if (c->memory) {
+        return (ssize_t) c->length;
+    }
+
+    size = c->buf->end - c->buf->pos;
 
+#if (NGX_HAVE_FILE_AIO || NGX_THREADS)
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 #endif
 
 #if (NGX_HAVE_FILE_AIO)
 
     if (clcf->aio == NGX_HTTP_AIO_ON && ngx_file_aio) {
-        n = ngx_file_aio_read(&c->file, c->buf->pos, c->body_start, 0, r->pool);
+        n = ngx_file_aio_read(&c->file, c->buf->pos, size, 0, r->pool);
 
         if (n != NGX_AGAIN) {
             c->reading = 0;
@@ -703,7 +1005,7 @@ ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->file.thread_handler = ngx_http_cache_thread_handler;
         c->file.thread_ctx = r;
 
-        n = ngx_thread_read(&c->file, c->buf->pos, c->body_start, 0, r->pool);
+        n = ngx_thread_read(&c->file, c->buf->pos, size, 0, r->pool);
 
         c->thread_task = c->file.thread_task;
         c->reading = (n == NGX_AGAIN);
@@ -713,7 +1015,7 @@ ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
 #endif
 
-    return ngx_read_file(&c->file, c->buf->pos, c->body_start, 0);
+    return ngx_read_file(&c->file, c->buf->pos, size, 0);
 }
 
 
@@ -819,15 +1121,18 @@ ngx_http_cache_thread_event_handler(ngx_event_t *ev)
 static ngx_int_t
 ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 {
-    ngx_int_t                    rc;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_int_t                     rc;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     fcn = c->node;
 
     if (fcn == NULL) {
-        fcn = ngx_http_file_cache_lookup(cache, c->key);
+        fcn = ngx_http_file_cache_lookup(shard, c->key);
     }
 
     if (fcn) {
@@ -866,35 +1171,35 @@ ngx_http_file_cache_exists(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
         goto done;
     }
 
-    fcn = ngx_slab_calloc_locked(cache->shpool,
+    fcn = ngx_slab_calloc_locked(shard->shpool,
                                  sizeof(ngx_http_file_cache_node_t));
     if (fcn == NULL) {
-        ngx_http_file_cache_set_watermark(cache);
+        ngx_http_file_cache_set_watermark(shard);
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
-        (void) ngx_http_file_cache_forced_expire(cache);
+        (void) ngx_http_file_cache_forced_expire(cache, shard);
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->shpool->mutex);
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
+        fcn = ngx_slab_calloc_locked(shard->shpool,
                                      sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
             ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                          "could not allocate node%s", cache->shpool->log_ctx);
+                          "could not allocate node%s", shard->shpool->log_ctx);
             rc = NGX_ERROR;
             goto failed;
         }
     }
 
-    cache->sh->count++;
+    shard->count++;
 
     ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
     ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
                NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-    ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+    ngx_rbtree_insert(&shard->rbtree, &fcn->node);
 
     fcn->uses = 1;
     fcn->count = 1;
@@ -910,12 +1215,13 @@ renew:
     fcn->uniq = 0;
     fcn->body_start = 0;
     fcn->fs_size = 0;
+    fcn->indexed = 0;
 
 done:
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
     c->uniq = fcn->uniq;
     c->error = fcn->error;
@@ -923,7 +1229,7 @@ done:
 
 failed:
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     return rc;
 }
@@ -964,8 +1270,26 @@ ngx_http_file_cache_name(ngx_http_request_t *r, ngx_path_t *path)
 }
 
 
+static ngx_http_file_cache_shard_t *
+ngx_http_file_cache_shard(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_uint_t  n;
+
+    if (cache->shards == 1) {
+        return cache->sh->shards[0];
+    }
+
+    /* the key start is used as the rbtree key, so the end is used here */
+
+    n = (key[NGX_HTTP_CACHE_KEY_LEN - 2] << 8)
+        | key[NGX_HTTP_CACHE_KEY_LEN - 1];
+
+    return cache->sh->shards[n % cache->shards];
+}
+
+
 static ngx_http_file_cache_node_t *
-ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
+ngx_http_file_cache_lookup(ngx_http_file_cache_shard_t *shard, u_char *key)
 {
     ngx_int_t                    rc;
     ngx_rbtree_key_t             node_key;
@@ -974,8 +1298,8 @@ ngx_http_file_cache_lookup(ngx_http_file_cache_t *cache, u_char *key)
 
     ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
 
-    node = cache->sh->rbtree.root;
-    sentinel = cache->sh->rbtree.sentinel;
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
 
     while (node != sentinel) {
 
@@ -1207,7 +1531,7 @@ ngx_http_file_cache_vary_header(ngx_http_request_t *r, ngx_md5_t *md5,
 static ngx_int_t
 ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_t  *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache reopen");
@@ -1219,16 +1543,17 @@ ngx_http_file_cache_reopen(ngx_http_request_t *r, ngx_http_cache_t *c)
         return NGX_DECLINED;
     }
 
-    cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     c->node->count--;
     c->node = NULL;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     c->secondary = 1;
+    c->memory = 0;
     c->file.name.len = 0;
     c->body_start = c->buf->end - c->buf->start;
 
@@ -1306,7 +1631,8 @@ ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf)
 static ngx_int_t
 ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
-    ngx_http_file_cache_t  *cache;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     if (!c->secondary) {
         return NGX_OK;
@@ -1328,13 +1654,15 @@ ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http file cache main key");
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     c->node->count--;
     c->node->updating = 0;
     c->node = NULL;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     c->file.name.len = 0;
 
@@ -1355,13 +1683,14 @@ ngx_http_file_cache_update_variant(ngx_http_request_t *r, ngx_http_cache_t *c)
 void
 ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 {
-    off_t                   fs_size;
-    ngx_int_t               rc;
-    ngx_file_uniq_t         uniq;
-    ngx_file_info_t         fi;
-    ngx_http_cache_t        *c;
-    ngx_ext_rename_file_t   ext;
-    ngx_http_file_cache_t  *cache;
+    off_t                         fs_size;
+    ngx_int_t                     rc;
+    ngx_file_uniq_t               uniq;
+    ngx_file_info_t               fi;
+    ngx_http_cache_t             *c;
+    ngx_ext_rename_file_t         ext;
+    ngx_http_file_cache_t        *cache;
+    ngx_http_file_cache_shard_t  *shard;
 
     c = r->cache;
 
@@ -1407,14 +1736,21 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
         }
     }
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    if (cache->memory) {
+        ngx_http_file_cache_memory_delete(cache, c->key);
+    }
+
+    shard = ngx_http_file_cache_shard(cache, c->key);
+
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     c->node->count--;
     c->node->error = 0;
     c->node->uniq = uniq;
     c->node->body_start = c->body_start;
+    c->node->indexed = 0;
 
-    cache->sh->size += fs_size - c->node->fs_size;
+    shard->size += fs_size - c->node->fs_size;
     c->node->fs_size = fs_size;
 
     if (rc == NGX_OK) {
@@ -1423,7 +1759,7 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
 
     c->node->updating = 0;
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 }
 
 
@@ -1550,6 +1886,10 @@ ngx_http_file_cache_update_header(ngx_http_request_t *r)
     (void) ngx_write_file(&file, (u_char *) &h,
                           sizeof(ngx_http_file_cache_header_t), 0);
 
+    if (c->file_cache->memory) {
+        ngx_http_file_cache_memory_delete(c->file_cache, c->key);
+    }
+
 done:
 
     if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
@@ -1583,9 +1923,11 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
-    b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
-    if (b->file == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    if (!c->memory) {
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
     }
 
     rc = ngx_http_send_header(r);
@@ -1594,16 +1936,24 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return rc;
     }
 
-    b->file_pos = c->body_start;
-    b->file_last = c->length;
-
-    b->in_file = (c->length - c->body_start) ? 1: 0;
     b->last_buf = (r == r->main) ? 1: 0;
     b->last_in_chain = 1;
 
-    b->file->fd = c->file.fd;
-    b->file->name = c->file.name;
-    b->file->log = r->connection->log;
+    if (c->memory) {
+        b->pos = c->buf->start + c->body_start;
+        b->last = c->buf->start + c->length;
+        b->memory = (c->length - c->body_start) ? 1: 0;
+
+    } else {
+        b->file_pos = c->body_start;
+        b->file_last = c->length;
+
+        b->in_file = (c->length - c->body_start) ? 1: 0;
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+    }
 
     out.buf = b;
     out.next = NULL;
@@ -1615,19 +1965,19 @@ ngx_http_cache_send(ngx_http_request_t *r)
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
-    ngx_http_file_cache_t       *cache;
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
     if (c->updated || c->node == NULL) {
         return;
     }
 
-    cache = c->file_cache;
+    shard = ngx_http_file_cache_shard(c->file_cache, c->key);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
                    "http file cache free, fd: %d", c->file.fd);
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     fcn = c->node;
     fcn->count--;
@@ -1646,13 +1996,13 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     } else if (!fcn->exists && fcn->count == 0 && c->min_uses == 1) {
         ngx_queue_remove(&fcn->queue);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
+        ngx_rbtree_delete(&shard->rbtree, &fcn->node);
+        ngx_slab_free_locked(shard->shpool, fcn);
+        shard->count--;
         c->node = NULL;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     c->updated = 1;
     c->updating = 0;
@@ -1699,7 +2049,8 @@ ngx_http_file_cache_cleanup(void *data)
 
 
 static time_t
-ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
+ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard)
 {
     u_char                      *name, *p;
     size_t                       len;
@@ -1727,14 +2078,14 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
     tries = 20;
     sentinel = NULL;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     for ( ;; ) {
-        if (ngx_queue_empty(&cache->sh->queue)) {
+        if (ngx_queue_empty(&shard->queue)) {
             break;
         }
 
-        q = ngx_queue_last(&cache->sh->queue);
+        q = ngx_queue_last(&shard->queue);
 
         if (q == sentinel) {
             break;
@@ -1748,7 +2099,7 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
                   fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
         if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
+            ngx_http_file_cache_delete(cache, shard, q, name);
             wait = 0;
             break;
         }
@@ -1766,7 +2117,7 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 
         ngx_queue_remove(q);
         fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                       "ignore long locked inactive cache entry %*s, count:%d",
@@ -1784,7 +2135,7 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
         break;
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     ngx_free(name);
 
@@ -1795,14 +2146,11 @@ ngx_http_file_cache_forced_expire(ngx_http_file_cache_t *cache)
 static time_t
 ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 {
-    u_char                      *name, *p;
-    size_t                       len;
-    time_t                       now, wait;
-    ngx_path_t                  *path;
-    ngx_msec_t                   elapsed;
-    ngx_queue_t                 *q;
-    ngx_http_file_cache_node_t  *fcn;
-    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+    u_char      *name;
+    size_t       len;
+    time_t       wait, next;
+    ngx_uint_t   i;
+    ngx_path_t  *path;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                    "http file cache expire");
@@ -1817,9 +2165,42 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
     ngx_memcpy(name, path->name.data, path->name.len);
 
+    wait = 10;
+
+    for (i = 0; i < cache->shards; i++) {
+        next = ngx_http_file_cache_expire_shard(cache, cache->sh->shards[i],
+                                                name);
+
+        if (next < wait) {
+            wait = next;
+        }
+
+        if (wait == 0) {
+            break;
+        }
+    }
+
+    ngx_free(name);
+
+    return wait;
+}
+
+
+static time_t
+ngx_http_file_cache_expire_shard(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, u_char *name)
+{
+    u_char                      *p;
+    size_t                       len;
+    time_t                       now, wait;
+    ngx_msec_t                   elapsed;
+    ngx_queue_t                 *q;
+    ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[2 * NGX_HTTP_CACHE_KEY_LEN];
+
     now = ngx_time();
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    ngx_shmtx_lock(&shard->shpool->mutex);
 
     for ( ;; ) {
 
@@ -1828,12 +2209,12 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
             break;
         }
 
-        if (ngx_queue_empty(&cache->sh->queue)) {
+        if (ngx_queue_empty(&shard->queue)) {
             wait = 10;
             break;
         }
 
-        q = ngx_queue_last(&cache->sh->queue);
+        q = ngx_queue_last(&shard->queue);
 
         fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
@@ -1850,7 +2231,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
                        fcn->key[0], fcn->key[1], fcn->key[2], fcn->key[3]);
 
         if (fcn->count == 0) {
-            ngx_http_file_cache_delete(cache, q, name);
+            ngx_http_file_cache_delete(cache, shard, q, name);
             goto next;
         }
 
@@ -1872,7 +2253,7 @@ ngx_http_file_cache_expire(ngx_http_file_cache_t *cache)
 
         ngx_queue_remove(q);
         fcn->expire = ngx_time() + cache->inactive;
-        ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+        ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
         ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
                       "ignore long locked inactive cache entry %*s, count:%d",
@@ -1895,27 +2276,26 @@ next:
         }
     }
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
-
-    ngx_free(name);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     return wait;
 }
 
 
 static void
-ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
-    u_char *name)
+ngx_http_file_cache_delete(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_shard_t *shard, ngx_queue_t *q, u_char *name)
 {
     u_char                      *p;
     size_t                       len;
     ngx_path_t                  *path;
     ngx_http_file_cache_node_t  *fcn;
+    u_char                       key[NGX_HTTP_CACHE_KEY_LEN];
 
     fcn = ngx_queue_data(q, ngx_http_file_cache_node_t, queue);
 
     if (fcn->exists) {
-        cache->sh->size -= fcn->fs_size;
+        shard->size -= fcn->fs_size;
 
         path = cache->path;
         p = name + path->name.len + 1 + path->len;
@@ -1925,9 +2305,12 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
         p = ngx_hex_dump(p, fcn->key, len);
         *p = '\0';
 
+        ngx_memcpy(key, &fcn->node.key, sizeof(ngx_rbtree_key_t));
+        ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key, len);
+
         fcn->count++;
         fcn->deleting = 1;
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+        ngx_shmtx_unlock(&shard->shpool->mutex);
 
         len = path->name.len + 1 + path->len + 2 * NGX_HTTP_CACHE_KEY_LEN;
         ngx_create_hashed_filename(path, name, len);
@@ -1935,21 +2318,25 @@ ngx_http_file_cache_delete(ngx_http_file_cache_t *cache, ngx_queue_t *q,
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
                        "http file cache expire: \"%s\"", name);
 
+        if (cache->memory) {
+            ngx_http_file_cache_memory_delete(cache, key);
+        }
+
         if (ngx_delete_file(name) == NGX_FILE_ERROR) {
             ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
                           ngx_delete_file_n " \"%s\" failed", name);
         }
 
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        ngx_shmtx_lock(&shard->shpool->mutex);
         fcn->count--;
         fcn->deleting = 0;
     }
 
     if (fcn->count == 0) {
         ngx_queue_remove(q);
-        ngx_rbtree_delete(&cache->sh->rbtree, &fcn->node);
-        ngx_slab_free_locked(cache->shpool, fcn);
-        cache->sh->count--;
+        ngx_rbtree_delete(&shard->rbtree, &fcn->node);
+        ngx_slab_free_locked(shard->shpool, fcn);
+        shard->count--;
     }
 }
 
@@ -1959,10 +2346,11 @@ ngx_http_file_cache_manager(void *data)
 {
     ngx_http_file_cache_t  *cache = data;
 
-    off_t       size;
-    time_t      wait;
-    ngx_msec_t  elapsed, next;
-    ngx_uint_t  count, watermark;
+    off_t                         size, shard_size, max;
+    time_t                        wait, now;
+    ngx_msec_t                    elapsed, next, n;
+    ngx_uint_t                    i, count, watermark;
+    ngx_http_file_cache_shard_t  *shard, *expire, *largest;
 
     cache->last = ngx_current_msec;
     cache->files = 0;
@@ -1975,23 +2363,55 @@ ngx_http_file_cache_manager(void *data)
     }
 
     for ( ;; ) {
-        ngx_shmtx_lock(&cache->shpool->mutex);
+        size = 0;
+        max = 0;
+        expire = NULL;
+        largest = NULL;
+
+        for (i = 0; i < cache->shards; i++) {
+            shard = cache->sh->shards[i];
+
+            ngx_shmtx_lock(&shard->shpool->mutex);
+
+            shard_size = shard->size;
+            count = shard->count;
+            watermark = shard->watermark;
 
-        size = cache->sh->size;
-        count = cache->sh->count;
-        watermark = cache->sh->watermark;
+            ngx_shmtx_unlock(&shard->shpool->mutex);
 
-        ngx_shmtx_unlock(&cache->shpool->mutex);
+            ngx_log_debug4(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                           "http file cache shard:%ui size: %O c:%ui w:%i",
+                           i, shard_size, count, (ngx_int_t) watermark);
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                       "http file cache size: %O c:%ui w:%i",
-                       size, count, (ngx_int_t) watermark);
+            size += shard_size;
 
-        if (size < cache->max_size && count < watermark) {
+            if (largest == NULL || shard_size > max) {
+                max = shard_size;
+                largest = shard;
+            }
+
+            if (count >= watermark && expire == NULL) {
+                expire = shard;
+            }
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "http file cache size: %O", size);
+
+        if (size < cache->max_size && expire == NULL) {
             break;
         }
 
-        wait = ngx_http_file_cache_forced_expire(cache);
+        /*
+         * the keys are evenly distributed between shards,
+         * so the largest shard is expected to hold the oldest entries
+         */
+
+        if (expire == NULL) {
+            expire = largest;
+        }
+
+        wait = ngx_http_file_cache_forced_expire(cache, expire);
 
         if (wait > 0) {
             next = (ngx_msec_t) wait * 1000;
@@ -2019,6 +2439,31 @@ ngx_http_file_cache_manager(void *data)
 
 done:
 
+    if (cache->index_interval) {
+
+        now = ngx_time();
+
+        if (cache->sh->cold) {
+            n = (ngx_msec_t) cache->index_interval * 1000;
+
+        } else {
+            if (now >= cache->index_time) {
+                ngx_http_file_cache_write_index(cache);
+
+                ngx_time_update();
+
+                now = ngx_time();
+                cache->index_time = now + cache->index_interval;
+            }
+
+            n = (ngx_msec_t) (cache->index_time - now) * 1000;
+        }
+
+        if (n < next) {
+            next = n;
+        }
+    }
+
     elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
 
     ngx_log_debug3(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
@@ -2030,51 +2475,685 @@ done:
 
 
 static void
-ngx_http_file_cache_loader(void *data)
+ngx_http_file_cache_write_index(ngx_http_file_cache_t *cache)
 {
-    ngx_http_file_cache_t  *cache = data;
+    off_t                                 offset;
+    size_t                                size;
+    ngx_uint_t                            i, k, n, batch, records;
+    ngx_file_t                            file;
+    ngx_rbtree_node_t                    *node;
+    ngx_http_file_cache_node_t           *fcn;
+    ngx_http_file_cache_shard_t          *shard;
+    ngx_http_file_cache_index_entry_t    *buf, *entry;
+    ngx_http_file_cache_index_record_t   *rec;
+    ngx_http_file_cache_index_header_t    header;
+    u_char                                key[NGX_HTTP_CACHE_KEY_LEN];
 
-    ngx_tree_ctx_t  tree;
+    ngx_memzero(&file, sizeof(ngx_file_t));
 
-    if (!cache->sh->cold || cache->sh->loading) {
-        return;
-    }
+    file.name = cache->index_temp;
+    file.log = ngx_cycle->log;
 
-    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_WRONLY,
+                            NGX_FILE_TRUNCATE, NGX_FILE_DEFAULT_ACCESS);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", file.name.data);
         return;
     }
 
-    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache loader");
+    offset = sizeof(ngx_http_file_cache_index_header_t);
+    records = 0;
 
-    tree.init_handler = NULL;
-    tree.file_handler = ngx_http_file_cache_manage_file;
-    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
-    tree.post_tree_handler = ngx_http_file_cache_noop;
-    tree.spec_handler = ngx_http_file_cache_delete_file;
-    tree.data = cache;
-    tree.alloc = 0;
-    tree.log = ngx_cycle->log;
+    for (i = 0; i < cache->shards; i++) {
+        shard = cache->sh->shards[i];
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+        ngx_shmtx_lock(&shard->shpool->mutex);
+        n = shard->count;
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+
+        if (n == 0) {
+            continue;
+        }
+
+        buf = ngx_alloc(n * sizeof(ngx_http_file_cache_index_entry_t),
+                        ngx_cycle->log);
+        if (buf == NULL) {
+            goto failed;
+        }
+
+        entry = buf;
+
+        /*
+         * the nodes are copied in the tree order in batches, the shard
+         * is unlocked between batches to let workers process requests
+         */
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        node = ngx_http_file_cache_lower_bound(shard, NULL);
+
+        for (batch = 0;
+             node && (ngx_uint_t) (entry - buf) < n;
+             node = ngx_rbtree_next(&shard->rbtree, node))
+        {
+            if (++batch > NGX_HTTP_CACHE_INDEX_RECORDS) {
+                ngx_http_file_cache_node_key(node, key);
+
+                ngx_shmtx_unlock(&shard->shpool->mutex);
+                ngx_shmtx_lock(&shard->shpool->mutex);
+
+                node = ngx_http_file_cache_lower_bound(shard, key);
+                batch = 1;
+
+                if (node == NULL) {
+                    break;
+                }
+            }
+
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            if (!fcn->exists || fcn->deleting) {
+                continue;
+            }
+
+            ngx_http_file_cache_node_key(node, entry->record.key);
+
+            entry->record.uniq = (uint64_t) fcn->uniq;
+            entry->record.fs_size = (uint64_t) fcn->fs_size;
+            entry->expire = fcn->expire;
+
+            entry++;
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+
+        n = entry - buf;
+
+        /*
+         * the expiration time is renewed on each use, so sorting by it
+         * restores the order of the queue, from least recently used
+         */
+
+        ngx_qsort(buf, n, sizeof(ngx_http_file_cache_index_entry_t),
+                  ngx_http_file_cache_index_cmp);
+
+        rec = (ngx_http_file_cache_index_record_t *) buf;
+
+        for (k = 0; k < n; k++) {
+            ngx_memmove(&rec[k], &buf[k].record,
+                        sizeof(ngx_http_file_cache_index_record_t));
+        }
+
+        size = n * sizeof(ngx_http_file_cache_index_record_t);
+
+        if (size && ngx_write_file(&file, (u_char *) rec, size, offset)
+                    == NGX_ERROR)
+        {
+            ngx_free(buf);
+            goto failed;
+        }
+
+        ngx_free(buf);
+
+        offset += size;
+        records += n;
+    }
+
+    ngx_memzero(&header, sizeof(ngx_http_file_cache_index_header_t));
+
+    ngx_memcpy(header.magic, ngx_http_file_cache_index_magic,
+               sizeof(ngx_http_file_cache_index_magic));
+    header.version = NGX_HTTP_CACHE_INDEX_VERSION;
+    header.record_size = sizeof(ngx_http_file_cache_index_record_t);
+    header.bsize = cache->bsize;
+    header.records = records;
+    header.time = ngx_time();
+
+    if (ngx_write_file(&file, (u_char *) &header,
+                       sizeof(ngx_http_file_cache_index_header_t), 0)
+        == NGX_ERROR)
+    {
+        goto failed;
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    if (ngx_rename_file(cache->index_temp.data, cache->index.data)
+        == NGX_FILE_ERROR)
+    {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      cache->index_temp.data, cache->index.data);
+        return;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache index: \"%s\" %ui",
+                   cache->index.data, records);
+
+    return;
+
+failed:
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    if (ngx_delete_file(file.name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_delete_file_n " \"%s\" failed", file.name.data);
+    }
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_file_cache_index_cmp(const void *one, const void *two)
+{
+    ngx_http_file_cache_index_entry_t  *first, *second;
+
+    first = (ngx_http_file_cache_index_entry_t *) one;
+    second = (ngx_http_file_cache_index_entry_t *) two;
+
+    if (first->expire < second->expire) {
+        return -1;
+    }
+
+    return (first->expire > second->expire) ? 1 : 0;
+}
+
+
+static void
+ngx_http_file_cache_loader(void *data)
+{
+    ngx_http_file_cache_t  *cache = data;
+
+    off_t                          size;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i;
+    ngx_http_file_cache_loader_t   loader;
+#if (NGX_THREADS)
+    ngx_uint_t                     pending;
+#endif
+
+    if (!cache->sh->cold || cache->sh->loading) {
+        return;
+    }
+
+    if (!ngx_atomic_cmp_set(&cache->sh->loading, 0, ngx_pid)) {
+        return;
+    }
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader");
+
+    ngx_memzero(&loader, sizeof(ngx_http_file_cache_loader_t));
+
+    loader.cache = cache;
+
+    if (cache->index.len) {
+        rc = ngx_http_file_cache_load_index(cache);
+
+        if (rc == NGX_ABORT) {
+            cache->sh->loading = 0;
+            return;
+        }
+
+        if (rc == NGX_OK) {
+
+            /*
+             * the keys zone is usable now, files created after the index
+             * was written are added by a walk which keeps the order
+             * of the known entries
+             */
+
+            cache->sh->cold = 0;
+            loader.reconcile = 1;
+        }
+    }
 
-    if (ngx_walk_tree(&tree, &cache->path->name) == NGX_ABORT) {
+#if (NGX_THREADS)
+
+    pending = 0;
+
+    if (cache->loader_thread_pool && !loader.reconcile) {
+
+        if (ngx_thread_pool_start(cache->loader_thread_pool,
+                                  (ngx_cycle_t *) ngx_cycle)
+            == NGX_OK)
+        {
+            loader.thread_pool = cache->loader_thread_pool;
+            loader.pending = &pending;
+        }
+    }
+
+#endif
+
+    loader.last = ngx_http_file_cache_loader_time(&loader);
+
+    rc = ngx_http_file_cache_loader_walk(&loader, &cache->path->name,
+                                         ngx_cycle->log);
+
+#if (NGX_THREADS)
+
+    /*
+     * the tasks post completion events to the loader process, which
+     * has no other events, so the events are processed here until
+     * all the tasks are completed
+     */
+
+    while (pending) {
+        ngx_process_events_and_timers((ngx_cycle_t *) ngx_cycle);
+    }
+
+#endif
+
+    if (rc == NGX_ABORT || ngx_quit || ngx_terminate) {
         cache->sh->loading = 0;
         return;
     }
 
+    if (loader.reconcile) {
+        ngx_http_file_cache_prune_index(cache);
+    }
+
     cache->sh->cold = 0;
     cache->sh->loading = 0;
 
+    size = 0;
+
+    for (i = 0; i < cache->shards; i++) {
+        size += cache->sh->shards[i]->size;
+    }
+
     ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
                   "http file cache: %V %.3fM, bsize: %uz",
                   &cache->path->name,
-                  ((double) cache->sh->size * cache->bsize) / (1024 * 1024),
+                  ((double) size * cache->bsize) / (1024 * 1024),
                   cache->bsize);
 }
 
 
+static ngx_int_t
+ngx_http_file_cache_load_index(ngx_http_file_cache_t *cache)
+{
+    off_t                                 offset;
+    size_t                                size;
+    ssize_t                               n;
+    ngx_err_t                             err;
+    ngx_int_t                             rc;
+    uint64_t                              records;
+    ngx_uint_t                            i, count;
+    ngx_file_t                            file;
+    ngx_file_info_t                       fi;
+    ngx_http_cache_t                      c;
+    ngx_http_file_cache_index_header_t    header;
+    ngx_http_file_cache_index_record_t   *buf;
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.name = cache->index;
+    file.log = ngx_cycle->log;
+
+    file.fd = ngx_open_file(file.name.data, NGX_FILE_RDONLY,
+                            NGX_FILE_OPEN, 0);
+
+    if (file.fd == NGX_INVALID_FILE) {
+        err = ngx_errno;
+
+        if (err != NGX_ENOENT) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, err,
+                          ngx_open_file_n " \"%s\" failed", file.name.data);
+        }
+
+        return NGX_DECLINED;
+    }
+
+    rc = NGX_DECLINED;
+    buf = NULL;
+
+    if (ngx_fd_info(file.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", file.name.data);
+        goto done;
+    }
+
+    n = ngx_read_file(&file, (u_char *) &header,
+                      sizeof(ngx_http_file_cache_index_header_t), 0);
+
+    if (n == NGX_ERROR) {
+        goto done;
+    }
+
+    if (n != sizeof(ngx_http_file_cache_index_header_t)
+        || ngx_memcmp(header.magic, ngx_http_file_cache_index_magic,
+                      sizeof(ngx_http_file_cache_index_magic))
+           != 0
+        || header.version != NGX_HTTP_CACHE_INDEX_VERSION
+        || header.record_size != sizeof(ngx_http_file_cache_index_record_t)
+        || header.bsize != cache->bsize
+        || (uint64_t) ngx_file_size(&fi)
+           != sizeof(ngx_http_file_cache_index_header_t)
+              + header.records * sizeof(ngx_http_file_cache_index_record_t))
+    {
+        ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                      "cache index \"%s\" is invalid, ignored",
+                      file.name.data);
+        goto done;
+    }
+
+    buf = ngx_alloc(NGX_HTTP_CACHE_INDEX_RECORDS
+                    * sizeof(ngx_http_file_cache_index_record_t),
+                    ngx_cycle->log);
+    if (buf == NULL) {
+        goto done;
+    }
+
+    offset = sizeof(ngx_http_file_cache_index_header_t);
+
+    for (records = 0; records < header.records; records += count) {
+
+        count = (ngx_uint_t) ngx_min(header.records - records,
+                                     NGX_HTTP_CACHE_INDEX_RECORDS);
+
+        size = count * sizeof(ngx_http_file_cache_index_record_t);
+
+        n = ngx_read_file(&file, (u_char *) buf, size, offset);
+
+        if (n == NGX_ERROR) {
+            goto done;
+        }
+
+        if ((size_t) n != size) {
+            ngx_log_error(NGX_LOG_CRIT, ngx_cycle->log, 0,
+                          ngx_read_file_n " read only %z of %uz from \"%s\"",
+                          n, size, file.name.data);
+            goto done;
+        }
+
+        offset += size;
+
+        for (i = 0; i < count; i++) {
+            ngx_memzero(&c, sizeof(ngx_http_cache_t));
+
+            ngx_memcpy(c.key, buf[i].key, NGX_HTTP_CACHE_KEY_LEN);
+            c.uniq = (ngx_file_uniq_t) buf[i].uniq;
+            c.fs_size = (off_t) buf[i].fs_size;
+
+            (void) ngx_http_file_cache_add(cache, &c,
+                                           NGX_HTTP_CACHE_LOAD_INDEX);
+        }
+
+        if (ngx_quit || ngx_terminate) {
+            rc = NGX_ABORT;
+            goto done;
+        }
+    }
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "http file cache: %V %uL entries loaded from index",
+                  &cache->path->name, header.records);
+
+    rc = NGX_OK;
+
+done:
+
+    if (buf) {
+        ngx_free(buf);
+    }
+
+    if (ngx_close_file(file.fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", file.name.data);
+    }
+
+    return rc;
+}
+
+
+static void
+ngx_http_file_cache_prune_index(ngx_http_file_cache_t *cache)
+{
+    ngx_uint_t                    i, batch, pruned;
+    ngx_rbtree_node_t            *node, *next;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
+    u_char                        key[NGX_HTTP_CACHE_KEY_LEN];
+
+    /*
+     * the entries loaded from the index whose files were not found
+     * by the walk were deleted after the index was written
+     */
+
+    pruned = 0;
+
+    for (i = 0; i < cache->shards; i++) {
+        shard = cache->sh->shards[i];
+
+        ngx_shmtx_lock(&shard->shpool->mutex);
+
+        node = ngx_http_file_cache_lower_bound(shard, NULL);
+
+        for (batch = 0; node; node = next) {
+
+            if (++batch > NGX_HTTP_CACHE_INDEX_RECORDS) {
+                ngx_http_file_cache_node_key(node, key);
+
+                ngx_shmtx_unlock(&shard->shpool->mutex);
+                ngx_shmtx_lock(&shard->shpool->mutex);
+
+                node = ngx_http_file_cache_lower_bound(shard, key);
+                batch = 1;
+
+                if (node == NULL) {
+                    break;
+                }
+            }
+
+            next = ngx_rbtree_next(&shard->rbtree, node);
+
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            if (!fcn->indexed) {
+                continue;
+            }
+
+            fcn->indexed = 0;
+
+            if (fcn->count || fcn->deleting) {
+                continue;
+            }
+
+            if (fcn->exists) {
+                shard->size -= fcn->fs_size;
+            }
+
+            ngx_queue_remove(&fcn->queue);
+            ngx_rbtree_delete(&shard->rbtree, node);
+            ngx_slab_free_locked(shard->shpool, fcn);
+            shard->count--;
+
+            pruned++;
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+    }
+
+    if (pruned) {
+        ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                      "http file cache: %V %ui entries of index not found",
+                      &cache->path->name, pruned);
+    }
+}
+
+
+static ngx_rbtree_node_t *
+ngx_http_file_cache_lower_bound(ngx_http_file_cache_shard_t *shard,
+    u_char *key)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_key_t             node_key;
+    ngx_rbtree_node_t           *node, *sentinel, *found;
+    ngx_http_file_cache_node_t  *fcn;
+
+    /* the first node with the key not less than the given one */
+
+    node = shard->rbtree.root;
+    sentinel = shard->rbtree.sentinel;
+
+    if (node == sentinel) {
+        return NULL;
+    }
+
+    if (key == NULL) {
+        return ngx_rbtree_min(node, sentinel);
+    }
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    found = NULL;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            rc = -1;
+
+        } else if (node_key > node->key) {
+            rc = 1;
+
+        } else {
+            fcn = (ngx_http_file_cache_node_t *) node;
+
+            rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+        }
+
+        if (rc <= 0) {
+            found = node;
+            node = node->left;
+
+        } else {
+            node = node->right;
+        }
+    }
+
+    return found;
+}
+
+
+static void
+ngx_http_file_cache_node_key(ngx_rbtree_node_t *node, u_char *key)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    fcn = (ngx_http_file_cache_node_t *) node;
+
+    ngx_memcpy(key, &node->key, sizeof(ngx_rbtree_key_t));
+    ngx_memcpy(&key[sizeof(ngx_rbtree_key_t)], fcn->key,
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_loader_walk(ngx_http_file_cache_loader_t *loader,
+    ngx_str_t *path, ngx_log_t *log)
+{
+    ngx_tree_ctx_t  tree;
+
+    tree.init_handler = NULL;
+    tree.file_handler = ngx_http_file_cache_manage_file;
+    tree.pre_tree_handler = ngx_http_file_cache_manage_directory;
+    tree.post_tree_handler = ngx_http_file_cache_noop;
+    tree.spec_handler = ngx_http_file_cache_delete_file;
+    tree.data = loader;
+    tree.alloc = 0;
+    tree.log = log;
+
+    return ngx_walk_tree(&tree, path);
+}
+
+
+#if (NGX_THREADS)
+
+static ngx_int_t
+ngx_http_file_cache_loader_post(ngx_http_file_cache_loader_t *loader,
+    ngx_str_t *path)
+{
+    ngx_thread_task_t                  *task;
+    ngx_http_file_cache_loader_task_t  *lt;
+
+    task = ngx_thread_task_alloc(ngx_cycle->pool,
+                                 sizeof(ngx_http_file_cache_loader_task_t)
+                                 + path->len + 1);
+    if (task == NULL) {
+        return NGX_OK;
+    }
+
+    lt = task->ctx;
+
+    lt->loader = *loader;
+    lt->loader.thread_pool = NULL;
+    lt->loader.thread = 1;
+    lt->loader.files = 0;
+
+    lt->path.len = path->len;
+    lt->path.data = (u_char *) (lt + 1);
+    ngx_memcpy(lt->path.data, path->data, path->len + 1);
+
+    task->handler = ngx_http_file_cache_loader_thread;
+    task->event.handler = ngx_http_file_cache_loader_thread_event_handler;
+    task->event.log = ngx_cycle->log;
+
+    if (ngx_thread_task_post(loader->thread_pool, task) != NGX_OK) {
+
+        /* walk the directory in the loader itself */
+
+        return NGX_OK;
+    }
+
+    (*loader->pending)++;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "http file cache loader thread: \"%s\"", path->data);
+
+    return NGX_DECLINED;
+}
+
+
+static void
+ngx_http_file_cache_loader_thread(void *data, ngx_log_t *log)
+{
+    ngx_http_file_cache_loader_task_t  *lt = data;
+
+    lt->loader.last = ngx_http_file_cache_loader_time(&lt->loader);
+
+    (void) ngx_http_file_cache_loader_walk(&lt->loader, &lt->path, log);
+}
+
+
+static void
+ngx_http_file_cache_loader_thread_event_handler(ngx_event_t *ev)
+{
+    ngx_thread_task_t                  *task;
+    ngx_http_file_cache_loader_task_t  *lt;
+
+    /* the task is completed, called in the loader process itself */
+
+    task = (ngx_thread_task_t *) ((u_char *) ev
+                                  - offsetof(ngx_thread_task_t, event));
+    lt = task->ctx;
+
+    (*lt->loader.pending)--;
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 {
@@ -2085,28 +3164,37 @@ ngx_http_file_cache_noop(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 static ngx_int_t
 ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 {
-    ngx_msec_t              elapsed;
-    ngx_http_file_cache_t  *cache;
+    ngx_msec_t                     elapsed;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_loader_t  *loader;
 
-    cache = ctx->data;
+    loader = ctx->data;
+    cache = loader->cache;
+
+    if ((path->len == cache->index.len
+         && ngx_strcmp(path->data, cache->index.data) == 0)
+        || (path->len == cache->index_temp.len
+            && ngx_strcmp(path->data, cache->index_temp.data) == 0))
+    {
+        return NGX_OK;
+    }
 
     if (ngx_http_file_cache_add_file(ctx, path) != NGX_OK) {
         (void) ngx_http_file_cache_delete_file(ctx, path);
     }
 
-    if (++cache->files >= cache->loader_files) {
-        ngx_http_file_cache_loader_sleep(cache);
+    if (++loader->files >= cache->loader_files) {
+        ngx_http_file_cache_loader_sleep(loader);
 
     } else {
-        ngx_time_update();
+        elapsed = ngx_abs((ngx_msec_int_t)
+                      (ngx_http_file_cache_loader_time(loader) - loader->last));
 
-        elapsed = ngx_abs((ngx_msec_int_t) (ngx_current_msec - cache->last));
-
-        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ctx->log, 0,
                        "http file cache loader time elapsed: %M", elapsed);
 
         if (elapsed >= cache->loader_threshold) {
-            ngx_http_file_cache_loader_sleep(cache);
+            ngx_http_file_cache_loader_sleep(loader);
         }
     }
 
@@ -2117,25 +3205,62 @@ ngx_http_file_cache_manage_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 static ngx_int_t
 ngx_http_file_cache_manage_directory(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 {
+#if (NGX_THREADS)
+    ngx_path_t                    *cpath;
+    ngx_http_file_cache_loader_t  *loader;
+#endif
+
     if (path->len >= 5
         && ngx_strncmp(path->data + path->len - 5, "/temp", 5) == 0)
     {
-        return NGX_DECLINED;
+        return NGX_DECLINED;
+    }
+
+#if (NGX_THREADS)
+
+    loader = ctx->data;
+    cpath = loader->cache->path;
+
+    /* the first level directories are walked in threads */
+
+    if (loader->thread_pool
+        && cpath->level[0]
+        && path->len == cpath->name.len + 1 + cpath->level[0])
+    {
+        return ngx_http_file_cache_loader_post(loader, path);
     }
 
+#endif
+
     return NGX_OK;
 }
 
 
 static void
-ngx_http_file_cache_loader_sleep(ngx_http_file_cache_t *cache)
+ngx_http_file_cache_loader_sleep(ngx_http_file_cache_loader_t *loader)
 {
-    ngx_msleep(cache->loader_sleep);
+    ngx_msleep(loader->cache->loader_sleep);
+
+    loader->last = ngx_http_file_cache_loader_time(loader);
+    loader->files = 0;
+}
 
-    ngx_time_update();
 
-    cache->last = ngx_current_msec;
-    cache->files = 0;
+static ngx_msec_t
+ngx_http_file_cache_loader_time(ngx_http_file_cache_loader_t *loader)
+{
+    struct timeval  tv;
+
+    if (!loader->thread) {
+        ngx_time_update();
+        return ngx_current_msec;
+    }
+
+    /* the cached time is only updated by the loader process itself */
+
+    ngx_gettimeofday(&tv);
+
+    return (ngx_msec_t) (tv.tv_sec * 1000 + tv.tv_usec / 1000);
 }
 
 
@@ -2145,8 +3270,9 @@ ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
     u_char                 *p;
     ngx_int_t               n;
     ngx_uint_t              i;
-    ngx_http_cache_t        c;
-    ngx_http_file_cache_t  *cache;
+    ngx_http_cache_t               c;
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_loader_t  *loader;
 
     if (name->len < 2 * NGX_HTTP_CACHE_KEY_LEN) {
         return NGX_ERROR;
@@ -2170,7 +3296,8 @@ ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
     }
 
     ngx_memzero(&c, sizeof(ngx_http_cache_t));
-    cache = ctx->data;
+    loader = ctx->data;
+    cache = loader->cache;
 
     c.length = ctx->size;
     c.fs_size = (ctx->fs_size + cache->bsize - 1) / cache->bsize;
@@ -2189,50 +3316,77 @@ ngx_http_file_cache_add_file(ngx_tree_ctx_t *ctx, ngx_str_t *name)
         c.key[i] = (u_char) n;
     }
 
-    return ngx_http_file_cache_add(cache, &c);
+    return ngx_http_file_cache_add(cache, &c,
+                                   loader->reconcile
+                                   ? NGX_HTTP_CACHE_LOAD_RECONCILE
+                                   : NGX_HTTP_CACHE_LOAD_WALK);
 }
 
 
 static ngx_int_t
-ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
+ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c,
+    ngx_uint_t source)
 {
-    ngx_http_file_cache_node_t  *fcn;
+    ngx_http_file_cache_node_t   *fcn;
+    ngx_http_file_cache_shard_t  *shard;
 
-    ngx_shmtx_lock(&cache->shpool->mutex);
+    shard = ngx_http_file_cache_shard(cache, c->key);
 
-    fcn = ngx_http_file_cache_lookup(cache, c->key);
+    ngx_shmtx_lock(&shard->shpool->mutex);
+
+    fcn = ngx_http_file_cache_lookup(shard, c->key);
 
     if (fcn == NULL) {
 
-        fcn = ngx_slab_calloc_locked(cache->shpool,
+        fcn = ngx_slab_calloc_locked(shard->shpool,
                                      sizeof(ngx_http_file_cache_node_t));
         if (fcn == NULL) {
-            ngx_http_file_cache_set_watermark(cache);
+            ngx_http_file_cache_set_watermark(shard);
 
             if (cache->fail_time != ngx_time()) {
                 cache->fail_time = ngx_time();
                 ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, 0,
-                           "could not allocate node%s", cache->shpool->log_ctx);
+                           "could not allocate node%s", shard->shpool->log_ctx);
             }
 
-            ngx_shmtx_unlock(&cache->shpool->mutex);
+            ngx_shmtx_unlock(&shard->shpool->mutex);
             return NGX_ERROR;
         }
 
-        cache->sh->count++;
+        shard->count++;
 
         ngx_memcpy((u_char *) &fcn->node.key, c->key, sizeof(ngx_rbtree_key_t));
 
         ngx_memcpy(fcn->key, &c->key[sizeof(ngx_rbtree_key_t)],
                    NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
 
-        ngx_rbtree_insert(&cache->sh->rbtree, &fcn->node);
+        ngx_rbtree_insert(&shard->rbtree, &fcn->node);
 
         fcn->uses = 1;
         fcn->exists = 1;
+        fcn->uniq = c->uniq;
         fcn->fs_size = c->fs_size;
+        fcn->indexed = (source == NGX_HTTP_CACHE_LOAD_INDEX);
+
+        shard->size += c->fs_size;
+
+    } else if (source == NGX_HTTP_CACHE_LOAD_RECONCILE) {
+
+        /*
+         * the order of the known entries is kept, an entry loaded from
+         * the index is updated from the file, which might be rewritten
+         */
 
-        cache->sh->size += c->fs_size;
+        if (fcn->indexed) {
+            fcn->indexed = 0;
+            fcn->uniq = 0;
+
+            shard->size += c->fs_size - fcn->fs_size;
+            fcn->fs_size = c->fs_size;
+        }
+
+        ngx_shmtx_unlock(&shard->shpool->mutex);
+        return NGX_OK;
 
     } else {
         ngx_queue_remove(&fcn->queue);
@@ -2240,9 +3394,9 @@ ngx_http_file_cache_add(ngx_http_file_cache_t *cache, ngx_http_cache_t *c)
 
     fcn->expire = ngx_time() + cache->inactive;
 
-    ngx_queue_insert_head(&cache->sh->queue, &fcn->queue);
+    ngx_queue_insert_head(&shard->queue, &fcn->queue);
 
-    ngx_shmtx_unlock(&cache->shpool->mutex);
+    ngx_shmtx_unlock(&shard->shpool->mutex);
 
     return NGX_OK;
 }
@@ -2264,12 +3418,243 @@ ngx_http_file_cache_delete_file(ngx_tree_ctx_t *ctx, ngx_str_t *path)
 
 
 static void
-ngx_http_file_cache_set_watermark(ngx_http_file_cache_t *cache)
+ngx_http_file_cache_set_watermark(ngx_http_file_cache_shard_t *shard)
 {
-    cache->sh->watermark = cache->sh->count - cache->sh->count / 8;
+    shard->watermark = shard->count - shard->count / 8;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
-                   "http file cache watermark: %ui", cache->sh->watermark);
+                   "http file cache watermark: %ui", shard->watermark);
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_memory_get(ngx_http_request_t *r, ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_t         *cache;
+    ngx_http_file_cache_object_t  *obj;
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->memory_shpool->mutex);
+
+    obj = ngx_http_file_cache_memory_lookup(cache->memory, c->key);
+
+    /*
+     * the object is only valid for the cache file it was read from;
+     * the file is not known for nodes added by the cache loader,
+     * such objects are removed when the file is updated or deleted
+     */
+
+    if (obj == NULL || (c->uniq && obj->uniq != c->uniq)) {
+        ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    c->buf = ngx_create_temp_buf(r->pool, ngx_max(obj->len, c->body_start));
+    if (c->buf == NULL) {
+        ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(c->buf->pos, obj->data, obj->len);
+
+    c->length = obj->len;
+    c->fs_size = obj->fs_size;
+
+    ngx_queue_remove(&obj->queue);
+    ngx_queue_insert_head(&cache->memory->queue, &obj->queue);
+
+    ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache memory hit: %O", c->length);
+
+    c->file.log = r->connection->log;
+    c->memory = 1;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_file_cache_memory_set(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c)
+{
+    size_t                         size;
+    ngx_uint_t                     tries;
+    ngx_queue_t                   *q;
+    ngx_http_file_cache_object_t  *obj, *old;
+
+    size = offsetof(ngx_http_file_cache_object_t, data) + (size_t) c->length;
+
+    ngx_shmtx_lock(&cache->memory_shpool->mutex);
+
+    old = ngx_http_file_cache_memory_lookup(cache->memory, c->key);
+
+    if (old) {
+        if (old->uniq == c->uniq) {
+            ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+            return;
+        }
+
+        ngx_queue_remove(&old->queue);
+        ngx_rbtree_delete(&cache->memory->rbtree, &old->node);
+        ngx_slab_free_locked(cache->memory_shpool, old);
+    }
+
+    tries = 20;
+
+    for ( ;; ) {
+        obj = ngx_slab_alloc_locked(cache->memory_shpool, size);
+
+        if (obj || ngx_queue_empty(&cache->memory->queue) || --tries == 0) {
+            break;
+        }
+
+        /* evict the least recently used object */
+
+        q = ngx_queue_last(&cache->memory->queue);
+        old = ngx_queue_data(q, ngx_http_file_cache_object_t, queue);
+
+        ngx_queue_remove(q);
+        ngx_rbtree_delete(&cache->memory->rbtree, &old->node);
+        ngx_slab_free_locked(cache->memory_shpool, old);
+    }
+
+    if (obj == NULL) {
+        ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                       "http file cache memory full, %uz bytes", size);
+        return;
+    }
+
+    ngx_memcpy((u_char *) &obj->node.key, c->key, sizeof(ngx_rbtree_key_t));
+
+    ngx_memcpy(obj->key, &c->key[sizeof(ngx_rbtree_key_t)],
+               NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+    obj->uniq = c->uniq;
+    obj->fs_size = c->fs_size;
+    obj->len = (size_t) c->length;
+
+    ngx_memcpy(obj->data, c->buf->pos, obj->len);
+
+    ngx_rbtree_insert(&cache->memory->rbtree, &obj->node);
+    ngx_queue_insert_head(&cache->memory->queue, &obj->queue);
+
+    ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->file.log, 0,
+                   "http file cache memory set: %uz", obj->len);
+}
+
+
+static void
+ngx_http_file_cache_memory_delete(ngx_http_file_cache_t *cache, u_char *key)
+{
+    ngx_http_file_cache_object_t  *obj;
+
+    ngx_shmtx_lock(&cache->memory_shpool->mutex);
+
+    obj = ngx_http_file_cache_memory_lookup(cache->memory, key);
+
+    if (obj) {
+        ngx_queue_remove(&obj->queue);
+        ngx_rbtree_delete(&cache->memory->rbtree, &obj->node);
+        ngx_slab_free_locked(cache->memory_shpool, obj);
+    }
+
+    ngx_shmtx_unlock(&cache->memory_shpool->mutex);
+}
+
+
+static ngx_http_file_cache_object_t *
+ngx_http_file_cache_memory_lookup(ngx_http_file_cache_memory_t *memory,
+    u_char *key)
+{
+    ngx_int_t                      rc;
+    ngx_rbtree_key_t               node_key;
+    ngx_rbtree_node_t             *node, *sentinel;
+    ngx_http_file_cache_object_t  *obj;
+
+    ngx_memcpy((u_char *) &node_key, key, sizeof(ngx_rbtree_key_t));
+
+    node = memory->rbtree.root;
+    sentinel = memory->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (node_key < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (node_key > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* node_key == node->key */
+
+        obj = (ngx_http_file_cache_object_t *) node;
+
+        rc = ngx_memcmp(&key[sizeof(ngx_rbtree_key_t)], obj->key,
+                        NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t));
+
+        if (rc == 0) {
+            return obj;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    /* not found */
+
+    return NULL;
+}
+
+
+static void
+ngx_http_file_cache_memory_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t             **p;
+    ngx_http_file_cache_object_t   *obj, *objt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            obj = (ngx_http_file_cache_object_t *) node;
+            objt = (ngx_http_file_cache_object_t *) temp;
+
+            p = (ngx_memcmp(obj->key, objt->key,
+                            NGX_HTTP_CACHE_KEY_LEN - sizeof(ngx_rbtree_key_t))
+                 < 0)
+                    ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
 }
 
 
@@ -2306,12 +3691,13 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     off_t                   max_size;
     u_char                 *last, *p;
-    time_t                  inactive;
-    ssize_t                 size;
+    time_t                  inactive, index_interval;
+    ssize_t                 size, memory_size, max_object;
     ngx_str_t               s, name, *value;
     ngx_int_t               loader_files, manager_files;
     ngx_msec_t              loader_sleep, manager_sleep, loader_threshold,
                             manager_threshold;
+    ngx_int_t               shards;
     ngx_uint_t              i, n, use_temp_path;
     ngx_array_t            *caches;
     ngx_http_file_cache_t  *cache, **ce;
@@ -2329,6 +3715,7 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     use_temp_path = 1;
 
     inactive = 600;
+    index_interval = 0;
 
     loader_files = 100;
     loader_sleep = 50;
@@ -2341,6 +3728,9 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     name.len = 0;
     size = 0;
     max_size = NGX_MAX_OFF_T_VALUE;
+    shards = 1;
+    memory_size = 0;
+    max_object = 64 * 1024;
 
     value = cf->args->elts;
 
@@ -2446,6 +3836,66 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shards=", 7) == 0) {
+
+            shards = ngx_atoi(value[i].data + 7, value[i].len - 7);
+            if (shards == NGX_ERROR || shards == 0 || shards > 256) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid shards value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+#if !(NGX_HAVE_ATOMIC_OPS)
+            if (shards > 1) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "\"shards\" parameter requires "
+                                   "atomic operations on this platform");
+                return NGX_CONF_ERROR;
+            }
+#endif
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "memory_tier=", 12) == 0) {
+
+            s.len = value[i].len - 12;
+            s.data = value[i].data + 12;
+
+            memory_size = ngx_parse_size(&s);
+            if (memory_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid memory_tier value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (memory_size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "memory tier \"%V\" is too small",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_object=", 11) == 0) {
+
+            s.len = value[i].len - 11;
+            s.data = value[i].data + 11;
+
+            max_object = ngx_parse_size(&s);
+            if (max_object == NGX_ERROR || max_object == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_object value \"%V\"",
+                                   &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
 
             s.len = value[i].len - 9;
@@ -2518,6 +3968,40 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "loader_thread_pool=", 19) == 0) {
+#if (NGX_THREADS)
+            s.len = value[i].len - 19;
+            s.data = value[i].data + 19;
+
+            cache->loader_thread_pool = ngx_thread_pool_add(cf, &s);
+            if (cache->loader_thread_pool == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+#else
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"loader_thread_pool\" is unsupported "
+                               "on this platform");
+            return NGX_CONF_ERROR;
+#endif
+        }
+
+        if (ngx_strncmp(value[i].data, "index_interval=", 15) == 0) {
+
+            s.len = value[i].len - 15;
+            s.data = value[i].data + 15;
+
+            index_interval = ngx_parse_time(&s, 1);
+            if (index_interval == (time_t) NGX_ERROR || index_interval == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid index_interval value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "manager_files=", 14) == 0) {
 
             manager_files = ngx_atoi(value[i].data + 14, value[i].len - 14);
@@ -2603,10 +4087,54 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     cache->shm_zone->init = ngx_http_file_cache_init;
     cache->shm_zone->data = cache;
 
+    if (memory_size) {
+
+        /* keys zone names cannot contain ":" */
+
+        s.len = name.len + sizeof(":memory") - 1;
+        s.data = ngx_pnalloc(cf->pool, s.len);
+        if (s.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(s.data, "%V:memory", &name);
+
+        cache->memory_zone = ngx_shared_memory_add(cf, &s, memory_size,
+                                                   cmd->post);
+        if (cache->memory_zone == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        cache->memory_zone->init = ngx_http_file_cache_memory_init;
+        cache->memory_zone->data = cache;
+
+        cache->max_object = max_object;
+    }
+
+    if (index_interval) {
+        s.len = cache->path->name.len + sizeof("/cache.index.tmp");
+
+        cache->index.data = ngx_pnalloc(cf->pool, 2 * s.len);
+        if (cache->index.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        last = ngx_sprintf(cache->index.data, "%V/cache.index%Z",
+                           &cache->path->name);
+        cache->index.len = last - cache->index.data - 1;
+
+        cache->index_temp.data = last;
+        last = ngx_sprintf(last, "%V/cache.index.tmp%Z", &cache->path->name);
+        cache->index_temp.len = last - cache->index_temp.data - 1;
+
+        cache->index_interval = index_interval;
+    }
+
     cache->use_temp_path = use_temp_path;
 
     cache->inactive = inactive;
     cache->max_size = max_size;
+    cache->shards = shards;
 
     caches = (ngx_array_t *) (confp + cmd->offset);
 
@@ -9,6 +9,16 @@
 #include <ngx_core.h>
 #include <ngx_http.h>
 
+#if (NGX_HAVE_SSE42)
+#include <nmmintrin.h>
+#endif
+#if (NGX_HAVE_AVX2)
+#include <immintrin.h>
+#endif
+
+
+static ngx_http_name_hash_t *ngx_http_arg_hash(ngx_http_request_t *r);
+
 
 static uint32_t  usual[] = {
     0xffffdbfe, /* 1111 1111 1111 1111  1101 1011 1111 1110 */
@@ -98,6 +108,239 @@ static uint32_t  usual[] = {
 #endif
 
 
+/*
+ * The bytes which change the state in sw_check_uri and sw_uri states
+ * of the request line, and in sw_value state of a header line.
+ * The vectorized scans below stop at any of these bytes, and leave
+ * the last incomplete block to the state machines.
+ */
+
+static u_char  ngx_http_parse_uri_stop[16] =
+    { '\0', CR, LF, ' ', '#', '%', '+', '.', '/', '?', '\\' };
+
+static u_char  ngx_http_parse_args_stop[16] =
+    { '\0', CR, LF, ' ', '#' };
+
+static u_char  ngx_http_parse_value_stop[16] =
+    { '\0', CR, LF, ' ' };
+
+/* the header name characters which have non-zero lowcase[] */
+
+static u_char  ngx_http_parse_name_ranges[16] = "--09AZaz";
+
+
+#if (NGX_HAVE_SSE42)
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_parse_skip_sse42(u_char *p, u_char *last, u_char *stop, int n)
+{
+    int      i;
+    __m128i  s, v;
+
+    s = _mm_loadu_si128((const __m128i *) stop);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+
+        i = _mm_cmpestri(s, n, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY
+                         |_SIDD_LEAST_SIGNIFICANT);
+        if (i != 16) {
+            return p + i;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+__attribute__((target("sse4.2")))
+static u_char *
+ngx_http_parse_skip_name_sse42(u_char *p, u_char *last)
+{
+    int      i;
+    __m128i  s, v;
+
+    s = _mm_loadu_si128((const __m128i *) ngx_http_parse_name_ranges);
+
+    while (last - p >= 16) {
+        v = _mm_loadu_si128((const __m128i *) p);
+
+        i = _mm_cmpestri(s, 8, v, 16,
+                         _SIDD_UBYTE_OPS|_SIDD_CMP_RANGES
+                         |_SIDD_NEGATIVE_POLARITY|_SIDD_LEAST_SIGNIFICANT);
+        if (i != 16) {
+            return p + i;
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+#endif
+
+
+#if (NGX_HAVE_AVX2)
+
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_parse_skip_avx2(u_char *p, u_char *last, u_char *stop, int n)
+{
+    int       i;
+    uint32_t  mask;
+    __m128i   v16, m16;
+    __m256i   v, m, s[16];
+
+    for (i = 0; i < n; i++) {
+        s[i] = _mm256_set1_epi8((char) stop[i]);
+    }
+
+    while (last - p >= 32) {
+        v = _mm256_loadu_si256((const __m256i *) p);
+
+        m = _mm256_cmpeq_epi8(v, s[0]);
+
+        for (i = 1; i < n; i++) {
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, s[i]));
+        }
+
+        mask = (uint32_t) _mm256_movemask_epi8(m);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    if (last - p >= 16) {
+        v16 = _mm_loadu_si128((const __m128i *) p);
+
+        m16 = _mm_cmpeq_epi8(v16, _mm256_castsi256_si128(s[0]));
+
+        for (i = 1; i < n; i++) {
+            m16 = _mm_or_si128(m16, _mm_cmpeq_epi8(v16,
+                                              _mm256_castsi256_si128(s[i])));
+        }
+
+        mask = (uint32_t) _mm_movemask_epi8(m16);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+
+__attribute__((target("avx2")))
+static u_char *
+ngx_http_parse_skip_name_avx2(u_char *p, u_char *last)
+{
+    uint32_t  mask;
+    __m128i   v16, l16, m16;
+    __m256i   v, l, m;
+
+    while (last - p >= 32) {
+        v = _mm256_loadu_si256((const __m256i *) p);
+
+        /* "a".."z" after case folding */
+
+        l = _mm256_sub_epi8(_mm256_or_si256(v, _mm256_set1_epi8(0x20)),
+                            _mm256_set1_epi8('a'));
+        m = _mm256_cmpeq_epi8(_mm256_min_epu8(l, _mm256_set1_epi8(25)), l);
+
+        /* "0".."9" */
+
+        l = _mm256_sub_epi8(v, _mm256_set1_epi8('0'));
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(
+                                 _mm256_min_epu8(l, _mm256_set1_epi8(9)), l));
+
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8('-')));
+
+        mask = ~ (uint32_t) _mm256_movemask_epi8(m);
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 32;
+    }
+
+    if (last - p >= 16) {
+        v16 = _mm_loadu_si128((const __m128i *) p);
+
+        l16 = _mm_sub_epi8(_mm_or_si128(v16, _mm_set1_epi8(0x20)),
+                           _mm_set1_epi8('a'));
+        m16 = _mm_cmpeq_epi8(_mm_min_epu8(l16, _mm_set1_epi8(25)), l16);
+
+        l16 = _mm_sub_epi8(v16, _mm_set1_epi8('0'));
+        m16 = _mm_or_si128(m16, _mm_cmpeq_epi8(
+                                  _mm_min_epu8(l16, _mm_set1_epi8(9)), l16));
+
+        m16 = _mm_or_si128(m16, _mm_cmpeq_epi8(v16, _mm_set1_epi8('-')));
+
+        mask = ~ (uint32_t) _mm_movemask_epi8(m16) & 0xffff;
+
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+
+        p += 16;
+    }
+
+    return p;
+}
+
+#endif
+
+
+static ngx_inline u_char *
+ngx_http_parse_skip(u_char *p, u_char *last, u_char *stop, int n)
+{
+#if (NGX_HAVE_AVX2)
+    if (ngx_cpu_features & NGX_CPU_AVX2) {
+        return ngx_http_parse_skip_avx2(p, last, stop, n);
+    }
+#endif
+
+#if (NGX_HAVE_SSE42)
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        return ngx_http_parse_skip_sse42(p, last, stop, n);
+    }
+#endif
+
+    return p;
+}
+
+
+static ngx_inline u_char *
+ngx_http_parse_skip_name(u_char *p, u_char *last)
+{
+#if (NGX_HAVE_AVX2)
+    if (ngx_cpu_features & NGX_CPU_AVX2) {
+        return ngx_http_parse_skip_name_avx2(p, last);
+    }
+#endif
+
+#if (NGX_HAVE_SSE42)
+    if (ngx_cpu_features & NGX_CPU_SSE42) {
+        return ngx_http_parse_skip_name_sse42(p, last);
+    }
+#endif
+
+    return p;
+}
+
+
 /* gcc, icc, msvc and others compile these switches as an jump table */
 
 ngx_int_t
@@ -546,6 +789,8 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_check_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+                p = ngx_http_parse_skip(p + 1, b->last,
+                                        ngx_http_parse_uri_stop, 11) - 1;
                 break;
             }
 
@@ -632,6 +877,8 @@ ngx_http_parse_request_line(ngx_http_request_t *r, ngx_buf_t *b)
         case sw_uri:
 
             if (usual[ch >> 5] & (1U << (ch & 0x1f))) {
+                p = ngx_http_parse_skip(p + 1, b->last,
+                                        ngx_http_parse_args_stop, 5) - 1;
                 break;
             }
 
@@ -846,7 +1093,7 @@ ngx_int_t
 ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
     ngx_uint_t allow_underscores)
 {
-    u_char      c, ch, *p;
+    u_char      c, ch, *p, *q;
     ngx_uint_t  hash, i;
     enum {
         sw_start = 0,
@@ -941,6 +1188,19 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 hash = ngx_hash(hash, c);
                 r->lowcase_header[i++] = c;
                 i &= (NGX_HTTP_LC_HEADER_LEN - 1);
+
+                /* the name characters found by the scan are lowcased */
+
+                for (q = ngx_http_parse_skip_name(p + 1, b->last);
+                     p + 1 < q;
+                     p++)
+                {
+                    c = p[1] | 0x20;
+                    hash = ngx_hash(hash, c);
+                    r->lowcase_header[i++] = c;
+                    i &= (NGX_HTTP_LC_HEADER_LEN - 1);
+                }
+
                 break;
             }
 
@@ -1035,6 +1295,10 @@ ngx_http_parse_header_line(ngx_http_request_t *r, ngx_buf_t *b,
                 goto done;
             case '\0':
                 return NGX_HTTP_PARSE_INVALID_HEADER;
+            default:
+                p = ngx_http_parse_skip(p + 1, b->last,
+                                        ngx_http_parse_value_stop, 4) - 1;
+                break;
             }
             break;
 
@@ -2102,42 +2366,95 @@ ngx_http_parse_set_cookie_lines(ngx_array_t *headers, ngx_str_t *name,
 ngx_int_t
 ngx_http_arg(ngx_http_request_t *r, u_char *name, size_t len, ngx_str_t *value)
 {
-    u_char  *p, *last;
+    ngx_str_t             *arg;
+    ngx_http_name_hash_t  *hash;
 
     if (r->args.len == 0) {
         return NGX_DECLINED;
     }
 
+    hash = r->args_hash;
+
+    if (hash == NULL
+        || hash->data != r->args.data
+        || hash->nelts != r->args.len)
+    {
+        hash = ngx_http_arg_hash(r);
+        if (hash == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    arg = ngx_http_name_hash_find(hash, name, len);
+
+    if (arg == NULL) {
+        return NGX_DECLINED;
+    }
+
+    *value = *arg;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_name_hash_t *
+ngx_http_arg_hash(ngx_http_request_t *r)
+{
+    u_char                *p, *last, *end;
+    ngx_str_t              name, value;
+    ngx_uint_t             n;
+    ngx_http_name_hash_t  *hash;
+
     p = r->args.data;
     last = p + r->args.len;
 
+    n = 1;
+
     for ( /* void */ ; p < last; p++) {
+        if (*p == '&') {
+            n++;
+        }
+    }
 
-        /* we need '=' after name, so drop one char from last */
+    hash = ngx_http_name_hash_init(r->pool, r->args_hash, n, 0);
+    if (hash == NULL) {
+        return NULL;
+    }
 
-        p = ngx_strlcasestrn(p, last - 1, name, len - 1);
+    /* an argument without "=" cannot be found */
 
-        if (p == NULL) {
-            return NGX_DECLINED;
-        }
+    for (p = r->args.data; p < last; p = end + 1) {
 
-        if ((p == r->args.data || *(p - 1) == '&') && *(p + len) == '=') {
+        for (end = p; end < last && *end != '&' && *end != '='; end++) {
+            /* void */
+        }
 
-            value->data = p + len + 1;
+        if (end == last || *end == '&') {
+            continue;
+        }
 
-            p = ngx_strlchr(p, last, '&');
+        name.len = end - p;
+        name.data = p;
 
-            if (p == NULL) {
-                p = r->args.data + r->args.len;
-            }
+        value.data = end + 1;
 
-            value->len = p - value->data;
+        end = ngx_strlchr(value.data, last, '&');
 
-            return NGX_OK;
+        if (end == NULL) {
+            end = last;
         }
+
+        value.len = end - value.data;
+
+        ngx_http_name_hash_add(hash, &name, &value);
     }
 
-    return NGX_DECLINED;
+    hash->data = r->args.data;
+    hash->nelts = r->args.len;
+
+    r->args_hash = hash;
+
+    return hash;
 }
 
 
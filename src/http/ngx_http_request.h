@@ -427,6 +427,11 @@ struct ngx_http_request_s {
 
     ngx_http_variable_value_t        *variables;
 
+    /* lazily built indexes for $http_*, $cookie_* and ngx_http_arg() */
+    ngx_http_name_hash_t             *headers_hash;
+    ngx_http_name_hash_t             *cookies_hash;
+    ngx_http_name_hash_t             *args_hash;
+
 #if (NGX_PCRE)
     ngx_uint_t                        ncaptures;
     int                              *captures;
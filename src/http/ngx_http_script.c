@@ -70,6 +70,10 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 
     ngx_http_script_flush_complex_value(r, val);
 
+    if (val->segments) {
+        return ngx_http_script_run_segments(r, val->segments, 0, value);
+    }
+
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
 
     e.ip = val->lengths;
@@ -174,6 +178,7 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->flushes = NULL;
     ccv->complex_value->lengths = NULL;
     ccv->complex_value->values = NULL;
+    ccv->complex_value->segments = NULL;
 
     if (nv == 0 && nc == 0) {
         return NGX_OK;
@@ -235,6 +240,14 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->lengths = lengths.elts;
     ccv->complex_value->values = values.elts;
 
+    if (ngx_http_script_compile_segments(ccv->cf, values.elts,
+                                         (u_char *) values.elts + values.nelts,
+                                         &ccv->complex_value->segments)
+        == NGX_ERROR)
+    {
+        return NGX_ERROR;
+    }
+
     return NGX_OK;
 }
 
@@ -640,6 +653,233 @@ ngx_http_script_flush_no_cacheable_variables(ngx_http_request_t *r,
 }
 
 
+/*
+ * the values codes consisting of copy, variable and capture codes only are
+ * also compiled into segments: adjacent texts are merged and each segment
+ * is a text followed by a variable or a capture, so a value is built in a
+ * single loop without calling the lengths and values codes
+ */
+
+ngx_int_t
+ngx_http_script_compile_segments(ngx_conf_t *cf, u_char *start, u_char *end,
+    ngx_http_script_segment_t **segments)
+{
+    u_char                       *ip, *p;
+    size_t                        size;
+    ngx_uint_t                    n;
+    ngx_http_script_code_pt       code;
+    ngx_http_script_segment_t    *seg;
+    ngx_http_script_copy_code_t  *copy;
+
+    *segments = NULL;
+
+    n = 1;
+    size = 0;
+
+    for (ip = start; ip < end && *(uintptr_t *) ip; /* void */ ) {
+
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            copy = (ngx_http_script_copy_code_t *) ip;
+
+            size += copy->len;
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + ((copy->len + sizeof(uintptr_t) - 1)
+                     & ~(sizeof(uintptr_t) - 1));
+            continue;
+        }
+
+        if (code == ngx_http_script_copy_var_code) {
+            ip += sizeof(ngx_http_script_var_code_t);
+            n++;
+            continue;
+        }
+
+#if (NGX_PCRE)
+        if (code == ngx_http_script_copy_capture_code) {
+            ip += sizeof(ngx_http_script_copy_capture_code_t);
+            n++;
+            continue;
+        }
+#endif
+
+        return NGX_DECLINED;
+    }
+
+    seg = ngx_palloc(cf->pool, n * sizeof(ngx_http_script_segment_t));
+    if (seg == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_pnalloc(cf->pool, size);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    *segments = seg;
+
+    seg->text.data = p;
+
+    for (ip = start; ip < end && *(uintptr_t *) ip; /* void */ ) {
+
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            copy = (ngx_http_script_copy_code_t *) ip;
+
+            p = ngx_cpymem(p, ip + sizeof(ngx_http_script_copy_code_t),
+                           copy->len);
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + ((copy->len + sizeof(uintptr_t) - 1)
+                     & ~(sizeof(uintptr_t) - 1));
+            continue;
+        }
+
+        seg->text.len = p - seg->text.data;
+
+        if (code == ngx_http_script_copy_var_code) {
+            seg->type = NGX_HTTP_SCRIPT_SEGMENT_VAR;
+            seg->n = ((ngx_http_script_var_code_t *) ip)->index;
+            ip += sizeof(ngx_http_script_var_code_t);
+
+        } else {
+            seg->type = NGX_HTTP_SCRIPT_SEGMENT_CAPTURE;
+            seg->n = ((ngx_http_script_copy_capture_code_t *) ip)->n;
+            ip += sizeof(ngx_http_script_copy_capture_code_t);
+        }
+
+        seg++;
+        seg->text.data = p;
+    }
+
+    seg->text.len = p - seg->text.data;
+    seg->type = NGX_HTTP_SCRIPT_SEGMENT_LAST;
+    seg->n = 0;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_http_script_run_segments(ngx_http_request_t *r,
+    ngx_http_script_segment_t *segments, ngx_uint_t escape, ngx_str_t *value)
+{
+    u_char                     *p, *last;
+    size_t                      len;
+    ngx_http_variable_t        *v;
+    ngx_http_variable_value_t  *vv;
+    ngx_http_script_segment_t  *seg;
+    ngx_http_core_main_conf_t  *cmcf;
+#if (NGX_PCRE)
+    int                        *cap;
+#endif
+
+    /*
+     * the variables are evaluated once in the first pass, and the second
+     * pass copies their values cached in r->variables
+     */
+
+    len = 0;
+
+    for (seg = segments; /* void */ ; seg++) {
+
+        len += seg->text.len;
+
+        if (seg->type == NGX_HTTP_SCRIPT_SEGMENT_VAR) {
+            vv = ngx_http_get_indexed_variable(r, seg->n);
+
+            if (vv && !vv->not_found) {
+                len += vv->len;
+            }
+
+            continue;
+        }
+
+        if (seg->type == NGX_HTTP_SCRIPT_SEGMENT_LAST) {
+            break;
+        }
+
+#if (NGX_PCRE)
+        if (seg->n < r->ncaptures) {
+            cap = r->captures;
+            len += cap[seg->n + 1] - cap[seg->n];
+
+            if (escape) {
+                len += 2 * ngx_escape_uri(NULL, &r->captures_data[cap[seg->n]],
+                                          cap[seg->n + 1] - cap[seg->n],
+                                          NGX_ESCAPE_ARGS);
+            }
+        }
+#endif
+    }
+
+    p = ngx_pnalloc(r->pool, len);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    value->data = p;
+    last = p + len;
+
+    for (seg = segments; /* void */ ; seg++) {
+
+        p = ngx_cpymem(p, seg->text.data, seg->text.len);
+
+        if (seg->type == NGX_HTTP_SCRIPT_SEGMENT_VAR) {
+            vv = &r->variables[seg->n];
+
+            if (!vv->valid || vv->not_found) {
+                continue;
+            }
+
+            /* evaluating a variable might change a value measured before */
+
+            if (vv->len > (size_t) (last - p)) {
+                cmcf = ngx_http_get_module_main_conf(r, ngx_http_core_module);
+                v = cmcf->variables.elts;
+
+                ngx_log_error(NGX_LOG_ALERT, r->connection->log, 0,
+                              "the length of the \"%V\" variable changed "
+                              "while evaluating a value, the variable "
+                              "is skipped", &v[seg->n].name);
+                continue;
+            }
+
+            p = ngx_cpymem(p, vv->data, vv->len);
+
+            continue;
+        }
+
+        if (seg->type == NGX_HTTP_SCRIPT_SEGMENT_LAST) {
+            break;
+        }
+
+#if (NGX_PCRE)
+        if (seg->n < r->ncaptures) {
+            cap = r->captures;
+
+            if (escape) {
+                p = (u_char *) ngx_escape_uri(p, &r->captures_data[cap[seg->n]],
+                                              cap[seg->n + 1] - cap[seg->n],
+                                              NGX_ESCAPE_ARGS);
+            } else {
+                p = ngx_cpymem(p, &r->captures_data[cap[seg->n]],
+                               cap[seg->n + 1] - cap[seg->n]);
+            }
+        }
+#endif
+    }
+
+    value->len = p - value->data;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http script segments: \"%V\"", value);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_script_init_arrays(ngx_http_script_compile_t *sc)
 {
@@ -1751,6 +1991,52 @@ ngx_http_script_complex_value_code(ngx_http_script_engine_t *e)
 }
 
 
+void
+ngx_http_script_segments_code(ngx_http_script_engine_t *e)
+{
+    ngx_str_t                         value;
+    ngx_uint_t                        escape;
+    ngx_http_request_t               *r;
+    ngx_http_script_segment_t        *seg;
+    ngx_http_script_segments_code_t  *code;
+
+    code = (ngx_http_script_segments_code_t *) e->ip;
+
+    e->ip += sizeof(ngx_http_script_segments_code_t);
+
+    r = e->request;
+
+    escape = 0;
+
+    for (seg = code->segments;
+         seg->type != NGX_HTTP_SCRIPT_SEGMENT_LAST;
+         seg++)
+    {
+        if (seg->type == NGX_HTTP_SCRIPT_SEGMENT_CAPTURE) {
+            escape = e->quote && (r->quoted_uri || r->plus_in_uri);
+            continue;
+        }
+
+        if (r->variables[seg->n].no_cacheable) {
+            r->variables[seg->n].valid = 0;
+            r->variables[seg->n].not_found = 0;
+        }
+    }
+
+    if (ngx_http_script_run_segments(r, code->segments, escape, &value)
+        != NGX_OK)
+    {
+        e->ip = ngx_http_script_exit;
+        e->status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        return;
+    }
+
+    e->sp->len = value.len;
+    e->sp->data = value.data;
+    e->sp++;
+}
+
+
 void
 ngx_http_script_value_code(ngx_http_script_engine_t *e)
 {
@@ -63,11 +63,29 @@ typedef struct {
 } ngx_http_script_compile_t;
 
 
+#define NGX_HTTP_SCRIPT_SEGMENT_LAST      0
+#define NGX_HTTP_SCRIPT_SEGMENT_VAR       1
+#define NGX_HTTP_SCRIPT_SEGMENT_CAPTURE   2
+
+
+/*
+ * a literal text followed by a variable or a capture, the last segment
+ * of a value holds the trailing text only
+ */
+
+typedef struct {
+    ngx_str_t                   text;
+    ngx_uint_t                  type;
+    ngx_uint_t                  n;
+} ngx_http_script_segment_t;
+
+
 typedef struct {
     ngx_str_t                   value;
     ngx_uint_t                 *flushes;
     void                       *lengths;
     void                       *values;
+    ngx_http_script_segment_t  *segments;
 
     union {
         size_t                  size;
@@ -199,6 +217,12 @@ typedef struct {
 } ngx_http_script_complex_value_code_t;
 
 
+typedef struct {
+    ngx_http_script_code_pt     code;
+    ngx_http_script_segment_t  *segments;
+} ngx_http_script_segments_code_t;
+
+
 typedef struct {
     ngx_http_script_code_pt     code;
     uintptr_t                   value;
@@ -233,6 +257,10 @@ u_char *ngx_http_script_run(ngx_http_request_t *r, ngx_str_t *value,
     void *code_lengths, size_t reserved, void *code_values);
 void ngx_http_script_flush_no_cacheable_variables(ngx_http_request_t *r,
     ngx_array_t *indices);
+ngx_int_t ngx_http_script_compile_segments(ngx_conf_t *cf, u_char *start,
+    u_char *end, ngx_http_script_segment_t **segments);
+ngx_int_t ngx_http_script_run_segments(ngx_http_request_t *r,
+    ngx_http_script_segment_t *segments, ngx_uint_t escape, ngx_str_t *value);
 
 void *ngx_http_script_start_code(ngx_pool_t *pool, ngx_array_t **codes,
     size_t size);
@@ -257,6 +285,7 @@ void ngx_http_script_equal_code(ngx_http_script_engine_t *e);
 void ngx_http_script_not_equal_code(ngx_http_script_engine_t *e);
 void ngx_http_script_file_code(ngx_http_script_engine_t *e);
 void ngx_http_script_complex_value_code(ngx_http_script_engine_t *e);
+void ngx_http_script_segments_code(ngx_http_script_engine_t *e);
 void ngx_http_script_value_code(ngx_http_script_engine_t *e);
 void ngx_http_script_set_var_code(ngx_http_script_engine_t *e);
 void ngx_http_script_var_set_handler_code(ngx_http_script_engine_t *e);
@@ -1538,6 +1538,29 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     u->state->peer = u->peer.name;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (u->upstream && u->upstream->resolve && u->peer.name
+        && rc != NGX_BUSY)
+    {
+        /* the peer may be removed from the zone before the request ends */
+
+        u->state->peer = ngx_palloc(r->pool,
+                                    sizeof(ngx_str_t) + u->peer.name->len);
+        if (u->state->peer == NULL) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        u->state->peer->len = u->peer.name->len;
+        u->state->peer->data = (u_char *) (u->state->peer + 1);
+        ngx_memcpy(u->state->peer->data, u->peer.name->data,
+                   u->peer.name->len);
+    }
+
+#endif
+
     if (rc == NGX_BUSY) {
         ngx_log_error(NGX_LOG_ERR, r->connection->log, 0, "no live upstreams");
         ngx_http_upstream_next(r, u, NGX_HTTP_UPSTREAM_FT_NOLIVE);
@@ -1551,6 +1574,8 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     /* rc == NGX_OK || rc == NGX_AGAIN || rc == NGX_DONE */
 
+    u->state->cached = u->peer.cached;
+
     c = u->peer.connection;
 
     c->requests++;
@@ -5943,6 +5968,13 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (ngx_strcmp(value[i].data, "resolve") == 0) {
+            us->resolve = 1;
+            continue;
+        }
+#endif
+
         goto invalid;
     }
 
@@ -5960,6 +5992,34 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (us->resolve) {
+
+        if (u.family == AF_UNIX) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "\"resolve\" cannot be used with "
+                               "unix domain socket \"%V\"", &u.url);
+            return NGX_CONF_ERROR;
+        }
+
+        if (ngx_inet_addr(u.host.data, u.host.len) != INADDR_NONE
+#if (NGX_HAVE_INET6)
+            || u.host.data[0] == '['
+#endif
+           )
+        {
+            /* an address literal does not need to be resolved */
+            us->resolve = 0;
+
+        } else {
+            us->host = u.host;
+            uscf->resolve = 1;
+        }
+    }
+
+#endif
+
     us->name = u.url;
     us->addrs = u.addrs;
     us->naddrs = u.naddrs;
@@ -67,6 +67,8 @@ typedef struct {
     off_t                            bytes_sent;
 
     ngx_str_t                       *peer;
+
+    ngx_uint_t                       cached;  /* unsigned cached:1 */
 } ngx_http_upstream_state_t;
 
 
@@ -102,7 +104,10 @@ typedef struct {
     ngx_msec_t                       slow_start;
     ngx_uint_t                       down;
 
+    ngx_str_t                        host;
+
     unsigned                         backup:1;
+    unsigned                         resolve:1;
 
     NGX_COMPAT_BEGIN(6)
     NGX_COMPAT_END
@@ -133,6 +138,7 @@ struct ngx_http_upstream_srv_conf_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_shm_zone_t                  *shm_zone;
+    ngx_uint_t                       resolve;  /* unsigned resolve:1 */
 #endif
 };
 
@@ -16,6 +16,10 @@
 
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp);
+#if (NGX_HTTP_UPSTREAM_ZONE)
+static ngx_int_t ngx_http_upstream_rr_peers_refresh(
+    ngx_http_upstream_rr_peer_data_t *rrp);
+#endif
 
 #if (NGX_HTTP_SSL)
 
@@ -42,6 +46,16 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     if (us->servers) {
         server = us->servers->elts;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (us->resolve && us->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "resolving names at run time requires "
+                          "upstream \"%V\" in %s:%ui to be in shared memory",
+                          &us->host, us->file_name, us->line);
+            return NGX_ERROR;
+        }
+#endif
+
         n = 0;
         w = 0;
 
@@ -97,6 +111,9 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].fail_timeout = server[i].fail_timeout;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+                peer[n].host = server[i].resolve ? &server[i] : NULL;
+#endif
 
                 *peerp = &peer[n];
                 peerp = &peer[n].next;
@@ -161,6 +178,9 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
                 peer[n].fail_timeout = server[i].fail_timeout;
                 peer[n].down = server[i].down;
                 peer[n].server = server[i].name;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+                peer[n].host = server[i].resolve ? &server[i] : NULL;
+#endif
 
                 *peerp = &peer[n];
                 peerp = &peer[n].next;
@@ -261,6 +281,15 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     rrp->peers = us->peer.data;
     rrp->current = NULL;
     rrp->config = 0;
+    rrp->pool = r->pool;
+
+    ngx_http_upstream_rr_peers_rlock(rrp->peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (rrp->peers->config) {
+        rrp->config = *rrp->peers->config;
+    }
+#endif
 
     n = rrp->peers->number;
 
@@ -268,9 +297,14 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
         n = rrp->peers->next->number;
     }
 
+    r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
+
+    ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
     if (n <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
         rrp->data = 0;
+        rrp->ntried = 1;
 
     } else {
         n = (n + (8 * sizeof(uintptr_t) - 1)) / (8 * sizeof(uintptr_t));
@@ -279,11 +313,12 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
         if (rrp->tried == NULL) {
             return NGX_ERROR;
         }
+
+        rrp->ntried = n;
     }
 
     r->upstream->peer.get = ngx_http_upstream_get_round_robin_peer;
     r->upstream->peer.free = ngx_http_upstream_free_round_robin_peer;
-    r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
 #if (NGX_HTTP_SSL)
     r->upstream->peer.set_session =
                                ngx_http_upstream_set_round_robin_peer_session;
@@ -386,10 +421,12 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
     rrp->peers = peers;
     rrp->current = NULL;
     rrp->config = 0;
+    rrp->pool = r->pool;
 
     if (rrp->peers->number <= 8 * sizeof(uintptr_t)) {
         rrp->tried = &rrp->data;
         rrp->data = 0;
+        rrp->ntried = 1;
 
     } else {
         n = (rrp->peers->number + (8 * sizeof(uintptr_t) - 1))
@@ -399,6 +436,8 @@ ngx_http_upstream_create_round_robin_peer(ngx_http_request_t *r,
         if (rrp->tried == NULL) {
             return NGX_ERROR;
         }
+
+        rrp->ntried = n;
     }
 
     r->upstream->peer.get = ngx_http_upstream_get_round_robin_peer;
@@ -432,6 +471,15 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     peers = rrp->peers;
     ngx_http_upstream_rr_peers_wlock(peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (ngx_http_upstream_rr_peers_changed(rrp)
+        && ngx_http_upstream_rr_peers_refresh(rrp) != NGX_OK)
+    {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return NGX_ERROR;
+    }
+#endif
+
     if (peers->single) {
         peer = peers->peer;
 
@@ -481,6 +529,12 @@ failed:
         n = (rrp->peers->number + (8 * sizeof(uintptr_t) - 1))
                 / (8 * sizeof(uintptr_t));
 
+        /* the backup servers may be re-resolved after the bitmap was sized */
+
+        if (n > rrp->ntried) {
+            n = rrp->ntried;
+        }
+
         for (i = 0; i < n; i++) {
             rrp->tried[i] = 0;
         }
@@ -504,6 +558,49 @@ failed:
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t
+ngx_http_upstream_rr_peers_refresh(ngx_http_upstream_rr_peer_data_t *rrp)
+{
+    ngx_uint_t   n;
+    uintptr_t   *tried;
+
+    /*
+     * the peers were changed while the request was in progress, e.g.
+     * re-resolved: positions of the peers tried before are not valid
+     * anymore, so the tried bitmap is sized for the new peers and cleared
+     */
+
+    n = rrp->peers->number;
+
+    if (rrp->peers->next && rrp->peers->next->number > n) {
+        n = rrp->peers->next->number;
+    }
+
+    n = (n + (8 * sizeof(uintptr_t) - 1)) / (8 * sizeof(uintptr_t));
+
+    if (n > rrp->ntried) {
+        tried = ngx_pcalloc(rrp->pool, n * sizeof(uintptr_t));
+        if (tried == NULL) {
+            return NGX_ERROR;
+        }
+
+        rrp->tried = tried;
+        rrp->ntried = n;
+
+    } else {
+        ngx_memzero(rrp->tried, rrp->ntried * sizeof(uintptr_t));
+    }
+
+    rrp->config = *rrp->peers->config;
+
+    return NGX_OK;
+}
+
+#endif
+
+
 static ngx_http_upstream_rr_peer_t *
 ngx_http_upstream_get_peer(ngx_http_upstream_rr_peer_data_t *rrp)
 {
@@ -589,6 +686,9 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     ngx_http_upstream_rr_peer_data_t  *rrp = data;
 
     time_t                       now;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_uint_t                   zombie;
+#endif
     ngx_http_upstream_rr_peer_t  *peer;
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, pc->log, 0,
@@ -601,6 +701,32 @@ ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc, void *data,
     ngx_http_upstream_rr_peers_rlock(rrp->peers);
     ngx_http_upstream_rr_peer_lock(rrp->peers, peer);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    if (peer->zombie) {
+
+        /* the peer was removed from the zone while in use */
+
+        peer->conns--;
+        zombie = (peer->conns == 0 && peer->keepalive == 0);
+
+        ngx_http_upstream_rr_peer_unlock(rrp->peers, peer);
+
+        if (zombie) {
+            ngx_http_upstream_zone_free_peer(rrp->peers, peer);
+        }
+
+        ngx_http_upstream_rr_peers_unlock(rrp->peers);
+
+        if (pc->tries) {
+            pc->tries--;
+        }
+
+        return;
+    }
+
+#endif
+
     if (rrp->peers->single) {
 
         peer->conns--;
@@ -38,6 +38,9 @@ struct ngx_http_upstream_rr_peer_s {
     ngx_msec_t                      slow_start;
     ngx_msec_t                      start_time;
 
+    ngx_msec_t                      latency;
+    ngx_msec_t                      latency_updated;
+
     ngx_uint_t                      down;
 
 #if (NGX_HTTP_SSL || NGX_COMPAT)
@@ -47,6 +50,17 @@ struct ngx_http_upstream_rr_peer_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_atomic_t                    lock;
+
+    ngx_atomic_t                    check_next;
+    ngx_uint_t                      check_fails;
+    ngx_uint_t                      check_passes;
+
+    ngx_http_upstream_server_t     *host;
+    ngx_uint_t                      zombie;  /* unsigned zombie:1 */
+
+    /* keepalive connections in all and in each worker process */
+    ngx_atomic_t                    keepalive;
+    ngx_atomic_t                   *keepalive_worker;
 #endif
 
     ngx_http_upstream_rr_peer_t    *next;
@@ -64,6 +78,9 @@ struct ngx_http_upstream_rr_peers_s {
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_slab_pool_t                *shpool;
     ngx_atomic_t                    rwlock;
+    ngx_uint_t                     *config;
+    ngx_atomic_t                    keepalive;
+    ngx_atomic_t                   *keepalive_worker;
     ngx_http_upstream_rr_peers_t   *zone_next;
 #endif
 
@@ -113,6 +130,10 @@ struct ngx_http_upstream_rr_peers_s {
         ngx_rwlock_unlock(&peer->lock);                                       \
     }
 
+
+#define ngx_http_upstream_rr_peers_changed(rrp)                               \
+    ((rrp)->peers->config && (rrp)->config != *(rrp)->peers->config)
+
 #else
 
 #define ngx_http_upstream_rr_peers_rlock(peers)
@@ -121,6 +142,8 @@ struct ngx_http_upstream_rr_peers_s {
 #define ngx_http_upstream_rr_peer_lock(peers, peer)
 #define ngx_http_upstream_rr_peer_unlock(peers, peer)
 
+#define ngx_http_upstream_rr_peers_changed(rrp)  0
+
 #endif
 
 
@@ -130,6 +153,11 @@ typedef struct {
     ngx_http_upstream_rr_peer_t    *current;
     uintptr_t                      *tried;
     uintptr_t                       data;
+
+    /* the size of the tried bitmap in words, peers may grow later */
+    ngx_uint_t                      ntried;
+
+    ngx_pool_t                     *pool;
 } ngx_http_upstream_rr_peer_data_t;
 
 
@@ -144,6 +172,11 @@ ngx_int_t ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc,
 void ngx_http_upstream_free_round_robin_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+void ngx_http_upstream_zone_free_peer(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer);
+#endif
+
 #if (NGX_HTTP_SSL)
 ngx_int_t
     ngx_http_upstream_set_round_robin_peer_session(ngx_peer_connection_t *pc,
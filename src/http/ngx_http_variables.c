@@ -34,6 +34,8 @@ static ngx_int_t ngx_http_variable_headers_internal(ngx_http_request_t *r,
 
 static ngx_int_t ngx_http_variable_unknown_header_in(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_http_name_hash_t *ngx_http_variable_headers_hash(
+    ngx_http_request_t *r);
 static ngx_int_t ngx_http_variable_unknown_header_out(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_unknown_trailer_out(ngx_http_request_t *r,
@@ -42,6 +44,8 @@ static ngx_int_t ngx_http_variable_request_line(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 static ngx_int_t ngx_http_variable_cookie(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_http_name_hash_t *ngx_http_variable_cookies_hash(
+    ngx_http_request_t *r);
 static ngx_int_t ngx_http_variable_argument(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data);
 #if (NGX_HAVE_TCP_INFO)
@@ -914,9 +918,94 @@ static ngx_int_t
 ngx_http_variable_unknown_header_in(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
-    return ngx_http_variable_unknown_header(v, (ngx_str_t *) data,
-                                            &r->headers_in.headers.part,
-                                            sizeof("http_") - 1);
+    ngx_str_t *var = (ngx_str_t *) data;
+
+    ngx_str_t             *value;
+    ngx_http_name_hash_t  *hash;
+
+    hash = ngx_http_variable_headers_hash(r);
+    if (hash == NULL) {
+        return NGX_ERROR;
+    }
+
+    value = ngx_http_name_hash_find(hash, var->data + sizeof("http_") - 1,
+                                    var->len - (sizeof("http_") - 1));
+
+    if (value == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = value->len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = value->data;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_name_hash_t *
+ngx_http_variable_headers_hash(ngx_http_request_t *r)
+{
+    ngx_uint_t             i, n;
+    ngx_list_t            *headers;
+    ngx_list_part_t       *part;
+    ngx_table_elt_t       *header;
+    ngx_http_name_hash_t  *hash;
+
+    /* subrequests share request headers with the main request */
+
+    headers = &r->headers_in.headers;
+    hash = r->main->headers_hash;
+
+    if (hash
+        && hash->data == headers->last
+        && hash->nelts == headers->last->nelts)
+    {
+        return hash;
+    }
+
+    n = 0;
+
+    for (part = &headers->part; part; part = part->next) {
+        n += part->nelts;
+    }
+
+    hash = ngx_http_name_hash_init(r->pool, hash, n, 1);
+    if (hash == NULL) {
+        return NULL;
+    }
+
+    part = &headers->part;
+    header = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+
+            part = part->next;
+            header = part->elts;
+            i = 0;
+        }
+
+        if (header[i].hash == 0) {
+            continue;
+        }
+
+        ngx_http_name_hash_add(hash, &header[i].key, &header[i].value);
+    }
+
+    hash->data = headers->last;
+    hash->nelts = headers->last->nelts;
+
+    r->main->headers_hash = hash;
+
+    return hash;
 }
 
 
@@ -1040,28 +1129,126 @@ ngx_http_variable_cookie(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 {
     ngx_str_t *name = (ngx_str_t *) data;
 
-    ngx_str_t  cookie, s;
+    ngx_str_t             *cookie;
+    ngx_http_name_hash_t  *hash;
 
-    s.len = name->len - (sizeof("cookie_") - 1);
-    s.data = name->data + sizeof("cookie_") - 1;
+    hash = ngx_http_variable_cookies_hash(r);
+    if (hash == NULL) {
+        return NGX_ERROR;
+    }
 
-    if (ngx_http_parse_multi_header_lines(&r->headers_in.cookies, &s, &cookie)
-        == NGX_DECLINED)
-    {
+    cookie = ngx_http_name_hash_find(hash, name->data + sizeof("cookie_") - 1,
+                                     name->len - (sizeof("cookie_") - 1));
+
+    if (cookie == NULL) {
         v->not_found = 1;
         return NGX_OK;
     }
 
-    v->len = cookie.len;
+    v->len = cookie->len;
     v->valid = 1;
     v->no_cacheable = 0;
     v->not_found = 0;
-    v->data = cookie.data;
+    v->data = cookie->data;
 
     return NGX_OK;
 }
 
 
+static ngx_http_name_hash_t *
+ngx_http_variable_cookies_hash(ngx_http_request_t *r)
+{
+    u_char                *start, *end, *p, *last;
+    ngx_str_t              name, value;
+    ngx_uint_t             i, n;
+    ngx_array_t           *cookies;
+    ngx_table_elt_t      **h;
+    ngx_http_name_hash_t  *hash;
+
+    cookies = &r->headers_in.cookies;
+    hash = r->main->cookies_hash;
+
+    if (hash && hash->data == cookies->elts && hash->nelts == cookies->nelts) {
+        return hash;
+    }
+
+    h = cookies->elts;
+    n = 0;
+
+    for (i = 0; i < cookies->nelts; i++) {
+        n++;
+
+        for (p = h[i]->value.data; p < h[i]->value.data + h[i]->value.len; p++)
+        {
+            if (*p == ';' || *p == ',') {
+                n++;
+            }
+        }
+    }
+
+    hash = ngx_http_name_hash_init(r->pool, hash, n, 0);
+    if (hash == NULL) {
+        return NULL;
+    }
+
+    /*
+     * the pairs are split as ngx_http_parse_multi_header_lines() does:
+     * a name is followed by optional spaces and "=", a value ends at ";",
+     * and the next pair starts after ";" or ","
+     */
+
+    for (i = 0; i < cookies->nelts; i++) {
+
+        start = h[i]->value.data;
+        end = h[i]->value.data + h[i]->value.len;
+
+        while (start < end) {
+
+            for (p = start; p < end && *p != '=' && *p != ';' && *p != ','; p++)
+            {
+                /* void */
+            }
+
+            for (last = p; last > start && *(last - 1) == ' '; last--) {
+                /* void */
+            }
+
+            if (p < end && *p == '=') {
+                name.len = last - start;
+                name.data = start;
+
+                for (p++; p < end && *p == ' '; p++) { /* void */ }
+
+                for (last = p; last < end && *last != ';'; last++) {
+                    /* void */
+                }
+
+                value.len = last - p;
+                value.data = p;
+
+                ngx_http_name_hash_add(hash, &name, &value);
+            }
+
+            while (start < end) {
+                p = start++;
+                if (*p == ';' || *p == ',') {
+                    break;
+                }
+            }
+
+            while (start < end && *start == ' ') { start++; }
+        }
+    }
+
+    hash->data = cookies->elts;
+    hash->nelts = cookies->nelts;
+
+    r->main->cookies_hash = hash;
+
+    return hash;
+}
+
+
 static ngx_int_t
 ngx_http_variable_argument(ngx_http_request_t *r, ngx_http_variable_value_t *v,
     uintptr_t data)
@@ -2402,33 +2589,163 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
 #if (NGX_PCRE)
 
     if (len && map->nregex) {
-        ngx_int_t              n;
-        ngx_uint_t             i;
-        ngx_http_map_regex_t  *reg;
+        ngx_int_t  n;
 
-        reg = map->regex;
+        n = ngx_http_regex_multi_exec(r, map->regex_multi, match);
 
-        for (i = 0; i < map->nregex; i++) {
+        if (n >= 0) {
+            return map->regex[n].value;
+        }
 
-            n = ngx_http_regex_exec(r, reg[i].regex, match);
+        /* NGX_DECLINED or NGX_ERROR */
 
-            if (n == NGX_OK) {
-                return reg[i].value;
-            }
+        return NULL;
+    }
 
-            if (n == NGX_DECLINED) {
-                continue;
-            }
+#endif
+
+    return NULL;
+}
 
-            /* NGX_ERROR */
 
-            return NULL;
+ngx_http_name_hash_t *
+ngx_http_name_hash_init(ngx_pool_t *pool, ngx_http_name_hash_t *hash,
+    ngx_uint_t n, ngx_uint_t header)
+{
+    ngx_uint_t  size;
+
+    /* at least a half of the slots are kept free for open addressing */
+
+    for (size = 8; size < 2 * n; size <<= 1) { /* void */ }
+
+    if (hash && hash->mask + 1 >= size) {
+        ngx_memzero(hash->elts, (hash->mask + 1)
+                                * sizeof(ngx_http_name_hash_elt_t));
+        hash->header = header;
+        return hash;
+    }
+
+    hash = ngx_palloc(pool, sizeof(ngx_http_name_hash_t));
+    if (hash == NULL) {
+        return NULL;
+    }
+
+    hash->elts = ngx_pcalloc(pool, size * sizeof(ngx_http_name_hash_elt_t));
+    if (hash->elts == NULL) {
+        return NULL;
+    }
+
+    hash->mask = size - 1;
+    hash->header = header;
+    hash->data = NULL;
+    hash->nelts = 0;
+
+    return hash;
+}
+
+
+static ngx_inline u_char
+ngx_http_name_hash_char(ngx_http_name_hash_t *hash, u_char ch)
+{
+    /* as in $http_*, header names are matched with "-" replaced by "_" */
+
+    if (ch >= 'A' && ch <= 'Z') {
+        return ch | 0x20;
+    }
+
+    if (ch == '-' && hash->header) {
+        return '_';
+    }
+
+    return ch;
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_http_name_hash_key(ngx_http_name_hash_t *hash, u_char *name, size_t len)
+{
+    ngx_uint_t  i, key;
+
+    key = 0;
+
+    for (i = 0; i < len; i++) {
+        key = ngx_hash(key, ngx_http_name_hash_char(hash, name[i]));
+    }
+
+    return key;
+}
+
+
+static ngx_inline ngx_uint_t
+ngx_http_name_hash_equal(ngx_http_name_hash_t *hash,
+    ngx_http_name_hash_elt_t *elt, ngx_uint_t key, u_char *name, size_t len)
+{
+    ngx_uint_t  i;
+
+    if (elt->key != key || elt->name.len != len) {
+        return 0;
+    }
+
+    for (i = 0; i < len; i++) {
+        if (ngx_http_name_hash_char(hash, elt->name.data[i])
+            != ngx_http_name_hash_char(hash, name[i]))
+        {
+            return 0;
         }
     }
 
-#endif
+    return 1;
+}
 
-    return NULL;
+
+void
+ngx_http_name_hash_add(ngx_http_name_hash_t *hash, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    ngx_uint_t                 i, key;
+    ngx_http_name_hash_elt_t  *elt;
+
+    key = ngx_http_name_hash_key(hash, name->data, name->len);
+
+    for (i = key & hash->mask; /* void */ ; i = (i + 1) & hash->mask) {
+        elt = &hash->elts[i];
+
+        if (elt->name.data == NULL) {
+            break;
+        }
+
+        /* the first occurrence wins, as with linear lookups */
+
+        if (ngx_http_name_hash_equal(hash, elt, key, name->data, name->len)) {
+            return;
+        }
+    }
+
+    elt->key = key;
+    elt->name = *name;
+    elt->value = *value;
+}
+
+
+ngx_str_t *
+ngx_http_name_hash_find(ngx_http_name_hash_t *hash, u_char *name, size_t len)
+{
+    ngx_uint_t                 i, key;
+    ngx_http_name_hash_elt_t  *elt;
+
+    key = ngx_http_name_hash_key(hash, name, len);
+
+    for (i = key & hash->mask; /* void */ ; i = (i + 1) & hash->mask) {
+        elt = &hash->elts[i];
+
+        if (elt->name.data == NULL) {
+            return NULL;
+        }
+
+        if (ngx_http_name_hash_equal(hash, elt, key, name, len)) {
+            return &elt->value;
+        }
+    }
 }
 
 
@@ -2469,6 +2786,7 @@ ngx_http_regex_compile(ngx_conf_t *cf, ngx_regex_compile_t *rc)
 
     re->regex = rc->regex;
     re->ncaptures = rc->captures;
+    re->options = rc->options;
     re->name = rc->pattern;
 
     cmcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_core_module);
@@ -2585,6 +2903,348 @@ ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re, ngx_str_t *s)
     return NGX_OK;
 }
 
+
+static ngx_uint_t
+ngx_http_regex_multi_eligible(ngx_http_regex_t *re)
+{
+    u_char  *p, *last;
+
+    if (re->options & ~NGX_REGEX_CASELESS) {
+        return 0;
+    }
+
+    /*
+     * patterns which refer to groups by number, recurse, use verbs,
+     * \G, \Q...\E quoting or extended syntax cannot be embedded
+     * into a combined pattern as is
+     */
+
+    p = re->name.data;
+    last = p + re->name.len;
+
+    while (p < last) {
+
+        if (*p == '\\') {
+            if (++p == last) {
+                return 0;
+            }
+
+            if ((*p >= '1' && *p <= '9')
+                || *p == 'g' || *p == 'k' || *p == 'G' || *p == 'Q')
+            {
+                return 0;
+            }
+
+            p++;
+            continue;
+        }
+
+        if (*p++ != '(' || p == last) {
+            continue;
+        }
+
+        if (*p == '*') {
+            return 0;
+        }
+
+        if (*p++ != '?' || p == last) {
+            continue;
+        }
+
+        if (*p == 'R' || *p == '&' || *p == '(' || *p == '+'
+            || (*p >= '0' && *p <= '9'))
+        {
+            return 0;
+        }
+
+        if (*p == 'P' && p + 1 < last && (p[1] == '=' || p[1] == '>')) {
+            return 0;
+        }
+
+        if (*p == '-' && p + 1 < last && p[1] >= '0' && p[1] <= '9') {
+            return 0;
+        }
+
+        while (p < last
+               && ((*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z')
+                   || *p == '-'))
+        {
+            if (*p++ == 'x') {
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+
+static ngx_int_t
+ngx_http_regex_multi_add(ngx_conf_t *cf, ngx_http_regex_multi_t *rm,
+    ngx_array_t *chunks, ngx_uint_t start, ngx_uint_t end)
+{
+    u_char                  *p;
+    size_t                   len;
+    ngx_uint_t               i, mid, group, *groups;
+    ngx_http_regex_t        *re;
+    ngx_regex_compile_t      rc;
+    ngx_http_regex_chunk_t  *chunk;
+    u_char                   errstr[NGX_MAX_CONF_ERRSTR];
+
+    if (end - start < 2) {
+        goto single;
+    }
+
+    /*
+     * "^(?:[\s\S]*?(re1)|[\s\S]*?(?i:(re2))|...)": an alternative is only
+     * tried if none of the previous patterns matches anywhere in a string,
+     * so the first pattern in the configuration order wins
+     */
+
+    len = sizeof("(?J)^(?:)") - 1;
+
+    for (i = start; i < end; i++) {
+        len += sizeof("|[\\s\\S]*?(?i:())") - 1 + rm->regex[i]->name.len;
+    }
+
+    groups = ngx_palloc(cf->pool, (end - start) * sizeof(ngx_uint_t));
+    if (groups == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = ngx_pnalloc(cf->pool, len + 1);
+    if (p == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memzero(&rc, sizeof(ngx_regex_compile_t));
+
+    rc.pattern.data = p;
+    rc.pool = cf->pool;
+    rc.err.len = NGX_MAX_CONF_ERRSTR;
+    rc.err.data = errstr;
+
+    p = ngx_cpymem(p, "(?J)^(?:", sizeof("(?J)^(?:") - 1);
+
+    group = 1;
+
+    for (i = start; i < end; i++) {
+        re = rm->regex[i];
+
+        if (i != start) {
+            *p++ = '|';
+        }
+
+        p = ngx_cpymem(p, "[\\s\\S]*?", sizeof("[\\s\\S]*?") - 1);
+
+        if (re->options & NGX_REGEX_CASELESS) {
+            p = ngx_cpymem(p, "(?i:", sizeof("(?i:") - 1);
+        }
+
+        *p++ = '(';
+        p = ngx_cpymem(p, re->name.data, re->name.len);
+        *p++ = ')';
+
+        if (re->options & NGX_REGEX_CASELESS) {
+            *p++ = ')';
+        }
+
+        groups[i - start] = group;
+        group += 1 + re->ncaptures;
+    }
+
+    *p++ = ')';
+    *p = '\0';
+
+    rc.pattern.len = p - rc.pattern.data;
+
+    if (ngx_regex_compile(&rc) == NGX_OK
+        && (ngx_uint_t) rc.captures == group - 1)
+    {
+        chunk = ngx_array_push(chunks);
+        if (chunk == NULL) {
+            return NGX_ERROR;
+        }
+
+        chunk->regex = rc.regex;
+        chunk->start = start;
+        chunk->end = end;
+        chunk->groups = groups;
+
+        rm->ncaptures = ngx_max(rm->ncaptures, group * 3);
+
+        return NGX_OK;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "cannot combine regexes %ui-%ui: %V",
+                   start, end - 1, &rc.err);
+
+    mid = start + (end - start) / 2;
+
+    if (ngx_http_regex_multi_add(cf, rm, chunks, start, mid) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_regex_multi_add(cf, rm, chunks, mid, end);
+
+single:
+
+    chunk = chunks->nelts ? (ngx_http_regex_chunk_t *) chunks->elts
+                            + chunks->nelts - 1
+                          : NULL;
+
+    if (chunk && chunk->regex == NULL && chunk->end == start) {
+        chunk->end = end;
+        return NGX_OK;
+    }
+
+    chunk = ngx_array_push(chunks);
+    if (chunk == NULL) {
+        return NGX_ERROR;
+    }
+
+    chunk->regex = NULL;
+    chunk->start = start;
+    chunk->end = end;
+    chunk->groups = NULL;
+
+    return NGX_OK;
+}
+
+
+ngx_http_regex_multi_t *
+ngx_http_regex_multi_create(ngx_conf_t *cf, ngx_http_regex_t **regex,
+    ngx_uint_t n)
+{
+    ngx_uint_t               i, start;
+    ngx_array_t              chunks;
+    ngx_http_regex_multi_t  *rm;
+
+    rm = ngx_pcalloc(cf->pool, sizeof(ngx_http_regex_multi_t));
+    if (rm == NULL) {
+        return NULL;
+    }
+
+    if (ngx_array_init(&chunks, cf->pool, 4, sizeof(ngx_http_regex_chunk_t))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    rm->regex = regex;
+
+    /*
+     * runs of patterns that can be combined are matched by a single
+     * regex, the rest are tested one by one in the configuration order
+     */
+
+    for (i = 0; i < n; /* void */ ) {
+        start = i;
+
+        if (ngx_http_regex_multi_eligible(regex[i])) {
+            while (i < n && ngx_http_regex_multi_eligible(regex[i])) {
+                i++;
+            }
+
+        } else {
+            i++;
+        }
+
+        if (ngx_http_regex_multi_add(cf, rm, &chunks, start, i) != NGX_OK) {
+            return NULL;
+        }
+    }
+
+    rm->chunks = chunks.elts;
+    rm->nchunks = chunks.nelts;
+
+    if (rm->ncaptures) {
+        rm->captures = ngx_palloc(cf->pool, rm->ncaptures * sizeof(int));
+        if (rm->captures == NULL) {
+            return NULL;
+        }
+    }
+
+    return rm;
+}
+
+
+ngx_int_t
+ngx_http_regex_multi_exec(ngx_http_request_t *r, ngx_http_regex_multi_t *rm,
+    ngx_str_t *s)
+{
+    ngx_int_t                rc;
+    ngx_uint_t               i, k, group;
+    ngx_http_regex_chunk_t  *chunk;
+
+    for (chunk = rm->chunks; chunk < rm->chunks + rm->nchunks; chunk++) {
+
+        i = chunk->start;
+
+        if (chunk->regex) {
+
+            rc = ngx_regex_exec(chunk->regex, s, rm->captures,
+                                rm->ncaptures);
+
+            if (rc == NGX_REGEX_NO_MATCHED) {
+                continue;
+            }
+
+            if (rc < 0) {
+
+                /*
+                 * the combined regex may hit limits the separate ones
+                 * do not, e.g. the match limit, so they are tested
+                 * one by one
+                 */
+
+                ngx_log_error(NGX_LOG_INFO, r->connection->log, 0,
+                              ngx_regex_exec_n " of combined regex failed: "
+                              "%i on \"%V\"", rc, s);
+
+            } else {
+
+                /*
+                 * the winner is the only alternative with its group set;
+                 * its own regex is then run to get the captures
+                 */
+
+                for (k = 0; k < chunk->end - chunk->start; k++) {
+                    group = chunk->groups[k];
+
+                    if ((ngx_int_t) group < rc
+                        && rm->captures[2 * group] >= 0)
+                    {
+                        i += k;
+                        break;
+                    }
+                }
+            }
+        }
+
+        for ( /* void */ ; i < chunk->end; i++) {
+
+            ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http regex test \"%V\"", &rm->regex[i]->name);
+
+            rc = ngx_http_regex_exec(r, rm->regex[i], s);
+
+            if (rc == NGX_OK) {
+                return i;
+            }
+
+            if (rc == NGX_DECLINED) {
+                continue;
+            }
+
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
 #endif
 
 
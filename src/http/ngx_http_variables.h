@@ -61,6 +61,32 @@ ngx_int_t ngx_http_variable_unknown_header(ngx_http_variable_value_t *v,
     ngx_str_t *var, ngx_list_part_t *part, size_t prefix);
 
 
+typedef struct {
+    ngx_uint_t                    key;
+    ngx_str_t                     name;
+    ngx_str_t                     value;
+} ngx_http_name_hash_elt_t;
+
+
+typedef struct {
+    ngx_http_name_hash_elt_t     *elts;
+    ngx_uint_t                    mask;
+    ngx_uint_t                    header;    /* unsigned  header:1; */
+
+    /* the source the hash was built from */
+    void                         *data;
+    ngx_uint_t                    nelts;
+} ngx_http_name_hash_t;
+
+
+ngx_http_name_hash_t *ngx_http_name_hash_init(ngx_pool_t *pool,
+    ngx_http_name_hash_t *hash, ngx_uint_t n, ngx_uint_t header);
+void ngx_http_name_hash_add(ngx_http_name_hash_t *hash, ngx_str_t *name,
+    ngx_str_t *value);
+ngx_str_t *ngx_http_name_hash_find(ngx_http_name_hash_t *hash, u_char *name,
+    size_t len);
+
+
 #if (NGX_PCRE)
 
 typedef struct {
@@ -74,10 +100,28 @@ typedef struct {
     ngx_uint_t                    ncaptures;
     ngx_http_regex_variable_t    *variables;
     ngx_uint_t                    nvariables;
+    ngx_int_t                     options;
     ngx_str_t                     name;
 } ngx_http_regex_t;
 
 
+typedef struct {
+    ngx_regex_t                  *regex;
+    ngx_uint_t                    start;
+    ngx_uint_t                    end;
+    ngx_uint_t                   *groups;
+} ngx_http_regex_chunk_t;
+
+
+typedef struct {
+    ngx_http_regex_t            **regex;
+    ngx_http_regex_chunk_t       *chunks;
+    ngx_uint_t                    nchunks;
+    int                          *captures;
+    ngx_uint_t                    ncaptures;
+} ngx_http_regex_multi_t;
+
+
 typedef struct {
     ngx_http_regex_t             *regex;
     void                         *value;
@@ -88,6 +132,10 @@ ngx_http_regex_t *ngx_http_regex_compile(ngx_conf_t *cf,
     ngx_regex_compile_t *rc);
 ngx_int_t ngx_http_regex_exec(ngx_http_request_t *r, ngx_http_regex_t *re,
     ngx_str_t *s);
+ngx_http_regex_multi_t *ngx_http_regex_multi_create(ngx_conf_t *cf,
+    ngx_http_regex_t **regex, ngx_uint_t n);
+ngx_int_t ngx_http_regex_multi_exec(ngx_http_request_t *r,
+    ngx_http_regex_multi_t *rm, ngx_str_t *s);
 
 #endif
 
@@ -97,6 +145,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_http_map_regex_t         *regex;
     ngx_uint_t                    nregex;
+    ngx_http_regex_multi_t       *regex_multi;
 #endif
 } ngx_http_map_t;
 
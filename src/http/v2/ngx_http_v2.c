@@ -276,6 +276,9 @@ ngx_http_v2_init(ngx_event_t *rev)
     h2c->concurrent_pushes = h2scf->concurrent_pushes;
     h2c->priority_limit = h2scf->concurrent_streams;
 
+    h2c->hpack_enc.limit = h2scf->hpack_encoder_table_size;
+    ngx_http_v2_encoder_table_size(h2c, NGX_HTTP_V2_TABLE_SIZE);
+
     h2c->pool = ngx_create_pool(h2scf->pool_size, h2c->connection->log);
     if (h2c->pool == NULL) {
         ngx_http_close_connection(c);
@@ -2098,6 +2101,7 @@ ngx_http_v2_state_settings_params(ngx_http_v2_connection_t *h2c, u_char *pos,
         case NGX_HTTP_V2_HEADER_TABLE_SIZE_SETTING:
 
             h2c->table_update = 1;
+            h2c->hpack_enc.update = value;
             break;
 
         default:
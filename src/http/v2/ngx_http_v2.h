@@ -25,6 +25,9 @@
 #define NGX_HTTP_V2_MAX_FIELD                                                 \
     (127 + (1 << (NGX_HTTP_V2_INT_OCTETS - 1) * 7) - 1)
 
+#define NGX_HTTP_V2_TABLE_SIZE           4096
+#define NGX_HTTP_V2_MAX_TABLE_SIZE       65536
+
 #define NGX_HTTP_V2_STREAM_ID_SIZE       4
 
 #define NGX_HTTP_V2_FRAME_HEADER_SIZE    9
@@ -115,6 +118,30 @@ typedef struct {
 } ngx_http_v2_hpack_t;
 
 
+typedef struct {
+    ngx_str_t                        name;
+    ngx_str_t                        value;
+    ngx_uint_t                       hash;
+} ngx_http_v2_hpack_field_t;
+
+
+typedef struct {
+    ngx_http_v2_hpack_field_t       *entries;
+
+    ngx_uint_t                       added;
+    ngx_uint_t                       deleted;
+    ngx_uint_t                       allocated;
+
+    size_t                           limit;
+    size_t                           update;
+    size_t                           size;
+    size_t                           free;
+    u_char                          *storage;
+    u_char                          *last;
+    u_char                          *pos;
+} ngx_http_v2_hpack_enc_t;
+
+
 struct ngx_http_v2_connection_s {
     ngx_connection_t                *connection;
     ngx_http_connection_t           *http_connection;
@@ -141,6 +168,7 @@ struct ngx_http_v2_connection_s {
     ngx_http_v2_state_t              state;
 
     ngx_http_v2_hpack_t              hpack;
+    ngx_http_v2_hpack_enc_t          hpack_enc;
 
     ngx_pool_t                      *pool;
 
@@ -309,6 +337,13 @@ ngx_int_t ngx_http_v2_add_header(ngx_http_v2_connection_t *h2c,
     ngx_http_v2_header_t *header);
 ngx_int_t ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size);
 
+ngx_int_t ngx_http_v2_find_header(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value, ngx_uint_t *index);
+ngx_int_t ngx_http_v2_index_header(ngx_http_v2_connection_t *h2c,
+    ngx_str_t *name, ngx_str_t *value);
+void ngx_http_v2_encoder_table_size(ngx_http_v2_connection_t *h2c,
+    size_t size);
+
 
 ngx_int_t ngx_http_v2_huff_decode(u_char *state, u_char *src, size_t len,
     u_char **dst, ngx_uint_t last, ngx_log_t *log);
@@ -416,6 +451,8 @@ size_t ngx_http_v2_huff_encode(u_char *src, size_t len, u_char *dst,
 
 u_char *ngx_http_v2_string_encode(u_char *dst, u_char *src, size_t len,
     u_char *tmp, ngx_uint_t lower);
+u_char *ngx_http_v2_write_int(u_char *pos, ngx_uint_t prefix,
+    ngx_uint_t value);
 
 
 #endif /* _NGX_HTTP_V2_H_INCLUDED_ */
@@ -52,6 +52,15 @@ static ngx_http_v2_push_header_t  ngx_http_v2_push_headers[] = {
     (sizeof(ngx_http_v2_push_headers) / sizeof(ngx_http_v2_push_header_t))
 
 
+static u_char *ngx_http_v2_write_table_update(ngx_http_v2_connection_t *h2c,
+    u_char *pos);
+static u_char *ngx_http_v2_write_field(ngx_http_v2_connection_t *h2c,
+    u_char *pos, ngx_uint_t index, ngx_str_t *name, ngx_str_t *value,
+    u_char *tmp);
+static u_char *ngx_http_v2_write_unindexed(ngx_http_v2_connection_t *h2c,
+    u_char *pos, ngx_uint_t index);
+static ngx_uint_t ngx_http_v2_volatile_header(ngx_str_t *name);
+
 static ngx_int_t ngx_http_v2_push_resources(ngx_http_request_t *r);
 static ngx_int_t ngx_http_v2_push_resource(ngx_http_request_t *r,
     ngx_str_t *path, ngx_str_t *binary);
@@ -135,8 +144,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 {
     u_char                     status, *pos, *start, *p, *tmp;
     size_t                     len, tmp_len;
-    ngx_str_t                  host, location;
-    ngx_uint_t                 i, port, fin;
+    ngx_str_t                  host, location, value;
+    ngx_uint_t                 i, port, fin, fields;
     ngx_list_part_t           *part;
     ngx_table_elt_t           *header;
     ngx_connection_t          *fc;
@@ -147,6 +156,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     ngx_http_core_loc_conf_t  *clcf;
     ngx_http_core_srv_conf_t  *cscf;
     u_char                     addr[NGX_SOCKADDR_STRLEN];
+    u_char                     code[NGX_INT_T_LEN];
 
     static const u_char nginx[5] = "\x84\xaa\x63\x55\xe7";
 #if (NGX_HTTP_GZIP)
@@ -253,10 +263,12 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
-    len = h2c->table_update ? 1 : 0;
+    len = h2c->table_update ? 1 + NGX_HTTP_V2_INT_OCTETS : 0;
 
     len += status ? 1 : 1 + ngx_http_v2_literal_size("418");
 
+    fields = 8;
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_out.server == NULL) {
@@ -425,6 +437,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         len += 1 + NGX_HTTP_V2_INT_OCTETS + header[i].key.len
                  + NGX_HTTP_V2_INT_OCTETS + header[i].value.len;
 
+        fields++;
+
         if (header[i].key.len > tmp_len) {
             tmp_len = header[i].key.len;
         }
@@ -434,6 +448,16 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
     }
 
+    if (h2c->hpack_enc.limit) {
+
+        /*
+         * a field may take one more octet: an index into the dynamic table
+         * or a static name index with a shorter prefix
+         */
+
+        len += fields;
+    }
+
     tmp = ngx_palloc(r->pool, tmp_len);
     pos = ngx_pnalloc(r->pool, len);
 
@@ -444,10 +468,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     start = pos;
 
     if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
+        pos = ngx_http_v2_write_table_update(h2c, pos);
     }
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
@@ -457,6 +478,16 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (status) {
         *pos++ = status;
 
+    } else if (h2c->hpack_enc.size) {
+        value.data = code;
+        value.len = ngx_sprintf(code, "%03ui", r->headers_out.status) - code;
+
+        pos = ngx_http_v2_write_field(h2c, pos, NGX_HTTP_V2_STATUS_INDEX,
+                                      NULL, &value, tmp);
+        if (pos == NULL) {
+            goto failed;
+        }
+
     } else {
         *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_STATUS_INDEX);
         *pos++ = NGX_HTTP_V2_ENCODE_RAW | 3;
@@ -480,9 +511,26 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                            "http2 output header: \"server: nginx\"");
         }
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
+        if (h2c->hpack_enc.size) {
+            if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
+                ngx_str_set(&value, NGINX_VER);
+
+            } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
+                ngx_str_set(&value, NGINX_VER_BUILD);
+
+            } else {
+                ngx_str_set(&value, "nginx");
+            }
+
+            pos = ngx_http_v2_write_field(h2c, pos, NGX_HTTP_V2_SERVER_INDEX,
+                                          NULL, &value, tmp);
+            if (pos == NULL) {
+                goto failed;
+            }
+
+        } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
 
-        if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_ON) {
             if (nginx_ver[0] == '\0') {
                 p = ngx_http_v2_write_value(nginx_ver, (u_char *) NGINX_VER,
                                             sizeof(NGINX_VER) - 1, tmp);
@@ -492,6 +540,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
             pos = ngx_cpymem(pos, nginx_ver, nginx_ver_len);
 
         } else if (clcf->server_tokens == NGX_HTTP_SERVER_TOKENS_BUILD) {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
+
             if (nginx_ver_build[0] == '\0') {
                 p = ngx_http_v2_write_value(nginx_ver_build,
                                             (u_char *) NGINX_VER_BUILD,
@@ -502,6 +552,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
             pos = ngx_cpymem(pos, nginx_ver_build, nginx_ver_build_len);
 
         } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SERVER_INDEX);
             pos = ngx_cpymem(pos, nginx, sizeof(nginx));
         }
     }
@@ -511,13 +562,12 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"date: %V\"",
                        &ngx_cached_http_time);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_DATE_INDEX);
+        pos = ngx_http_v2_write_unindexed(h2c, pos, NGX_HTTP_V2_DATE_INDEX);
         pos = ngx_http_v2_write_value(pos, ngx_cached_http_time.data,
                                       ngx_cached_http_time.len, tmp);
     }
 
     if (r->headers_out.content_type.len) {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
 
         if (r->headers_out.content_type_len == r->headers_out.content_type.len
             && r->headers_out.charset.len)
@@ -527,7 +577,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
             p = ngx_pnalloc(r->pool, len);
             if (p == NULL) {
-                return NGX_ERROR;
+                goto failed;
             }
 
             p = ngx_cpymem(p, r->headers_out.content_type.data,
@@ -548,8 +598,22 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-type: %V\"",
                        &r->headers_out.content_type);
 
-        pos = ngx_http_v2_write_value(pos, r->headers_out.content_type.data,
-                                      r->headers_out.content_type.len, tmp);
+        if (h2c->hpack_enc.size) {
+            pos = ngx_http_v2_write_field(h2c, pos,
+                                          NGX_HTTP_V2_CONTENT_TYPE_INDEX,
+                                          NULL, &r->headers_out.content_type,
+                                          tmp);
+            if (pos == NULL) {
+                goto failed;
+            }
+
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_TYPE_INDEX);
+            pos = ngx_http_v2_write_value(pos,
+                                          r->headers_out.content_type.data,
+                                          r->headers_out.content_type.len,
+                                          tmp);
+        }
     }
 
     if (r->headers_out.content_length == NULL
@@ -559,7 +623,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"content-length: %O\"",
                        r->headers_out.content_length_n);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
+        pos = ngx_http_v2_write_unindexed(h2c, pos,
+                                          NGX_HTTP_V2_CONTENT_LENGTH_INDEX);
 
         p = pos;
         pos = ngx_sprintf(pos + 1, "%O", r->headers_out.content_length_n);
@@ -569,7 +634,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     if (r->headers_out.last_modified == NULL
         && r->headers_out.last_modified_time != -1)
     {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LAST_MODIFIED_INDEX);
+        pos = ngx_http_v2_write_unindexed(h2c, pos,
+                                          NGX_HTTP_V2_LAST_MODIFIED_INDEX);
 
         ngx_http_time(pos, r->headers_out.last_modified_time);
         len = sizeof("Wed, 31 Dec 1986 18:00:00 GMT") - 1;
@@ -590,7 +656,8 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
                        "http2 output header: \"location: %V\"",
                        &r->headers_out.location->value);
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_LOCATION_INDEX);
+        pos = ngx_http_v2_write_unindexed(h2c, pos,
+                                          NGX_HTTP_V2_LOCATION_INDEX);
         pos = ngx_http_v2_write_value(pos, r->headers_out.location->value.data,
                                       r->headers_out.location->value.len, tmp);
     }
@@ -600,8 +667,19 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                        "http2 output header: \"vary: Accept-Encoding\"");
 
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
-        pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        if (h2c->hpack_enc.size) {
+            ngx_str_set(&value, "Accept-Encoding");
+
+            pos = ngx_http_v2_write_field(h2c, pos, NGX_HTTP_V2_VARY_INDEX,
+                                          NULL, &value, tmp);
+            if (pos == NULL) {
+                goto failed;
+            }
+
+        } else {
+            *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_VARY_INDEX);
+            pos = ngx_cpymem(pos, accept_encoding, sizeof(accept_encoding));
+        }
     }
 #endif
 
@@ -634,6 +712,18 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
         }
 #endif
 
+        if (h2c->hpack_enc.size
+            && !ngx_http_v2_volatile_header(&header[i].key))
+        {
+            pos = ngx_http_v2_write_field(h2c, pos, 0, &header[i].key,
+                                          &header[i].value, tmp);
+            if (pos == NULL) {
+                goto failed;
+            }
+
+            continue;
+        }
+
         *pos++ = 0;
 
         pos = ngx_http_v2_write_name(pos, header[i].key.data,
@@ -648,7 +738,7 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
 
     frame = ngx_http_v2_create_headers_frame(r, start, pos, fin);
     if (frame == NULL) {
-        return NGX_ERROR;
+        goto failed;
     }
 
     ngx_http_v2_queue_blocked_frame(h2c, frame);
@@ -667,6 +757,150 @@ ngx_http_v2_header_filter(ngx_http_request_t *r)
     fc->need_last_buf = 1;
 
     return ngx_http_v2_filter_send(fc, stream);
+
+failed:
+
+    if (h2c->hpack_enc.size) {
+
+        /* the client will not see the fields already added to the table */
+
+        h2c->connection->error = 1;
+    }
+
+    return NGX_ERROR;
+}
+
+
+static u_char *
+ngx_http_v2_write_table_update(ngx_http_v2_connection_t *h2c, u_char *pos)
+{
+    /*
+     * The table is emptied first, this also signals the smallest size
+     * if the client has changed it several times since the last header block.
+     */
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table size update: 0");
+
+    *pos++ = (1 << 5) | 0;
+
+    h2c->table_update = 0;
+
+    ngx_http_v2_encoder_table_size(h2c, h2c->hpack_enc.update);
+
+    if (h2c->hpack_enc.size) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table size update: %uz", h2c->hpack_enc.size);
+
+        *pos = 1 << 5;
+        pos = ngx_http_v2_write_int(pos, ngx_http_v2_prefix(5),
+                                    h2c->hpack_enc.size);
+    }
+
+    return pos;
+}
+
+
+static u_char *
+ngx_http_v2_write_field(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index, ngx_str_t *name, ngx_str_t *value, u_char *tmp)
+{
+    ngx_int_t   rc;
+    ngx_uint_t  prefix;
+
+    if (name == NULL) {
+        name = ngx_http_v2_get_static_name(index);
+    }
+
+    rc = ngx_http_v2_find_header(h2c, name, value, &index);
+
+    if (rc == NGX_OK) {
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                       "http2 table indexed: %ui", index);
+
+        *pos = ngx_http_v2_indexed(0);
+        return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(7), index);
+    }
+
+    rc = ngx_http_v2_index_header(h2c, name, value);
+
+    if (rc == NGX_ERROR) {
+        return NULL;
+    }
+
+    if (rc == NGX_OK) {
+        *pos = ngx_http_v2_inc_indexed(0);
+        prefix = ngx_http_v2_prefix(6);
+
+    } else {
+        *pos = 0;
+        prefix = ngx_http_v2_prefix(4);
+    }
+
+    if (index) {
+        pos = ngx_http_v2_write_int(pos, prefix, index);
+
+    } else {
+        pos = ngx_http_v2_write_name(pos + 1, name->data, name->len, tmp);
+    }
+
+    return ngx_http_v2_write_value(pos, value->data, value->len, tmp);
+}
+
+
+static u_char *
+ngx_http_v2_write_unindexed(ngx_http_v2_connection_t *h2c, u_char *pos,
+    ngx_uint_t index)
+{
+    /*
+     * Without the encoder table the client is still asked to index the field,
+     * as we never refer to its dynamic table.  Otherwise the field must not
+     * be indexed, as the client's table would go out of sync with ours.
+     */
+
+    if (h2c->hpack_enc.size == 0) {
+        *pos++ = ngx_http_v2_inc_indexed(index);
+        return pos;
+    }
+
+    *pos = 0;
+
+    return ngx_http_v2_write_int(pos, ngx_http_v2_prefix(4), index);
+}
+
+
+static ngx_uint_t
+ngx_http_v2_volatile_header(ngx_str_t *name)
+{
+    ngx_uint_t  i;
+
+    /*
+     * these fields either change with every response, or carry data
+     * which should not be shared through the table
+     */
+
+    static ngx_str_t  headers[] = {
+        ngx_string("age"),
+        ngx_string("content-length"),
+        ngx_string("content-range"),
+        ngx_string("date"),
+        ngx_string("etag"),
+        ngx_string("expires"),
+        ngx_string("last-modified"),
+        ngx_string("location"),
+        ngx_string("set-cookie"),
+        ngx_null_string
+    };
+
+    for (i = 0; headers[i].len; i++) {
+        if (headers[i].len == name->len
+            && ngx_strncasecmp(headers[i].data, name->data, name->len) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
 }
 
 
@@ -975,7 +1209,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
 
             value = &(*h)->value;
 
-            len = 1 + NGX_HTTP_V2_INT_OCTETS + value->len;
+            len = 2 + NGX_HTTP_V2_INT_OCTETS + value->len;
 
             pos = ngx_pnalloc(r->pool, len);
             if (pos == NULL) {
@@ -984,14 +1218,14 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
 
             binary[i].data = pos;
 
-            *pos++ = ngx_http_v2_inc_indexed(ph[i].index);
+            pos = ngx_http_v2_write_unindexed(h2c, pos, ph[i].index);
             pos = ngx_http_v2_write_value(pos, value->data, value->len, tmp);
 
             binary[i].len = pos - binary[i].data;
         }
     }
 
-    len = (h2c->table_update ? 1 : 0)
+    len = (h2c->table_update ? 1 + NGX_HTTP_V2_INT_OCTETS : 0)
           + 1
           + 1 + NGX_HTTP_V2_INT_OCTETS + path->len
           + 1 + NGX_HTTP_V2_INT_OCTETS + r->schema.len;
@@ -1008,10 +1242,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
     start = pos;
 
     if (h2c->table_update) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
-                       "http2 table size update: 0");
-        *pos++ = (1 << 5) | 0;
-        h2c->table_update = 0;
+        pos = ngx_http_v2_write_table_update(h2c, pos);
     }
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, fc->log, 0,
@@ -1022,7 +1253,7 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
                    "http2 push header: \":path: %V\"", path);
 
-    *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_PATH_INDEX);
+    pos = ngx_http_v2_write_unindexed(h2c, pos, NGX_HTTP_V2_PATH_INDEX);
     pos = ngx_http_v2_write_value(pos, path->data, path->len, tmp);
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, fc->log, 0,
@@ -1037,7 +1268,8 @@ ngx_http_v2_push_resource(ngx_http_request_t *r, ngx_str_t *path,
         *pos++ = ngx_http_v2_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
 
     } else {
-        *pos++ = ngx_http_v2_inc_indexed(NGX_HTTP_V2_SCHEME_HTTP_INDEX);
+        pos = ngx_http_v2_write_unindexed(h2c, pos,
+                                          NGX_HTTP_V2_SCHEME_HTTP_INDEX);
         pos = ngx_http_v2_write_value(pos, r->schema.data, r->schema.len, tmp);
     }
 
@@ -10,11 +10,9 @@
 #include <ngx_http.h>
 
 
-#define NGX_HTTP_V2_TABLE_SIZE  4096
-
-
 static ngx_int_t ngx_http_v2_table_account(ngx_http_v2_connection_t *h2c,
     size_t size);
+static void ngx_http_v2_table_evict(ngx_http_v2_hpack_enc_t *enc);
 
 
 static ngx_http_v2_header_t  ngx_http_v2_static_table[] = {
@@ -361,3 +359,208 @@ ngx_http_v2_table_size(ngx_http_v2_connection_t *h2c, size_t size)
 
     return NGX_OK;
 }
+
+
+/*
+ * The encoder table mirrors the client's dynamic table as filled by our
+ * header blocks.  The fields are evicted in the same order as the client
+ * does, but possibly earlier: the client still keeps them, we just do not
+ * refer to them anymore, so the indices stay in sync.  This allows to keep
+ * names and values contiguous in the storage, wrapping at its end.
+ */
+
+ngx_int_t
+ngx_http_v2_find_header(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value, ngx_uint_t *index)
+{
+    ngx_uint_t                  i, n, hash;
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_field_t  *field;
+
+    enc = &h2c->hpack_enc;
+
+    hash = 0;
+
+    for (i = 0; i < name->len; i++) {
+        hash = ngx_hash(hash, ngx_tolower(name->data[i]));
+    }
+
+    for (n = enc->added; n != enc->deleted; n--) {
+        field = &enc->entries[(n - 1) % enc->allocated];
+
+        if (field->hash != hash
+            || field->name.len != name->len
+            || ngx_strncasecmp(field->name.data, name->data, name->len) != 0)
+        {
+            continue;
+        }
+
+        if (field->value.len == value->len
+            && ngx_memcmp(field->value.data, value->data, value->len) == 0)
+        {
+            *index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + 1 + enc->added - n;
+            return NGX_OK;
+        }
+
+        if (*index == 0) {
+            *index = NGX_HTTP_V2_STATIC_TABLE_ENTRIES + 1 + enc->added - n;
+        }
+    }
+
+    if (*index) {
+        return NGX_DECLINED;
+    }
+
+    /* pseudo-header fields are not looked up */
+
+    for (i = NGX_HTTP_V2_STATUS_500_INDEX;
+         i < NGX_HTTP_V2_STATIC_TABLE_ENTRIES;
+         i++)
+    {
+        if (ngx_http_v2_static_table[i].name.len == name->len
+            && ngx_strncasecmp(ngx_http_v2_static_table[i].name.data,
+                               name->data, name->len)
+               == 0)
+        {
+            *index = i + 1;
+            break;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+ngx_int_t
+ngx_http_v2_index_header(ngx_http_v2_connection_t *h2c, ngx_str_t *name,
+    ngx_str_t *value)
+{
+    size_t                      size, len;
+    ngx_uint_t                  i, hash;
+    ngx_http_v2_hpack_enc_t    *enc;
+    ngx_http_v2_hpack_field_t  *field;
+
+    enc = &h2c->hpack_enc;
+
+    len = name->len + value->len;
+    size = 32 + len;
+
+    /* a single large field is not worth flushing most of the table */
+
+    if (size > enc->size / 2) {
+        return NGX_DECLINED;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 table index: \"%V: %V\"", name, value);
+
+    if (enc->entries == NULL) {
+        enc->allocated = (enc->size + 31) / 32;
+
+        enc->entries = ngx_palloc(h2c->connection->pool,
+                                  sizeof(ngx_http_v2_hpack_field_t)
+                                  * enc->allocated);
+        if (enc->entries == NULL) {
+            return NGX_ERROR;
+        }
+
+        enc->storage = ngx_palloc(h2c->connection->pool, enc->size);
+        if (enc->storage == NULL) {
+            return NGX_ERROR;
+        }
+
+        enc->last = enc->storage + enc->size;
+        enc->pos = enc->storage;
+    }
+
+    while (size > enc->free) {
+        ngx_http_v2_table_evict(enc);
+    }
+
+    if (enc->added == enc->deleted) {
+        enc->pos = enc->storage;
+
+    } else if (enc->pos + len > enc->last) {
+
+        /* the fields left after the previous wrap are the oldest ones */
+
+        while (enc->added != enc->deleted
+               && enc->entries[enc->deleted % enc->allocated].name.data
+                  >= enc->pos)
+        {
+            ngx_http_v2_table_evict(enc);
+        }
+
+        enc->pos = enc->storage;
+    }
+
+    while (enc->added != enc->deleted) {
+        field = &enc->entries[enc->deleted % enc->allocated];
+
+        if (field->name.data < enc->pos || field->name.data >= enc->pos + len)
+        {
+            break;
+        }
+
+        ngx_http_v2_table_evict(enc);
+    }
+
+    hash = 0;
+
+    for (i = 0; i < name->len; i++) {
+        hash = ngx_hash(hash, ngx_tolower(name->data[i]));
+    }
+
+    field = &enc->entries[enc->added++ % enc->allocated];
+
+    field->hash = hash;
+
+    field->name.len = name->len;
+    field->name.data = enc->pos;
+    ngx_strlow(enc->pos, name->data, name->len);
+
+    field->value.len = value->len;
+    field->value.data = enc->pos + name->len;
+    enc->pos = ngx_cpymem(field->value.data, value->data, value->len);
+
+    enc->free -= size;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_v2_table_evict(ngx_http_v2_hpack_enc_t *enc)
+{
+    ngx_http_v2_hpack_field_t  *field;
+
+    field = &enc->entries[enc->deleted++ % enc->allocated];
+    enc->free += 32 + field->name.len + field->value.len;
+}
+
+
+void
+ngx_http_v2_encoder_table_size(ngx_http_v2_connection_t *h2c, size_t size)
+{
+    ngx_http_v2_hpack_enc_t  *enc;
+
+    enc = &h2c->hpack_enc;
+
+    size = ngx_min(size, enc->limit);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, h2c->connection->log, 0,
+                   "http2 new encoder table size: %uz was:%uz",
+                   size, enc->size);
+
+    if (enc->entries && size > (size_t) (enc->last - enc->storage)) {
+        (void) ngx_pfree(h2c->connection->pool, enc->entries);
+        (void) ngx_pfree(h2c->connection->pool, enc->storage);
+
+        enc->entries = NULL;
+    }
+
+    enc->deleted = enc->added;
+    enc->size = size;
+    enc->free = size;
+    enc->pos = enc->storage;
+}
@@ -13,4 +13,54 @@ ngx_chain_t *ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in,
     off_t limit);
 
 
+#if (NGX_HAVE_IO_URING)
+
+/* the tag of file aio requests user_data, it is never set in pointers */
+#define NGX_IO_URING_AIO  ((uint64_t) 1 << 63)
+
+
+typedef struct {
+    int                    fd;
+
+    u_char                *sq_ring;
+    size_t                 sq_ring_size;
+    u_char                *cq_ring;
+    size_t                 cq_ring_size;
+
+    struct io_uring_sqe   *sqes;
+    size_t                 sqes_size;
+
+    volatile uint32_t     *sq_head;
+    volatile uint32_t     *sq_tail;
+    uint32_t              *sq_array;
+    uint32_t               sq_mask;
+    uint32_t               sq_entries;
+    uint32_t               sq_local_tail;
+
+    volatile uint32_t     *cq_head;
+    volatile uint32_t     *cq_tail;
+    struct io_uring_cqe   *cqes;
+    uint32_t               cq_mask;
+} ngx_io_uring_t;
+
+
+ngx_int_t ngx_io_uring_create(ngx_io_uring_t *ring, ngx_uint_t entries,
+    uint32_t features, ngx_log_t *log);
+void ngx_io_uring_destroy(ngx_io_uring_t *ring, ngx_log_t *log);
+ngx_int_t ngx_io_uring_register_eventfd(ngx_io_uring_t *ring, int fd,
+    ngx_log_t *log);
+struct io_uring_sqe *ngx_io_uring_get_sqe(ngx_io_uring_t *ring,
+    ngx_log_t *log);
+int ngx_io_uring_enter(ngx_io_uring_t *ring, ngx_uint_t wait,
+    ngx_msec_t timer);
+
+#if (NGX_HAVE_IO_URING_AIO)
+void ngx_io_uring_aio_event(uint64_t data, int32_t res);
+
+extern ngx_io_uring_t  *ngx_io_uring_aio;
+#endif
+
+#endif
+
+
 #endif /* _NGX_LINUX_H_INCLUDED_ */
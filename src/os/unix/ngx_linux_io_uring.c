@@ -0,0 +1,263 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * We call io_uring_setup(), io_uring_enter(), and io_uring_register()
+ * directly as syscalls instead of liburing usage, because only a small part
+ * of the library is needed and it is not available on many systems.
+ */
+
+static int
+io_uring_setup(u_int entries, struct io_uring_params *p)
+{
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, u_int to_submit, u_int min_complete, u_int flags,
+    void *arg, size_t argsz)
+{
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+                   arg, argsz);
+}
+
+
+static int
+io_uring_register(int fd, u_int opcode, void *arg, u_int nargs)
+{
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+
+ngx_int_t
+ngx_io_uring_create(ngx_io_uring_t *ring, ngx_uint_t entries,
+    uint32_t features, ngx_log_t *log)
+{
+    struct io_uring_params  p;
+
+    ngx_memzero(ring, sizeof(ngx_io_uring_t));
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    p.flags = IORING_SETUP_CLAMP;
+
+    ring->fd = io_uring_setup(entries, &p);
+
+    if (ring->fd == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "io_uring_setup() failed");
+        return NGX_ERROR;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring: fd:%d sq:%uD cq:%uD features:%XD",
+                   ring->fd, p.sq_entries, p.cq_entries, p.features);
+
+    if ((p.features & features) != features) {
+        ngx_io_uring_destroy(ring, log);
+        return NGX_DECLINED;
+    }
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = p.cq_off.cqes
+                         + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_ring_size = ngx_max(ring->sq_ring_size, ring->cq_ring_size);
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE,
+                         MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+    if (ring->sq_ring == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        ring->sq_ring = NULL;
+        goto failed;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+
+    } else {
+        ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ|PROT_WRITE,
+                             MAP_SHARED|MAP_POPULATE, ring->fd,
+                             IORING_OFF_CQ_RING);
+
+        if (ring->cq_ring == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            ring->cq_ring = NULL;
+            goto failed;
+        }
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+    if (ring->sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        ring->sqes = NULL;
+        goto failed;
+    }
+
+    ring->sq_head = (uint32_t *) (ring->sq_ring + p.sq_off.head);
+    ring->sq_tail = (uint32_t *) (ring->sq_ring + p.sq_off.tail);
+    ring->sq_array = (uint32_t *) (ring->sq_ring + p.sq_off.array);
+    ring->sq_mask = *(uint32_t *) (ring->sq_ring + p.sq_off.ring_mask);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    ring->cq_head = (uint32_t *) (ring->cq_ring + p.cq_off.head);
+    ring->cq_tail = (uint32_t *) (ring->cq_ring + p.cq_off.tail);
+    ring->cqes = (struct io_uring_cqe *) (ring->cq_ring + p.cq_off.cqes);
+    ring->cq_mask = *(uint32_t *) (ring->cq_ring + p.cq_off.ring_mask);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_io_uring_destroy(ring, log);
+
+    return NGX_ERROR;
+}
+
+
+void
+ngx_io_uring_destroy(ngx_io_uring_t *ring, ngx_log_t *log)
+{
+    if (ring->sqes && munmap(ring->sqes, ring->sqes_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(IORING_OFF_SQES) failed");
+    }
+
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring
+        && munmap(ring->cq_ring, ring->cq_ring_size) == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(IORING_OFF_CQ_RING) failed");
+    }
+
+    if (ring->sq_ring && munmap(ring->sq_ring, ring->sq_ring_size) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "munmap(IORING_OFF_SQ_RING) failed");
+    }
+
+    if (close(ring->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring close() failed");
+    }
+
+    ngx_memzero(ring, sizeof(ngx_io_uring_t));
+
+    ring->fd = -1;
+}
+
+
+ngx_int_t
+ngx_io_uring_register_eventfd(ngx_io_uring_t *ring, int fd, ngx_log_t *log)
+{
+    if (io_uring_register(ring->fd, IORING_REGISTER_EVENTFD, &fd, 1) == -1) {
+        ngx_log_error(NGX_LOG_EMERG, log, ngx_errno,
+                      "io_uring_register(IORING_REGISTER_EVENTFD) failed");
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+struct io_uring_sqe *
+ngx_io_uring_get_sqe(ngx_io_uring_t *ring, ngx_log_t *log)
+{
+    uint32_t              n;
+    ngx_err_t             err;
+    struct io_uring_sqe  *sqe;
+
+    if (ring->sq_local_tail - *ring->sq_head >= ring->sq_entries) {
+
+        /* the submission ring is full, pass the queued requests */
+
+        if (ngx_io_uring_enter(ring, 0, 0) == -1) {
+            err = ngx_errno;
+
+            if (err != EBUSY && err != NGX_EAGAIN) {
+                ngx_log_error(NGX_LOG_ALERT, log, err,
+                              "io_uring_enter() failed");
+                return NULL;
+            }
+        }
+
+        if (ring->sq_local_tail - *ring->sq_head >= ring->sq_entries) {
+            ngx_log_error(NGX_LOG_ALERT, log, 0,
+                          "io_uring submission queue overflow");
+            return NULL;
+        }
+    }
+
+    n = ring->sq_local_tail & ring->sq_mask;
+
+    sqe = &ring->sqes[n];
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    ring->sq_array[n] = n;
+    ring->sq_local_tail++;
+
+    return sqe;
+}
+
+
+int
+ngx_io_uring_enter(ngx_io_uring_t *ring, ngx_uint_t wait, ngx_msec_t timer)
+{
+    void                           *arg;
+    size_t                          argsz;
+    uint32_t                        n;
+    u_int                           flags;
+    struct __kernel_timespec        ts;
+    struct io_uring_getevents_arg   ext;
+
+    ngx_memory_barrier();
+
+    *ring->sq_tail = ring->sq_local_tail;
+
+    n = ring->sq_local_tail - *ring->sq_head;
+
+    flags = 0;
+    arg = NULL;
+    argsz = 0;
+
+    if (wait) {
+        flags |= IORING_ENTER_GETEVENTS;
+
+        if (timer != NGX_TIMER_INFINITE) {
+            ts.tv_sec = timer / 1000;
+            ts.tv_nsec = (timer % 1000) * 1000000;
+
+            ngx_memzero(&ext, sizeof(struct io_uring_getevents_arg));
+            ext.ts = (uint64_t) (uintptr_t) &ts;
+
+            flags |= IORING_ENTER_EXT_ARG;
+            arg = &ext;
+            argsz = sizeof(struct io_uring_getevents_arg);
+        }
+
+    } else if (n == 0) {
+        return 0;
+    }
+
+    return io_uring_enter(ring->fd, n, wait ? 1 : 0, flags, arg, argsz);
+}
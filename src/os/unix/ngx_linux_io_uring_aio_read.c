@@ -0,0 +1,151 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+
+
+/*
+ * io_uring reads do not require O_DIRECT: the data found in page cache
+ * are copied inline, and other reads are completed asynchronously
+ * by the kernel.  The requests are queued to the ring of the event module
+ * in use and are passed to the kernel on the next event loop iteration.
+ */
+
+
+ngx_io_uring_t  *ngx_io_uring_aio;
+
+
+static void ngx_file_aio_event_handler(ngx_event_t *ev);
+
+
+ngx_int_t
+ngx_file_aio_init(ngx_file_t *file, ngx_pool_t *pool)
+{
+    ngx_event_aio_t  *aio;
+
+    aio = ngx_pcalloc(pool, sizeof(ngx_event_aio_t));
+    if (aio == NULL) {
+        return NGX_ERROR;
+    }
+
+    aio->file = file;
+    aio->fd = file->fd;
+    aio->event.data = aio;
+    aio->event.ready = 1;
+    aio->event.log = file->log;
+
+    file->aio = aio;
+
+    return NGX_OK;
+}
+
+
+ssize_t
+ngx_file_aio_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
+    ngx_pool_t *pool)
+{
+    ngx_event_t          *ev;
+    ngx_event_aio_t      *aio;
+    struct io_uring_sqe  *sqe;
+
+    if (!ngx_file_aio || ngx_io_uring_aio == NULL) {
+        return ngx_read_file(file, buf, size, offset);
+    }
+
+    if (file->aio == NULL && ngx_file_aio_init(file, pool) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    aio = file->aio;
+    ev = &aio->event;
+
+    if (!ev->ready) {
+        ngx_log_error(NGX_LOG_ALERT, file->log, 0,
+                      "second aio post for \"%V\"", &file->name);
+        return NGX_AGAIN;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, file->log, 0,
+                   "aio complete:%d @%O:%uz %V",
+                   ev->complete, offset, size, &file->name);
+
+    if (ev->complete) {
+        ev->active = 0;
+        ev->complete = 0;
+
+        if (aio->res >= 0) {
+            ngx_set_errno(0);
+            return aio->res;
+        }
+
+        ngx_set_errno(-aio->res);
+
+        ngx_log_error(NGX_LOG_CRIT, file->log, ngx_errno,
+                      "aio read \"%s\" failed", file->name.data);
+
+        return NGX_ERROR;
+    }
+
+    sqe = ngx_io_uring_get_sqe(ngx_io_uring_aio, file->log);
+
+    if (sqe == NULL) {
+        return ngx_read_file(file, buf, size, offset);
+    }
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = file->fd;
+    sqe->addr = (uint64_t) (uintptr_t) buf;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t) (uintptr_t) ev | NGX_IO_URING_AIO;
+
+    ev->handler = ngx_file_aio_event_handler;
+
+    ev->active = 1;
+    ev->ready = 0;
+    ev->complete = 0;
+
+    return NGX_AGAIN;
+}
+
+
+void
+ngx_io_uring_aio_event(uint64_t data, int32_t res)
+{
+    ngx_event_t      *e;
+    ngx_event_aio_t  *aio;
+
+    e = (ngx_event_t *) (uintptr_t) (data & ~NGX_IO_URING_AIO);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, e->log, 0,
+                   "io_uring aio event: %p res:%D", e, res);
+
+    e->complete = 1;
+    e->active = 0;
+    e->ready = 1;
+
+    aio = e->data;
+    aio->res = res;
+
+    ngx_post_event(e, &ngx_posted_events);
+}
+
+
+static void
+ngx_file_aio_event_handler(ngx_event_t *ev)
+{
+    ngx_event_aio_t  *aio;
+
+    aio = ev->data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                   "aio event handler fd:%d %V", aio->fd, &aio->file->name);
+
+    aio->handler(ev);
+}
@@ -18,6 +18,7 @@ static void ngx_start_cache_manager_processes(ngx_cycle_t *cycle,
 static void ngx_pass_open_channel(ngx_cycle_t *cycle, ngx_channel_t *ch);
 static void ngx_signal_worker_processes(ngx_cycle_t *cycle, int signo);
 static ngx_uint_t ngx_reap_children(ngx_cycle_t *cycle);
+static void ngx_reap_shared_memory(ngx_cycle_t *cycle, ngx_uint_t worker);
 static void ngx_master_process_exit(ngx_cycle_t *cycle);
 static void ngx_worker_process_cycle(ngx_cycle_t *cycle, void *data);
 static void ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker);
@@ -617,6 +618,14 @@ ngx_reap_children(ngx_cycle_t *cycle)
                 }
             }
 
+            if (ngx_processes[i].proc == ngx_worker_process_cycle
+                && !ngx_processes[i].exiting)
+            {
+                ngx_reap_shared_memory(cycle,
+                                       (ngx_uint_t) (intptr_t)
+                                       ngx_processes[i].data);
+            }
+
             if (ngx_processes[i].respawn
                 && !ngx_processes[i].exiting
                 && !ngx_terminate
@@ -684,6 +693,40 @@ ngx_reap_children(ngx_cycle_t *cycle)
 }
 
 
+static void
+ngx_reap_shared_memory(ngx_cycle_t *cycle, ngx_uint_t worker)
+{
+    ngx_uint_t        i;
+    ngx_shm_zone_t   *shm_zone;
+    ngx_list_part_t  *part;
+
+    /*
+     * the worker process of the current configuration exited unexpectedly,
+     * its state in the shared memory zones is released before the process
+     * with the same number is respawned
+     */
+
+    part = &cycle->shared_memory.part;
+    shm_zone = part->elts;
+
+    for (i = 0; /* void */ ; i++) {
+
+        if (i >= part->nelts) {
+            if (part->next == NULL) {
+                break;
+            }
+            part = part->next;
+            shm_zone = part->elts;
+            i = 0;
+        }
+
+        if (shm_zone[i].reap) {
+            shm_zone[i].reap(&shm_zone[i], worker);
+        }
+    }
+}
+
+
 static void
 ngx_master_process_exit(ngx_cycle_t *cycle)
 {
@@ -827,6 +870,8 @@ ngx_worker_process_init(ngx_cycle_t *cycle, ngx_int_t worker)
                           ccf->rlimit_core);
         }
     }
+
+    ngx_pool_cache_init(ccf->pool_cache);
     /* 设置UID GROUPUID */
     if (geteuid() == 0) {
         if (setgid(ccf->group) == -1) {
@@ -991,6 +1036,15 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
         }
     }
 
+    if (ngx_pool_cache_stats.hits || ngx_pool_cache_stats.misses) {
+        ngx_log_error(NGX_LOG_INFO, cycle->log, 0,
+                      "pool cache: %ui hits, %ui misses, %ui released, "
+                      "%uz bytes retained",
+                      ngx_pool_cache_stats.hits, ngx_pool_cache_stats.misses,
+                      ngx_pool_cache_stats.released,
+                      ngx_pool_cache_stats.retained);
+    }
+
     if (ngx_exiting) {
         c = cycle->connections;
         for (i = 0; i < cycle->connection_n; i++) {